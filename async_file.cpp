@@ -0,0 +1,330 @@
+/*! @file async_file.cpp
+ * @brief Output file with writes that complete in the background
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define ASYNC_FILE_IO_URING
+#endif
+#endif
+
+#include "async_file.h"
+#include "timing.h"
+#include "stats.h"
+#include "trace.h"
+
+
+#ifdef ASYNC_FILE_IO_URING
+
+/* mapped submission and completion queues, without liburing */
+struct CAsyncFile::IO_RING {
+	int fd;
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+
+	volatile unsigned* sq_head;
+	volatile unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	volatile unsigned* cq_head;
+	volatile unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+
+	struct iovec iov[ASYNC_FILE_MAX_PENDING]; /* IORING_OP_WRITEV works on every io_uring kernel */
+};
+
+#else
+
+struct CAsyncFile::IO_RING {
+	int fd;
+};
+
+#endif
+
+
+CAsyncFile::CAsyncFile() : m_fd(-1), m_ring(NULL), m_bRingTried(false), m_pending_count(0)
+		, m_unsubmitted_count(0), m_err(SUCCESS) {
+	memset(m_pending, 0, sizeof(m_pending));
+}
+
+CAsyncFile::~CAsyncFile() {
+	Close();
+	FreeRing();
+}
+
+OSC_ERR CAsyncFile::Open(const char* fn) {
+	if(m_fd >= 0) return(EALREADY_INITIALIZED);
+
+	m_fd=open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(m_fd < 0) {
+		OscLog(ERROR, "Cannot create %s: %s\n", fn, strerror(errno));
+		return(EFILE_ERROR);
+	}
+	m_err=SUCCESS;
+
+	/* the ring is kept for the following files */
+	if(!m_bRingTried) {
+		m_bRingTried=true;
+		if(InitRing() != SUCCESS)
+			OscLog(NOTICE, "io_uring not available, writing with pwrite\n");
+	}
+	return(SUCCESS);
+}
+
+OSC_ERR CAsyncFile::Close() {
+	if(m_fd < 0) return(SUCCESS);
+
+	OSC_ERR err=Wait(true);
+	if(m_pending_count > 0) {
+		/* the kernel may still write from the caller's buffers and to the file */
+		Abort();
+		err=EFILE_ERROR;
+		if(m_pending_count > 0) {
+			OscLog(ERROR, "%i writes did not complete, the file is left open\n", m_pending_count);
+			m_fd=-1;
+			return(err);
+		}
+	}
+	if(close(m_fd) != 0 && err == SUCCESS) err=EFILE_ERROR;
+	m_fd=-1;
+	return(err);
+}
+
+OSC_ERR CAsyncFile::Write(const void* data, size_t size, uint64_t offset) {
+	if(m_fd < 0) return(EGENERAL);
+	if(!m_ring) {
+		CStageTimer timer(StatStage_recordWrite);
+		return(WriteSync((const uint8*)data, size, offset));
+	}
+
+#ifdef ASYNC_FILE_IO_URING
+	while(m_pending_count == ASYNC_FILE_MAX_PENDING) {
+		if(!Reap(true)) {
+			/* the ring is stuck, keep the data */
+			CStageTimer timer(StatStage_recordWrite);
+			return(WriteSync((const uint8*)data, size, offset));
+		}
+	}
+	int slot=0;
+	while(m_pending[slot].bUsed) ++slot;
+
+	PENDING& pending=m_pending[slot];
+	pending.bUsed=true;
+	pending.data=(const uint8*)data;
+	pending.size=size;
+	pending.offset=offset;
+	pending.submit_ns=GetMonotonicTimeNs();
+	++m_pending_count;
+
+	m_ring->iov[slot].iov_base=(void*)data;
+	m_ring->iov[slot].iov_len=size;
+
+	const unsigned tail=*m_ring->sq_tail;
+	const unsigned index=tail & m_ring->sq_mask;
+	struct io_uring_sqe* sqe=&m_ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode=IORING_OP_WRITEV;
+	sqe->fd=m_fd;
+	sqe->addr=(uint64_t)(uintptr_t)&m_ring->iov[slot];
+	sqe->len=1;
+	sqe->off=offset;
+	sqe->user_data=slot;
+	m_ring->sq_array[index]=index;
+	/* the entry must be visible before the tail that publishes it */
+	__sync_synchronize();
+	*m_ring->sq_tail=tail + 1;
+	++m_unsubmitted_count;
+
+	/* if the kernel does not take it now, Reap submits it again */
+	Submit();
+#endif
+	return(SUCCESS);
+}
+
+OSC_ERR CAsyncFile::Wait(bool bBlock) {
+	while(m_pending_count > 0) {
+		if(!Reap(bBlock)) break;
+	}
+	const OSC_ERR err=m_err;
+	m_err=SUCCESS;
+	return(err);
+}
+
+OSC_ERR CAsyncFile::WriteSync(const uint8* data, size_t size, uint64_t offset) {
+	while(size > 0) {
+		const ssize_t n=pwrite(m_fd, data, size, offset);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) {
+			OscLog(ERROR, "Write failed: %s\n", n < 0 ? strerror(errno) : "disk full");
+			return(EFILE_ERROR);
+		}
+		data+=n;
+		size-=n;
+		offset+=n;
+	}
+	return(SUCCESS);
+}
+
+#ifdef ASYNC_FILE_IO_URING
+
+OSC_ERR CAsyncFile::InitRing() {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	const int fd=syscall(__NR_io_uring_setup, ASYNC_FILE_MAX_PENDING, &params);
+	if(fd < 0) return(EGENERAL);
+
+	IO_RING* ring=new IO_RING;
+	memset(ring, 0, sizeof(*ring));
+	ring->fd=fd;
+	ring->sq_size=params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	ring->cq_size=params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_size=ring->cq_size=std::max(ring->sq_size, ring->cq_size);
+	ring->sqes_size=params.sq_entries*sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr=mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ptr == MAP_FAILED) ring->sq_ptr=NULL;
+	if(ring->sq_ptr && (params.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring->cq_ptr=ring->sq_ptr;
+	} else if(ring->sq_ptr) {
+		ring->cq_ptr=mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(ring->cq_ptr == MAP_FAILED) ring->cq_ptr=NULL;
+	}
+	void* sqes=mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	ring->sqes=(sqes == MAP_FAILED ? NULL : (struct io_uring_sqe*)sqes);
+	m_ring=ring;
+	if(!ring->sq_ptr || !ring->cq_ptr || !ring->sqes) {
+		FreeRing();
+		return(EGENERAL);
+	}
+
+	uint8* sq=(uint8*)ring->sq_ptr;
+	ring->sq_head=(unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail=(unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask=*(unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array=(unsigned*)(sq + params.sq_off.array);
+	uint8* cq=(uint8*)ring->cq_ptr;
+	ring->cq_head=(unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail=(unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask=*(unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes=(struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return(SUCCESS);
+}
+
+void CAsyncFile::FreeRing() {
+	if(!m_ring) return;
+	if(m_ring->sqes) munmap(m_ring->sqes, m_ring->sqes_size);
+	if(m_ring->cq_ptr && m_ring->cq_ptr != m_ring->sq_ptr) munmap(m_ring->cq_ptr, m_ring->cq_size);
+	if(m_ring->sq_ptr) munmap(m_ring->sq_ptr, m_ring->sq_size);
+	close(m_ring->fd);
+	delete m_ring;
+	m_ring=NULL;
+}
+
+bool CAsyncFile::Submit() {
+	for(;;) {
+		const int ret=syscall(__NR_io_uring_enter, m_ring->fd, m_unsubmitted_count, 0, 0, NULL, 0);
+		if(ret >= 0) {
+			m_unsubmitted_count-=ret;
+			return(ret > 0);
+		}
+		if(errno != EINTR) {
+			OscLog(ERROR, "io_uring_enter: %s\n", strerror(errno));
+			return(false);
+		}
+	}
+}
+
+void CAsyncFile::Abort() {
+	/* without SQPOLL the kernel takes entries only in io_uring_enter: the ones after its head are ours */
+	const unsigned head=*m_ring->sq_head;
+	for(unsigned i=head; i != *m_ring->sq_tail; ++i) {
+		const int slot=(int)m_ring->sqes[m_ring->sq_array[i & m_ring->sq_mask]].user_data;
+		m_pending[slot].bUsed=false;
+		--m_pending_count;
+	}
+	*m_ring->sq_tail=head;
+	m_unsubmitted_count=0;
+	m_err=EFILE_ERROR;
+
+	const uint64_t end_us=GetMonotonicTimeUs() + ASYNC_FILE_CLOSE_TIMEOUT_MS*1000;
+	while(m_pending_count > 0 && GetMonotonicTimeUs() < end_us) {
+		if(!Reap(true)) usleep(1000);
+	}
+}
+
+bool CAsyncFile::Reap(bool bBlock) {
+	for(;;) {
+		const unsigned head=*m_ring->cq_head;
+		/* the entry is read after the tail that published it */
+		__sync_synchronize();
+		if(head != *m_ring->cq_tail) {
+			const struct io_uring_cqe* cqe=&m_ring->cqes[head & m_ring->cq_mask];
+			const int slot=(int)cqe->user_data;
+			const int res=cqe->res;
+			__sync_synchronize();
+			*m_ring->cq_head=head + 1;
+
+			PENDING& pending=m_pending[slot];
+			CStats::Record(StatStage_recordWrite, (uint32)((GetMonotonicTimeNs() - pending.submit_ns)/1000));
+			if(res < 0) {
+				OscLog(ERROR, "Write failed: %s\n", strerror(-res));
+				m_err=EFILE_ERROR;
+			} else if((size_t)res < pending.size) {
+				/* short write, e.g. interrupted: the rest is written now */
+				if(WriteSync(pending.data + res, pending.size - res, pending.offset + res) != SUCCESS)
+					m_err=EFILE_ERROR;
+			}
+			pending.bUsed=false;
+			--m_pending_count;
+			return(true);
+		}
+		if(!bBlock) return(false);
+		/* entries the kernel did not take yet would never complete */
+		const int ret=syscall(__NR_io_uring_enter, m_ring->fd, m_unsubmitted_count, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(ret >= 0) {
+			m_unsubmitted_count-=ret;
+		} else if(errno != EINTR) {
+			OscLog(ERROR, "io_uring_enter: %s\n", strerror(errno));
+			m_err=EFILE_ERROR;
+			return(false);
+		}
+	}
+}
+
+#else
+
+OSC_ERR CAsyncFile::InitRing() {
+	return(EGENERAL);
+}
+
+void CAsyncFile::FreeRing() {
+}
+
+bool CAsyncFile::Submit() {
+	return(false);
+}
+
+void CAsyncFile::Abort() {
+}
+
+bool CAsyncFile::Reap(bool bBlock) {
+	return(false);
+}
+
+#endif
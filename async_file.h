@@ -0,0 +1,86 @@
+/*! @file async_file.h
+ * @brief Output file with writes that complete in the background
+ *  Writes are queued with io_uring where the kernel supports it (Linux 5.1)
+ *  and the caller continues while the kernel copies the data; otherwise, or
+ *  if io_uring is not permitted, they fall back to pwrite and complete in
+ *  the call. Not thread safe: one thread writes a file.
+ */
+
+#ifndef ASYNC_FILE_H_
+#define ASYNC_FILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "includes.h"
+
+
+/* writes in flight at most */
+#define ASYNC_FILE_MAX_PENDING 4
+/* Close waits this long for writes in flight if the ring fails [ms] */
+#define ASYNC_FILE_CLOSE_TIMEOUT_MS 5000
+
+
+class CAsyncFile {
+public:
+	CAsyncFile();
+	~CAsyncFile();
+
+	/*! @brief create or truncate the file */
+	OSC_ERR Open(const char* fn);
+	bool IsOpen() const { return(m_fd >= 0); }
+
+	/*! @brief write size bytes at offset
+	 * The data must stay valid until Wait returned (it is not copied).
+	 * Waits for the oldest write if ASYNC_FILE_MAX_PENDING are in flight.
+	 */
+	OSC_ERR Write(const void* data, size_t size, uint64_t offset);
+
+	/*! @brief collect completed writes, bBlock: wait until all are done
+	 * returns the error of a failed write since the last call
+	 */
+	OSC_ERR Wait(bool bBlock=true);
+
+	/*! @brief wait for all writes and close the file
+	 * Writes the kernel did not take are dropped. If writes in flight do not
+	 * complete, the file is left open and getPendingCount stays > 0: their
+	 * data is still in use and must not be freed.
+	 */
+	OSC_ERR Close();
+
+	/*! @brief true if writes go through io_uring */
+	bool isAsync() const { return(m_ring != NULL); }
+	int getPendingCount() const { return(m_pending_count); }
+
+private:
+	struct IO_RING;
+	struct PENDING {
+		bool bUsed;
+		const uint8* data;
+		size_t size;
+		uint64_t offset;
+		uint64_t submit_ns;
+	};
+
+	OSC_ERR InitRing();
+	void FreeRing();
+	/* hand the queued entries to the kernel, false if it took none of them */
+	bool Submit();
+	/* take one completion, bBlock: wait for it */
+	bool Reap(bool bBlock);
+	/* after a failure: drop the writes not submitted, wait for the ones in flight */
+	void Abort();
+	/* write the part of a write the kernel did not take */
+	OSC_ERR WriteSync(const uint8* data, size_t size, uint64_t offset);
+
+	int m_fd;
+	IO_RING* m_ring; /* NULL: pwrite */
+	bool m_bRingTried;
+	PENDING m_pending[ASYNC_FILE_MAX_PENDING];
+	int m_pending_count;
+	int m_unsubmitted_count; /* queued, not taken by the kernel yet */
+	OSC_ERR m_err;
+};
+
+
+#endif /* ASYNC_FILE_H_ */
@@ -0,0 +1,45 @@
+/*! @file auto_exposure.cpp
+ * @brief Software exposure control on the image statistics
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+
+#include "auto_exposure.h"
+
+
+CAutoExposure::CAutoExposure() : m_bEnabled(false), m_target(AE_DEFAULT_TARGET), m_percentile(AE_DEFAULT_PERCENTILE)
+	, m_exposure_us(0), m_changed_seq(0), m_level(0) {
+}
+
+void CAutoExposure::Enable(uint32 exposure_us) {
+	m_exposure_us=std::min(std::max(exposure_us, (uint32)AE_MIN_EXPOSURE_US), (uint32)AE_MAX_EXPOSURE_US);
+	m_bEnabled=true;
+	m_changed_seq=0;
+	m_level=0;
+}
+
+bool CAutoExposure::Update(const IMAGE_STATS& stats) {
+	if(!m_bEnabled || stats.count == 0) return(false);
+
+	m_level=CImageStats::Percentile(stats, m_percentile);
+	/* the frame was exposed before the last change took effect */
+	if(m_changed_seq != 0 && stats.frame_seq - m_changed_seq < AE_SETTLE_FRAMES) return(false);
+	if(abs(m_level - m_target) <= AE_DEADBAND) return(false);
+
+	/* a clipped level only tells the direction */
+	double ratio;
+	if(m_level >= 255) ratio=1.0/AE_MAX_STEP;
+	else if(m_level <= 0) ratio=AE_MAX_STEP;
+	else ratio=std::min(std::max((double)m_target/m_level, 1.0/AE_MAX_STEP), AE_MAX_STEP);
+	ratio=1.0 + AE_DAMPING*(ratio - 1.0);
+
+	double exposure=m_exposure_us*ratio;
+	exposure=std::min(std::max(exposure, (double)AE_MIN_EXPOSURE_US), (double)AE_MAX_EXPOSURE_US);
+	const uint32 exposure_us=(uint32)(exposure + 0.5);
+	if(exposure_us == m_exposure_us) return(false);
+
+	m_exposure_us=exposure_us;
+	m_changed_seq=stats.frame_seq;
+	return(true);
+}
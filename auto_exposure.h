@@ -0,0 +1,68 @@
+/*! @file auto_exposure.h
+ * @brief Software exposure control on the image statistics
+ *  Unlike the sensor's own AEC, it measures inside a region only (see
+ *  CImageStats::setRegion) and controls a percentile of the samples, e.g.
+ *  the 95th to avoid clipping highlights or the median for the mid tones.
+ *  The pixel values are taken as proportional to the exposure time: the
+ *  time is scaled by target/level, damped and limited per step. A new time
+ *  shows in the pictures only a few frames later, meanwhile the control
+ *  waits.
+ */
+
+#ifndef AUTO_EXPOSURE_H_
+#define AUTO_EXPOSURE_H_
+
+#include "includes.h"
+#include "image_stats.h"
+
+
+#define AE_DEFAULT_TARGET 118
+#define AE_DEFAULT_PERCENTILE 50
+/* levels around the target without correction */
+#define AE_DEADBAND 6
+/* largest change of the exposure time per step (factor) */
+#define AE_MAX_STEP 2.0
+/* part of the correction applied per step */
+#define AE_DAMPING 0.7
+/* frames until a new exposure time shows in the pictures */
+#define AE_SETTLE_FRAMES 2
+#define AE_MIN_EXPOSURE_US 20
+#define AE_MAX_EXPOSURE_US 50000
+
+
+class CAutoExposure {
+public:
+	CAutoExposure();
+
+	/*! @brief start the control at the current exposure time */
+	void Enable(uint32 exposure_us);
+	void Disable() { m_bEnabled=false; }
+	bool IsEnabled() const { return(m_bEnabled); }
+
+	/*! @brief level [0, 255] the percentile is driven to */
+	void setTarget(int level) { m_target=level; }
+	int getTarget() const { return(m_target); }
+	void setPercentile(int percent) { m_percentile=percent; }
+	int getPercentile() const { return(m_percentile); }
+
+	/*! @brief one control step on the statistics of a frame
+	 * returns true if the exposure time changed (see getExposure)
+	 */
+	bool Update(const IMAGE_STATS& stats);
+
+	/*! @brief exposure time [us] */
+	uint32 getExposure() const { return(m_exposure_us); }
+	/*! @brief value of the percentile in the last frame */
+	int getLevel() const { return(m_level); }
+
+private:
+	bool m_bEnabled;
+	int m_target;
+	int m_percentile;
+	uint32 m_exposure_us;
+	uint32 m_changed_seq; /* frame of the last change */
+	int m_level;
+};
+
+
+#endif /* AUTO_EXPOSURE_H_ */
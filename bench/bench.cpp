@@ -0,0 +1,376 @@
+/*! @file bench.cpp
+ * @brief Headless benchmark of the frame path camera -> processing -> encoding
+ *  Pictures come from image files kept in memory instead of the sensor, every
+ *  configuration (resolution x color type x thread count) runs as fast as
+ *  possible. Reports frames/s, the stage latencies of CStats and the encoded
+ *  bytes, as text or as one JSON object per configuration (-o json) for
+ *  regression tracking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+
+#include "opencv.hpp"
+
+#include "../includes.h"
+#include "../camera.h"
+#include "../image_processing.h"
+#include "../image_codec.h"
+#include "../jpeg_encoder.h"
+#include "../worker_pool.h"
+#include "../trace.h"
+
+
+#define BENCH_DEFAULT_FRAMES 300
+#define BENCH_DEFAULT_WARMUP 20
+#define BENCH_DEFAULT_QUALITY 80
+#define BENCH_DEFAULT_IMAGE "test.bmp"
+#define BENCH_MAX_CONFIGS 16
+
+
+enum BenchEncoder {
+	BenchEncoder_jpeg, // CJpegEncoder as used by GetImage
+	BenchEncoder_cvjpeg, // cv::imencode, the baseline
+	BenchEncoder_qoi,
+	BenchEncoder_raw,
+	BenchEncoder_rle,
+	BenchEncoder_none
+};
+
+static const char* g_encoder_names[]={ "jpeg", "cvjpeg", "qoi", "raw", "rle", "none" };
+
+struct BENCH_OPTIONS {
+	int frames;
+	int warmup;
+	int quality;
+	int perspective; /* 0: camera image, 1..3: processing image */
+	BenchEncoder encoder;
+	bool bJson;
+
+	int size_count; /* 0: size of the first input picture */
+	int widths[BENCH_MAX_CONFIGS];
+	int heights[BENCH_MAX_CONFIGS];
+	int color_count;
+	ColorType colors[BENCH_MAX_CONFIGS];
+	int thread_count;
+	int threads[BENCH_MAX_CONFIGS]; /* 0: one per CPU */
+
+	std::vector<std::string> inputs;
+};
+
+struct BENCH_RESULT {
+	int threads; /* threads encoding a picture */
+	int frames;
+	double seconds;
+	uint64_t bytes;
+	STAT_LATENCY stages[StatStage_count];
+};
+
+/* the stages the frame path goes through */
+static const StatStage g_bench_stages[]={ StatStage_acquire, StatStage_process, StatStage_encode };
+#define BENCH_STAGE_COUNT (int)(sizeof(g_bench_stages)/sizeof(g_bench_stages[0]))
+
+
+static void Usage(const char* name) {
+	fprintf(stderr, "usage: %s [-n frames] [-w warmup frames] [-r WxH[,WxH]...] [-c gray|color[,...]]\n"
+			"\t[-j threads[,threads]...] [-e jpeg|cvjpeg|qoi|raw|rle|none] [-Q quality]\n"
+			"\t[-P perspective] [-o text|json] [picture...]\n"
+			"  pictures are played in a loop (default " BENCH_DEFAULT_IMAGE "), threads 0: one per CPU\n", name);
+}
+
+/* comma separated list of "WxH" */
+static bool ParseSizes(const char* str, BENCH_OPTIONS& opt) {
+	opt.size_count=0;
+	while(*str && opt.size_count < BENCH_MAX_CONFIGS) {
+		int w, h, n;
+		if(sscanf(str, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0) return(false);
+		/* the camera needs a width that is a multiple of 4 */
+		if(w%4 != 0) return(false);
+		opt.widths[opt.size_count]=w;
+		opt.heights[opt.size_count++]=h;
+		str+=n;
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(*str == 0);
+}
+
+static bool ParseColors(const char* str, BENCH_OPTIONS& opt) {
+	opt.color_count=0;
+	while(*str && opt.color_count < BENCH_MAX_CONFIGS) {
+		if(strncmp(str, "gray", 4) == 0) { opt.colors[opt.color_count++]=ColorType_gray; str+=4; }
+		else if(strncmp(str, "color", 5) == 0) { opt.colors[opt.color_count++]=ColorType_debayered; str+=5; }
+		else return(false);
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(*str == 0);
+}
+
+static bool ParseThreads(const char* str, BENCH_OPTIONS& opt) {
+	opt.thread_count=0;
+	while(*str && opt.thread_count < BENCH_MAX_CONFIGS) {
+		char* end;
+		long n=strtol(str, &end, 10);
+		if(end == str || n < 0 || n > WORKER_POOL_MAX_THREADS) return(false);
+		opt.threads[opt.thread_count++]=(int)n;
+		str=end;
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(*str == 0);
+}
+
+static OSC_ERR ParseOptions(int argc, char** argv, BENCH_OPTIONS& opt) {
+	opt.frames=BENCH_DEFAULT_FRAMES;
+	opt.warmup=BENCH_DEFAULT_WARMUP;
+	opt.quality=BENCH_DEFAULT_QUALITY;
+	opt.perspective=0;
+	opt.encoder=BenchEncoder_jpeg;
+	opt.bJson=false;
+	opt.size_count=0;
+	opt.color_count=1;
+	opt.colors[0]=ColorType_gray;
+	opt.thread_count=1;
+	opt.threads[0]=0;
+
+	int c;
+	bool bValid=true;
+	while(bValid && (c=getopt(argc, argv, "n:w:r:c:j:e:Q:P:o:")) != -1) {
+		switch(c) {
+		case 'n': opt.frames=atoi(optarg); bValid=opt.frames > 0; break;
+		case 'w': opt.warmup=atoi(optarg); bValid=opt.warmup >= 0; break;
+		case 'r': bValid=ParseSizes(optarg, opt); break;
+		case 'c': bValid=ParseColors(optarg, opt); break;
+		case 'j': bValid=ParseThreads(optarg, opt); break;
+		case 'Q': opt.quality=atoi(optarg); bValid=opt.quality > 0 && opt.quality <= 100; break;
+		case 'P': opt.perspective=atoi(optarg); bValid=opt.perspective >= 0 && opt.perspective <= 3; break;
+		case 'e':
+			bValid=false;
+			for(int i=0; i<=BenchEncoder_none; ++i) {
+				if(strcmp(optarg, g_encoder_names[i]) == 0) {
+					opt.encoder=(BenchEncoder)i;
+					bValid=true;
+				}
+			}
+			break;
+		case 'o':
+			opt.bJson=strcmp(optarg, "json") == 0;
+			bValid=opt.bJson || strcmp(optarg, "text") == 0;
+			break;
+		default: bValid=false; break;
+		}
+	}
+	if(!bValid) {
+		Usage(argv[0]);
+		return(EINVALID_PARAMETER);
+	}
+	for(int i=optind; i<argc; ++i)
+		opt.inputs.push_back(argv[i]);
+	if(opt.inputs.empty())
+		opt.inputs.push_back(BENCH_DEFAULT_IMAGE);
+	return(SUCCESS);
+}
+
+
+/*! @brief the input pictures in the layout of the sensor: RGB, aligned to PICTURE_ALIGNMENT */
+class CFrameSource {
+public:
+	OSC_ERR Load(const std::vector<std::string>& files, int width, int height) {
+		const uint32 size=CCamera::AlignSize(3*width*height);
+		m_pictures.clear();
+		m_storage.resize(files.size()*size + PICTURE_ALIGNMENT);
+		uint8* data=CCamera::AlignPicture(&m_storage[0]);
+
+		for(size_t i=0; i<files.size(); ++i) {
+			cv::Mat img=cv::imread(files[i], CV_LOAD_IMAGE_COLOR);
+			if(img.empty()) {
+				fprintf(stderr, "Could not read '%s'\n", files[i].c_str());
+				return(EGENERAL);
+			}
+			if(img.cols != width || img.rows != height)
+				cv::resize(img, img, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+
+			cv::Mat picture(height, width, CV_8UC3, data + i*size);
+			cv::cvtColor(img, picture, cv::COLOR_BGR2RGB);
+			m_pictures.push_back(data + i*size);
+		}
+		m_next=0;
+		return(SUCCESS);
+	}
+
+	const uint8* Next() {
+		const uint8* picture=m_pictures[m_next];
+		if(++m_next == m_pictures.size()) m_next=0;
+		return(picture);
+	}
+
+private:
+	std::vector<uint8> m_storage;
+	std::vector<const uint8*> m_pictures;
+	size_t m_next;
+};
+
+
+static OSC_ERR Encode(const BENCH_OPTIONS& opt, CJpegEncoder& jpeg, const cv::Mat& img
+		, uint32 frame_seq, std::vector<uint8>& out) {
+
+	switch(opt.encoder) {
+	case BenchEncoder_jpeg:
+		return(jpeg.Encode(img, opt.quality, out));
+	case BenchEncoder_cvjpeg: {
+		std::vector<int> params;
+		params.push_back(CV_IMWRITE_JPEG_QUALITY);
+		params.push_back(opt.quality);
+		return(cv::imencode(".jpg", img, out, params) ? SUCCESS : EGENERAL);
+	}
+	case BenchEncoder_qoi:
+		return(CImageCodec::EncodeQoi(img, out));
+	case BenchEncoder_raw:
+		return(CImageCodec::EncodeRaw(img, frame_seq, out));
+	case BenchEncoder_rle:
+		return(CImageCodec::EncodeRle(img, frame_seq, out));
+	default:
+		out.clear();
+		return(SUCCESS);
+	}
+}
+
+/* one frame through camera, processing and encoder, the encoded picture ends up in out */
+static OSC_ERR RunFrame(const BENCH_OPTIONS& opt, CCamera& camera, CImageProcessor& process
+		, CFrameSource& source, CJpegEncoder& jpeg, std::vector<uint8>& out) {
+
+	CStageTimer acquire_timer(StatStage_acquire);
+	cv::Mat* img=camera.ReadPictureFromMemory(source.Next());
+	acquire_timer.Stop();
+	if(!img) return(EGENERAL);
+	CStats::Count(StatCounter_framesCaptured);
+
+	OSC_ERR err=process.DoProcess(img);
+	if(err != SUCCESS) return(err);
+
+	const cv::Mat* img_encode=opt.perspective == 0 ? img : process.GetProcImage(opt.perspective-1);
+	CStageTimer encode_timer(StatStage_encode);
+	return(Encode(opt, jpeg, *img_encode, camera.getFrameSeq(), out));
+}
+
+static OSC_ERR RunConfig(const BENCH_OPTIONS& opt, int width, int height, ColorType color
+		, int threads, BENCH_RESULT& result) {
+	OSC_ERR err;
+
+	CFrameSource source;
+	if((err=source.Load(opt.inputs, width, height)) != SUCCESS)
+		return(err);
+
+	CCamera camera;
+	camera.InitMemorySource(ROI(0, 0, width, height));
+	camera.setColorType(color);
+	CImageProcessor process;
+	CWorkerPool pool;
+	if((err=pool.Init(threads)) != SUCCESS)
+		return(err);
+	CJpegEncoder jpeg(&pool);
+	std::vector<uint8> out;
+	result.threads=pool.getThreadCount();
+
+	for(int i=0; i<opt.warmup; ++i) {
+		if((err=RunFrame(opt, camera, process, source, jpeg, out)) != SUCCESS)
+			return(err);
+	}
+
+	CStats::Reset();
+	result.bytes=0;
+	const uint64_t start_us=GetMonotonicTimeUs();
+	for(int i=0; i<opt.frames; ++i) {
+		if((err=RunFrame(opt, camera, process, source, jpeg, out)) != SUCCESS)
+			return(err);
+		result.bytes+=out.size();
+	}
+	result.seconds=(GetMonotonicTimeUs() - start_us)*1e-6;
+	result.frames=opt.frames;
+	for(int s=0; s<StatStage_count; ++s)
+		CStats::GetLatency((StatStage)s, result.stages[s]);
+	return(SUCCESS);
+}
+
+
+static void PrintResult(const BENCH_OPTIONS& opt, int width, int height, ColorType color
+		, const BENCH_RESULT& result) {
+
+	const char* color_name=color == ColorType_gray ? "gray" : "color";
+	const double fps=result.seconds > 0 ? result.frames/result.seconds : 0;
+	const double bytes_per_frame=(double)result.bytes/result.frames;
+
+	if(opt.bJson) {
+		printf("{\"width\":%d,\"height\":%d,\"color\":\"%s\",\"threads\":%d,\"encoder\":\"%s\""
+				",\"quality\":%d,\"perspective\":%d,\"frames\":%d,\"seconds\":%.6f,\"fps\":%.2f"
+				",\"bytes\":%llu,\"bytes_per_frame\":%.1f,\"stages\":{"
+				, width, height, color_name, result.threads, g_encoder_names[opt.encoder], opt.quality
+				, opt.perspective, result.frames, result.seconds, fps
+				, (unsigned long long)result.bytes, bytes_per_frame);
+		for(int i=0; i<BENCH_STAGE_COUNT; ++i) {
+			const STAT_LATENCY& l=result.stages[g_bench_stages[i]];
+			printf("%s\"%s\":{\"count\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}"
+					, i ? "," : "", CStats::StageName(g_bench_stages[i])
+					, l.count, l.p50, l.p90, l.p99, l.max);
+		}
+		printf("}}\n");
+	} else {
+		printf("%4dx%-4d %-5s threads %2d %-6s %8.1f fps %10.0f bytes/frame"
+				, width, height, color_name, result.threads, g_encoder_names[opt.encoder]
+				, fps, bytes_per_frame);
+		for(int i=0; i<BENCH_STAGE_COUNT; ++i) {
+			const STAT_LATENCY& l=result.stages[g_bench_stages[i]];
+			printf("  %s p50 %u p99 %u us", CStats::StageName(g_bench_stages[i]), l.p50, l.p99);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+
+int main(int argc, char** argv) {
+	OSC_ERR err;
+
+	BENCH_OPTIONS opt;
+	if(ParseOptions(argc, argv, opt) != SUCCESS)
+		return(1);
+
+	/* logging only, pictures do not come from the camera module */
+	if((err=OscCreate(&OscModule_log, &OscModule_sup)) != SUCCESS)
+		return(1);
+	OscLogSetConsoleLogLevel(WARN);
+
+	if(opt.size_count == 0) {
+		cv::Mat first=cv::imread(opt.inputs[0], CV_LOAD_IMAGE_COLOR);
+		if(first.empty()) {
+			fprintf(stderr, "Could not read '%s'\n", opt.inputs[0].c_str());
+			OscDestroy();
+			return(1);
+		}
+		opt.widths[0]=first.cols & ~3;
+		opt.heights[0]=first.rows;
+		opt.size_count=1;
+	}
+
+	for(int s=0; s<opt.size_count && err == SUCCESS; ++s) {
+		for(int c=0; c<opt.color_count && err == SUCCESS; ++c) {
+			for(int t=0; t<opt.thread_count && err == SUCCESS; ++t) {
+				BENCH_RESULT result;
+				err=RunConfig(opt, opt.widths[s], opt.heights[s], opt.colors[c], opt.threads[t], result);
+				if(err == SUCCESS)
+					PrintResult(opt, opt.widths[s], opt.heights[s], opt.colors[c], result);
+				else
+					fprintf(stderr, "Benchmark failed (Error=%i)\n", err);
+			}
+		}
+	}
+
+	OscDestroy();
+	return(err == SUCCESS ? 0 : 1);
+}
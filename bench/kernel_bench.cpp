@@ -0,0 +1,410 @@
+/*! @file kernel_bench.cpp
+ * @brief Micro-benchmark of the image kernels against their OpenCV baseline
+ *  Every kernel runs on pictures of several sizes whose data starts at an
+ *  offset from a PICTURE_ALIGNMENT boundary. Reports ns and cycles per pixel
+ *  and GB/s of the project implementation (as called by the application) and
+ *  of the plain OpenCV call. Kernels of kernels.h run once per instruction set
+ *  the CPU supports (impl "scalar", "sse4.1", ...), -I selects one. With -b, the run fails if a kernel is slower than
+ *  in a baseline file written earlier with -s (e.g. on the same target).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "opencv.hpp"
+
+#include "../includes.h"
+#include "../camera.h"
+#include "../image_processing.h"
+#include "../image_codec.h"
+#include "../jpeg_encoder.h"
+#include "../timing.h"
+#include "../kernels.h"
+
+
+#define KBENCH_DEFAULT_SIZES "320x240,640x480,1280x960"
+#define KBENCH_DEFAULT_OFFSETS "0,1,8"
+/* minimum duration of a measurement, the median of KBENCH_REPEATS is reported */
+#define KBENCH_MIN_BATCH_NS 20000000ULL
+#define KBENCH_REPEATS 7
+/* allowed slowdown against the baseline [%] */
+#define KBENCH_DEFAULT_THRESHOLD 10
+#define KBENCH_JPEG_QUALITY 80
+#define KBENCH_MAX_CONFIGS 16
+#define KBENCH_CPU_FREQ_FILE "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq"
+
+
+/* buffers and state the kernels work on */
+struct KERNEL_CONTEXT {
+	cv::Mat src; /* input, starts at the configured offset */
+	cv::Mat dst;
+	cv::Mat dst2;
+	std::vector<uint8> out; /* encoded picture */
+	CCamera camera;
+	CImageProcessor process;
+	CJpegEncoder jpeg; /* without pool: the kernel on a single thread */
+	uint32 hist[256];
+};
+
+typedef void (*KERNEL_FN)(KERNEL_CONTEXT& ctx);
+
+struct KERNEL {
+	const char* name;
+	int src_channels;
+	double bytes_per_pixel; /* read and written, for GB/s */
+	KERNEL_FN project; /* NULL if the project calls OpenCV directly */
+	KERNEL_FN opencv;
+	bool bIsa; /* the project implementation dispatches on the instruction set (CKernels) */
+};
+
+
+/* camera picture (RGB) to gray as in CCamera */
+static void GrayProject(KERNEL_CONTEXT& ctx) {
+	ctx.camera.ReadPictureFromMemory(ctx.src.data);
+}
+static void GrayOpenCV(KERNEL_CONTEXT& ctx) {
+	cv::cvtColor(ctx.src, ctx.dst, cv::COLOR_RGB2GRAY);
+}
+
+/* inverted image of the processing (255 - image) */
+static void InvertProject(KERNEL_CONTEXT& ctx) {
+	ctx.process.DoProcess(&ctx.src);
+}
+static void InvertOpenCV(KERNEL_CONTEXT& ctx) {
+	cv::subtract(cv::Scalar::all(255), ctx.src, ctx.dst);
+}
+
+static void GradientOpenCV(KERNEL_CONTEXT& ctx) {
+	cv::Sobel(ctx.src, ctx.dst, CV_16S, 1, 0);
+	cv::Sobel(ctx.src, ctx.dst2, CV_16S, 0, 1);
+}
+
+static void NormalizeOpenCV(KERNEL_CONTEXT& ctx) {
+	cv::normalize(ctx.src, ctx.dst, 0, 255, cv::NORM_MINMAX, CV_8U);
+}
+
+static void JpegProject(KERNEL_CONTEXT& ctx) {
+	ctx.jpeg.Encode(ctx.src, KBENCH_JPEG_QUALITY, ctx.out);
+}
+static void JpegOpenCV(KERNEL_CONTEXT& ctx) {
+	std::vector<int> params;
+	params.push_back(CV_IMWRITE_JPEG_QUALITY);
+	params.push_back(KBENCH_JPEG_QUALITY);
+	cv::imencode(".jpg", ctx.src, ctx.out, params);
+}
+
+static void QoiProject(KERNEL_CONTEXT& ctx) {
+	CImageCodec::EncodeQoi(ctx.src, ctx.out);
+}
+
+/* histogram of every pixel (the statistics use a subsampled grid) */
+static void HistProject(KERNEL_CONTEXT& ctx) {
+	CKernels::Histogram(ctx.src, cv::Rect(0, 0, ctx.src.cols, ctx.src.rows), 1, 1, ctx.hist);
+}
+static void HistOpenCV(KERNEL_CONTEXT& ctx) {
+	const int channels=0, bins=256;
+	const float range[]={ 0, 256 };
+	const float* ranges=range;
+	cv::calcHist(&ctx.src, 1, &channels, cv::Mat(), ctx.dst, 1, &bins, &ranges);
+}
+
+/* focus score of every row (the camera uses every step-th) */
+static void LaplaceProject(KERNEL_CONTEXT& ctx) {
+	int64_t sum;
+	uint64_t sum_sq;
+	CKernels::Laplacian(ctx.src, cv::Rect(0, 0, ctx.src.cols, ctx.src.rows), 1, &sum, &sum_sq);
+}
+static void LaplaceOpenCV(KERNEL_CONTEXT& ctx) {
+	cv::Scalar mean, stddev;
+	cv::Laplacian(ctx.src, ctx.dst, CV_16S, 1);
+	cv::meanStdDev(ctx.dst, mean, stddev);
+}
+
+static const KERNEL g_kernels[]={
+	{ "gray", 3, 4, GrayProject, GrayOpenCV, true },
+	{ "invert", 1, 2, InvertProject, InvertOpenCV, true },
+	{ "gradient", 1, 5, NULL, GradientOpenCV, false },
+	{ "normalize", 1, 3, NULL, NormalizeOpenCV, false },
+	{ "jpeg", 1, 1, JpegProject, JpegOpenCV, false },
+	{ "qoi", 1, 1, QoiProject, NULL, false },
+	{ "hist", 1, 1, HistProject, HistOpenCV, true },
+	{ "laplace", 1, 1, LaplaceProject, LaplaceOpenCV, true }
+};
+#define KBENCH_KERNEL_COUNT (int)(sizeof(g_kernels)/sizeof(g_kernels[0]))
+
+
+struct KBENCH_OPTIONS {
+	int size_count;
+	int widths[KBENCH_MAX_CONFIGS];
+	int heights[KBENCH_MAX_CONFIGS];
+	int offset_count;
+	int offsets[KBENCH_MAX_CONFIGS]; /* bytes from a PICTURE_ALIGNMENT boundary */
+	const char* kernel; /* NULL: all */
+	int isa; /* KernelIsa_count: all supported */
+	const char* baseline_in;
+	const char* baseline_out;
+	int threshold;
+	double cpu_ghz; /* 0: unknown, no cycles */
+};
+
+/* one line of a baseline file: "<kernel> <impl> <width>x<height> <offset> <ns per pixel>" */
+struct KBENCH_RESULT {
+	std::string kernel;
+	std::string impl;
+	int width;
+	int height;
+	int offset;
+	double ns_per_pixel;
+};
+
+
+static void Usage(const char* name) {
+	fprintf(stderr, "usage: %s [-r WxH[,WxH]...] [-a offset[,offset]...] [-k kernel] [-I isa]\n"
+			"\t[-b baseline] [-s baseline] [-t threshold %%] [-F cpu MHz]\n"
+			"  defaults: -r " KBENCH_DEFAULT_SIZES " -a " KBENCH_DEFAULT_OFFSETS " -t %d\n"
+			"  isa: scalar, sse4.1, avx2 or neon (default: all the CPU supports)\n"
+			"  exit status 2: a kernel is slower than its baseline by more than the threshold\n"
+			, name, KBENCH_DEFAULT_THRESHOLD);
+}
+
+/* comma separated list of "WxH" */
+static bool ParseSizes(const char* str, KBENCH_OPTIONS& opt) {
+	opt.size_count=0;
+	while(*str && opt.size_count < KBENCH_MAX_CONFIGS) {
+		int w, h, n;
+		/* CCamera needs a width that is a multiple of 4 */
+		if(sscanf(str, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0 || w%4 != 0) return(false);
+		opt.widths[opt.size_count]=w;
+		opt.heights[opt.size_count++]=h;
+		str+=n;
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(*str == 0);
+}
+
+static bool ParseOffsets(const char* str, KBENCH_OPTIONS& opt) {
+	opt.offset_count=0;
+	while(*str && opt.offset_count < KBENCH_MAX_CONFIGS) {
+		char* end;
+		long n=strtol(str, &end, 10);
+		if(end == str || n < 0 || n >= PICTURE_ALIGNMENT) return(false);
+		opt.offsets[opt.offset_count++]=(int)n;
+		str=end;
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(*str == 0);
+}
+
+static bool ParseIsa(const char* str, KBENCH_OPTIONS& opt) {
+	for(int i=0; i<KernelIsa_count; ++i) {
+		if(strcmp(str, CKernels::IsaName((KernelIsa)i)) == 0) {
+			opt.isa=i;
+			return(CKernels::IsSupported((KernelIsa)i));
+		}
+	}
+	return(false);
+}
+
+static double ReadCpuGHz() {
+	FILE* f=fopen(KBENCH_CPU_FREQ_FILE, "r");
+	if(!f) return(0);
+	long khz=0;
+	if(fscanf(f, "%ld", &khz) != 1) khz=0;
+	fclose(f);
+	return(khz*1e-6);
+}
+
+static bool ReadBaseline(const char* fn, std::vector<KBENCH_RESULT>& baseline) {
+	FILE* f=fopen(fn, "r");
+	if(!f) return(false);
+	char kernel[64], impl[64];
+	KBENCH_RESULT r;
+	while(fscanf(f, "%63s %63s %dx%d %d %lf", kernel, impl, &r.width, &r.height, &r.offset, &r.ns_per_pixel) == 6) {
+		r.kernel=kernel;
+		r.impl=impl;
+		baseline.push_back(r);
+	}
+	fclose(f);
+	return(true);
+}
+
+static bool WriteBaseline(const char* fn, const std::vector<KBENCH_RESULT>& results) {
+	FILE* f=fopen(fn, "w");
+	if(!f) return(false);
+	for(size_t i=0; i<results.size(); ++i) {
+		const KBENCH_RESULT& r=results[i];
+		fprintf(f, "%s %s %dx%d %d %.4f\n", r.kernel.c_str(), r.impl.c_str(), r.width, r.height
+				, r.offset, r.ns_per_pixel);
+	}
+	return(fclose(f) == 0);
+}
+
+static const KBENCH_RESULT* FindBaseline(const std::vector<KBENCH_RESULT>& baseline, const KBENCH_RESULT& r) {
+	for(size_t i=0; i<baseline.size(); ++i) {
+		const KBENCH_RESULT& b=baseline[i];
+		if(b.kernel == r.kernel && b.impl == r.impl && b.width == r.width && b.height == r.height
+				&& b.offset == r.offset)
+			return(&b);
+	}
+	return(NULL);
+}
+
+
+/* median time of one call [ns] */
+static double TimeKernel(KERNEL_FN fn, KERNEL_CONTEXT& ctx) {
+	/* warm up caches and let OpenCV allocate its outputs */
+	fn(ctx);
+	uint64_t begin=GetMonotonicTimeNs();
+	fn(ctx);
+	uint64_t single=GetMonotonicTimeNs() - begin;
+	const uint64_t iterations=std::max((uint64_t)1, (uint64_t)(KBENCH_MIN_BATCH_NS/(single + 1)));
+
+	double times[KBENCH_REPEATS];
+	for(int r=0; r<KBENCH_REPEATS; ++r) {
+		begin=GetMonotonicTimeNs();
+		for(uint64_t i=0; i<iterations; ++i)
+			fn(ctx);
+		times[r]=(double)(GetMonotonicTimeNs() - begin)/iterations;
+	}
+	std::sort(times, times + KBENCH_REPEATS);
+	return(times[KBENCH_REPEATS/2]);
+}
+
+
+int main(int argc, char** argv) {
+	KBENCH_OPTIONS opt;
+	ParseSizes(KBENCH_DEFAULT_SIZES, opt);
+	ParseOffsets(KBENCH_DEFAULT_OFFSETS, opt);
+	opt.kernel=NULL;
+	opt.isa=KernelIsa_count;
+	opt.baseline_in=NULL;
+	opt.baseline_out=NULL;
+	opt.threshold=KBENCH_DEFAULT_THRESHOLD;
+	opt.cpu_ghz=ReadCpuGHz();
+
+	int c;
+	bool bValid=true;
+	while(bValid && (c=getopt(argc, argv, "r:a:k:I:b:s:t:F:")) != -1) {
+		switch(c) {
+		case 'r': bValid=ParseSizes(optarg, opt); break;
+		case 'a': bValid=ParseOffsets(optarg, opt); break;
+		case 'k': opt.kernel=optarg; break;
+		case 'I': bValid=ParseIsa(optarg, opt); break;
+		case 'b': opt.baseline_in=optarg; break;
+		case 's': opt.baseline_out=optarg; break;
+		case 't': opt.threshold=atoi(optarg); bValid=opt.threshold >= 0; break;
+		case 'F': opt.cpu_ghz=atof(optarg)*1e-3; bValid=opt.cpu_ghz > 0; break;
+		default: bValid=false; break;
+		}
+	}
+	if(!bValid || optind < argc) {
+		Usage(argv[0]);
+		return(1);
+	}
+
+	std::vector<KBENCH_RESULT> baseline;
+	if(opt.baseline_in && !ReadBaseline(opt.baseline_in, baseline)) {
+		fprintf(stderr, "Could not read the baseline '%s'\n", opt.baseline_in);
+		return(1);
+	}
+
+	if(OscCreate(&OscModule_log, &OscModule_sup) != SUCCESS)
+		return(1);
+	OscLogSetConsoleLogLevel(WARN);
+
+	/* the test picture as in the application, noise where there is none */
+	cv::Mat picture=cv::imread("test.bmp", CV_LOAD_IMAGE_COLOR);
+	if(picture.empty()) {
+		picture.create(OSC_CAM_MAX_IMAGE_HEIGHT, OSC_CAM_MAX_IMAGE_WIDTH, CV_8UC3);
+		cv::randu(picture, cv::Scalar::all(0), cv::Scalar::all(255));
+	}
+
+	printf("%-10s %-7s %9s %6s %10s %10s %8s %9s\n", "kernel", "impl", "size", "offset"
+			, "ns/pixel", "cyc/pixel", "GB/s", "baseline");
+
+	std::vector<KBENCH_RESULT> results;
+	int regressions=0;
+	for(int k=0; k<KBENCH_KERNEL_COUNT; ++k) {
+		const KERNEL& kernel=g_kernels[k];
+		if(opt.kernel && strcmp(opt.kernel, kernel.name) != 0) continue;
+
+		for(int s=0; s<opt.size_count; ++s) {
+			const int width=opt.widths[s], height=opt.heights[s];
+			const int row_bytes=width*kernel.src_channels;
+
+			cv::Mat scaled, input;
+			cv::resize(picture, scaled, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+			if(kernel.src_channels == 1) cv::cvtColor(scaled, input, cv::COLOR_BGR2GRAY);
+			else cv::cvtColor(scaled, input, cv::COLOR_BGR2RGB);
+
+			std::vector<uint8> storage(row_bytes*height + 2*PICTURE_ALIGNMENT);
+			for(int o=0; o<opt.offset_count; ++o) {
+				KERNEL_CONTEXT ctx;
+				uint8* data=CCamera::AlignPicture(&storage[0]) + opt.offsets[o];
+				ctx.src=cv::Mat(height, width, CV_MAKETYPE(CV_8U, kernel.src_channels), data, row_bytes);
+				input.copyTo(ctx.src);
+				ctx.camera.InitMemorySource(ROI(0, 0, width, height));
+				ctx.camera.setColorType(ColorType_gray);
+
+				/* impl 0..KernelIsa_count-1: project with that instruction set, KernelIsa_count: OpenCV */
+				for(int impl=0; impl<=KernelIsa_count; ++impl) {
+					const bool bOpenCV=impl == KernelIsa_count;
+					KERNEL_FN fn=bOpenCV ? kernel.opencv : kernel.project;
+					if(!fn) continue;
+					if(!bOpenCV && kernel.bIsa) {
+						if((opt.isa != KernelIsa_count && impl != opt.isa)
+								|| CKernels::setIsa((KernelIsa)impl) != SUCCESS)
+							continue;
+					} else if(!bOpenCV && impl != 0) {
+						continue;
+					}
+
+					KBENCH_RESULT r;
+					r.kernel=kernel.name;
+					if(bOpenCV) r.impl="opencv";
+					else r.impl=kernel.bIsa ? CKernels::IsaName((KernelIsa)impl) : "project";
+					r.width=width;
+					r.height=height;
+					r.offset=opt.offsets[o];
+					r.ns_per_pixel=TimeKernel(fn, ctx)/((double)width*height);
+					results.push_back(r);
+
+					char size[24], cycles[24], base[24];
+					snprintf(size, sizeof(size), "%dx%d", width, height);
+					if(opt.cpu_ghz > 0) snprintf(cycles, sizeof(cycles), "%10.3f", r.ns_per_pixel*opt.cpu_ghz);
+					else snprintf(cycles, sizeof(cycles), "%10s", "-");
+					const KBENCH_RESULT* b=FindBaseline(baseline, r);
+					const bool bRegression=b && r.ns_per_pixel > b->ns_per_pixel*(100 + opt.threshold)/100;
+					if(b) snprintf(base, sizeof(base), "%+8.1f%%", 100*(r.ns_per_pixel/b->ns_per_pixel - 1));
+					else snprintf(base, sizeof(base), "%9s", "-");
+					regressions+=bRegression;
+
+					printf("%-10s %-7s %9s %6d %10.4f %s %8.2f %s%s\n", r.kernel.c_str(), r.impl.c_str()
+							, size, r.offset, r.ns_per_pixel, cycles, kernel.bytes_per_pixel/r.ns_per_pixel
+							, base, bRegression ? "  REGRESSION" : "");
+					fflush(stdout);
+				}
+			}
+		}
+	}
+
+	OscDestroy();
+
+	if(opt.baseline_out && !WriteBaseline(opt.baseline_out, results)) {
+		fprintf(stderr, "Could not write the baseline '%s'\n", opt.baseline_out);
+		return(1);
+	}
+	if(regressions > 0) {
+		fprintf(stderr, "%d measurements slower than the baseline by more than %d%%\n", regressions, opt.threshold);
+		return(2);
+	}
+	return(0);
+}
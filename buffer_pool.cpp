@@ -0,0 +1,42 @@
+/*! @file buffer_pool.cpp
+ * @brief Pool of byte buffers that keep their capacity between uses
+ */
+
+#include "buffer_pool.h"
+
+
+CBufferPool::CBufferPool() : m_free_count(0) {
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+CBufferPool::~CBufferPool() {
+	for(int i=0; i<m_free_count; ++i)
+		delete m_free[i];
+	pthread_mutex_destroy(&m_mutex);
+}
+
+std::vector<uint8>* CBufferPool::Acquire() {
+	std::vector<uint8>* buf=NULL;
+	
+	pthread_mutex_lock(&m_mutex);
+	if(m_free_count > 0) buf=m_free[--m_free_count];
+	pthread_mutex_unlock(&m_mutex);
+	
+	if(!buf) buf=new std::vector<uint8>();
+	buf->clear();
+	return(buf);
+}
+
+void CBufferPool::Release(std::vector<uint8>* buf) {
+	if(!buf) return;
+	
+	pthread_mutex_lock(&m_mutex);
+	if(m_free_count < BUFFER_POOL_SIZE) {
+		m_free[m_free_count++]=buf;
+		buf=NULL;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	
+	/* pool is full */
+	delete buf;
+}
@@ -0,0 +1,53 @@
+/*! @file buffer_pool.h
+ * @brief Pool of byte buffers that keep their capacity between uses
+ *  Avoids reallocating the output buffers of the image encoders for every request.
+ */
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <vector>
+#include <pthread.h>
+
+#include "includes.h"
+
+
+#define BUFFER_POOL_SIZE 8
+
+
+class CBufferPool {
+public:
+	CBufferPool();
+	~CBufferPool();
+	
+	/*! @brief get an empty buffer; a new one is created if all pooled buffers are in use */
+	std::vector<uint8>* Acquire();
+	/*! @brief give a buffer back to the pool, its capacity is kept */
+	void Release(std::vector<uint8>* buf);
+	
+private:
+	std::vector<uint8>* m_free[BUFFER_POOL_SIZE];
+	int m_free_count;
+	pthread_mutex_t m_mutex;
+};
+
+
+/*! @brief scoped use of a pooled buffer */
+class CPooledBuffer {
+public:
+	CPooledBuffer(CBufferPool& pool) : m_pool(pool), m_buf(pool.Acquire()) {}
+	~CPooledBuffer() { m_pool.Release(m_buf); }
+	
+	std::vector<uint8>& operator*() { return(*m_buf); }
+	std::vector<uint8>* operator->() { return(m_buf); }
+	
+private:
+	CPooledBuffer(const CPooledBuffer&);
+	CPooledBuffer& operator=(const CPooledBuffer&);
+	
+	CBufferPool& m_pool;
+	std::vector<uint8>* m_buf;
+};
+
+
+#endif /* BUFFER_POOL_H_ */
@@ -1,10 +1,20 @@
 
 #include "camera.h"
+#include "timing.h"
+#include "stats.h"
+#include "mat_arena.h"
+#include "kernels.h"
+#include "trace.h"
 #include <fstream>
+#include <errno.h>
 
 
-CCamera::CCamera() : m_img(NULL), m_frame_buffer_ids(NULL), m_frame_buffers(NULL)
-	, m_bRoi_changed(false), m_color_type(ColorType_gray), m_perspective(0) {}
+CCamera::CCamera() : m_img(NULL), m_source(CameraSource_sensor), m_file_period_ns(0), m_file_next_ns(0)
+	, m_frame_buffer_ids(NULL), m_frame_buffers(NULL)
+	, m_bRoi_changed(false), m_color_type(ColorType_gray), m_perspective(0)
+	, m_frame_seq(0), m_frame_timestamp(0), m_bArmed(false), m_frame_exposure(INIT_EXPOSURE_TIME) {
+	m_applied=m_settings.Latest();
+}
 
 CCamera::~CCamera() {
 	if(m_frame_buffer_ids) delete[](m_frame_buffer_ids);
@@ -55,6 +65,25 @@ OSC_ERR CCamera::Init(const ROI& region_of_interest, uint8 buffer_count) {
 			return(err);
 	}
 	
+	m_bArmed=false;
+	return(m_trigger.Init());
+}
+
+OSC_ERR CCamera::InitFileSource(const char* fn, double fps) {
+	
+	cv::Mat picture=cv::imread(fn, CV_LOAD_IMAGE_COLOR);
+	if(picture.cols < 4) {
+		OscLog(ERROR, "Could not read the picture '%s'\n", fn);
+		return(EFILE_ERROR);
+	}
+	/* the sensor delivers RGB */
+	cv::cvtColor(picture(cv::Rect(0, 0, picture.cols & ~3, picture.rows)), m_file_picture, cv::COLOR_BGR2RGB);
+	
+	m_source=CameraSource_file;
+	m_roi=ROI(0, 0, m_file_picture.cols, m_file_picture.rows);
+	m_bRoi_changed=true;
+	m_file_period_ns=fps > 0 ? (uint64_t)(1e9/fps) : 0;
+	m_file_next_ns=GetMonotonicTimeNs();
 	return(SUCCESS);
 }
 
@@ -71,6 +100,8 @@ uint32 CCamera::AlignSize(uint32 size) {
 
 cv::Mat* CCamera::ReadLatestPicture() {
 	
+	if(m_source == CameraSource_file) return(ReadFilePicture());
+	
 	uint8* pic_data = NULL;
 #ifdef OSC_HOST
 	/* wait for the picture to be captured -> otherwise it could run too fast on the host */
@@ -84,6 +115,8 @@ cv::Mat* CCamera::ReadLatestPicture() {
 
 cv::Mat* CCamera::ReadPicture( uint16 max_age, uint16 timeout) {
 	
+	if(m_source == CameraSource_file) return(ReadFilePicture());
+	
 	uint8* pic_data = NULL;
 	if(OscCamReadPicture(m_buffer_count>1 ? OSC_CAM_MULTI_BUFFER : 0, &pic_data, max_age, timeout)==SUCCESS) {
 		return(HandlePictureColoringAndSize(pic_data));
@@ -93,22 +126,63 @@ cv::Mat* CCamera::ReadPicture( uint16 max_age, uint16 timeout) {
 	return(NULL);
 }
 
+cv::Mat* CCamera::ReadPictureFromMemory(const uint8* pic_data) {
+	/* the picture is only read: RgbToGray resp. copyTo */
+	return(HandlePictureColoringAndSize((uint8*)pic_data));
+}
+
+cv::Mat* CCamera::ReadFilePicture() {
+	
+	/* a free running sensor: one picture per period */
+	if(m_file_period_ns > 0) {
+		struct timespec deadline;
+		deadline.tv_sec=m_file_next_ns/1000000000;
+		deadline.tv_nsec=m_file_next_ns%1000000000;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+		m_file_next_ns+=m_file_period_ns;
+		/* after a stall, do not catch up with a burst of pictures */
+		const uint64_t now=GetMonotonicTimeNs();
+		if(m_file_next_ns < now) m_file_next_ns=now;
+	}
+	return(ReadPictureFromMemory(m_file_picture.data));
+}
+
+cv::Mat* CCamera::ReadTriggeredPicture() {
+	
+	m_trigger.Poll();
+	TRIGGER_EVENT event;
+	if(!m_trigger.PopEvent(event)) return(NULL);
+	
+	/* the sensor took the picture on the edge */
+	cv::Mat* img=ReadPicture(0, TRIGGER_FRAME_TIMEOUT_MS);
+	if(!img) {
+		CStats::Count(StatCounter_triggersMissed);
+		return(NULL);
+	}
+	m_bArmed=false;
+	m_trigger.Match(event, m_frame_seq, m_frame_timestamp);
+	return(img);
+}
+
 cv::Mat* CCamera::HandlePictureColoringAndSize(uint8* pic_data) {
 	
+	ApplySettings();
+	m_frame_exposure=m_auto_exposure.IsEnabled() ? m_auto_exposure.getExposure() : m_applied.exposure_time;
 	if(m_color_type == ColorType_none || !pic_data) return(0);
         
         if(m_color_type == ColorType_debayered) {
 
 		AdjustImageHeader(m_img, 3);
 		
-		*m_img = cv::Mat(m_img->rows, m_img->cols, CV_8UC3, pic_data).clone();
+		/* into the existing buffer, no allocation per frame */
+		cv::Mat(m_img->rows, m_img->cols, CV_8UC3, pic_data).copyTo(*m_img);
 	} else {
 		// 1 channel
 		AdjustImageHeader(m_img, 1);
                 
                 cv::Mat col_img = cv::Mat(m_img->rows, m_img->cols, CV_8UC3, pic_data);
                 
-                cv::cvtColor(col_img, *m_img, cv::COLOR_RGB2GRAY);
+                CKernels::RgbToGray(col_img, *m_img);
                 //cv::imwrite("orig.png", col_img);
 		
 /*
@@ -124,13 +198,81 @@ cv::Mat* CCamera::HandlePictureColoringAndSize(uint8* pic_data) {
 	}
         
         //cv::imwrite("gray.png", *m_img);
+	
+	++m_frame_seq;
+	const uint64_t timestamp=GetMonotonicTimeUs();
+	if(m_frame_timestamp != 0)
+		CStats::Record(StatStage_frameInterval, (uint32)(timestamp - m_frame_timestamp));
+	m_frame_timestamp=timestamp;
+	
+	UpdateStatistics();
 
 	return(m_img);
 }
 
+void CCamera::ApplySettings() {
+	const CAMERA_SETTINGS* s=m_settings.Take();
+	if(!s) return;
+	
+	m_color_type=s->color_type;
+	m_perspective=s->perspective;
+	m_image_stats.setStep(s->stats_step);
+	m_image_stats.setRegion(s->stats_region);
+	m_auto_exposure.setTarget(s->ae_target);
+	m_auto_exposure.setPercentile(s->ae_percentile);
+	m_focus.setStep(s->focus_step);
+	m_focus.setTiles(s->focus_tiles_x, s->focus_tiles_y);
+	
+	const bool bSensor=m_source == CameraSource_sensor;
+	if(s->exposure_control != m_applied.exposure_control
+			|| (s->exposure_control == ExposureControl_manual && s->exposure_time != m_applied.exposure_time)) {
+		switch(s->exposure_control) {
+		case ExposureControl_sensor:
+			m_auto_exposure.Disable();
+			/* the software control had turned the sensor's off */
+			if(m_applied.exposure_control == ExposureControl_software) setAutoExposure(true);
+			if(bSensor) OscCamSetShutterWidth(0);
+			break;
+		case ExposureControl_manual:
+			m_auto_exposure.Disable();
+			if(bSensor) OscCamSetShutterWidth(s->exposure_time);
+			break;
+		case ExposureControl_software:
+			/* our control takes over from the sensor's */
+			setAutoExposure(false);
+			m_auto_exposure.Enable(s->exposure_time);
+			break;
+		}
+	}
+	m_applied=*s;
+}
+
+void CCamera::UpdateStatistics() {
+	if(m_image_stats.IsEnabled()) {
+		CStageTimer timer(StatStage_imageStats);
+		m_image_stats.Compute(*m_img, m_frame_seq);
+		if(m_auto_exposure.Update(m_image_stats.get()) && m_source == CameraSource_sensor)
+			OscCamSetShutterWidth(m_auto_exposure.getExposure());
+	}
+	if(m_focus.IsEnabled()) {
+		CStageTimer timer(StatStage_focus);
+		m_focus.Compute(*m_img, m_frame_seq);
+	}
+}
+
 OSC_ERR CCamera::CapturePicture() {
 	OSC_ERR ret;
 	
+	if(m_source != CameraSource_sensor) return(SUCCESS);
+	
+	if(m_trigger.isExternal()) {
+		/* the input edge triggers the capture */
+		if(m_bArmed) return(SUCCESS);
+		ret=OscCamSetupCapture( m_buffer_count>1 ? OSC_CAM_MULTI_BUFFER : 0 );
+		m_bArmed=ret==SUCCESS;
+		return(ret);
+	}
+	
 	ret=OscCamSetupCapture( m_buffer_count>1 ? OSC_CAM_MULTI_BUFFER : 0 );
 	if(ret==SUCCESS) ret=OscGpioTriggerImage();
 	
@@ -140,14 +282,20 @@ OSC_ERR CCamera::CapturePicture() {
 
 void CCamera::AdjustImageHeader(cv::Mat*& img, int channel_count) {
 	
-	if(!(img) || m_bRoi_changed || img->channels()!=channel_count) {
+	/* the pipeline swaps in the image of a recycled frame, it may be empty or of an older ROI */
+	if(!(img) || m_bRoi_changed || img->empty() || img->rows != m_roi.height || img->cols != m_roi.width
+			|| img->channels()!=channel_count) {
 		m_bRoi_changed=false;
 		
-		if(img) delete img;
+		/* the header is kept, its buffers come from the arena */
+		if(!img) {
+			img=new cv::Mat();
+			CMatArena::Use(*img);
+		}
                 if(channel_count==1){
-                    img=new cv::Mat(cvSize(m_roi.width, m_roi.height), CV_8UC1);
+                    img->create(m_roi.height, m_roi.width, CV_8UC1);
                 } else if(channel_count==3){
-                    img=new cv::Mat(cvSize(m_roi.width, m_roi.height), CV_8UC3);
+                    img->create(m_roi.height, m_roi.width, CV_8UC3);
                 } else {
                     OscLog(ERROR, "channel_count not supported");
                 }
@@ -167,12 +315,14 @@ ColorType CCamera::getAppropriateColorType() {
 
 
 void CCamera::setAutoExposure(bool bEnabled) {
+	if(m_source != CameraSource_sensor) return;
 	uint16 reg_val;
 	OscCamGetRegisterValue(REG_AEC_AGC_ENABLE, &reg_val);
 	OscCamSetRegisterValue(REG_AEC_AGC_ENABLE, (reg_val & ~0x1) | (uint16)bEnabled);
 }
 
 bool CCamera::getAutoExposure() const {
+	if(m_source != CameraSource_sensor) return(false);
 	uint16 reg_val;
 	OscCamGetRegisterValue(REG_AEC_AGC_ENABLE, &reg_val);
 	return(reg_val & 0x1);
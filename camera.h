@@ -8,6 +8,11 @@
 
 #include "opencv.hpp"
 #include "includes.h"
+#include "trigger.h"
+#include "camera_settings.h"
+#include "image_stats.h"
+#include "auto_exposure.h"
+#include "focus.h"
 
 
 #define REG_AEC_AGC_ENABLE 0xAF
@@ -25,15 +30,19 @@ struct ROI {
 };
 
 
-enum ColorType {
-	ColorType_none, // No valid image yet
-	ColorType_gray, // Image from a grayscale sensor
-	ColorType_raw, // Raw image from a color sensor
-	ColorType_debayered // Debayered image from a color sensor
-};
-
 #define PICTURE_ALIGNMENT 16
 
+/* cameras of one application instance */
+#define MAX_CAMERAS 4
+
+
+/* where the pictures come from */
+enum CameraSource {
+	CameraSource_sensor, // Oscar's camera module, one sensor per process
+	CameraSource_memory, // pictures passed to ReadPictureFromMemory (benchmarks)
+	CameraSource_file // a picture file replayed at a fixed rate (see InitFileSource)
+};
+
 
 
 class CCamera {
@@ -46,6 +55,24 @@ public:
 	 */
 	OSC_ERR Init(const ROI& region_of_interest, uint8 buffer_count=3);
 	
+	/*! @brief use pictures from memory only (benchmarks), the sensor is not touched
+	 * Oscar's camera module is not needed for this.
+	 */
+	void InitMemorySource(const ROI& region_of_interest) {
+		m_source=CameraSource_memory; m_roi=region_of_interest; m_bRoi_changed=true;
+		/* benchmarks measure the reading of the picture only */
+		m_settings.BeginUpdate().stats_step=0;
+		m_settings.EndUpdate();
+	}
+	
+	/*! @brief replay the picture file fn at fps (0: as fast as read) instead of a sensor
+	 * Oscar drives a single sensor, further cameras of a multi camera setup come from files.
+	 * The ROI is the size of the picture, its width cut to a multiple of 4.
+	 */
+	OSC_ERR InitFileSource(const char* fn, double fps);
+	
+	CameraSource getSource() const { return(m_source); }
+	
 	
 	
 	/*! @brief get the latest picture and do debayering if needed 
@@ -60,39 +87,88 @@ public:
 	 *  call CapturePicture and ReadPicture if you want the most actual picture
 	 */
 	cv::Mat* ReadPicture(uint16 max_age=0, uint16 timeout=0);
+	
+	/*! @brief like ReadPicture, but with a picture from memory instead of the sensor
+	 * pic_data: RGB picture of the size of the ROI (see InitMemorySource)
+	 */
+	cv::Mat* ReadPictureFromMemory(const uint8* pic_data);
+	
+	/*! @brief external trigger: poll the trigger input and read the picture of the oldest edge
+	 * returns NULL if there is no edge or its picture did not arrive within TRIGGER_FRAME_TIMEOUT_MS
+	 */
+	cv::Mat* ReadTriggeredPicture();
         
         /*! @brief Read the last captured picture.
 	 */
 	cv::Mat* GetLastPicture() {return m_img;}    
 	
+	/*! @brief sequence number of the last read picture (incremented on every read) */
+	uint32 getFrameSeq() const { return(m_frame_seq); }
+	/*! @brief CLOCK_MONOTONIC time of the last read picture [us] */
+	uint64_t getFrameTimestamp() const { return(m_frame_timestamp); }
+	/*! @brief trigger edge of the last read picture, 0 if it was triggered by software */
+	uint32 getTriggerSeq() const {
+		return(m_trigger.getLastFrameSeq() == m_frame_seq ? m_trigger.getLastEvent().seq : 0);
+	}
+	
 	
-	/*! @brief setup a capture an return immediately */
+	/*! @brief setup a capture an return immediately
+	 * With the external trigger, the sensor stays armed until the picture of an edge is read.
+	 */
 	OSC_ERR CapturePicture();
 	
+	/*! @brief trigger source, configure it before Init */
+	CTrigger& getTrigger() { return(m_trigger); }
+	bool isExternalTrigger() const { return(m_trigger.isExternal()); }
+	
+	/*! @brief settings applied at the start of the next picture read
+	 * Requests change them here instead of in the camera, the camera itself
+	 * is only used by the thread reading the pictures (see CCameraSettings).
+	 */
+	CCameraSettings& getSettings() { return(m_settings); }
+	/*! @brief settings the last picture was read with, for its FRAME */
+	const CAMERA_SETTINGS& getAppliedSettings() const { return(m_applied); }
+	/*! @brief exposure time [us] the last picture was read with, also under software control */
+	uint32 getFrameExposure() const { return(m_frame_exposure); }
+	
 	
 	/*! @brief get region of interest */
 	const ROI& getROI() const { return(m_roi); }
 	
 	void setROI(const ROI& new_roi) { 
 		m_roi=new_roi; m_bRoi_changed=true; 
-		OscCamSetAreaOfInterest(m_roi.low_x, m_roi.low_y, m_roi.width, m_roi.height);
+		if(m_source == CameraSource_sensor)
+			OscCamSetAreaOfInterest(m_roi.low_x, m_roi.low_y, m_roi.width, m_roi.height);
 	}
 	
 	
+	/*! @brief color type and perspective of the last picture read, the setters change the settings */
 	ColorType getColorType() { return(m_color_type); }
-	void setColorType(ColorType type) { m_color_type=type; }
+	void setColorType(ColorType type) {
+		m_settings.BeginUpdate().color_type=type;
+		m_settings.EndUpdate();
+	}
 	/*! @brief getAppropriateColorType: returns color type depending on hardware: either gray or color */
 	ColorType getAppropriateColorType();
 	
 	
 	int getPerspective() { return(m_perspective); }
 	void setPerspective(int perspective) {
-		m_perspective=perspective;
+		m_settings.BeginUpdate().perspective=perspective;
+		m_settings.EndUpdate();
 	}
 	
+	/*! @brief the sensor's own exposure control (AEC/AGC) */
 	void setAutoExposure(bool bEnabled);
 	bool getAutoExposure() const;
 	
+	/*! @brief statistics of every picture read, and the exposure control on them
+	 * Their settings are applied from getSettings.
+	 */
+	CImageStats& getImageStats() { return(m_image_stats); }
+	CAutoExposure& getSoftwareExposure() { return(m_auto_exposure); }
+	CFocus& getFocus() { return(m_focus); }
+	
 	
 	/*! @brief Align an image pointer to a multiple of PICTURE_ALIGNMENT
 	 * IMPORTANT: make sure, pic is PICTURE_ALIGNMENT bytes larger than needed!
@@ -103,10 +179,21 @@ public:
 	
 private:
 	cv::Mat* HandlePictureColoringAndSize(uint8* pic_data);
+	/* take the settings published since the last picture */
+	void ApplySettings();
+	/* file source: wait for the next frame period, returns the picture */
+	cv::Mat* ReadFilePicture();
 	/* set new imageheader if channel_count is not the same or size is not same as from camera */
 	void AdjustImageHeader(cv::Mat*& img, int channel_count);
+	/* statistics and focus score of the picture read, the exposure control sets the next exposure time */
+	void UpdateStatistics();
 	cv::Mat* m_img;
 	
+	CameraSource m_source;
+	cv::Mat m_file_picture; /* RGB, CameraSource_file */
+	uint64_t m_file_period_ns; /* 0: no pacing */
+	uint64_t m_file_next_ns; /* CLOCK_MONOTONIC deadline of the next picture */
+	
 	uint8* m_frame_buffer_ids;
 	uint8_t* m_frame_buffers;
 	ROI m_roi;
@@ -115,6 +202,20 @@ private:
 	int m_buffer_count;
 	ColorType m_color_type;
 	int m_perspective; /* different processing images can be shown */
+	
+	uint32 m_frame_seq;
+	uint64_t m_frame_timestamp;
+	
+	CTrigger m_trigger;
+	bool m_bArmed; /* external trigger: a capture is set up */
+	
+	CImageStats m_image_stats;
+	CAutoExposure m_auto_exposure;
+	CFocus m_focus;
+	
+	CCameraSettings m_settings;
+	CAMERA_SETTINGS m_applied;
+	uint32 m_frame_exposure;
 };
 
 
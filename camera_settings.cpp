@@ -0,0 +1,62 @@
+/*! @file camera_settings.cpp
+ * @brief Settings of a camera as immutable, versioned snapshots
+ */
+
+#include <string.h>
+
+#include "camera_settings.h"
+#include "image_stats.h"
+#include "auto_exposure.h"
+#include "focus.h"
+
+
+CCameraSettings::CCameraSettings() : m_front(0), m_back(2), m_middle(1) {
+	/* the defaults of the camera, nothing to apply until the first change */
+	m_edit.version=0;
+	m_edit.exposure_control=ExposureControl_sensor;
+	m_edit.exposure_time=INIT_EXPOSURE_TIME;
+	m_edit.ae_target=AE_DEFAULT_TARGET;
+	m_edit.ae_percentile=AE_DEFAULT_PERCENTILE;
+	m_edit.stats_step=IMAGE_STATS_DEFAULT_STEP;
+	m_edit.stats_region=cv::Rect(0, 0, 0, 0);
+	m_edit.focus_step=0;
+	m_edit.focus_tiles_x=FOCUS_DEFAULT_TILES_X;
+	m_edit.focus_tiles_y=FOCUS_DEFAULT_TILES_Y;
+	m_edit.color_type=ColorType_gray;
+	m_edit.perspective=0;
+	for(int i=0; i<3; ++i)
+		m_slots[i]=m_edit;
+	m_latest=m_edit;
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+CCameraSettings::~CCameraSettings() {
+	pthread_mutex_destroy(&m_mutex);
+}
+
+CAMERA_SETTINGS& CCameraSettings::BeginUpdate() {
+	pthread_mutex_lock(&m_mutex);
+	return(m_edit);
+}
+
+uint32 CCameraSettings::EndUpdate() {
+	/* all members are 32 bit, without padding */
+	if(memcmp(&m_edit, &m_latest, sizeof(m_edit)) != 0) {
+		++m_edit.version;
+		m_slots[m_back]=m_edit;
+		/* the snapshot is complete before the capture stage can see it */
+		__sync_synchronize();
+		m_back=__sync_lock_test_and_set(&m_middle, m_back | SETTINGS_FRESH) & ~SETTINGS_FRESH;
+		m_latest=m_edit;
+	}
+	const uint32 version=m_latest.version;
+	pthread_mutex_unlock(&m_mutex);
+	return(version);
+}
+
+CAMERA_SETTINGS CCameraSettings::Latest() const {
+	pthread_mutex_lock(&m_mutex);
+	const CAMERA_SETTINGS settings=m_latest;
+	pthread_mutex_unlock(&m_mutex);
+	return(settings);
+}
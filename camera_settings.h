@@ -0,0 +1,95 @@
+/*! @file camera_settings.h
+ * @brief Settings of a camera as immutable, versioned snapshots
+ *  Requests change the settings, the capture stage applies them at the
+ *  start of a frame (see CCamera::ApplySettings), so a frame is produced
+ *  with one consistent set of settings and the camera needs no lock.
+ *  A change is written to a slot the capture stage does not use and then
+ *  published by exchanging one word. The capture stage loads that word
+ *  once per frame and only if it was published exchanges it to take the
+ *  snapshot. Three slots (one on either side and the one in between)
+ *  keep both sides from ever waiting for each other.
+ */
+
+#ifndef CAMERA_SETTINGS_H_
+#define CAMERA_SETTINGS_H_
+
+#include <pthread.h>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+#define INIT_EXPOSURE_TIME 10000
+
+/* flag of the slot in between: published and not taken yet */
+#define SETTINGS_FRESH 4
+
+
+enum ColorType {
+	ColorType_none, // No valid image yet
+	ColorType_gray, // Image from a grayscale sensor
+	ColorType_raw, // Raw image from a color sensor
+	ColorType_debayered // Debayered image from a color sensor
+};
+
+enum ExposureControl {
+	ExposureControl_sensor, // the sensor's own AEC/AGC
+	ExposureControl_manual, // exposure_time
+	ExposureControl_software // CAutoExposure, starting at exposure_time
+};
+
+struct CAMERA_SETTINGS {
+	uint32 version; /* incremented by every published change, 0: initial settings */
+	ExposureControl exposure_control;
+	uint32 exposure_time; /* [us] */
+	int ae_target; /* see CAutoExposure */
+	int ae_percentile;
+	int stats_step; /* see CImageStats */
+	cv::Rect stats_region;
+	int focus_step; /* see CFocus */
+	int focus_tiles_x;
+	int focus_tiles_y;
+	ColorType color_type;
+	int perspective;
+};
+
+
+class CCameraSettings {
+public:
+	CCameraSettings();
+	~CCameraSettings();
+
+	/*! @brief writer: the newest settings to change in place, EndUpdate publishes them
+	 * Writers wait for each other, never for the capture stage.
+	 */
+	CAMERA_SETTINGS& BeginUpdate();
+	/*! @brief publish the changes of BeginUpdate, returns the version (unchanged if nothing changed) */
+	uint32 EndUpdate();
+
+	/*! @brief copy of the newest published settings */
+	CAMERA_SETTINGS Latest() const;
+
+	/*! @brief capture stage: the newest snapshot if one was published since the last call, else NULL
+	 * The snapshot stays unchanged until the next call.
+	 */
+	const CAMERA_SETTINGS* Take() {
+		if(!(m_middle & SETTINGS_FRESH)) return(NULL);
+		/* our reads of the old snapshot are done before the writer may reuse its slot */
+		__sync_synchronize();
+		m_front=__sync_lock_test_and_set(&m_middle, m_front) & ~SETTINGS_FRESH;
+		return(&m_slots[m_front]);
+	}
+
+private:
+	CAMERA_SETTINGS m_slots[3];
+	int m_front; /* slot of the capture stage */
+	int m_back; /* slot the writer fills */
+	volatile int m_middle; /* slot in between, with SETTINGS_FRESH */
+
+	CAMERA_SETTINGS m_edit; /* changed by the writer */
+	CAMERA_SETTINGS m_latest; /* published last */
+	mutable pthread_mutex_t m_mutex; /* between writers */
+};
+
+
+#endif /* CAMERA_SETTINGS_H_ */
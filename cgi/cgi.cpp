@@ -1,13 +1,21 @@
-
 /*! @file cgi.cpp
  * @brief CGI used for the webinterface
+ *
+ * Relays a request from the web server to the application over the unix
+ * domain socket and the answer back. Started as a plain CGI, it handles one
+ * request and exits. Started by a FastCGI process manager (stdin is a
+ * listening socket), it stays alive and handles requests until it is killed.
  */
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdarg>
 using namespace std;
 
 
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -16,95 +24,559 @@ using namespace std;
 #include <errno.h>
 
 #include "cgi.h"
-#include <fstream>
 
 
-void copyAll(int outFd, int inFd, int* num_written) {
+/* bytes moved per splice()/read() call */
+#define RELAY_CHUNK (64*1024)
+/* FastCGI records carry at most 65535 bytes */
+#define FCGI_MAX_CONTENT 0xffff
+
+
+/* the log file is only opened if there is something to log */
+static FILE* g_log=NULL;
+
+static void LogError(const char* format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+
+	if(!g_log) g_log=fopen("msg.log", "a");
+	if(g_log) {
+		va_start(args, format);
+		vfprintf(g_log, format, args);
+		va_end(args);
+		fflush(g_log);
+	}
+}
+
+
+/* block until fd is ready for events, instead of polling with sleeps */
+static void WaitFd(int fd, short events) {
+	struct pollfd p;
+	p.fd=fd;
+	p.events=events;
+	while(poll(&p, 1, -1) == -1 && errno == EINTR) {}
+}
+
+static bool WriteAll(int fd, const void* data, size_t count) {
+	const char* p=(const char*)data;
+	while(count > 0) {
+		ssize_t ret=write(fd, p, count);
+		if(ret < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				WaitFd(fd, POLLOUT);
+				continue;
+			}
+			return(false);
+		}
+		p+=ret;
+		count-=ret;
+	}
+	return(true);
+}
+
+/* returns the number of bytes read, 0 on end of file, -1 on errors */
+static ssize_t ReadSome(int fd, void* data, size_t count) {
+	for(;;) {
+		ssize_t ret=read(fd, data, count);
+		if(ret >= 0) return(ret);
+		if(errno == EINTR) continue;
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			WaitFd(fd, POLLIN);
+			continue;
+		}
+		return(-1);
+	}
+}
+
+static bool ReadAll(int fd, void* data, size_t count) {
+	char* p=(char*)data;
+	while(count > 0) {
+		ssize_t ret=ReadSome(fd, p, count);
+		if(ret <= 0) return(false);
+		p+=ret;
+		count-=ret;
+	}
+	return(true);
+}
+
+
+/* pipe of Relay for splice(), -1 if not open */
+static int g_pipe_fd[2]={ -1, -1 };
+
+/* on errors data may be left in the pipe, it must not go out with the next response */
+static void ClosePipe() {
+	if(g_pipe_fd[0] != -1) {
+		close(g_pipe_fd[0]);
+		close(g_pipe_fd[1]);
+		g_pipe_fd[0]=g_pipe_fd[1]=-1;
+	}
+}
+
+
+/* writes the header of a chunk in front of the relayed data (FastCGI records) */
+typedef bool (*CHUNK_HEADER)(int out_fd, size_t length, void* context);
+
+/*! @brief copy everything from in_fd to out_fd until end of file
+ * The data is moved with splice() through a pipe, so it is never copied to
+ * user space. Descriptors splice() does not support fall back to read/write.
+ * If header is given, it is called before every chunk of at most max_chunk bytes.
+ */
+static bool Relay(int out_fd, int in_fd, size_t* num_written
+		, CHUNK_HEADER header=NULL, void* context=NULL, size_t max_chunk=RELAY_CHUNK) {
+
+	static bool bSplice=true;
+	static char buffer[RELAY_CHUNK];
 
 	if(num_written) *num_written=0;
-	
-	size_t num;
-	char buffer[1024];
-	
-	while((num=read(inFd, buffer, sizeof(buffer))) != 0) {
-		if(num > 0) {
-			if(num_written) *num_written+=num;
-			while(write(outFd, buffer, num) == -1 
-					&& (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)) {
-				usleep(1000);
+	if(max_chunk > RELAY_CHUNK) max_chunk=RELAY_CHUNK;
+
+#ifdef SPLICE_F_MOVE
+	if(bSplice && g_pipe_fd[0] == -1) {
+		if(pipe(g_pipe_fd) != 0) {
+			g_pipe_fd[0]=g_pipe_fd[1]=-1;
+			bSplice=false;
+		} else {
+#ifdef F_SETPIPE_SZ
+			fcntl(g_pipe_fd[1], F_SETPIPE_SZ, RELAY_CHUNK);
+#endif
+		}
+	}
+
+	while(bSplice) {
+		ssize_t num=splice(in_fd, NULL, g_pipe_fd[1], NULL, max_chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if(num == 0) return(true);
+		if(num < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN) {
+				WaitFd(in_fd, POLLIN);
+				continue;
+			}
+			if(errno == EINVAL || errno == ENOSYS) {
+				/* nothing was moved yet, use read/write from now on */
+				bSplice=false;
+				break;
 			}
+			LogError("Error reading: %s\n", strerror(errno));
+			return(false);
+		}
+
+		if(header && !header(out_fd, num, context)) {
+			ClosePipe();
+			return(false);
+		}
+		if(num_written) *num_written+=num;
+
+		while(num > 0) {
+			ssize_t moved=splice(g_pipe_fd[0], NULL, out_fd, NULL, num, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if(moved < 0) {
+				if(errno == EINTR) continue;
+				if(errno == EAGAIN) {
+					WaitFd(out_fd, POLLOUT);
+					continue;
+				}
+				if(errno != EINVAL) {
+					LogError("Error writing: %s\n", strerror(errno));
+					ClosePipe();
+					return(false);
+				}
+				/* the output does not take splice, drain the pipe by copying */
+				bSplice=false;
+				while(num > 0) {
+					ssize_t n=ReadSome(g_pipe_fd[0], buffer, num < RELAY_CHUNK ? num : RELAY_CHUNK);
+					if(n <= 0 || !WriteAll(out_fd, buffer, n)) {
+						ClosePipe();
+						return(false);
+					}
+					num-=n;
+				}
+				ClosePipe();
+				break;
+			}
+			num-=moved;
+		}
+	}
+#endif /* SPLICE_F_MOVE */
+
+	for(;;) {
+		ssize_t num=ReadSome(in_fd, buffer, max_chunk);
+		if(num == 0) return(true);
+		if(num < 0) {
+			LogError("Error reading: %s\n", strerror(errno));
+			return(false);
+		}
+		if((header && !header(out_fd, num, context)) || !WriteAll(out_fd, buffer, num)) {
+			LogError("Error writing: %s\n", strerror(errno));
+			return(false);
 		}
+		if(num_written) *num_written+=num;
 	}
 }
 
 
-int main(int argc, char ** argv) {
-	
-	/* process request */
-	int fd, err, num_written;
-	
-	std::ofstream o("msg.log", std::ios::out | std::ios::app);
-
-	
-	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+static int ConnectToApplication() {
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 	if(fd < 0) {
-		fprintf(stderr, "Error creating the socket: %s", strerror(errno));
-		o << "Error creating the socket" << std::endl;
-		o.close();
+		LogError("Error creating the socket: %s\n", strerror(errno));
 		return(-1);
 	}
-	
-	{
-		struct sockaddr_un servaddr;
-		servaddr.sun_family=AF_UNIX;
-		
-		strncpy(servaddr.sun_path, CGI_SOCKET_PATH, sizeof servaddr.sun_path);
-		
-		err = connect(fd, (struct sockaddr *) &servaddr, SUN_LEN(&servaddr));
-		if(err != 0) {
-			fprintf(stderr, "Error connecting to the server: %s", strerror(errno));
-			close(fd);
-			o << "Error connecting to the server" << std::endl;
-			o.close();
-			return(-1);
-		}
+
+	struct sockaddr_un servaddr;
+	servaddr.sun_family=AF_UNIX;
+
+	strncpy(servaddr.sun_path, CGI_SOCKET_PATH, sizeof servaddr.sun_path);
+
+	if(connect(fd, (struct sockaddr *) &servaddr, SUN_LEN(&servaddr)) != 0) {
+		LogError("Error connecting to the server: %s\n", strerror(errno));
+		close(fd);
+		return(-1);
 	}
-	
-	copyAll(fd, 0, &num_written); //copy POST data from stdin to socket
-	
+	return(fd);
+}
+
+/* a request without POST data: the GET arguments, one per line */
+static bool WriteArguments(int fd, int argc, const char* const* argv) {
+	for(int arg=0; arg<argc; ++arg) {
+		if(!WriteAll(fd, argv[arg], strlen(argv[arg])) || !WriteAll(fd, "\n", 1))
+			return(false);
+	}
+	return(true);
+}
+
+static const char g_empty_reply[]="Status: 200 OK\nContent-Type: text/plain\n\n";
+
+
+/* Plain CGI: one request from stdin/argv, answer on stdout */
+static int RunCgi(int argc, char ** argv) {
+
+	size_t num_written;
+
+	int fd=ConnectToApplication();
+	if(fd < 0) return(-1);
+
+	Relay(fd, 0, &num_written); //copy POST data from stdin to socket
+
 	if(num_written==0) { //no POST data -> try GET variables
-		for(int arg=1; arg<argc; ++arg) {
-			int ret = write(fd, argv[arg], strlen(argv[arg]));
-			ret = write(fd, "\n", 1);
-		}
+		WriteArguments(fd, argc-1, argv+1);
 	}
-	
-	
-	err = shutdown(fd, 1);
-	if(err != 0) {
-		fprintf(stderr, "Error closing the writing part of the connection: %s", strerror(errno));
-		o << "Error closing the writing part of the connection" << std::endl;
-		o.close();
+
+	if(shutdown(fd, SHUT_WR) != 0) {
+		LogError("Error closing the writing part of the connection: %s\n", strerror(errno));
 		close(fd);
 		return(-1);
 	}
-	
-	copyAll(1, fd, &num_written); //copy socket data to stdout
-	
+
+	Relay(1, fd, &num_written); //copy socket data to stdout
+
 	if(num_written==0) {
-		printf("Status: 200 OK\n");
-		printf("Content-Type: text/plain\n");
-		printf("\n");
-		fflush(stdout);
-	}
-	
-	err = close(fd);
-	if(err != 0) {
-		fprintf(stderr, "Error closing the writing part of the connection: %s", strerror(errno));
-		o << "Error closing the writing part of the connection" << std::endl;
-		o.close();
+		WriteAll(1, g_empty_reply, sizeof(g_empty_reply)-1);
+	}
+
+	if(close(fd) != 0) {
+		LogError("Error closing the connection: %s\n", strerror(errno));
 		return(-1);
 	}
+	return(0);
+}
+
+
+/* FastCGI (responder role only, one request per connection at a time) */
+#define FCGI_VERSION_1 1
+
+enum fcgiRecordTypes {
+	fcgiRecord_beginRequest=1,
+	fcgiRecord_abortRequest=2,
+	fcgiRecord_endRequest=3,
+	fcgiRecord_params=4,
+	fcgiRecord_stdin=5,
+	fcgiRecord_stdout=6,
+	fcgiRecord_stderr=7,
+	fcgiRecord_data=8,
+	fcgiRecord_getValues=9,
+	fcgiRecord_getValuesResult=10,
+	fcgiRecord_unknownType=11
+};
+
+#define FCGI_ROLE_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_CANT_MPX_CONN 1
+#define FCGI_OVERLOADED 2
+#define FCGI_UNKNOWN_ROLE 3
+
+struct FCGI_HEADER {
+	uint8_t version;
+	uint8_t type;
+	uint8_t request_id_b1;
+	uint8_t request_id_b0;
+	uint8_t content_length_b1;
+	uint8_t content_length_b0;
+	uint8_t padding_length;
+	uint8_t reserved;
+};
+
+struct FCGI_REQUEST {
+	int id; /* 0 if there is no active request */
+	bool bKeepConn;
+	int app_fd; /* connection to the application */
+	size_t stdin_bytes;
+	char* params; /* name-value pairs as received */
+	size_t params_length;
+	size_t params_size;
+};
+
+
+static bool FcgiWriteRecord(int fd, int type, int request_id, const void* content, size_t length) {
+	FCGI_HEADER h;
+	const uint8_t padding[8]={ 0 };
+	const int padding_length=(8 - length%8)%8;
+
+	h.version=FCGI_VERSION_1;
+	h.type=type;
+	h.request_id_b1=request_id >> 8;
+	h.request_id_b0=request_id & 0xff;
+	h.content_length_b1=length >> 8;
+	h.content_length_b0=length & 0xff;
+	h.padding_length=padding_length;
+	h.reserved=0;
+
+	return(WriteAll(fd, &h, sizeof(h)) && (length == 0 || WriteAll(fd, content, length))
+			&& WriteAll(fd, padding, padding_length));
+}
+
+/* Relay() callback: the header of an FCGI_STDOUT record. The relayed chunks
+ * are at most FCGI_MAX_CONTENT bytes, the padding is left out (it is optional). */
+static bool FcgiStdoutHeader(int out_fd, size_t length, void* context) {
+	const int request_id=*(const int*)context;
+	FCGI_HEADER h;
+
+	h.version=FCGI_VERSION_1;
+	h.type=fcgiRecord_stdout;
+	h.request_id_b1=request_id >> 8;
+	h.request_id_b0=request_id & 0xff;
+	h.content_length_b1=length >> 8;
+	h.content_length_b0=length & 0xff;
+	h.padding_length=0;
+	h.reserved=0;
+	return(WriteAll(out_fd, &h, sizeof(h)));
+}
+
+static void FcgiEndRequest(int fd, int request_id, int protocol_status) {
+	uint8_t body[8]={ 0 }; /* application status 0 */
+	body[4]=protocol_status;
+	FcgiWriteRecord(fd, fcgiRecord_endRequest, request_id, body, sizeof(body));
+}
+
+/* length of a name or value in a name-value pair: 1 or 4 bytes */
+static bool FcgiReadLength(const uint8_t*& p, const uint8_t* end, size_t& length) {
+	if(p >= end) return(false);
+	if(!(*p & 0x80)) {
+		length=*p++;
+		return(true);
+	}
+	if(end - p < 4) return(false);
+	length=((p[0] & 0x7f) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	p+=4;
+	return(true);
+}
+
+/* returns the value of the parameter 'name' (not null-terminated), NULL if not found */
+static const char* FcgiFindParam(const FCGI_REQUEST& req, const char* name, size_t& value_length) {
+	const uint8_t* p=(const uint8_t*)req.params;
+	const uint8_t* end=p + req.params_length;
+	const size_t name_length=strlen(name);
+
+	size_t nl, vl;
+	while(FcgiReadLength(p, end, nl) && FcgiReadLength(p, end, vl) && (size_t)(end - p) >= nl + vl) {
+		if(nl == name_length && memcmp(p, name, nl) == 0) {
+			value_length=vl;
+			return((const char*)p + nl);
+		}
+		p+=nl + vl;
+	}
+	return(NULL);
+}
+
+static int HexValue(char c) {
+	if(c >= '0' && c <= '9') return(c - '0');
+	if(c >= 'a' && c <= 'f') return(c - 'a' + 10);
+	if(c >= 'A' && c <= 'F') return(c - 'A' + 10);
+	return(-1);
+}
+
+/* as a web server does for a CGI: the query string split at '+' and decoded, one argument per line */
+static bool FcgiWriteQuery(int fd, const char* query, size_t length) {
+	static char line[RELAY_CHUNK];
+	size_t n=0;
+
+	for(size_t i=0; i<=length; ++i) {
+		if(i == length || query[i] == '+') {
+			line[n++]='\n';
+			if(!WriteAll(fd, line, n)) return(false);
+			n=0;
+		} else if(n < sizeof(line)-1) {
+			if(query[i] == '%' && i+2 < length && HexValue(query[i+1]) >= 0 && HexValue(query[i+2]) >= 0) {
+				line[n++]=(char)(HexValue(query[i+1])*16 + HexValue(query[i+2]));
+				i+=2;
+			} else {
+				line[n++]=query[i];
+			}
+		}
+	}
+	return(true);
+}
+
+/* all input of the request is there: pass it on and relay the answer */
+static void FcgiFinishRequest(int conn_fd, FCGI_REQUEST& req) {
+
+	size_t num_written=0;
+
+	if(req.app_fd >= 0) {
+		size_t query_length;
+		const char* query=FcgiFindParam(req, "QUERY_STRING", query_length);
+		if(req.stdin_bytes == 0 && query && query_length > 0) //no POST data -> GET variables
+			FcgiWriteQuery(req.app_fd, query, query_length);
+
+		if(shutdown(req.app_fd, SHUT_WR) != 0)
+			LogError("Error closing the writing part of the connection: %s\n", strerror(errno));
+		else
+			Relay(conn_fd, req.app_fd, &num_written, FcgiStdoutHeader, &req.id, FCGI_MAX_CONTENT);
+
+		close(req.app_fd);
+		req.app_fd=-1;
+	}
+
+	if(num_written == 0)
+		FcgiWriteRecord(conn_fd, fcgiRecord_stdout, req.id, g_empty_reply, sizeof(g_empty_reply)-1);
+	FcgiWriteRecord(conn_fd, fcgiRecord_stdout, req.id, NULL, 0);
+	FcgiEndRequest(conn_fd, req.id, FCGI_REQUEST_COMPLETE);
+
+	req.id=0;
+}
+
+static void FcgiGetValues(int conn_fd) {
+	/* no multiplexing, one request per connection */
+	static const char values[]={
+		14, 1, 'F', 'C', 'G', 'I', '_', 'M', 'A', 'X', '_', 'C', 'O', 'N', 'N', 'S', '1',
+		13, 1, 'F', 'C', 'G', 'I', '_', 'M', 'A', 'X', '_', 'R', 'E', 'Q', 'S', '1',
+		15, 1, 'F', 'C', 'G', 'I', '_', 'M', 'P', 'X', 'S', '_', 'C', 'O', 'N', 'N', 'S', '0'
+	};
+	FcgiWriteRecord(conn_fd, fcgiRecord_getValuesResult, 0, values, sizeof(values));
+}
+
+/* handle the records of one web server connection until it is closed */
+static void FcgiServeConnection(int conn_fd) {
+
+	static char content[FCGI_MAX_CONTENT + 255];
+	FCGI_REQUEST req;
+	memset(&req, 0, sizeof(req));
+	req.app_fd=-1;
+
+	for(;;) {
+		FCGI_HEADER h;
+		if(!ReadAll(conn_fd, &h, sizeof(h))) break;
+
+		const int request_id=(h.request_id_b1 << 8) | h.request_id_b0;
+		const size_t length=(h.content_length_b1 << 8) | h.content_length_b0;
+		if(!ReadAll(conn_fd, content, length + h.padding_length)) break;
+
+		if(h.type == fcgiRecord_getValues) {
+			FcgiGetValues(conn_fd);
+		} else if(h.type == fcgiRecord_beginRequest) {
+			const int role=length >= 3 ? (((uint8_t)content[0] << 8) | (uint8_t)content[1]) : 0;
+			if(req.id != 0) {
+				FcgiEndRequest(conn_fd, request_id, FCGI_CANT_MPX_CONN);
+			} else if(role != FCGI_ROLE_RESPONDER) {
+				FcgiEndRequest(conn_fd, request_id, FCGI_UNKNOWN_ROLE);
+			} else {
+				req.id=request_id;
+				req.bKeepConn=(content[2] & FCGI_KEEP_CONN) != 0;
+				req.stdin_bytes=0;
+				req.params_length=0;
+				req.app_fd=ConnectToApplication();
+			}
+		} else if(request_id == 0 || request_id != req.id) {
+			if(request_id == 0) { /* management record we do not know */
+				uint8_t body[8]={ h.type };
+				FcgiWriteRecord(conn_fd, fcgiRecord_unknownType, 0, body, sizeof(body));
+			}
+			/* records of requests that were rejected or ended are ignored */
+		} else if(h.type == fcgiRecord_params) {
+			if(req.params_length + length > req.params_size) {
+				const size_t size=2*(req.params_length + length);
+				char* params=(char*)realloc(req.params, size);
+				if(!params) {
+					LogError("Error allocating %u bytes for the parameters\n", (unsigned)size);
+					if(req.app_fd >= 0) close(req.app_fd);
+					req.app_fd=-1;
+					FcgiEndRequest(conn_fd, req.id, FCGI_OVERLOADED);
+					req.id=0;
+					if(!req.bKeepConn) break;
+					continue;
+				}
+				req.params=params;
+				req.params_size=size;
+			}
+			memcpy(req.params + req.params_length, content, length);
+			req.params_length+=length;
+		} else if(h.type == fcgiRecord_stdin) {
+			if(length == 0) {
+				FcgiFinishRequest(conn_fd, req);
+				if(!req.bKeepConn) break;
+			} else {
+				//copy POST data to the application
+				if(req.app_fd >= 0 && !WriteAll(req.app_fd, content, length)) {
+					close(req.app_fd);
+					req.app_fd=-1;
+				}
+				req.stdin_bytes+=length;
+			}
+		} else if(h.type == fcgiRecord_abortRequest) {
+			if(req.app_fd >= 0) close(req.app_fd);
+			req.app_fd=-1;
+			FcgiEndRequest(conn_fd, req.id, FCGI_REQUEST_COMPLETE);
+			req.id=0;
+			if(!req.bKeepConn) break;
+		}
+	}
+
+	if(req.app_fd >= 0) close(req.app_fd);
+	free(req.params);
+	close(conn_fd);
+}
+
+/* Persistent mode: the web server passes a listening socket as stdin */
+static int RunFastCgi() {
+	for(;;) {
+		int conn_fd=accept(0, NULL, NULL);
+		if(conn_fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			LogError("Error accepting a FastCGI connection: %s\n", strerror(errno));
+			return(-1);
+		}
+		FcgiServeConnection(conn_fd);
+	}
+}
+
+/* FastCGI applications are started with a listening socket as stdin */
+static bool IsFastCgi() {
+	struct sockaddr_un addr;
+	socklen_t length=sizeof(addr);
+	return(getpeername(0, (struct sockaddr*)&addr, &length) == -1 && errno == ENOTCONN);
+}
+
+
+int main(int argc, char ** argv) {
+
+	/* a client that went away must not kill the process */
+	signal(SIGPIPE, SIG_IGN);
+
+	int ret=IsFastCgi() ? RunFastCgi() : RunCgi(argc, argv);
 
-	o.close();
+	if(g_log) fclose(g_log);
+	return(ret);
 }
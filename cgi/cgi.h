@@ -11,8 +11,10 @@
 #ifndef CGI_H_
 #define CGI_H_
 
+#include <stdint.h>
+
 /*! @brief The path of the unix domain socket used for IPC between the application and its user interface. */
-#define CGI_SOCKET_PATH "/tmp/IPCSocket."APP_NAME".sock"
+#define CGI_SOCKET_PATH "/tmp/IPCSocket." APP_NAME ".sock"
 
 /* The parameter IDs to identify the different requests/responses. */
 enum ipcParamIds {
@@ -25,4 +27,252 @@ struct cgiBuffer {
 	char data[1024];
 };
 
+
+/* Binary protocol
+ * Besides the newline separated "key: value" text requests, the application
+ * accepts batched binary requests. A binary request starts with an
+ * IPC_BIN_HEADER followed by 'count' messages. Every message is an
+ * IPC_BIN_MSG followed by 'length' bytes of parameters, each parameter is an
+ * IPC_BIN_PARAM followed by 'length' bytes of value. Integer values are int32.
+ * The response (after the CGI header) has the same layout and contains one
+ * message per request message in the same order; 'status' tells whether
+ * the command succeeded. All values are in host byte order.
+ */
+#define IPC_BIN_MAGIC 0x31425657 /* 'WVB1', never the start of a text request */
+#define IPC_BIN_VERSION 1
+
+struct IPC_BIN_HEADER {
+	uint32_t magic;
+	uint16_t version; /* IPC_BIN_VERSION */
+	uint16_t count; /* number of messages */
+	uint32_t length; /* bytes following the header */
+};
+
+struct IPC_BIN_MSG {
+	uint8_t type; /* enum ipcMsgTypes */
+	uint8_t version; /* version of the message type; replies carry the version used */
+	int16_t status; /* enum ipcStatus, only used in replies */
+	uint32_t length; /* bytes of parameters following the message header */
+};
+
+struct IPC_BIN_PARAM {
+	uint16_t id; /* enum ipcParams */
+	uint16_t kind; /* enum ipcParamKinds */
+	uint32_t length; /* bytes of value following the parameter header */
+};
+
+/* Message types. The text protocol uses the names in the comments as header line. */
+enum ipcMsgTypes {
+	ipcMsg_setOptions = 1, /* SetOptions */
+	ipcMsg_getImageInfo, /* GetImageInfo */
+	ipcMsg_getImage, /* GetImage */
+	ipcMsg_getSystemInfo, /* GetSystemInfo */
+	ipcMsg_getStats, /* GetStats */
+	ipcMsg_dumpTrace, /* DumpTrace */
+	ipcMsg_getBurst, /* GetBurst */
+	ipcMsg_getHistogram /* GetHistogram */
+};
+
+enum ipcParamKinds {
+	ipcParamKind_int,
+	ipcParamKind_string,
+	ipcParamKind_blob
+};
+
+/* Parameter IDs. The text protocol uses the names in the comments as keys. */
+enum ipcParams {
+	ipcParam_width = 1, /* width */
+	ipcParam_height, /* height */
+	ipcParam_exposureTime, /* exposureTime [ms] */
+	ipcParam_colorType, /* colorType (none, gray, raw, debayered) */
+	ipcParam_perspective, /* perspective */
+	ipcParam_autoExposure, /* autoExposure (2: software control, see aeTarget) */
+	ipcParam_cameraModel, /* cameraModel */
+	ipcParam_imageSensor, /* imageSensor */
+	ipcParam_uClinuxVersion, /* uClinuxVersion */
+	ipcParam_image, /* image (blob, binary protocol only) */
+	ipcParam_clientId, /* clientId, identifies a viewer for the rate control */
+	ipcParam_targetBitrate, /* targetBitrate [kbit/s], 0: no target */
+	ipcParam_targetFps, /* targetFps, 0: no target */
+	ipcParam_jpegQuality, /* jpegQuality chosen for the client */
+	ipcParam_downscale, /* downscale: image is sent scaled by 1/2^downscale */
+	ipcParam_frameSkip, /* frameSkip: client should fetch every (frameSkip+1)-th frame */
+	ipcParam_frameInterval, /* frameInterval [ms] the client should wait between images */
+	ipcParam_clientBitrate, /* clientBitrate [kbit/s] the link to the client takes while an image is written */
+	ipcParam_clientFps, /* clientFps measured for the client */
+	ipcParam_clientLatency, /* clientLatency [ms] to write an image to the socket of the client */
+	ipcParam_delta, /* delta: GetImage returns a delta update, 1: changed tiles, 2: force a keyframe */
+	ipcParam_tileSize, /* tileSize of delta updates (16 or 32) */
+	ipcParam_format, /* format of GetImage (jpeg, raw, qoi, rle, bmp) */
+	/* GetStats: latencies of the stages (see IPC_STAT_LATENCY) */
+	ipcParam_latencyAcquire, /* latencyAcquire */
+	ipcParam_latencyCaptureSetup, /* latencyCaptureSetup */
+	ipcParam_latencyProcess, /* latencyProcess */
+	ipcParam_latencyProcess1, /* latencyProcess1 */
+	ipcParam_latencyProcess2, /* latencyProcess2 */
+	ipcParam_latencyProcess3, /* latencyProcess3 */
+	ipcParam_latencyEncode, /* latencyEncode */
+	ipcParam_latencyIpcWrite, /* latencyIpcWrite */
+	/* GetStats: counters since the start */
+	ipcParam_framesCaptured, /* framesCaptured */
+	ipcParam_framesDropped, /* framesDropped by the pipeline queues */
+	ipcParam_framesServed, /* framesServed: images sent */
+	ipcParam_kbytesSent, /* kbytesSent [kB] */
+	ipcParam_requests, /* requests answered */
+	ipcParam_deadlineMisses, /* deadlineMisses of the main loop */
+	ipcParam_trace, /* trace: SetOptions 1 records spans, 0 stops; DumpTrace replies with the JSON */
+	ipcParam_seconds, /* seconds: time span of DumpTrace */
+	ipcParam_latencyFrameInterval, /* latencyFrameInterval: GetStats, time between captured frames */
+	ipcParam_heapAllocations, /* heapAllocations: GetStats, heap allocations since the start */
+	ipcParam_kernelIsa, /* kernelIsa: GetStats, instruction set of the image kernels (scalar, sse4.1, avx2, neon) */
+	ipcParam_latencyTrigger, /* latencyTrigger: GetStats, external trigger edge to the read of its picture */
+	ipcParam_triggerEdges, /* triggerEdges: GetStats, edges of the external trigger input */
+	ipcParam_triggersMissed, /* triggersMissed: GetStats, trigger edges without picture */
+	ipcParam_camera, /* camera: index of the camera a request addresses, default 0 */
+	ipcParam_cameraCount, /* cameraCount: GetImageInfo, cameras of the application */
+	ipcParam_syncSkew, /* syncSkew [us]: GetImageInfo, timestamp difference of the frames served together */
+	ipcParam_seq, /* seq: GetImage/GetBurst, frame of the history by sequence number */
+	ipcParam_age, /* age [ms]: GetImage/GetBurst, frame of the history taken this long before the newest */
+	ipcParam_count, /* count: GetBurst, frames at most */
+	ipcParam_burst, /* burst (blob, see IPC_BURST_HEADER) */
+	ipcParam_historyFrames, /* historyFrames: GetImageInfo, frames in the history */
+	ipcParam_historyFirstSeq, /* historyFirstSeq: GetImageInfo, oldest frame in the history */
+	ipcParam_historyLastSeq, /* historyLastSeq: GetImageInfo, newest frame in the history */
+	ipcParam_latencyRecordWrite, /* latencyRecordWrite: GetStats, recorder write of a block */
+	ipcParam_framesRecorded, /* framesRecorded: GetStats */
+	ipcParam_recordDropped, /* recordDropped: GetStats, frames the recorder had no room for */
+	ipcParam_kbytesRecorded, /* kbytesRecorded: GetStats */
+	ipcParam_latencyImageStats, /* latencyImageStats: GetStats, histogram and exposure control */
+	ipcParam_statsStep, /* statsStep: spacing of the statistics samples, 0: off */
+	ipcParam_aeTarget, /* aeTarget: level [0, 255] the software exposure control drives the percentile to */
+	ipcParam_aePercentile, /* aePercentile [%] */
+	ipcParam_aeRegionX, /* aeRegionX, aeRegionY, aeRegionWidth, aeRegionHeight: region of the statistics, width 0: all */
+	ipcParam_aeRegionY,
+	ipcParam_aeRegionWidth,
+	ipcParam_aeRegionHeight,
+	ipcParam_statsMean, /* statsMean: GetImageInfo, mean value of the samples */
+	ipcParam_statsLevel, /* statsLevel: GetImageInfo, value of the aePercentile */
+	ipcParam_statsClippedLow, /* statsClippedLow [permille]: GetImageInfo, samples at the black level */
+	ipcParam_statsClippedHigh, /* statsClippedHigh [permille]: GetImageInfo, saturated samples */
+	ipcParam_histogram, /* histogram (blob): GetHistogram, 256 uint32_t counts in host byte order */
+	ipcParam_latencyFocus, /* latencyFocus: GetStats, focus score */
+	ipcParam_focusStep, /* focusStep: row spacing of the focus score, 0: off */
+	ipcParam_focusTilesX, /* focusTilesX, focusTilesY: grid of the tile scores (1..8) */
+	ipcParam_focusTilesY,
+	ipcParam_focusScore, /* focusScore: GetImageInfo, variance of the Laplacian, higher is sharper */
+	ipcParam_focusTiles, /* focusTiles: GetImageInfo, comma separated scores of the tiles row by row */
+	ipcParam_settingsVersion, /* settingsVersion: GetImageInfo, version of the newest camera settings */
+	ipcParam_frameSettingsVersion, /* frameSettingsVersion: GetImageInfo, version of the settings the frame was taken with */
+	ipcParam_roiX, /* roiX, roiY, roiWidth, roiHeight: GetImage, region of the image to send, width 0: all */
+	ipcParam_roiY,
+	ipcParam_roiWidth,
+	ipcParam_roiHeight,
+	ipcParam_outWidth, /* outWidth, outHeight: GetImage, size the region is scaled to, 0: from the other or the region */
+	ipcParam_outHeight,
+	ipcParam_imageCacheHits, /* imageCacheHits: GetStats, images sent as encoded for another request */
+	ipcParam_statsSharedThreads, /* statsSharedThreads: GetStats, threads without their own statistics slot (see STATS_MAX_THREADS) */
+	ipcParam_deltaBase /* deltaBase: frame_seq of the last delta update the client composed, a keyframe follows if the server's reference differs */
+};
+
+enum ipcStatus {
+	ipcStatus_ok = 0,
+	ipcStatus_unknownType = -1,
+	ipcStatus_badVersion = -2,
+	ipcStatus_badFormat = -3,
+	ipcStatus_failed = -4
+};
+
+
+/* Delta updates
+ * GetImage with "delta" (requires a clientId) returns an IPC_DELTA_HEADER followed by
+ * 'count' tiles. Each tile is an IPC_DELTA_TILE followed by 'length' bytes of JPEG
+ * to be drawn at (x, y) over the image the client composed so far. A keyframe
+ * contains one tile covering the whole image. Values are in host byte order.
+ */
+#define IPC_DELTA_MAGIC 0x31445657 /* 'WVD1' */
+
+struct IPC_DELTA_HEADER {
+	uint32_t magic;
+	uint16_t width; /* size of the whole image */
+	uint16_t height;
+	uint16_t tile_size;
+	uint16_t count; /* number of tiles */
+	uint8_t keyframe;
+	uint8_t reserved[3];
+	uint32_t frame_seq;
+};
+
+struct IPC_DELTA_TILE {
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	uint32_t length; /* bytes of JPEG data following */
+};
+
+
+/* Lossless image formats of GetImage
+ * raw: IPC_RAW_HEADER followed by 'height' rows of 'stride' bytes. The image is sent
+ *      as processed, without conversion to 8 bit.
+ * rle: IPC_RAW_HEADER with IPC_RLE_MAGIC (8 bit images only) followed by runs of equal
+ *      bytes: the byte value and the run length as LEB128 varint. Rows follow each
+ *      other without a break, stride is width*channels.
+ * qoi: standard QOI image (https://qoiformat.org), gray images are sent as RGB.
+ */
+#define IPC_RAW_MAGIC 0x31525657 /* 'WVR1' */
+#define IPC_RLE_MAGIC 0x314c5657 /* 'WVL1' */
+
+struct IPC_RAW_HEADER {
+	uint32_t magic;
+	uint16_t width;
+	uint16_t height;
+	uint16_t depth; /* OpenCV depth: 0=8U, 1=8S, 2=16U, 3=16S, 4=32S, 5=32F, 6=64F */
+	uint16_t channels;
+	uint32_t stride; /* bytes per row */
+	uint32_t frame_seq;
+};
+
+
+/* Frame history
+ * With a history configured (-H), the camera images of the last seconds are
+ * kept encoded. GetImage with "seq" or "age" returns a frame of the history as
+ * stored (jpeg, raw or qoi, see above) instead of the current one. GetBurst
+ * returns the frames from "seq" resp. "age" on (default: the oldest), at most
+ * "count", as IPC_BURST_HEADER followed by 'count' frames; each frame is an
+ * IPC_BURST_FRAME followed by 'length' bytes. Values are in host byte order.
+ */
+#define IPC_BURST_MAGIC 0x31535657 /* 'WVS1' */
+
+struct IPC_BURST_HEADER {
+	uint32_t magic;
+	uint32_t count;
+};
+
+struct IPC_BURST_FRAME {
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time the frame was read */
+	uint32_t frame_seq;
+	uint32_t length; /* bytes of image data following */
+	uint8_t format; /* format of GetImage: 0=jpeg, 1=raw, 2=qoi */
+	uint8_t reserved[7];
+};
+
+
+/* Statistics
+ * GetStats returns a latency summary per stage, in the text protocol as
+ * "count=<n> p50=<us> p90=<us> p99=<us> max=<us>", in the binary protocol
+ * as a blob holding an IPC_STAT_LATENCY. Percentiles have a resolution of 12.5%.
+ */
+struct IPC_STAT_LATENCY {
+	uint32_t count;
+	uint32_t p50_us;
+	uint32_t p90_us;
+	uint32_t p99_us;
+	uint32_t max_us;
+};
+
+/* Trace
+ * DumpTrace returns the spans of the last 'seconds' (default 5) recorded since
+ * SetOptions trace:1 as Chrome trace JSON (load in chrome://tracing or ui.perfetto.dev).
+ */
+
 #endif // #ifndef CGI_H_
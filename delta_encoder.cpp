@@ -0,0 +1,176 @@
+/*! @file delta_encoder.cpp
+ * @brief Encodes only the tiles of an image that changed since the last image
+ *  sent to a client
+ */
+
+#include "delta_encoder.h"
+#include "cgi/cgi.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+CDeltaEncoder::CDeltaEncoder() : m_use_count(0) {
+	for(int i=0; i<DELTA_MAX_CLIENTS; ++i) {
+		m_clients[i].id=-1;
+		m_clients[i].frames_since_key=0;
+		m_clients[i].last_frame_seq=0;
+		m_clients[i].last_use=0;
+	}
+	m_params.push_back(CV_IMWRITE_JPEG_QUALITY);
+	m_params.push_back(0);
+}
+
+CDeltaEncoder::DELTA_CLIENT* CDeltaEncoder::GetClient(int client_id) {
+	
+	DELTA_CLIENT* client=&m_clients[0];
+	for(int i=0; i<DELTA_MAX_CLIENTS; ++i) {
+		if(m_clients[i].id == client_id) {
+			client=&m_clients[i];
+			break;
+		}
+		/* otherwise take the least recently used slot */
+		if(m_clients[i].last_use < client->last_use) client=&m_clients[i];
+	}
+	if(client->id != client_id) {
+		client->id=client_id;
+		client->ref.release();
+		client->frames_since_key=0;
+	}
+	client->last_use=++m_use_count;
+	return(client);
+}
+
+/* sum of absolute differences of two rows of n bytes */
+static inline uint32 RowSad(const uint8* a, const uint8* b, int n) {
+	uint32 sum=0;
+	int x=0;
+#if defined(__SSE2__)
+	__m128i acc=_mm_setzero_si128();
+	for(; x+16<=n; x+=16) {
+		acc=_mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a+x))
+				, _mm_loadu_si128((const __m128i*)(b+x))));
+	}
+	sum=_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+	uint16x8_t acc=vdupq_n_u16(0);
+	for(; x+16<=n; x+=16) {
+		acc=vpadalq_u8(acc, vabdq_u8(vld1q_u8(a+x), vld1q_u8(b+x)));
+	}
+	const uint64x2_t acc64=vpaddlq_u32(vpaddlq_u16(acc));
+	sum=(uint32)(vgetq_lane_u64(acc64, 0) + vgetq_lane_u64(acc64, 1));
+#endif
+	for(; x<n; ++x)
+		sum+=a[x] > b[x] ? a[x]-b[x] : b[x]-a[x];
+	return(sum);
+}
+
+uint32 CDeltaEncoder::Sad(const cv::Mat& a, const cv::Mat& b) {
+	const int n=a.cols*a.elemSize();
+	uint32 sum=0;
+	for(int y=0; y<a.rows; ++y)
+		sum+=RowSad(a.ptr(y), b.ptr(y), n);
+	return(sum);
+}
+
+void CDeltaEncoder::AppendTile(std::vector<uint8>& out, const cv::Mat& img, const cv::Rect& r, int quality) {
+	
+	m_params[1]=quality;
+	cv::imencode(".jpg", img(r), m_jpeg, m_params);
+	
+	IPC_DELTA_TILE tile;
+	tile.x=r.x;
+	tile.y=r.y;
+	tile.width=r.width;
+	tile.height=r.height;
+	tile.length=m_jpeg.size();
+	
+	const size_t pos=out.size();
+	out.resize(pos + sizeof(tile) + m_jpeg.size());
+	memcpy(&out[pos], &tile, sizeof(tile));
+	memcpy(&out[pos + sizeof(tile)], &m_jpeg[0], m_jpeg.size());
+}
+
+OSC_ERR CDeltaEncoder::Encode(int client_id, const cv::Mat& img, uint32 frame_seq, int tile_size
+		, int quality, bool bKeyframe, int32 base_seq, std::vector<uint8>& out) {
+	
+	if(img.empty() || img.depth() != CV_8U) return(EINVALID_PARAMETER);
+	if(tile_size != 16 && tile_size != 32) tile_size=DELTA_DEFAULT_TILE_SIZE;
+	
+	DELTA_CLIENT* client=GetClient(client_id);
+	
+	bKeyframe=bKeyframe || client->ref.empty() || client->ref.size() != img.size()
+			|| client->ref.type() != img.type() || client->frames_since_key >= DELTA_KEYFRAME_INTERVAL
+			|| (base_seq >= 0 && (uint32)base_seq != client->last_frame_seq);
+	
+	out.resize(sizeof(IPC_DELTA_HEADER));
+	uint16 count=0;
+	
+	if(!bKeyframe && frame_seq != client->last_frame_seq) {
+		const int tiles_x=(img.cols + tile_size-1)/tile_size;
+		const int tiles_y=(img.rows + tile_size-1)/tile_size;
+		const uint32 threshold_per_pixel=DELTA_SAD_THRESHOLD*img.channels();
+		
+		m_changed.assign(tiles_x*tiles_y, 0);
+		int changed_count=0;
+		for(int ty=0; ty<tiles_y; ++ty) {
+			for(int tx=0; tx<tiles_x; ++tx) {
+				const cv::Rect r(tx*tile_size, ty*tile_size, std::min(tile_size, img.cols - tx*tile_size)
+						, std::min(tile_size, img.rows - ty*tile_size));
+				if(Sad(img(r), client->ref(r)) > threshold_per_pixel*r.area()) {
+					m_changed[ty*tiles_x + tx]=1;
+					++changed_count;
+				}
+			}
+		}
+		
+		if(changed_count*100 > DELTA_MAX_CHANGED_PERCENT*tiles_x*tiles_y) {
+			bKeyframe=true;
+		} else {
+			/* consecutive changed tiles of a row are sent as one patch to save JPEG headers */
+			for(int ty=0; ty<tiles_y; ++ty) {
+				for(int tx=0; tx<tiles_x; ) {
+					if(!m_changed[ty*tiles_x + tx]) {
+						++tx;
+						continue;
+					}
+					int end=tx;
+					while(end < tiles_x && m_changed[ty*tiles_x + end]) ++end;
+					
+					const int x=tx*tile_size, y=ty*tile_size;
+					const cv::Rect r(x, y, std::min(end*tile_size, img.cols) - x, std::min(tile_size, img.rows - y));
+					AppendTile(out, img, r, quality);
+					cv::Mat ref_tile=client->ref(r);
+					img(r).copyTo(ref_tile);
+					++count;
+					tx=end;
+				}
+			}
+			++client->frames_since_key;
+		}
+	}
+	
+	if(bKeyframe) {
+		AppendTile(out, img, cv::Rect(0, 0, img.cols, img.rows), quality);
+		img.copyTo(client->ref);
+		client->frames_since_key=0;
+		count=1;
+	}
+	client->last_frame_seq=frame_seq;
+	
+	IPC_DELTA_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.magic=IPC_DELTA_MAGIC;
+	header.width=img.cols;
+	header.height=img.rows;
+	header.tile_size=tile_size;
+	header.count=count;
+	header.keyframe=bKeyframe ? 1 : 0;
+	header.frame_seq=frame_seq;
+	memcpy(&out[0], &header, sizeof(header));
+	
+	return(SUCCESS);
+}
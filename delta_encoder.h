@@ -0,0 +1,64 @@
+/*! @file delta_encoder.h
+ * @brief Encodes only the tiles of an image that changed since the last image
+ *  sent to a client (see IPC_DELTA_HEADER in cgi/cgi.h for the format)
+ */
+
+#ifndef DELTA_ENCODER_H_
+#define DELTA_ENCODER_H_
+
+#include <vector>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+/* number of clients a reference image is kept for */
+#define DELTA_MAX_CLIENTS 8
+/* a full image is sent at least every DELTA_KEYFRAME_INTERVAL frames */
+#define DELTA_KEYFRAME_INTERVAL 50
+#define DELTA_DEFAULT_TILE_SIZE 32
+/* mean absolute difference per byte above which a tile counts as changed */
+#define DELTA_SAD_THRESHOLD 3
+/* if more than this percentage of the tiles changed, a keyframe is cheaper */
+#define DELTA_MAX_CHANGED_PERCENT 60
+
+
+class CDeltaEncoder {
+public:
+	CDeltaEncoder();
+
+	/*! @brief Encode img for the client into out
+	 * tile_size: 16 or 32; bKeyframe forces a full image
+	 * base_seq: frame_seq of the last update the client composed, -1 if unknown.
+	 *  If it is not the image the reference was last updated with, the client
+	 *  missed an update and a keyframe is sent.
+	 */
+	OSC_ERR Encode(int client_id, const cv::Mat& img, uint32 frame_seq, int tile_size
+			, int quality, bool bKeyframe, int32 base_seq, std::vector<uint8>& out);
+
+	/*! @brief sum of absolute differences of the bytes of two equally sized image regions */
+	static uint32 Sad(const cv::Mat& a, const cv::Mat& b);
+
+private:
+	struct DELTA_CLIENT {
+		int id; /* -1 if unused */
+		cv::Mat ref; /* image as last sent to the client */
+		uint32 frames_since_key;
+		uint32 last_frame_seq;
+		uint32 last_use;
+	};
+
+	DELTA_CLIENT* GetClient(int client_id);
+	void AppendTile(std::vector<uint8>& out, const cv::Mat& img, const cv::Rect& r, int quality);
+
+	DELTA_CLIENT m_clients[DELTA_MAX_CLIENTS];
+	uint32 m_use_count;
+
+	/* reused buffers */
+	std::vector<uint8> m_changed;
+	std::vector<uchar> m_jpeg;
+	std::vector<int> m_params;
+};
+
+
+#endif /* DELTA_ENCODER_H_ */
@@ -0,0 +1,59 @@
+/*! @file focus.cpp
+ * @brief Focus score of the camera image for adjusting a lens
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "focus.h"
+#include "kernels.h"
+
+
+CFocus::CFocus() : m_step(0), m_tiles_x(FOCUS_DEFAULT_TILES_X), m_tiles_y(FOCUS_DEFAULT_TILES_Y), m_phase(0) {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void CFocus::setTiles(int tiles_x, int tiles_y) {
+	m_tiles_x=std::min(std::max(tiles_x, 1), FOCUS_MAX_TILES_X);
+	m_tiles_y=std::min(std::max(tiles_y, 1), FOCUS_MAX_TILES_Y);
+}
+
+uint32 CFocus::Variance(int64_t sum, uint64_t sum_sq, uint32 count) {
+	if(count == 0) return(0);
+	const double mean=(double)sum/count;
+	const double variance=(double)sum_sq/count - mean*mean;
+	return(variance > 0 ? (uint32)(variance + 0.5) : 0);
+}
+
+void CFocus::Compute(const cv::Mat& img, uint32 frame_seq) {
+	if(m_step <= 0 || img.empty()) {
+		m_stats.count=0;
+		return;
+	}
+	m_phase=(m_phase + 1)%m_step;
+
+	int64_t total_sum=0;
+	uint64_t total_sum_sq=0;
+	uint32 total_count=0;
+	for(int ty=0; ty<m_tiles_y; ++ty) {
+		const int y0=img.rows*ty/m_tiles_y, y1=img.rows*(ty + 1)/m_tiles_y;
+		/* the first row of the image wide grid within the tile */
+		const int first=y0 + ((m_phase - y0)%m_step + m_step)%m_step;
+		for(int tx=0; tx<m_tiles_x; ++tx) {
+			const int x0=img.cols*tx/m_tiles_x, x1=img.cols*(tx + 1)/m_tiles_x;
+			int64_t sum;
+			uint64_t sum_sq;
+			const uint32 count=CKernels::Laplacian(img, cv::Rect(x0, first, x1 - x0, y1 - first), m_step, &sum, &sum_sq);
+			m_stats.tile[ty*m_tiles_x + tx]=Variance(sum, sum_sq, count);
+			total_sum+=sum;
+			total_sum_sq+=sum_sq;
+			total_count+=count;
+		}
+	}
+
+	m_stats.count=total_count;
+	m_stats.score=Variance(total_sum, total_sum_sq, total_count);
+	m_stats.tiles_x=m_tiles_x;
+	m_stats.tiles_y=m_tiles_y;
+	m_stats.frame_seq=frame_seq;
+}
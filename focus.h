@@ -0,0 +1,73 @@
+/*! @file focus.h
+ * @brief Focus score of the camera image for adjusting a lens
+ *  The score is the variance of the Laplacian: it grows with the contrast
+ *  of fine detail and drops as soon as the picture blurs. It is computed
+ *  in the capture stage on every step-th row (CKernels::Laplacian), for the
+ *  whole image and for each tile of a grid, so a lens can be focused on a
+ *  part of the scene or tilted until the corners agree. Like the image
+ *  statistics, the rows move down by one every frame.
+ */
+
+#ifndef FOCUS_H_
+#define FOCUS_H_
+
+#include <stdint.h>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+#define FOCUS_MAX_TILES_X 8
+#define FOCUS_MAX_TILES_Y 8
+#define FOCUS_MAX_TILES (FOCUS_MAX_TILES_X*FOCUS_MAX_TILES_Y)
+#define FOCUS_DEFAULT_TILES_X 4
+#define FOCUS_DEFAULT_TILES_Y 3
+/* row spacing when the score is turned on without one */
+#define FOCUS_DEFAULT_STEP 2
+
+
+struct FOCUS_STATS {
+	uint32 count; /* pixels, 0: no score */
+	uint32 score; /* variance of the Laplacian of the whole image */
+	uint32 tiles_x;
+	uint32 tiles_y;
+	uint32 tile[FOCUS_MAX_TILES]; /* score of each tile, row by row */
+	uint32 frame_seq;
+};
+
+
+class CFocus {
+public:
+	CFocus();
+
+	/*! @brief step: spacing of the rows, 0 turns the score off (default) */
+	void setStep(int step) {
+		m_step=step;
+		if(step <= 0) m_stats.count=0;
+	}
+	int getStep() const { return(m_step); }
+	bool IsEnabled() const { return(m_step > 0); }
+
+	/*! @brief grid of tiles, each limited to [1, FOCUS_MAX_TILES_X/Y] */
+	void setTiles(int tiles_x, int tiles_y);
+	int getTilesX() const { return(m_tiles_x); }
+	int getTilesY() const { return(m_tiles_y); }
+
+	/*! @brief score of an 8 bit gray or RGB image */
+	void Compute(const cv::Mat& img, uint32 frame_seq);
+
+	/*! @brief score of the last Compute */
+	const FOCUS_STATS& get() const { return(m_stats); }
+
+private:
+	static uint32 Variance(int64_t sum, uint64_t sum_sq, uint32 count);
+
+	int m_step;
+	int m_tiles_x;
+	int m_tiles_y;
+	int m_phase; /* row offset of the samples */
+	FOCUS_STATS m_stats;
+};
+
+
+#endif /* FOCUS_H_ */
@@ -0,0 +1,36 @@
+/*! @file frame.h
+ * @brief A camera frame together with its processing results
+ *  Frames are passed between the stages of the main loop; at any time a
+ *  frame belongs to exactly one stage or queue.
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stdint.h>
+
+#include "opencv.hpp"
+#include "includes.h"
+#include "image_stats.h"
+#include "focus.h"
+#include "camera_settings.h"
+
+
+/* number of processing images (see CImageProcessor::GetProcImage) */
+#define FRAME_PROC_COUNT 3
+
+
+struct FRAME {
+	cv::Mat img; /* camera image */
+	cv::Mat proc[FRAME_PROC_COUNT]; /* processing images, empty if not produced */
+	uint32 seq; /* camera frame sequence number */
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time the frame was read */
+	uint32 trigger_seq; /* edge of the external trigger that took the frame, 0: software trigger */
+	IMAGE_STATS stats; /* of the camera image, count 0 if there are none */
+	FOCUS_STATS focus; /* count 0 if there is none */
+	CAMERA_SETTINGS settings; /* the camera settings the frame was read with */
+	uint32 exposure_time; /* [us] the frame was read with, also under software exposure control */
+};
+
+
+#endif /* FRAME_H_ */
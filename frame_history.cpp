@@ -0,0 +1,103 @@
+/*! @file frame_history.cpp
+ * @brief In-memory history of encoded frames (pre-trigger buffer)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_history.h"
+
+
+CFrameHistory::CFrameHistory() : m_data(NULL), m_budget(0), m_max_age_us(0), m_write_pos(0)
+	, m_first(0), m_count(0) {
+}
+
+CFrameHistory::~CFrameHistory() {
+	free(m_data);
+}
+
+OSC_ERR CFrameHistory::Init(uint32 seconds, size_t budget) {
+	if(m_data) return(EALREADY_INITIALIZED);
+	if(seconds == 0 || budget == 0) return(EINVALID_PARAMETER);
+
+	m_data=(uint8*)malloc(budget);
+	if(!m_data) return(EOUT_OF_MEMORY);
+	/* touch the pages now, not while frames are stored */
+	memset(m_data, 0, budget);
+
+	m_budget=budget;
+	m_max_age_us=(uint64_t)seconds*1000000;
+	m_write_pos=0;
+	m_first=0;
+	m_count=0;
+	return(SUCCESS);
+}
+
+void CFrameHistory::DropOldest() {
+	m_first=(m_first + 1)%HISTORY_MAX_FRAMES;
+	--m_count;
+}
+
+OSC_ERR CFrameHistory::Add(uint32 seq, uint64_t timestamp_us, uint8 format, const uint8* data, size_t size) {
+	if(!m_data) return(EGENERAL);
+	if(size == 0 || size > m_budget) return(EINVALID_PARAMETER);
+
+	while(m_count > 0 && getFrame(0).timestamp_us + m_max_age_us < timestamp_us)
+		DropOldest();
+	if(m_count == HISTORY_MAX_FRAMES)
+		DropOldest();
+
+	size_t pos=m_write_pos;
+	if(pos + size > m_budget) {
+		/* the frames at the end of the ring are the oldest ones, the end stays unused */
+		while(m_count > 0 && getFrame(0).offset >= pos)
+			DropOldest();
+		pos=0;
+	}
+	/* the oldest frames are the ones ahead of the write position */
+	while(m_count > 0 && getFrame(0).offset < pos + size && getFrame(0).offset + getFrame(0).size > pos)
+		DropOldest();
+
+	memcpy(m_data + pos, data, size);
+	HISTORY_FRAME& frame=m_frames[(m_first + m_count)%HISTORY_MAX_FRAMES];
+	frame.seq=seq;
+	frame.timestamp_us=timestamp_us;
+	frame.format=format;
+	frame.offset=pos;
+	frame.size=(uint32)size;
+	++m_count;
+	m_write_pos=pos + size;
+	return(SUCCESS);
+}
+
+int CFrameHistory::FindSeq(uint32 seq, bool bExact) const {
+	/* sequence numbers grow with the index: first frame with a sequence number >= seq */
+	int low=0, high=m_count;
+	while(low < high) {
+		const int mid=(low + high)/2;
+		if(getFrame(mid).seq < seq) low=mid + 1;
+		else high=mid;
+	}
+	if(low == m_count || (bExact && getFrame(low).seq != seq)) return(-1);
+	return(low);
+}
+
+int CFrameHistory::FindAge(uint32 age_ms) const {
+	if(m_count == 0) return(-1);
+	const uint64_t newest=getFrame(m_count-1).timestamp_us;
+	if((uint64_t)age_ms*1000 > newest) return(-1);
+	const uint64_t time=newest - (uint64_t)age_ms*1000;
+
+	/* last frame with timestamp <= time */
+	int low=0, high=m_count-1, found=-1;
+	while(low <= high) {
+		const int mid=(low + high)/2;
+		if(getFrame(mid).timestamp_us <= time) {
+			found=mid;
+			low=mid + 1;
+		} else {
+			high=mid - 1;
+		}
+	}
+	return(found);
+}
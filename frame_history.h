@@ -0,0 +1,79 @@
+/*! @file frame_history.h
+ * @brief In-memory history of encoded frames (pre-trigger buffer)
+ *  The frames of the last seconds are kept encoded in a ring of bytes that
+ *  is allocated once with the memory budget. A new frame overwrites the
+ *  oldest ones when the ring is full; frames older than the configured
+ *  duration are dropped. Frames are found by sequence number or age and
+ *  returned as stored, so they are never encoded twice.
+ *  Not thread safe: the serve stage adds frames and answers the requests.
+ */
+
+#ifndef FRAME_HISTORY_H_
+#define FRAME_HISTORY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "includes.h"
+
+
+/* frames the index holds (60 s at 60 fps) */
+#define HISTORY_MAX_FRAMES 3600
+
+
+struct HISTORY_FRAME {
+	uint32 seq; /* camera frame sequence number */
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time the frame was read */
+	uint8 format; /* enum ImageFormat of the data */
+	size_t offset; /* of the data in the ring */
+	uint32 size;
+};
+
+
+class CFrameHistory {
+public:
+	CFrameHistory();
+	~CFrameHistory();
+
+	/*! @brief allocate the ring
+	 * seconds: frames older than this (relative to the newest) are dropped
+	 * budget: bytes of encoded frames kept at most
+	 */
+	OSC_ERR Init(uint32 seconds, size_t budget);
+
+	bool IsInitialized() const { return(m_data != NULL); }
+
+	/*! @brief store an encoded frame, older frames make room for it
+	 * fails if the frame is larger than the budget
+	 */
+	OSC_ERR Add(uint32 seq, uint64_t timestamp_us, uint8 format, const uint8* data, size_t size);
+
+	/*! @brief frames in the history, index 0 is the oldest */
+	int getCount() const { return(m_count); }
+	const HISTORY_FRAME& getFrame(int index) const {
+		return(m_frames[(m_first + index)%HISTORY_MAX_FRAMES]);
+	}
+	const uint8* getData(const HISTORY_FRAME& frame) const { return(m_data + frame.offset); }
+
+	/*! @brief index of the frame with sequence number seq, -1 if it is not (or no longer) stored
+	 * bExact=false: the first frame with a sequence number >= seq
+	 */
+	int FindSeq(uint32 seq, bool bExact=true) const;
+	/*! @brief index of the newest frame taken at least age_ms before the newest one, -1 if there is none */
+	int FindAge(uint32 age_ms) const;
+
+private:
+	void DropOldest();
+
+	uint8* m_data;
+	size_t m_budget;
+	uint64_t m_max_age_us;
+	size_t m_write_pos; /* behind the newest frame */
+
+	HISTORY_FRAME m_frames[HISTORY_MAX_FRAMES]; /* ring in the order of addition */
+	int m_first;
+	int m_count;
+};
+
+
+#endif /* FRAME_HISTORY_H_ */
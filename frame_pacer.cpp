@@ -0,0 +1,59 @@
+/*! @file frame_pacer.cpp
+ * @brief Deadline based pacing of the main loop
+ */
+
+#include "frame_pacer.h"
+#include "timing.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <sched.h>
+
+
+CFramePacer::CFramePacer() : m_target_fps(0), m_bLowLatency(false), m_period_ns(0), m_deadline_ns(0)
+	, m_frame_count(0), m_miss_count(0), m_measure_start_ns(0), m_measure_frames(0), m_measured_fps(0) {
+}
+
+void CFramePacer::Init(double fps, bool bLowLatency) {
+	m_target_fps=fps > 0 ? fps : 0;
+	m_bLowLatency=bLowLatency;
+	m_period_ns=m_target_fps > 0 && !bLowLatency ? (uint64_t)(1e9/m_target_fps + 0.5) : 0;
+}
+
+void CFramePacer::Start() {
+	m_measure_start_ns=GetMonotonicTimeNs();
+	m_deadline_ns=m_measure_start_ns + m_period_ns;
+	m_measure_frames=0;
+}
+
+void CFramePacer::Wait() {
+	
+	uint64_t now=GetMonotonicTimeNs();
+	
+	if(m_period_ns == 0) {
+		/* not paced: let other processes run, but do not sleep a kernel tick */
+		if(!m_bLowLatency) sched_yield();
+	} else if(now >= m_deadline_ns) {
+		/* too late: count the missed deadlines and start over from now
+		 * instead of running the following iterations back to back */
+		const uint32 missed=1 + (now - m_deadline_ns)/m_period_ns;
+		m_miss_count+=missed;
+		CStats::Count(StatCounter_deadlineMisses, missed);
+		m_deadline_ns=now + m_period_ns;
+	} else {
+		struct timespec ts;
+		ts.tv_sec=m_deadline_ns/1000000000ULL;
+		ts.tv_nsec=m_deadline_ns%1000000000ULL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+		m_deadline_ns+=m_period_ns;
+	}
+	
+	++m_frame_count;
+	++m_measure_frames;
+	now=GetMonotonicTimeNs();
+	if(now - m_measure_start_ns >= FRAME_PACER_MEASURE_INTERVAL_NS) {
+		m_measured_fps=m_measure_frames*1e9/(now - m_measure_start_ns);
+		m_measure_start_ns=now;
+		m_measure_frames=0;
+	}
+}
@@ -0,0 +1,57 @@
+/*! @file frame_pacer.h
+ * @brief Deadline based pacing of the main loop
+ *  Sleeps until absolute deadlines one frame period apart, so the loop runs
+ *  at the configured rate independent of how long an iteration took.
+ */
+
+#ifndef FRAME_PACER_H_
+#define FRAME_PACER_H_
+
+#include <stdint.h>
+
+#include "includes.h"
+
+
+/* interval over which the measured frame rate is computed */
+#define FRAME_PACER_MEASURE_INTERVAL_NS 1000000000ULL
+
+
+class CFramePacer {
+public:
+	CFramePacer();
+	
+	/*! @brief fps: target rate of the loop, 0 runs as fast as possible
+	 * bLowLatency: do not sleep, the next iteration starts as soon as the
+	 *  camera delivers a frame (the blocking frame read does the waiting)
+	 */
+	void Init(double fps, bool bLowLatency=false);
+	
+	/*! @brief the first deadline is one period from now */
+	void Start();
+	
+	/*! @brief call at the end of every iteration, returns at the next deadline */
+	void Wait();
+	
+	double getTargetFps() const { return(m_target_fps); }
+	bool isLowLatency() const { return(m_bLowLatency); }
+	/*! @brief iterations that ended after their deadline */
+	uint32 getMissCount() const { return(m_miss_count); }
+	uint32 getFrameCount() const { return(m_frame_count); }
+	/*! @brief iterations per second over the last measurement interval */
+	double getMeasuredFps() const { return(m_measured_fps); }
+	
+private:
+	double m_target_fps;
+	bool m_bLowLatency;
+	uint64_t m_period_ns; /* 0 if not paced */
+	uint64_t m_deadline_ns; /* end of the current iteration */
+	
+	uint32 m_frame_count;
+	uint32 m_miss_count;
+	uint64_t m_measure_start_ns;
+	uint32 m_measure_frames;
+	double m_measured_fps;
+};
+
+
+#endif /* FRAME_PACER_H_ */
@@ -0,0 +1,122 @@
+/*! @file frame_queue.cpp
+ * @brief Bounded queue of frames between two stages of the main loop
+ */
+
+#include "frame_queue.h"
+
+#include <errno.h>
+#include <time.h>
+
+
+CFrameQueue::CFrameQueue() : m_capacity(1), m_head(0), m_count(0), m_policy(QueuePolicy_block)
+	, m_bClosed(false), m_drop_count(0) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); /* timeouts must not jump with the wall clock */
+	
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond_not_empty, &attr);
+	pthread_cond_init(&m_cond_not_full, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+CFrameQueue::~CFrameQueue() {
+	pthread_cond_destroy(&m_cond_not_full);
+	pthread_cond_destroy(&m_cond_not_empty);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+OSC_ERR CFrameQueue::Init(int capacity, QueuePolicy policy) {
+	if(capacity < 1 || capacity > FRAME_QUEUE_MAX_CAPACITY) return(EINVALID_PARAMETER);
+	
+	pthread_mutex_lock(&m_mutex);
+	m_capacity=capacity;
+	m_policy=policy;
+	m_head=0;
+	m_count=0;
+	m_bClosed=false;
+	m_drop_count=0;
+	pthread_mutex_unlock(&m_mutex);
+	return(SUCCESS);
+}
+
+FRAME* CFrameQueue::Push(FRAME* frame) {
+	
+	FRAME* ret=NULL;
+	
+	pthread_mutex_lock(&m_mutex);
+	
+	if(m_policy == QueuePolicy_block) {
+		while(m_count == m_capacity && !m_bClosed)
+			pthread_cond_wait(&m_cond_not_full, &m_mutex);
+	}
+	
+	if(m_bClosed) {
+		ret=frame;
+	} else {
+		if(m_count == m_capacity) {
+			/* QueuePolicy_dropOldest */
+			ret=m_frames[m_head];
+			m_head=(m_head + 1) % m_capacity;
+			--m_count;
+			++m_drop_count;
+		}
+		m_frames[(m_head + m_count) % m_capacity]=frame;
+		++m_count;
+		pthread_cond_signal(&m_cond_not_empty);
+	}
+	
+	pthread_mutex_unlock(&m_mutex);
+	return(ret);
+}
+
+FRAME* CFrameQueue::Pop(int timeout_us) {
+	
+	FRAME* frame=NULL;
+	struct timespec deadline;
+	
+	if(timeout_us > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec+=timeout_us/1000000;
+		deadline.tv_nsec+=(timeout_us%1000000)*1000;
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec-=1000000000;
+			++deadline.tv_sec;
+		}
+	}
+	
+	pthread_mutex_lock(&m_mutex);
+	
+	while(m_count == 0 && !m_bClosed && timeout_us != 0) {
+		if(timeout_us < 0) {
+			pthread_cond_wait(&m_cond_not_empty, &m_mutex);
+		} else if(pthread_cond_timedwait(&m_cond_not_empty, &m_mutex, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	
+	if(m_count > 0) {
+		frame=m_frames[m_head];
+		m_head=(m_head + 1) % m_capacity;
+		--m_count;
+		pthread_cond_signal(&m_cond_not_full);
+	}
+	
+	pthread_mutex_unlock(&m_mutex);
+	return(frame);
+}
+
+void CFrameQueue::Close() {
+	pthread_mutex_lock(&m_mutex);
+	m_bClosed=true;
+	pthread_cond_broadcast(&m_cond_not_empty);
+	pthread_cond_broadcast(&m_cond_not_full);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+int CFrameQueue::getCount() {
+	pthread_mutex_lock(&m_mutex);
+	const int count=m_count;
+	pthread_mutex_unlock(&m_mutex);
+	return(count);
+}
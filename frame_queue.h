@@ -0,0 +1,67 @@
+/*! @file frame_queue.h
+ * @brief Bounded queue of frames between two stages of the main loop
+ *  Pushing a frame hands it over to the queue, popping hands it over to the
+ *  caller. Frames a queue drops are handed back to the pusher.
+ */
+
+#ifndef FRAME_QUEUE_H_
+#define FRAME_QUEUE_H_
+
+#include <pthread.h>
+
+#include "includes.h"
+#include "frame.h"
+
+
+#define FRAME_QUEUE_MAX_CAPACITY 16
+
+
+/* what Push does if the queue is full */
+enum QueuePolicy {
+	QueuePolicy_block, // wait until the consumer took a frame
+	QueuePolicy_dropOldest // replace the oldest frame in the queue
+};
+
+
+class CFrameQueue {
+public:
+	CFrameQueue();
+	~CFrameQueue();
+	
+	OSC_ERR Init(int capacity, QueuePolicy policy);
+	
+	/*! @brief append a frame
+	 * returns NULL if the queue took the frame, otherwise the frame the caller
+	 * owns again: the dropped oldest frame, or the frame itself if the queue is closed
+	 */
+	FRAME* Push(FRAME* frame);
+	
+	/*! @brief take the oldest frame, waits up to timeout_us (-1: forever)
+	 * returns NULL on timeout or if the queue is closed and empty
+	 */
+	FRAME* Pop(int timeout_us=-1);
+	
+	/*! @brief wake up all waiting threads; Push refuses frames from now on */
+	void Close();
+	
+	QueuePolicy getPolicy() const { return(m_policy); }
+	int getCount();
+	/*! @brief frames dropped because the queue was full */
+	uint32 getDropCount() const { return(m_drop_count); }
+	
+private:
+	FRAME* m_frames[FRAME_QUEUE_MAX_CAPACITY];
+	int m_capacity;
+	int m_head; /* index of the oldest frame */
+	int m_count;
+	QueuePolicy m_policy;
+	bool m_bClosed;
+	uint32 m_drop_count;
+	
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond_not_empty;
+	pthread_cond_t m_cond_not_full;
+};
+
+
+#endif /* FRAME_QUEUE_H_ */
@@ -0,0 +1,89 @@
+/*! @file frame_sync.cpp
+ * @brief Pairs the frames of several camera pipelines by timestamp
+ */
+
+#include <string.h>
+
+#include "frame_sync.h"
+#include "stats.h"
+
+
+CFrameSync::CFrameSync() : m_camera_count(0), m_tolerance_us(0), m_skew_us(0), m_drop_count(0) {
+	memset(m_pipelines, 0, sizeof(m_pipelines));
+	memset(m_candidates, 0, sizeof(m_candidates));
+	memset(m_served, 0, sizeof(m_served));
+}
+
+CFrameSync::~CFrameSync() {
+	Release();
+}
+
+OSC_ERR CFrameSync::Init(CPipeline** pipelines, int camera_count, uint32 tolerance_us) {
+	if(camera_count < 1 || camera_count > MAX_CAMERAS) return(EINVALID_PARAMETER);
+
+	Release();
+	for(int c=0; c<camera_count; ++c)
+		m_pipelines[c]=pipelines[c];
+	m_camera_count=camera_count;
+	m_tolerance_us=tolerance_us;
+	return(SUCCESS);
+}
+
+bool CFrameSync::NextSet(int timeout_us) {
+
+	if(m_tolerance_us == 0) {
+		/* unpaired: the newest frame of every camera */
+		bool bNew=false;
+		for(int c=0; c<m_camera_count; ++c) {
+			FRAME* frame=m_pipelines[c]->TakeFrame(c == 0 ? timeout_us : 0);
+			if(!frame) continue;
+			if(m_served[c]) m_pipelines[c]->ReleaseFrame(m_served[c]);
+			m_served[c]=frame;
+			bNew=true;
+		}
+		m_skew_us=0;
+		return(bNew);
+	}
+
+	for(;;) {
+		/* a frame of every camera, only the first missing one is waited for */
+		for(int c=0; c<m_camera_count; ++c) {
+			if(m_candidates[c]) continue;
+			m_candidates[c]=m_pipelines[c]->TakeFrame(timeout_us);
+			if(!m_candidates[c]) return(false);
+			timeout_us=0;
+		}
+
+		int oldest=0, newest=0;
+		for(int c=1; c<m_camera_count; ++c) {
+			if(m_candidates[c]->timestamp_us < m_candidates[oldest]->timestamp_us) oldest=c;
+			if(m_candidates[c]->timestamp_us > m_candidates[newest]->timestamp_us) newest=c;
+		}
+		const uint64_t skew=m_candidates[newest]->timestamp_us - m_candidates[oldest]->timestamp_us;
+
+		if(skew <= m_tolerance_us) {
+			for(int c=0; c<m_camera_count; ++c) {
+				if(m_served[c]) m_pipelines[c]->ReleaseFrame(m_served[c]);
+				m_served[c]=m_candidates[c];
+				m_candidates[c]=NULL;
+			}
+			m_skew_us=(uint32)skew;
+			return(true);
+		}
+
+		/* the other cameras are already past the oldest frame: it will not get a partner */
+		m_pipelines[oldest]->ReleaseFrame(m_candidates[oldest]);
+		m_candidates[oldest]=NULL;
+		++m_drop_count;
+		CStats::Count(StatCounter_framesDropped);
+	}
+}
+
+void CFrameSync::Release() {
+	for(int c=0; c<m_camera_count; ++c) {
+		if(m_candidates[c]) m_pipelines[c]->ReleaseFrame(m_candidates[c]);
+		if(m_served[c]) m_pipelines[c]->ReleaseFrame(m_served[c]);
+		m_candidates[c]=NULL;
+		m_served[c]=NULL;
+	}
+}
@@ -0,0 +1,58 @@
+/*! @file frame_sync.h
+ * @brief Pairs the frames of several camera pipelines by timestamp
+ *  The serve stage of a multi camera setup takes one frame of every
+ *  pipeline. If their timestamps lie within the tolerance, they form a set
+ *  and are served together; otherwise the oldest frame is dropped and the
+ *  next frame of its camera is tried. A set stays valid until the next one
+ *  is complete, then its frames go back to their pipelines.
+ */
+
+#ifndef FRAME_SYNC_H_
+#define FRAME_SYNC_H_
+
+#include "includes.h"
+#include "frame.h"
+#include "pipeline.h"
+
+
+/* largest timestamp difference within a set [us] if the frame rate is not known */
+#define FRAME_SYNC_DEFAULT_TOLERANCE_US 5000
+
+
+class CFrameSync {
+public:
+	CFrameSync();
+	~CFrameSync();
+
+	/*! @brief pipelines: one per camera, tolerance_us: 0 serves the newest frame of each camera unpaired */
+	OSC_ERR Init(CPipeline** pipelines, int camera_count, uint32 tolerance_us=FRAME_SYNC_DEFAULT_TOLERANCE_US);
+
+	/*! @brief collect frames, waits up to timeout_us for the first camera
+	 * returns true if a new set is complete (see getFrame)
+	 */
+	bool NextSet(int timeout_us=0);
+
+	/*! @brief frame of a camera in the current set, NULL before the first set */
+	const FRAME* getFrame(int camera) const { return(m_served[camera]); }
+
+	/*! @brief timestamp difference of the current set [us] */
+	uint32 getSkew() const { return(m_skew_us); }
+	/*! @brief frames dropped because no frame of the other cameras matched */
+	uint32 getDropCount() const { return(m_drop_count); }
+
+	/*! @brief give all frames back to the pipelines (before they are stopped) */
+	void Release();
+
+private:
+	CPipeline* m_pipelines[MAX_CAMERAS];
+	int m_camera_count;
+	uint32 m_tolerance_us;
+
+	FRAME* m_candidates[MAX_CAMERAS]; /* taken, not yet in a set */
+	FRAME* m_served[MAX_CAMERAS];
+	uint32 m_skew_us;
+	uint32 m_drop_count;
+};
+
+
+#endif /* FRAME_SYNC_H_ */
@@ -0,0 +1,37 @@
+/*! @file image_cache.cpp
+ * @brief Encoded images of the current frames, shared by the clients
+ */
+
+#include <string.h>
+
+#include "image_cache.h"
+
+
+CImageCache::CImageCache() : m_use_count(0) {
+	for(int i=0; i<IMAGE_CACHE_ENTRIES; ++i) {
+		memset(&m_entries[i].key, 0, sizeof(m_entries[i].key));
+		m_entries[i].last_use=0;
+	}
+}
+
+const std::vector<uint8>* CImageCache::Find(const IMAGE_CACHE_KEY& key) {
+	for(int i=0; i<IMAGE_CACHE_ENTRIES; ++i) {
+		ENTRY& entry=m_entries[i];
+		if(entry.last_use != 0 && memcmp(&entry.key, &key, sizeof(key)) == 0) {
+			entry.last_use=++m_use_count;
+			return(&entry.data);
+		}
+	}
+	return(NULL);
+}
+
+const std::vector<uint8>& CImageCache::Add(const IMAGE_CACHE_KEY& key, std::vector<uint8>& data) {
+	ENTRY* oldest=&m_entries[0];
+	for(int i=1; i<IMAGE_CACHE_ENTRIES; ++i) {
+		if(m_entries[i].last_use < oldest->last_use) oldest=&m_entries[i];
+	}
+	oldest->key=key;
+	oldest->data.swap(data);
+	oldest->last_use=++m_use_count;
+	return(oldest->data);
+}
@@ -0,0 +1,60 @@
+/*! @file image_cache.h
+ * @brief Encoded images of the current frames, shared by the clients
+ *  Clients watching the same camera, region and size at the same quality
+ *  get the same bytes, so only the first request of a frame encodes.
+ *  Entries are replaced least recently used first; the frame sequence
+ *  number is part of the key, so entries of older frames are not found.
+ */
+
+#ifndef IMAGE_CACHE_H_
+#define IMAGE_CACHE_H_
+
+#include <vector>
+
+#include "includes.h"
+
+
+#define IMAGE_CACHE_ENTRIES 8
+
+
+/* everything the encoded bytes depend on, 32 bit members only (compared as memory) */
+struct IMAGE_CACHE_KEY {
+	uint32 frame_seq;
+	int32 camera;
+	int32 perspective;
+	int32 format; /* enum ImageFormat */
+	int32 quality;
+	int32 roi_x; /* region of the image */
+	int32 roi_y;
+	int32 roi_width;
+	int32 roi_height;
+	int32 width; /* size it was scaled to */
+	int32 height;
+};
+
+
+class CImageCache {
+public:
+	CImageCache();
+
+	/*! @brief the encoded image of key, NULL if it is not cached */
+	const std::vector<uint8>* Find(const IMAGE_CACHE_KEY& key);
+
+	/*! @brief keep the encoded image data under key, returns the cached data
+	 * No copy: data is swapped with the buffer of the replaced entry and keeps its capacity.
+	 */
+	const std::vector<uint8>& Add(const IMAGE_CACHE_KEY& key, std::vector<uint8>& data);
+
+private:
+	struct ENTRY {
+		IMAGE_CACHE_KEY key;
+		std::vector<uint8> data;
+		uint32 last_use; /* 0: empty */
+	};
+
+	ENTRY m_entries[IMAGE_CACHE_ENTRIES];
+	uint32 m_use_count;
+};
+
+
+#endif /* IMAGE_CACHE_H_ */
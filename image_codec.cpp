@@ -0,0 +1,167 @@
+/*! @file image_codec.cpp
+ * @brief Fast lossless image encoders for the IPC (raw, QOI, run-length)
+ */
+
+#include "image_codec.h"
+#include "cgi/cgi.h"
+
+
+static void FillRawHeader(IPC_RAW_HEADER& header, uint32 magic, const cv::Mat& img, uint32 stride, uint32 frame_seq) {
+	memset(&header, 0, sizeof(header));
+	header.magic=magic;
+	header.width=img.cols;
+	header.height=img.rows;
+	header.depth=img.depth();
+	header.channels=img.channels();
+	header.stride=stride;
+	header.frame_seq=frame_seq;
+}
+
+OSC_ERR CImageCodec::EncodeRaw(const cv::Mat& img, uint32 frame_seq, std::vector<uint8>& out) {
+	
+	if(img.empty()) return(EINVALID_PARAMETER);
+	
+	const uint32 row_size=img.cols*img.elemSize();
+	IPC_RAW_HEADER header;
+	FillRawHeader(header, IPC_RAW_MAGIC, img, row_size, frame_seq);
+	
+	out.resize(sizeof(header) + (size_t)row_size*img.rows);
+	memcpy(&out[0], &header, sizeof(header));
+	uint8* dst=&out[sizeof(header)];
+	if(img.isContinuous()) {
+		memcpy(dst, img.data, (size_t)row_size*img.rows);
+	} else {
+		for(int y=0; y<img.rows; ++y, dst+=row_size)
+			memcpy(dst, img.ptr(y), row_size);
+	}
+	return(SUCCESS);
+}
+
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+static inline uint8* WriteBigEndian32(uint8* p, uint32 v) {
+	p[0]=v >> 24; p[1]=v >> 16; p[2]=v >> 8; p[3]=v;
+	return(p+4);
+}
+
+OSC_ERR CImageCodec::EncodeQoi(const cv::Mat& img, std::vector<uint8>& out) {
+	
+	if(img.empty() || img.depth() != CV_8U || (img.channels() != 1 && img.channels() != 3))
+		return(EINVALID_PARAMETER);
+	
+	static const uint8 end_marker[8]={0, 0, 0, 0, 0, 0, 0, 1};
+	const int cn=img.channels();
+	
+	/* worst case: every pixel as QOI_OP_RGB */
+	out.resize(QOI_HEADER_SIZE + (size_t)img.rows*img.cols*4 + sizeof(end_marker));
+	uint8* p=&out[0];
+	memcpy(p, "qoif", 4);
+	p=WriteBigEndian32(p+4, img.cols);
+	p=WriteBigEndian32(p, img.rows);
+	*p++=3; /* channels */
+	*p++=0; /* sRGB with linear alpha */
+	
+	/* RGBA like the decoder: empty slots (alpha 0) never match a pixel */
+	uint8 index[64][4];
+	memset(index, 0, sizeof(index));
+	uint8 pr=0, pg=0, pb=0; /* previous pixel, alpha is always 255 */
+	int run=0;
+	
+	for(int y=0; y<img.rows; ++y) {
+		const uint8* src=img.ptr(y);
+		for(int x=0; x<img.cols; ++x, src+=cn) {
+			const uint8 r=src[0];
+			const uint8 g=cn==3 ? src[1] : r;
+			const uint8 b=cn==3 ? src[2] : r;
+			
+			if(r==pr && g==pg && b==pb) {
+				if(++run == QOI_MAX_RUN) {
+					*p++=QOI_OP_RUN | (run-1);
+					run=0;
+				}
+				continue;
+			}
+			if(run > 0) {
+				*p++=QOI_OP_RUN | (run-1);
+				run=0;
+			}
+			
+			const int hash=(r*3 + g*5 + b*7 + 255*11) % 64;
+			if(index[hash][0]==r && index[hash][1]==g && index[hash][2]==b && index[hash][3]==255) {
+				*p++=QOI_OP_INDEX | hash;
+			} else {
+				index[hash][0]=r;
+				index[hash][1]=g;
+				index[hash][2]=b;
+				index[hash][3]=255;
+				
+				const int8 dr=r-pr, dg=g-pg, db=b-pb;
+				const int8 dr_dg=dr-dg, db_dg=db-dg;
+				if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+					*p++=QOI_OP_DIFF | (dr+2) << 4 | (dg+2) << 2 | (db+2);
+				} else if(dg > -33 && dg < 32 && dr_dg > -9 && dr_dg < 8 && db_dg > -9 && db_dg < 8) {
+					*p++=QOI_OP_LUMA | (dg+32);
+					*p++=(dr_dg+8) << 4 | (db_dg+8);
+				} else {
+					*p++=QOI_OP_RGB;
+					*p++=r;
+					*p++=g;
+					*p++=b;
+				}
+			}
+			pr=r;
+			pg=g;
+			pb=b;
+		}
+	}
+	if(run > 0) *p++=QOI_OP_RUN | (run-1);
+	
+	memcpy(p, end_marker, sizeof(end_marker));
+	p+=sizeof(end_marker);
+	out.resize(p - &out[0]);
+	return(SUCCESS);
+}
+
+OSC_ERR CImageCodec::EncodeRle(const cv::Mat& img, uint32 frame_seq, std::vector<uint8>& out) {
+	
+	if(img.empty() || img.depth() != CV_8U) return(EINVALID_PARAMETER);
+	
+	const int row_size=img.cols*img.channels();
+	IPC_RAW_HEADER header;
+	FillRawHeader(header, IPC_RLE_MAGIC, img, row_size, frame_seq);
+	
+	/* worst case: every byte is a run of length 1 (value + 1 byte varint) */
+	out.resize(sizeof(header) + 2*(size_t)row_size*img.rows);
+	memcpy(&out[0], &header, sizeof(header));
+	uint8* p=&out[sizeof(header)];
+	
+	uint8 value=img.ptr(0)[0];
+	uint32 run=0;
+	for(int y=0; y<img.rows; ++y) {
+		const uint8* src=img.ptr(y);
+		for(int x=0; x<row_size; ++x) {
+			if(src[x] == value) {
+				++run;
+				continue;
+			}
+			*p++=value;
+			for(; run >= 0x80; run>>=7) *p++=(run & 0x7f) | 0x80;
+			*p++=run;
+			value=src[x];
+			run=1;
+		}
+	}
+	*p++=value;
+	for(; run >= 0x80; run>>=7) *p++=(run & 0x7f) | 0x80;
+	*p++=run;
+	
+	out.resize(p - &out[0]);
+	return(SUCCESS);
+}
@@ -0,0 +1,37 @@
+/*! @file image_codec.h
+ * @brief Fast lossless image encoders for the IPC (raw, QOI, run-length)
+ *  The formats are described in cgi/cgi.h.
+ */
+
+#ifndef IMAGE_CODEC_H_
+#define IMAGE_CODEC_H_
+
+#include <vector>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+enum ImageFormat {
+	ImageFormat_jpeg,
+	ImageFormat_raw,
+	ImageFormat_qoi,
+	ImageFormat_rle,
+	ImageFormat_bmp
+};
+
+
+class CImageCodec {
+public:
+	/*! @brief header and rows of any depth and channel count */
+	static OSC_ERR EncodeRaw(const cv::Mat& img, uint32 frame_seq, std::vector<uint8>& out);
+	
+	/*! @brief QOI image, img must be 8 bit with 1 or 3 channels */
+	static OSC_ERR EncodeQoi(const cv::Mat& img, std::vector<uint8>& out);
+	
+	/*! @brief header and byte runs, img must be 8 bit (meant for binary masks) */
+	static OSC_ERR EncodeRle(const cv::Mat& img, uint32 frame_seq, std::vector<uint8>& out);
+};
+
+
+#endif /* IMAGE_CODEC_H_ */
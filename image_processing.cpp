@@ -1,12 +1,18 @@
 
 
 #include "image_processing.h"
+#include "trace.h"
+#include "mat_arena.h"
+#include "kernels.h"
 
+#include <algorithm>
 
-CImageProcessor::CImageProcessor() {
+
+CImageProcessor::CImageProcessor() : m_pool(NULL) {
 	for(uint32 i=0; i<3; i++) {
 		/* index 0 is 3 channels and indicies 1/2 are 1 channel deep */
 		m_proc_image[i] = new cv::Mat();
+		CMatArena::Use(*m_proc_image[i]);
 	}
 }
 
@@ -16,6 +22,15 @@ CImageProcessor::~CImageProcessor() {
 	}
 }
 
+void CImageProcessor::InvertBandJob(void* context, int index) {
+	const BAND_JOB& job=*(const BAND_JOB*)context;
+	const int rows=job.src->rows;
+	const int begin=index*rows/job.band_count, end=(index+1)*rows/job.band_count;
+	/* the band of dst refers to the allocated image, nothing is allocated */
+	cv::Mat dst=job.dst->rowRange(begin, end);
+	CKernels::SubtractFrom255(job.src->rowRange(begin, end), dst);
+}
+
 cv::Mat* CImageProcessor::GetProcImage(uint32 i) {
 	if(2 < i) {
 		i = 2;
@@ -26,11 +41,22 @@ cv::Mat* CImageProcessor::GetProcImage(uint32 i) {
 int CImageProcessor::DoProcess(cv::Mat* image) {
 	
 	if(!image) return(EINVALID_PARAMETER);	
+	
+	CStageTimer timer(StatStage_process);
         
         
 
 
-        cv::subtract(cv::Scalar::all(255), *image,*m_proc_image[0]);
+        CStageTimer timer1(StatStage_process1);
+        const int band_count=m_pool ? std::min(m_pool->getThreadCount(), image->rows/PROCESS_MIN_BAND_ROWS) : 1;
+        if(band_count > 1) {
+            m_proc_image[0]->create(image->rows, image->cols, image->type());
+            BAND_JOB job={ image, m_proc_image[0], band_count };
+            m_pool->Run(band_count, InvertBandJob, &job);
+        } else {
+            CKernels::SubtractFrom255(*image, *m_proc_image[0]);
+        }
+        timer1.Stop();
         
       //  cv::imwrite("dx.png", *m_proc_image[0]);
       //  cv::imwrite("dy.png", *m_proc_image[1]);
@@ -9,8 +9,12 @@
 
 #include "includes.h"
 #include "camera.h"
+#include "worker_pool.h"
 
 
+/* the processing of a frame is split into bands of at least this many rows */
+#define PROCESS_MIN_BAND_ROWS 64
+
 
 class CImageProcessor {
 public:
@@ -18,10 +22,23 @@ public:
 	~CImageProcessor();
 	
 	int DoProcess(cv::Mat* image);
+	
+	/*! @brief split the processing into row bands on pool, NULL: on the calling thread
+	 * The processors of several cameras can share a pool (see CWorkerPool::Run).
+	 */
+	void setPool(CWorkerPool* pool) { m_pool=pool; }
 
 	cv::Mat* GetProcImage(uint32 i);
 
 private:
+	struct BAND_JOB {
+		const cv::Mat* src;
+		cv::Mat* dst;
+		int band_count;
+	};
+	static void InvertBandJob(void* context, int index);
+	
+	CWorkerPool* m_pool;
 	cv::Mat* m_proc_image[3];/* we have three processing images for visualization available */
 };
 
@@ -0,0 +1,52 @@
+/*! @file image_stats.cpp
+ * @brief Histogram, mean and clipped pixels of the camera image
+ */
+
+#include <string.h>
+
+#include "image_stats.h"
+#include "kernels.h"
+
+
+CImageStats::CImageStats() : m_step(IMAGE_STATS_DEFAULT_STEP), m_region(0, 0, 0, 0), m_phase(0) {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void CImageStats::Compute(const cv::Mat& img, uint32 frame_seq) {
+	if(m_step <= 0 || img.empty()) {
+		m_stats.count=0;
+		return;
+	}
+
+	cv::Rect grid=(m_region.width > 0 && m_region.height > 0) ? m_region : cv::Rect(0, 0, img.cols, img.rows);
+	m_phase=(m_phase + 1)%m_step;
+	grid.y+=m_phase;
+	grid.height-=m_phase;
+
+	m_stats.count=CKernels::Histogram(img, grid, m_step, m_step, m_stats.hist);
+	m_stats.frame_seq=frame_seq;
+
+	uint64_t sum=0;
+	for(int v=0; v<256; ++v)
+		sum+=(uint64_t)v*m_stats.hist[v];
+	m_stats.mean_x16=m_stats.count ? (uint32)((sum*16 + m_stats.count/2)/m_stats.count) : 0;
+
+	m_stats.clipped_low=0;
+	for(int v=0; v<=IMAGE_STATS_CLIP_LOW; ++v)
+		m_stats.clipped_low+=m_stats.hist[v];
+	m_stats.clipped_high=0;
+	for(int v=IMAGE_STATS_CLIP_HIGH; v<256; ++v)
+		m_stats.clipped_high+=m_stats.hist[v];
+}
+
+int CImageStats::Percentile(const IMAGE_STATS& stats, int percent) {
+	if(stats.count == 0) return(0);
+
+	const uint64_t rank=((uint64_t)stats.count*percent + 99)/100;
+	uint64_t sum=0;
+	for(int v=0; v<256; ++v) {
+		sum+=stats.hist[v];
+		if(sum >= rank && sum > 0) return(v);
+	}
+	return(255);
+}
@@ -0,0 +1,66 @@
+/*! @file image_stats.h
+ * @brief Histogram, mean and clipped pixels of the camera image
+ *  Computed in the capture stage on a subsampled grid within a region
+ *  (see CKernels::Histogram). The grid origin moves down one row every
+ *  frame, so after step_y frames every row was sampled once and a thin
+ *  structure cannot hide between the rows of the grid.
+ */
+
+#ifndef IMAGE_STATS_H_
+#define IMAGE_STATS_H_
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+/* default spacing of the samples in both directions */
+#define IMAGE_STATS_DEFAULT_STEP 4
+/* samples at or below resp. at or above these values count as clipped */
+#define IMAGE_STATS_CLIP_LOW 2
+#define IMAGE_STATS_CLIP_HIGH 253
+
+
+struct IMAGE_STATS {
+	uint32 hist[256];
+	uint32 count; /* samples, 0: no statistics */
+	uint32 mean_x16; /* mean value * 16 */
+	uint32 clipped_low; /* samples <= IMAGE_STATS_CLIP_LOW */
+	uint32 clipped_high; /* samples >= IMAGE_STATS_CLIP_HIGH */
+	uint32 frame_seq;
+};
+
+
+class CImageStats {
+public:
+	CImageStats();
+
+	/*! @brief step: spacing of the samples, 0 turns the statistics off */
+	void setStep(int step) {
+		m_step=step;
+		if(step <= 0) m_stats.count=0;
+	}
+	int getStep() const { return(m_step); }
+	bool IsEnabled() const { return(m_step > 0); }
+
+	/*! @brief region the samples are taken from, an empty one is the whole image */
+	void setRegion(const cv::Rect& region) { m_region=region; }
+	const cv::Rect& getRegion() const { return(m_region); }
+
+	/*! @brief statistics of an 8 bit gray or RGB image */
+	void Compute(const cv::Mat& img, uint32 frame_seq);
+
+	/*! @brief statistics of the last Compute */
+	const IMAGE_STATS& get() const { return(m_stats); }
+
+	/*! @brief smallest value that percent of the samples do not exceed */
+	static int Percentile(const IMAGE_STATS& stats, int percent);
+
+private:
+	int m_step;
+	cv::Rect m_region;
+	int m_phase; /* row of the grid origin */
+	IMAGE_STATS m_stats;
+};
+
+
+#endif /* IMAGE_STATS_H_ */
@@ -3,6 +3,7 @@
  * @brief Implements the IPC handling of the template application.
  */
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
 #include "opencv.hpp"
@@ -11,6 +12,9 @@ using namespace std;
 #include "includes.h"
 #include "ipc.h"
 #include "cgi/cgi.h"
+#include "timing.h"
+#include "mat_arena.h"
+#include "kernels.h"
 
 
 #include <sys/types.h>
@@ -19,6 +23,7 @@ using namespace std;
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 
 
 
@@ -32,11 +37,23 @@ using namespace std;
 
 
 
-CIPC::CIPC(CCamera& camera,CImageProcessor& img_process) : m_camera(camera), m_img_process(img_process), m_bInit(false) {
+CIPC::CIPC(CCamera* cameras, int camera_count) : m_cameras(cameras), m_camera_count(camera_count)
+		, m_sync_skew_us(0), m_bInit(false), m_jpeg(&m_pool), m_history_format(ImageFormat_jpeg)
+		, m_recorder(NULL) {
+	for(int c=0; c<MAX_CAMERAS; ++c) {
+		m_frames[c]=NULL;
+		m_shm_seq[c]=0;
+		m_history[c]=NULL;
+	}
 	img_count=0;
+	m_bBinary=false;
+	m_jpeg_params.push_back(CV_IMWRITE_JPEG_QUALITY);
+	m_jpeg_params.push_back(0);
 }
 
 CIPC::~CIPC() {
+	for(int c=0; c<MAX_CAMERAS; ++c)
+		delete m_history[c];
 }
 
 
@@ -72,8 +89,15 @@ OSC_ERR CIPC::Init() {
 			, "Error listening on the socket: %s", strerror(errno));
 	
 	
-	/* init the web-settings */
-	m_web_settings.exposure_time=INIT_EXPOSURE_TIME;
+	/* shared memory frame ring of all cameras: slots must hold a full frame of 4 byte pixels (float processing images) */
+	uint32 shm_slot_size=0;
+	for(int c=0; c<m_camera_count; ++c)
+		shm_slot_size=std::max(shm_slot_size, 4u*m_cameras[c].getROI().width*m_cameras[c].getROI().height);
+	if(m_shm.Init(shm_slot_size, m_camera_count) != SUCCESS)
+		OscLog(WARN, "Shared memory frame ring not available\n");
+	
+	/* threads for the slices of the JPEG encoder, shared by all cameras */
+	m_pool.Init();
 	
 	m_bInit=true;
 	return(SUCCESS);
@@ -86,13 +110,17 @@ OSC_ERR CIPC::handleIpcRequests() {
 	
 	struct sockaddr remoteAddr;
 	unsigned int remoteAddrLen = sizeof(struct sockaddr);
-	
-	m_fd = accept(m_socket_fd, &remoteAddr, &remoteAddrLen);
 	OSC_ERR err=SUCCESS;
 	
-	if(m_fd<0) {
-		OscAssert_w(errno == EAGAIN, "Error accepting a connection: %s", strerror(errno));
-	} else {
+	/* the main loop is paced to the frame rate: answer all waiting requests */
+	for(int request=0; request<IPC_MAX_REQUESTS_PER_CALL; ++request) {
+		m_fd = accept(m_socket_fd, &remoteAddr, &remoteAddrLen);
+		
+		if(m_fd<0) {
+			OscAssert_w(errno == EAGAIN, "Error accepting a connection: %s", strerror(errno));
+			break;
+		}
+		
 		if(fcntl(m_fd, F_SETFL, O_NONBLOCK) != 0) {
 			close(m_fd);
 			OscMark_format("Error setting O_NONBLOCK: %s", strerror(errno));
@@ -109,8 +137,9 @@ OSC_ERR CIPC::handleIpcRequests() {
 		buffer[BUFFER_SIZE-remaining]=0;
 		m_bHeader_written=false;
 		
+		CStats::Count(StatCounter_requests);
 		if(remaining < BUFFER_SIZE) {
-			ProcessRequest(buffer);
+			ProcessRequest(buffer, BUFFER_SIZE-remaining);
 		}
 		WriteHtmlHeader(HEADER_TEXT_PLAIN); //will be written if not written already
 		
@@ -121,6 +150,83 @@ OSC_ERR CIPC::handleIpcRequests() {
 	return(err);
 }
 
+OSC_ERR CIPC::InitHistory(uint32 seconds, size_t budget, ImageFormat format) {
+	
+	if(m_history[0]) return(EALREADY_INITIALIZED);
+	if(format != ImageFormat_jpeg && format != ImageFormat_raw && format != ImageFormat_qoi)
+		return(EINVALID_PARAMETER);
+	
+	for(int c=0; c<m_camera_count; ++c) {
+		m_history[c]=new CFrameHistory();
+		const OSC_ERR err=m_history[c]->Init(seconds, budget/m_camera_count);
+		if(err != SUCCESS) {
+			OscLog(ERROR, "Frame history: cannot allocate %u bytes\n", (unsigned)(budget/m_camera_count));
+			return(err);
+		}
+	}
+	m_history_format=format;
+	OscLog(NOTICE, "Frame history: %u s, %u kB\n", seconds, (unsigned)(budget/1024));
+	return(SUCCESS);
+}
+
+void CIPC::RecordHistory() {
+	
+	for(int c=0; c<m_camera_count; ++c) {
+		CFrameHistory* history=m_history[c];
+		const FRAME* frame=m_frames[c];
+		if(history == NULL || frame == NULL || frame->img.empty()) continue;
+		/* the serve stage may see the same frame several times */
+		if(history->getCount() > 0 && history->getFrame(history->getCount()-1).seq == frame->seq)
+			continue;
+		
+		OSC_ERR err;
+		switch(m_history_format) {
+		case ImageFormat_raw:
+			err=CImageCodec::EncodeRaw(frame->img, frame->seq, m_history_buf);
+			break;
+		case ImageFormat_qoi:
+			err=CImageCodec::EncodeQoi(frame->img, m_history_buf);
+			break;
+		default:
+			err=EncodeJpeg(frame->img, HISTORY_JPEG_QUALITY, m_history_buf);
+			break;
+		}
+		if(err == SUCCESS)
+			err=history->Add(frame->seq, frame->timestamp_us, m_history_format, &m_history_buf[0], m_history_buf.size());
+		if(err != SUCCESS)
+			OscLog(WARN, "Frame %u not added to the history\n", frame->seq);
+	}
+}
+
+void CIPC::PublishFrames() {
+	
+	RecordHistory();
+	if(m_recorder) {
+		for(int c=0; c<m_camera_count; ++c) {
+			if(m_frames[c] && !m_frames[c]->img.empty())
+				m_recorder->Add(m_frames[c]->img, m_frames[c]->seq, m_frames[c]->timestamp_us, c);
+		}
+	}
+	
+	if(!m_shm.IsInitialized()) return;
+	
+	for(int c=0; c<m_camera_count; ++c) {
+		const FRAME* frame=m_frames[c];
+		/* a frame is served several times, its slots keep older frames */
+		if(frame == NULL || frame->img.empty() || frame->seq == m_shm_seq[c]) continue;
+		m_shm_seq[c]=frame->seq;
+		
+		const uint32 seq=frame->seq;
+		const uint64_t timestamp=frame->timestamp_us;
+		
+		m_shm.Publish(frame->img, c, ShmFrameStream_camera, seq, timestamp);
+		for(uint32 i=0; i<ShmFrameStream_count-1 && i<FRAME_PROC_COUNT; ++i) {
+			if(!frame->proc[i].empty())
+				m_shm.Publish(frame->proc[i], c, (ShmFrameStream)(ShmFrameStream_proc1+i), seq, timestamp);
+		}
+	}
+}
+
 void CIPC::WriteHtmlHeader(HTML_HEADER_TYPE type, int content_length) {
 	
 	if(m_bHeader_written) return;
@@ -149,6 +255,43 @@ void CIPC::WriteHtmlHeader(HTML_HEADER_TYPE type, int content_length) {
 		
 		IpcWrite(m_buffer, strlen(m_buffer));
 		
+		break;
+	case HEADER_IMAGE_QOI:
+		m_bHeader_written=true;
+		
+		sprintf(m_buffer,
+				"Content-Length: %i\r\n" \
+				"Content-Type: image/qoi\r\n" \
+				"\r\n"
+				, content_length);
+		
+		IpcWrite(m_buffer, strlen(m_buffer));
+		
+		break;
+	case HEADER_APPLICATION_BINARY:
+		m_bHeader_written=true;
+		
+		sprintf(m_buffer,
+				"Content-Length: %i\r\n" \
+				"Content-Type: application/octet-stream\r\n" \
+				"\r\n"
+				, content_length);
+		
+		IpcWrite(m_buffer, strlen(m_buffer));
+		
+		break;
+	case HEADER_APPLICATION_JSON:
+		m_bHeader_written=true;
+		
+		sprintf(m_buffer,
+				"Content-Length: %i\r\n" \
+				"Content-Type: application/json\r\n" \
+				"Content-Disposition: attachment; filename=\"trace.json\"\r\n" \
+				"\r\n"
+				, content_length);
+		
+		IpcWrite(m_buffer, strlen(m_buffer));
+		
 		break;
 	case HEADER_TEXT_PLAIN:
 		m_bHeader_written=true;
@@ -162,7 +305,171 @@ void CIPC::WriteHtmlHeader(HTML_HEADER_TYPE type, int content_length) {
 
 }
 
-void CIPC::ProcessRequest(char* request) {
+/* parameters known to the text protocol; enum values are transferred by name */
+static const char* const g_color_type_names[] = { "none", "gray", "raw", "debayered", NULL };
+static const char* const g_image_format_names[] = { "jpeg", "raw", "qoi", "rle", "bmp", NULL };
+
+struct IPC_PARAM_NAME {
+	uint16 param;
+	const char* name;
+	const char* const* enum_names;
+};
+
+static const IPC_PARAM_NAME g_param_names[] = {
+	{ ipcParam_width, "width", NULL },
+	{ ipcParam_height, "height", NULL },
+	{ ipcParam_exposureTime, "exposureTime", NULL },
+	{ ipcParam_colorType, "colorType", g_color_type_names },
+	{ ipcParam_perspective, "perspective", NULL },
+	{ ipcParam_autoExposure, "autoExposure", NULL },
+	{ ipcParam_cameraModel, "cameraModel", NULL },
+	{ ipcParam_imageSensor, "imageSensor", NULL },
+	{ ipcParam_uClinuxVersion, "uClinuxVersion", NULL },
+	{ ipcParam_image, "image", NULL },
+	{ ipcParam_clientId, "clientId", NULL },
+	{ ipcParam_targetBitrate, "targetBitrate", NULL },
+	{ ipcParam_targetFps, "targetFps", NULL },
+	{ ipcParam_jpegQuality, "jpegQuality", NULL },
+	{ ipcParam_downscale, "downscale", NULL },
+	{ ipcParam_frameSkip, "frameSkip", NULL },
+	{ ipcParam_frameInterval, "frameInterval", NULL },
+	{ ipcParam_clientBitrate, "clientBitrate", NULL },
+	{ ipcParam_clientFps, "clientFps", NULL },
+	{ ipcParam_clientLatency, "clientLatency", NULL },
+	{ ipcParam_delta, "delta", NULL },
+	{ ipcParam_tileSize, "tileSize", NULL },
+	{ ipcParam_format, "format", g_image_format_names },
+	{ ipcParam_latencyAcquire, "latencyAcquire", NULL },
+	{ ipcParam_latencyCaptureSetup, "latencyCaptureSetup", NULL },
+	{ ipcParam_latencyProcess, "latencyProcess", NULL },
+	{ ipcParam_latencyProcess1, "latencyProcess1", NULL },
+	{ ipcParam_latencyProcess2, "latencyProcess2", NULL },
+	{ ipcParam_latencyProcess3, "latencyProcess3", NULL },
+	{ ipcParam_latencyEncode, "latencyEncode", NULL },
+	{ ipcParam_latencyIpcWrite, "latencyIpcWrite", NULL },
+	{ ipcParam_framesCaptured, "framesCaptured", NULL },
+	{ ipcParam_framesDropped, "framesDropped", NULL },
+	{ ipcParam_framesServed, "framesServed", NULL },
+	{ ipcParam_kbytesSent, "kbytesSent", NULL },
+	{ ipcParam_requests, "requests", NULL },
+	{ ipcParam_deadlineMisses, "deadlineMisses", NULL },
+	{ ipcParam_trace, "trace", NULL },
+	{ ipcParam_seconds, "seconds", NULL },
+	{ ipcParam_latencyFrameInterval, "latencyFrameInterval", NULL },
+	{ ipcParam_heapAllocations, "heapAllocations", NULL },
+	{ ipcParam_kernelIsa, "kernelIsa", NULL },
+	{ ipcParam_latencyTrigger, "latencyTrigger", NULL },
+	{ ipcParam_triggerEdges, "triggerEdges", NULL },
+	{ ipcParam_triggersMissed, "triggersMissed", NULL },
+	{ ipcParam_camera, "camera", NULL },
+	{ ipcParam_cameraCount, "cameraCount", NULL },
+	{ ipcParam_syncSkew, "syncSkew", NULL },
+	{ ipcParam_seq, "seq", NULL },
+	{ ipcParam_age, "age", NULL },
+	{ ipcParam_count, "count", NULL },
+	{ ipcParam_burst, "burst", NULL },
+	{ ipcParam_historyFrames, "historyFrames", NULL },
+	{ ipcParam_historyFirstSeq, "historyFirstSeq", NULL },
+	{ ipcParam_historyLastSeq, "historyLastSeq", NULL },
+	{ ipcParam_latencyRecordWrite, "latencyRecordWrite", NULL },
+	{ ipcParam_framesRecorded, "framesRecorded", NULL },
+	{ ipcParam_recordDropped, "recordDropped", NULL },
+	{ ipcParam_kbytesRecorded, "kbytesRecorded", NULL },
+	{ ipcParam_latencyImageStats, "latencyImageStats", NULL },
+	{ ipcParam_statsStep, "statsStep", NULL },
+	{ ipcParam_aeTarget, "aeTarget", NULL },
+	{ ipcParam_aePercentile, "aePercentile", NULL },
+	{ ipcParam_aeRegionX, "aeRegionX", NULL },
+	{ ipcParam_aeRegionY, "aeRegionY", NULL },
+	{ ipcParam_aeRegionWidth, "aeRegionWidth", NULL },
+	{ ipcParam_aeRegionHeight, "aeRegionHeight", NULL },
+	{ ipcParam_statsMean, "statsMean", NULL },
+	{ ipcParam_statsLevel, "statsLevel", NULL },
+	{ ipcParam_statsClippedLow, "statsClippedLow", NULL },
+	{ ipcParam_statsClippedHigh, "statsClippedHigh", NULL },
+	{ ipcParam_histogram, "histogram", NULL },
+	{ ipcParam_latencyFocus, "latencyFocus", NULL },
+	{ ipcParam_focusStep, "focusStep", NULL },
+	{ ipcParam_focusTilesX, "focusTilesX", NULL },
+	{ ipcParam_focusTilesY, "focusTilesY", NULL },
+	{ ipcParam_focusScore, "focusScore", NULL },
+	{ ipcParam_focusTiles, "focusTiles", NULL },
+	{ ipcParam_settingsVersion, "settingsVersion", NULL },
+	{ ipcParam_frameSettingsVersion, "frameSettingsVersion", NULL },
+	{ ipcParam_roiX, "roiX", NULL },
+	{ ipcParam_roiY, "roiY", NULL },
+	{ ipcParam_roiWidth, "roiWidth", NULL },
+	{ ipcParam_roiHeight, "roiHeight", NULL },
+	{ ipcParam_outWidth, "outWidth", NULL },
+	{ ipcParam_outHeight, "outHeight", NULL },
+	{ ipcParam_imageCacheHits, "imageCacheHits", NULL },
+	{ ipcParam_statsSharedThreads, "statsSharedThreads", NULL },
+	{ ipcParam_deltaBase, "deltaBase", NULL }
+};
+static const int g_param_name_count=sizeof(g_param_names)/sizeof(g_param_names[0]);
+
+static const IPC_PARAM_NAME* FindParamName(uint16 param) {
+	for(int i=0; i<g_param_name_count; ++i)
+		if(g_param_names[i].param == param) return(&g_param_names[i]);
+	return(NULL);
+}
+
+
+const IPC_COMMAND CIPC::m_commands[] = {
+	/* name, type, version, bPrefix, bTextReply, handler */
+	{ "SetOptions", ipcMsg_setOptions, 1, false, false, &CIPC::CmdSetOptions },
+	{ "GetImageInfo", ipcMsg_getImageInfo, 1, false, true, &CIPC::CmdGetImageInfo },
+	{ "GetImage", ipcMsg_getImage, 1, true, false, &CIPC::CmdGetImage },
+	{ "GetSystemInfo", ipcMsg_getSystemInfo, 1, false, true, &CIPC::CmdGetSystemInfo },
+	{ "GetStats", ipcMsg_getStats, 1, false, true, &CIPC::CmdGetStats },
+	{ "DumpTrace", ipcMsg_dumpTrace, 1, false, false, &CIPC::CmdDumpTrace },
+	{ "GetBurst", ipcMsg_getBurst, 1, false, false, &CIPC::CmdGetBurst },
+	{ "GetHistogram", ipcMsg_getHistogram, 1, false, false, &CIPC::CmdGetHistogram },
+	{ NULL, 0, 0, false, false, NULL }
+};
+
+const IPC_COMMAND* CIPC::FindCommand(const char* name) {
+	const IPC_COMMAND* cmd;
+	for(cmd=m_commands; cmd->name; ++cmd)
+		if(strcmp(name, cmd->name) == 0) return(cmd);
+	for(cmd=m_commands; cmd->name; ++cmd)
+		if(cmd->bPrefix && strncmp(name, cmd->name, strlen(cmd->name)) == 0) return(cmd);
+	return(NULL);
+}
+
+const IPC_COMMAND* CIPC::FindCommand(uint8 type) {
+	for(const IPC_COMMAND* cmd=m_commands; cmd->name; ++cmd)
+		if(cmd->type == type) return(cmd);
+	return(NULL);
+}
+
+const IPC_ARG* IPC_ARGS::Find(uint16 param) const {
+	for(int i=0; i<count; ++i)
+		if(arg[i].param == param) return(&arg[i]);
+	return(NULL);
+}
+
+int32 IPC_ARGS::GetInt(uint16 param, int32 default_value) const {
+	const IPC_ARG* a=Find(param);
+	return(a ? a->value : default_value);
+}
+
+int CIPC::CameraIndex(const IPC_ARGS& args) const {
+	const int camera=args.GetInt(ipcParam_camera, 0);
+	return(camera >= 0 && camera < m_camera_count ? camera : -1);
+}
+
+
+void CIPC::ProcessRequest(char* request, size_t length) {
+	
+	uint32 magic;
+	if(length >= sizeof(IPC_BIN_HEADER)) {
+		memcpy(&magic, request, sizeof(magic));
+		if(magic == IPC_BIN_MAGIC) {
+			ProcessBinaryRequest((const uint8*)request, length);
+			return;
+		}
+	}
 	
 	char * header;
 	
@@ -170,102 +477,624 @@ void CIPC::ProcessRequest(char* request) {
 	
 	if(!(header=ReadHeader(&request))) return; /* wrong formated */
 	
+	const IPC_COMMAND* cmd=FindCommand(header);
+	if(!cmd) return;
+	
+	IPC_ARGS args;
+	while (*request) {
+		char * key, * value;
+		if(ReadArgument(&request, &key, &value)==SUCCESS) {
+			if(args.count < IPC_MAX_ARGS && TextToArgument(key, value, &args.arg[args.count]))
+				++args.count;
+		} else {
+			*request=0;
+		}
+	}
+	
 	//Note: call WriteHtmlHeader BEFORE calling writeArgument
+	if(cmd->bTextReply) WriteHtmlHeader(HEADER_TEXT_PLAIN);
+	
+	(this->*cmd->handler)(args);
+}
+
+bool CIPC::TextToArgument(const char* key, char* value, IPC_ARG* arg) {
 	
-	if(strcmp(header, "SetOptions") == 0) {
-		while (*request) {
-			char * key, * value;
-			if(ReadArgument(&request, &key, &value)==SUCCESS) {
+	for(int i=0; i<g_param_name_count; ++i) {
+		const IPC_PARAM_NAME& p=g_param_names[i];
+		if(strcmp(key, p.name) != 0) continue;
+		
+		arg->param=p.param;
+		arg->str=value;
+		arg->value=-1;
+		if(p.enum_names) {
+			for(int j=0; p.enum_names[j]; ++j)
+				if(strcmp(value, p.enum_names[j]) == 0) arg->value=j;
+		} else {
+			arg->value=strtol(value, NULL, 10);
+		}
+		return(true);
+	}
+	return(false);
+}
+
+void CIPC::ProcessBinaryRequest(const uint8* request, size_t length) {
+	
+	IPC_BIN_HEADER header;
+	memcpy(&header, request, sizeof(header));
+	
+	const uint8* const end=request + length;
+	const uint8* pos=request + sizeof(header);
+	
+	m_bBinary=true;
+	m_reply.resize(sizeof(IPC_BIN_HEADER));
+	
+	uint16 reply_count=0;
+	if(header.version == IPC_BIN_VERSION && header.length <= (size_t)(end - pos)) {
+		for(uint16 i=0; i<header.count; ++i) {
+			IPC_BIN_MSG msg;
+			if((size_t)(end - pos) < sizeof(msg)) break;
+			memcpy(&msg, pos, sizeof(msg));
+			pos+=sizeof(msg);
+			if((size_t)(end - pos) < msg.length) break;
 			
-				if(strcmp(key, "autoExposure") == 0) {
-					OscCamSetShutterWidth(0);
-				} else if (strcmp(key, "exposureTime") == 0) {
-					m_web_settings.exposure_time = strtol(value, NULL, 10)*1000;
-					OscCamSetShutterWidth(m_web_settings.exposure_time);
-				} else if (strcmp(key, "colorType") == 0) {
-					if (strcmp(value, "none") == 0)
-						m_camera.setColorType(ColorType_none);
-					else if (strcmp(value, "gray") == 0)
-						m_camera.setColorType( ColorType_gray);
-					else if (strcmp(value, "raw") == 0)
-						m_camera.setColorType(ColorType_raw);
-					else if (strcmp(value, "debayered") == 0)
-						m_camera.setColorType(ColorType_debayered);
-				} else if(strcmp(key, "perspective") == 0) {
-					m_camera.setPerspective(atoi(value));
-				} 
+			const size_t reply_pos=m_reply.size();
+			m_reply.resize(reply_pos + sizeof(IPC_BIN_MSG));
+			
+			IPC_BIN_MSG reply;
+			reply.type=msg.type;
+			reply.version=msg.version;
+			
+			const IPC_COMMAND* cmd=FindCommand(msg.type);
+			IPC_ARGS args;
+			if(!cmd) {
+				reply.status=ipcStatus_unknownType;
+			} else if(msg.version == 0 || msg.version > cmd->version) {
+				reply.status=ipcStatus_badVersion;
+				reply.version=cmd->version;
+			} else if(BinaryToArguments(pos, msg.length, &args) != SUCCESS) {
+				reply.status=ipcStatus_badFormat;
+			} else if((this->*cmd->handler)(args) != SUCCESS) {
+				reply.status=ipcStatus_failed;
 			} else {
-				*request=0;
+				reply.status=ipcStatus_ok;
 			}
+			/* drop partial results of failed commands */
+			if(reply.status != ipcStatus_ok) m_reply.resize(reply_pos + sizeof(IPC_BIN_MSG));
+			
+			reply.length=m_reply.size() - reply_pos - sizeof(IPC_BIN_MSG);
+			memcpy(&m_reply[reply_pos], &reply, sizeof(reply));
+			++reply_count;
+			pos+=msg.length;
 		}
+	} else {
+		OscLog(WARN, "Invalid binary IPC request (version %i, length %u)\n", header.version, header.length);
+	}
+	OscLog(DEBUG, "IPC binary request with %i messages\n", reply_count);
+	
+	header.count=reply_count;
+	header.version=IPC_BIN_VERSION;
+	header.length=m_reply.size() - sizeof(IPC_BIN_HEADER);
+	memcpy(&m_reply[0], &header, sizeof(header));
+	
+	WriteHtmlHeader(HEADER_APPLICATION_BINARY, m_reply.size());
+	const uint64_t write_start_us=GetMonotonicTimeUs();
+	const bool bWritten=IpcWrite(&m_reply[0], m_reply.size()) > 0;
+	const uint64_t write_us=GetMonotonicTimeUs() - write_start_us;
+	for(size_t i=0; i<m_rate_writes.size() && bWritten; ++i)
+		m_rate_control.EndFrame(m_rate_writes[i].client, m_rate_writes[i].bytes
+				, write_us*m_rate_writes[i].bytes/m_reply.size());
+	m_rate_writes.clear();
+	m_bBinary=false;
+}
+
+OSC_ERR CIPC::BinaryToArguments(const uint8* data, size_t length, IPC_ARGS* args) {
+	
+	const uint8* const end=data + length;
+	while(data < end) {
+		IPC_BIN_PARAM param;
+		if((size_t)(end - data) < sizeof(param)) return(EINVALID_PARAMETER);
+		memcpy(&param, data, sizeof(param));
+		data+=sizeof(param);
+		if((size_t)(end - data) < param.length) return(EINVALID_PARAMETER);
 		
-	} else if (strcmp(header, "GetImageInfo") == 0) {
-		const char * pEnumBuf = NULL;
-		
-		WriteHtmlHeader(HEADER_TEXT_PLAIN);
-		
-		WriteArgument("width", m_camera.getROI().width);
-		WriteArgument("height", m_camera.getROI().height);
-		WriteArgument("exposureTime", (m_web_settings.exposure_time+500)/1000);
-		if (m_camera.getColorType() == ColorType_none) {
-			pEnumBuf = "none";
-		} else if (m_camera.getColorType() == ColorType_gray) {
-			pEnumBuf = "gray";
-		} else if (m_camera.getColorType() == ColorType_raw) {
-			pEnumBuf = "raw";
-		} else if (m_camera.getColorType() == ColorType_debayered) {
-			pEnumBuf = "debayered";
+		/* only integer arguments are accepted in binary requests */
+		if(param.kind == ipcParamKind_int && param.length == sizeof(int32)) {
+			if(args->count >= IPC_MAX_ARGS) return(EINVALID_PARAMETER);
+			IPC_ARG& a=args->arg[args->count++];
+			a.param=param.id;
+			a.str=NULL;
+			memcpy(&a.value, data, sizeof(int32));
 		}
-		WriteArgument("colorType", pEnumBuf);
-		WriteArgument("perspective", m_camera.getPerspective());
-		WriteArgument("autoExposure", m_camera.getAutoExposure() ? 1 : 0);                
-		
-	} else if (strncmp(header, "GetImage", 8) == 0) {
-		
-		cv::Mat* img = m_camera.GetLastPicture();
+		data+=param.length;
+	}
+	return(SUCCESS);
+}
+
+
+OSC_ERR CIPC::CmdSetOptions(const IPC_ARGS& args) {
+	
+	const int c=CameraIndex(args);
+	if(c < 0) return(EINVALID_PARAMETER);
+	CCamera& camera=m_cameras[c];
+	/* the sensor settings only exist for the camera of Oscar's camera module */
+	const bool bSensor=camera.getSource() == CameraSource_sensor;
+	
+	/* the capture stage applies the camera settings with its next picture */
+	CAMERA_SETTINGS& s=camera.getSettings().BeginUpdate();
+	for(int i=0; i<args.count; ++i) {
+		const IPC_ARG& a=args.arg[i];
 		
-		if(img != NULL && !img->empty()) {
-			++img_count;
-						
-			cv::Mat img_write;
-			if(m_camera.getPerspective() == 0) {
-				/* we show the camera image */
-				img_write=*img;
+		switch(a.param) {
+		case ipcParam_autoExposure:
+			if(a.value == 2) {
+				s.exposure_control=ExposureControl_software;
+				if(s.stats_step == 0) s.stats_step=IMAGE_STATS_DEFAULT_STEP;
 			} else {
-				cv::Mat* img_proc=m_img_process.GetProcImage(m_camera.getPerspective()-1);
-                                /* in case image is empty -> show camera image*/
-                                if(img_proc->empty()) {
-                                    img_write=*img;
-                                } else {
-                                    /* convert to uint8 */
-                                    double min_val, max_val;
-                                    cv::minMaxLoc(*img_proc, &min_val, &max_val);
-                                    img_proc->convertTo(img_write, CV_MAKETYPE(CV_8U,img_proc->depth()), 255.0/(max_val - min_val), -min_val * 255.0/(max_val - min_val));
-                                }
+				s.exposure_control=ExposureControl_sensor;
 			}
+			break;
+		case ipcParam_exposureTime:
+			if(!bSensor) break;
+			s.exposure_control=ExposureControl_manual;
+			s.exposure_time=a.value*1000;
+			break;
+		case ipcParam_statsStep:
+			if(a.value >= 0) s.stats_step=a.value;
+			break;
+		case ipcParam_aeTarget:
+			if(a.value >= 0 && a.value <= 255) s.ae_target=a.value;
+			break;
+		case ipcParam_aePercentile:
+			if(a.value >= 0 && a.value <= 100) s.ae_percentile=a.value;
+			break;
+		case ipcParam_aeRegionX:
+			s.stats_region.x=std::max(a.value, 0);
+			break;
+		case ipcParam_aeRegionY:
+			s.stats_region.y=std::max(a.value, 0);
+			break;
+		case ipcParam_aeRegionWidth:
+			s.stats_region.width=std::max(a.value, 0);
+			break;
+		case ipcParam_aeRegionHeight:
+			s.stats_region.height=std::max(a.value, 0);
+			break;
+		case ipcParam_focusStep:
+			if(a.value >= 0) s.focus_step=a.value;
+			break;
+		case ipcParam_focusTilesX:
+			s.focus_tiles_x=std::min(std::max(a.value, 1), FOCUS_MAX_TILES_X);
+			break;
+		case ipcParam_focusTilesY:
+			s.focus_tiles_y=std::min(std::max(a.value, 1), FOCUS_MAX_TILES_Y);
+			break;
+		case ipcParam_colorType:
+			if(a.value >= ColorType_none && a.value <= ColorType_debayered)
+				s.color_type=(ColorType)a.value;
+			break;
+		case ipcParam_perspective:
+			s.perspective=a.value;
+			break;
+		case ipcParam_targetBitrate:
+			m_rate_control.setTargetBitrate(a.value);
+			break;
+		case ipcParam_targetFps:
+			m_rate_control.setTargetFps(a.value);
+			break;
+		case ipcParam_trace:
+			CTrace::Enable(a.value != 0);
+			break;
+		}
+	}
+	camera.getSettings().EndUpdate();
+	return(SUCCESS);
+}
 
-			if(WriteImage(img_write) !=SUCCESS) {
-				OscLog(ERROR, "Image could not be sent\n");
-			}
-			
-		} else {
-			OscLog(ERROR, "Could not Read Latest Picture\n");
+OSC_ERR CIPC::CmdGetImageInfo(const IPC_ARGS& args) {
+	
+	const int c=CameraIndex(args);
+	if(c < 0) return(EINVALID_PARAMETER);
+	CCamera& camera=m_cameras[c];
+	
+	WriteParam(ipcParam_width, camera.getROI().width);
+	WriteParam(ipcParam_height, camera.getROI().height);
+	/* the settings as requested, the frame tells which of them it was taken with */
+	const CAMERA_SETTINGS settings=camera.getSettings().Latest();
+	/* the exposure is the one the frame was read with (see FRAME) */
+	const FRAME* frame=m_frames[c];
+	WriteParam(ipcParam_exposureTime, ((frame ? frame->exposure_time : settings.exposure_time)+500)/1000);
+	WriteParam(ipcParam_colorType, settings.color_type);
+	WriteParam(ipcParam_perspective, settings.perspective);
+	const bool bSensorExposure=settings.exposure_control == ExposureControl_sensor
+			&& camera.getSource() == CameraSource_sensor;
+	WriteParam(ipcParam_autoExposure, settings.exposure_control == ExposureControl_software ? 2 : (bSensorExposure ? 1 : 0));
+	WriteParam(ipcParam_aeTarget, settings.ae_target);
+	WriteParam(ipcParam_aePercentile, settings.ae_percentile);
+	WriteParam(ipcParam_statsStep, settings.stats_step);
+	WriteParam(ipcParam_settingsVersion, (int)settings.version);
+	if(frame) WriteParam(ipcParam_frameSettingsVersion, (int)frame->settings.version);
+	if(frame && frame->stats.count > 0) {
+		const IMAGE_STATS& stats=frame->stats;
+		WriteParam(ipcParam_statsMean, (int)((stats.mean_x16 + 8)/16));
+		WriteParam(ipcParam_statsLevel, CImageStats::Percentile(stats, settings.ae_percentile));
+		WriteParam(ipcParam_statsClippedLow, (int)((uint64_t)stats.clipped_low*1000/stats.count));
+		WriteParam(ipcParam_statsClippedHigh, (int)((uint64_t)stats.clipped_high*1000/stats.count));
+	}
+	WriteParam(ipcParam_focusStep, settings.focus_step);
+	WriteParam(ipcParam_focusTilesX, settings.focus_tiles_x);
+	WriteParam(ipcParam_focusTilesY, settings.focus_tiles_y);
+	if(frame && frame->focus.count > 0) {
+		const FOCUS_STATS& focus=frame->focus;
+		WriteParam(ipcParam_focusScore, (int)focus.score);
+		char tiles[FOCUS_MAX_TILES*11];
+		int len=0;
+		for(uint32 i=0; i<focus.tiles_x*focus.tiles_y; ++i)
+			len+=snprintf(tiles + len, sizeof(tiles) - len, i ? ",%u" : "%u", focus.tile[i]);
+		WriteParam(ipcParam_focusTiles, tiles);
+	}
+	WriteParam(ipcParam_cameraCount, m_camera_count);
+	WriteParam(ipcParam_syncSkew, (int)m_sync_skew_us);
+	if(m_history[c] && m_history[c]->getCount() > 0) {
+		const CFrameHistory& history=*m_history[c];
+		WriteParam(ipcParam_historyFrames, history.getCount());
+		WriteParam(ipcParam_historyFirstSeq, (int)history.getFrame(0).seq);
+		WriteParam(ipcParam_historyLastSeq, (int)history.getFrame(history.getCount()-1).seq);
+	}
+	
+	WriteParam(ipcParam_targetBitrate, m_rate_control.getTargetBitrate());
+	WriteParam(ipcParam_targetFps, m_rate_control.getTargetFps());
+	/* unused slots have id -1, only clients that sent an id have rate control values */
+	const int client_id=RateClientId(args.GetInt(ipcParam_clientId, -1), c);
+	const RATE_CLIENT* client=client_id >= 0 ? m_rate_control.FindClient(client_id) : NULL;
+	if(client) {
+		WriteParam(ipcParam_jpegQuality, client->decision.quality);
+		WriteParam(ipcParam_downscale, client->decision.downscale);
+		WriteParam(ipcParam_frameSkip, client->decision.frame_skip);
+		WriteParam(ipcParam_frameInterval, CRateController::FrameIntervalMs(*client));
+		WriteParam(ipcParam_clientBitrate, (int)(client->bytes_per_sec*8/1000 + 0.5));
+		WriteParam(ipcParam_clientFps, (int)(client->fps + 0.5));
+		WriteParam(ipcParam_clientLatency, (int)(client->latency_ms + 0.5));
+	}
+	
+	return(SUCCESS);
+}
+
+OSC_ERR CIPC::CmdGetImage(const IPC_ARGS& args) {
+	
+	const int c=CameraIndex(args);
+	if(c < 0) return(EINVALID_PARAMETER);
+	if(args.Find(ipcParam_seq) || args.Find(ipcParam_age))
+		return(SendHistoryFrame(c, args));
+	const FRAME* frame=m_frames[c];
+	
+	if(frame == NULL || frame->img.empty()) {
+		OscLog(ERROR, "Could not Read Latest Picture\n");
+		return(EGENERAL);
+	}
+	const cv::Mat& img=frame->img;
+	++img_count;
+	
+	/* clients identifying themselves get images adapted to their link */
+	RATE_CLIENT* client=NULL;
+	RATE_DECISION decision={ RATE_CONTROL_DEFAULT_QUALITY, 0, 0 };
+	const int client_id=RateClientId(args.GetInt(ipcParam_clientId, -1), c);
+	if(client_id >= 0) {
+		client=m_rate_control.BeginFrame(client_id, frame->seq
+				, frame->timestamp_us, GetMonotonicTimeUs());
+		decision=client->decision;
+	}
+	
+	const int format=args.GetInt(ipcParam_format, ImageFormat_jpeg);
+	const int delta=args.GetInt(ipcParam_delta, 0);
+	/* JPEG or delta update, they follow the quality and downscale of the rate control */
+	const bool bJpeg=format != ImageFormat_raw && format != ImageFormat_qoi && format != ImageFormat_rle
+			&& format != ImageFormat_bmp;
+	
+	/* we show the camera image, or a processing image if there is one */
+	const int perspective=frame->settings.perspective;
+	const cv::Mat* src=&img;
+	if(perspective > 0 && !frame->proc[std::min(perspective-1, FRAME_PROC_COUNT-1)].empty())
+		src=&frame->proc[std::min(perspective-1, FRAME_PROC_COUNT-1)];
+	
+	/* region and size to send: only the region is converted, scaled and encoded */
+	const cv::Rect roi=RequestRegion(args, src->size());
+	if(roi.area() == 0) {
+		OscLog(ERROR, "Region outside of the image\n");
+		return(EINVALID_PARAMETER);
+	}
+	cv::Size size=RequestSize(args, roi.size());
+	if(bJpeg && decision.downscale > 0) {
+		const double scale=1.0/(1 << decision.downscale);
+		size=cv::Size(std::max(cvRound(size.width*scale), 1), std::max(cvRound(size.height*scale), 1));
+	}
+	
+	/* the same image for another client: send the bytes encoded for the first one */
+	IMAGE_CACHE_KEY key;
+	key.frame_seq=frame->seq;
+	key.camera=c;
+	key.perspective=src == &img ? 0 : perspective;
+	key.format=format;
+	key.quality=bJpeg ? decision.quality : 0;
+	key.roi_x=roi.x;
+	key.roi_y=roi.y;
+	key.roi_width=roi.width;
+	key.roi_height=roi.height;
+	key.width=size.width;
+	key.height=size.height;
+	const bool bCacheable=!(delta && client);
+	const std::vector<uint8>* cached=bCacheable ? m_image_cache.Find(key) : NULL;
+	
+	OSC_ERR err=SUCCESS;
+	HTML_HEADER_TYPE header_type=HEADER_APPLICATION_BINARY;
+	switch(format) {
+	case ImageFormat_raw:
+	case ImageFormat_rle:
+		break;
+	case ImageFormat_qoi:
+		header_type=HEADER_IMAGE_QOI;
+		break;
+	case ImageFormat_bmp:
+		header_type=HEADER_IMAGE_BMP;
+		break;
+	default:
+		if(!(delta && client)) header_type=HEADER_IMAGE_JPG;
+		break;
+	}
+	
+	CPooledBuffer buf(m_buffers);
+	if(cached) {
+		CStats::Count(StatCounter_imageCacheHits);
+	} else {
+		/* a view of the region, no copy */
+		cv::Mat img_write=(*src)(roi);
+		if(src != &img && format != ImageFormat_raw
+				&& (format == ImageFormat_jpeg || src->depth() != CV_8U)) {
+			/* convert to uint8, scaled to the range of the whole image as in the full view */
+			double min_val, max_val;
+			cv::minMaxLoc(*src, &min_val, &max_val);
+			cv::Mat img_converted;
+			CMatArena::Use(img_converted);
+			img_write.convertTo(img_converted, CV_MAKETYPE(CV_8U,src->depth()), 255.0/(max_val - min_val), -min_val * 255.0/(max_val - min_val));
+			img_write=img_converted;
 		}
-	} else if (strcmp(header, "GetSystemInfo") == 0) {
 		
-		WriteHtmlHeader(HEADER_TEXT_PLAIN);
-		
-		struct OscSystemInfo * pInfo;
-		if(OscCfgGetSystemInfo(&pInfo) == SUCCESS) {
-                  /*  WriteArgument("cameraModel", pInfo->hardware.board.revision);
-                    WriteArgument("imageSensor", (char*)"Color");
-                    WriteArgument("uClinuxVersion", pInfo->software.uClinux.version);*/
+		CStageTimer encode_timer(StatStage_encode);
+		if(size != img_write.size()) {
+			cv::Mat img_scaled;
+			CMatArena::Use(img_scaled);
+			const bool bShrink=size.width <= img_write.cols && size.height <= img_write.rows;
+			cv::resize(img_write, img_scaled, size, 0, 0, bShrink ? cv::INTER_AREA : cv::INTER_LINEAR);
+			img_write=img_scaled;
+		}
+		switch(format) {
+		case ImageFormat_raw:
+			err=CImageCodec::EncodeRaw(img_write, frame->seq, *buf);
+			break;
+		case ImageFormat_qoi:
+			err=CImageCodec::EncodeQoi(img_write, *buf);
+			break;
+		case ImageFormat_rle:
+			err=CImageCodec::EncodeRle(img_write, frame->seq, *buf);
+			break;
+		case ImageFormat_bmp:
+			err=cv::imencode(".bmp", img_write, *buf) ? SUCCESS : EGENERAL;
+			break;
+		default:
+			if(delta && client) {
+				/* only the tiles that changed since the last image sent to this client */
+				err=m_delta.Encode(client_id, img_write, frame->seq
+						, args.GetInt(ipcParam_tileSize, DELTA_DEFAULT_TILE_SIZE), decision.quality, delta == 2
+						, args.GetInt(ipcParam_deltaBase, -1), *buf);
+			} else {
+				err=EncodeJpeg(img_write, decision.quality, *buf);
+			}
+			break;
+		}
+		encode_timer.Stop();
 		
-                    WriteArgument("cameraModel", (char*)"Raspberry Pi Camera");
-                    WriteArgument("imageSensor", (char*)"Color");
-                    WriteArgument("uClinuxVersion", (char*)"0.9.0");
-                }
+		/* the cache keeps the bytes, buf gets the buffer of the replaced entry */
+		if(err == SUCCESS && bCacheable)
+			cached=&m_image_cache.Add(key, *buf);
+	}
+	
+	const std::vector<uint8>& data=cached ? *cached : *buf;
+	const uint64_t write_start_us=GetMonotonicTimeUs();
+	if(err == SUCCESS)
+		err=WriteData(header_type, ipcParam_image, &data[0], data.size());
+	if(err !=SUCCESS) {
+		OscLog(ERROR, "Image could not be sent\n");
+		return(EGENERAL);
+	}
+	CStats::Count(StatCounter_framesServed);
+	if(client && m_bBinary) {
+		/* written with the batch (see ProcessBinaryRequest) */
+		RATE_WRITE write={ client, data.size() };
+		m_rate_writes.push_back(write);
+	} else if(client) {
+		m_rate_control.EndFrame(client, data.size(), GetMonotonicTimeUs() - write_start_us);
+	}
+	return(SUCCESS);
+}
+
+int CIPC::FindHistoryFrame(const CFrameHistory& history, const IPC_ARGS& args, bool bExact) {
+	
+	const IPC_ARG* seq=args.Find(ipcParam_seq);
+	if(seq) return(seq->value < 0 ? -1 : history.FindSeq((uint32)seq->value, bExact));
+	const IPC_ARG* age=args.Find(ipcParam_age);
+	if(age) return(age->value < 0 ? -1 : history.FindAge((uint32)age->value));
+	return(history.getCount() > 0 ? 0 : -1);
+}
+
+OSC_ERR CIPC::SendHistoryFrame(int camera, const IPC_ARGS& args) {
+	
+	if(m_history[camera] == NULL) {
+		OscLog(ERROR, "No frame history (see option -H)\n");
+		return(EGENERAL);
+	}
+	const CFrameHistory& history=*m_history[camera];
+	const int index=FindHistoryFrame(history, args, true);
+	if(index < 0) {
+		OscLog(WARN, "Frame not in the history\n");
+		return(EINVALID_PARAMETER);
+	}
+	
+	/* sent as stored: no conversion, scaling or rate control */
+	const HISTORY_FRAME& frame=history.getFrame(index);
+	HTML_HEADER_TYPE header_type=HEADER_APPLICATION_BINARY;
+	if(frame.format == ImageFormat_jpeg) header_type=HEADER_IMAGE_JPG;
+	else if(frame.format == ImageFormat_qoi) header_type=HEADER_IMAGE_QOI;
+	
+	if(WriteData(header_type, ipcParam_image, history.getData(frame), frame.size) != SUCCESS) {
+		OscLog(ERROR, "Image could not be sent\n");
+		return(EGENERAL);
+	}
+	CStats::Count(StatCounter_framesServed);
+	return(SUCCESS);
+}
+
+OSC_ERR CIPC::CmdGetBurst(const IPC_ARGS& args) {
+	
+	const int c=CameraIndex(args);
+	if(c < 0) return(EINVALID_PARAMETER);
+	if(m_history[c] == NULL) {
+		OscLog(ERROR, "No frame history (see option -H)\n");
+		return(EGENERAL);
+	}
+	const CFrameHistory& history=*m_history[c];
+	
+	const int first=FindHistoryFrame(history, args, false);
+	int count=0;
+	if(first >= 0) {
+		const int max_count=args.GetInt(ipcParam_count, history.getCount());
+		count=std::max(0, std::min(max_count, history.getCount() - first));
+	}
+	
+	size_t size=sizeof(IPC_BURST_HEADER);
+	for(int i=0; i<count; ++i)
+		size+=sizeof(IPC_BURST_FRAME) + history.getFrame(first + i).size;
+	
+	CPooledBuffer buf(m_buffers);
+	buf->resize(size);
+	uint8* out=&(*buf)[0];
+	
+	IPC_BURST_HEADER header;
+	header.magic=IPC_BURST_MAGIC;
+	header.count=count;
+	memcpy(out, &header, sizeof(header));
+	out+=sizeof(header);
+	
+	for(int i=0; i<count; ++i) {
+		const HISTORY_FRAME& frame=history.getFrame(first + i);
+		IPC_BURST_FRAME f;
+		memset(&f, 0, sizeof(f));
+		f.timestamp_us=frame.timestamp_us;
+		f.frame_seq=frame.seq;
+		f.length=frame.size;
+		f.format=frame.format;
+		memcpy(out, &f, sizeof(f));
+		out+=sizeof(f);
+		memcpy(out, history.getData(frame), frame.size);
+		out+=frame.size;
+	}
+	
+	if(WriteData(HEADER_APPLICATION_BINARY, ipcParam_burst, &(*buf)[0], buf->size()) != SUCCESS) {
+		OscLog(ERROR, "Burst could not be sent\n");
+		return(EGENERAL);
+	}
+	CStats::Count(StatCounter_framesServed, count);
+	return(SUCCESS);
+}
+
+OSC_ERR CIPC::CmdGetHistogram(const IPC_ARGS& args) {
+	
+	const int c=CameraIndex(args);
+	if(c < 0) return(EINVALID_PARAMETER);
+	const FRAME* frame=m_frames[c];
+	if(frame == NULL || frame->stats.count == 0) {
+		OscLog(ERROR, "No image statistics (see statsStep)\n");
+		return(EGENERAL);
+	}
+	return(WriteData(HEADER_APPLICATION_BINARY, ipcParam_histogram, (const uint8*)frame->stats.hist, sizeof(frame->stats.hist)));
+}
+
+OSC_ERR CIPC::CmdGetSystemInfo(const IPC_ARGS& args) {
+	
+	struct OscSystemInfo * pInfo;
+	if(OscCfgGetSystemInfo(&pInfo) != SUCCESS) return(EGENERAL);
+	
+	/*  WriteParam(ipcParam_cameraModel, pInfo->hardware.board.revision);
+	WriteParam(ipcParam_imageSensor, "Color");
+	WriteParam(ipcParam_uClinuxVersion, pInfo->software.uClinux.version);*/
+	
+	WriteParam(ipcParam_cameraModel, "Raspberry Pi Camera");
+	WriteParam(ipcParam_imageSensor, "Color");
+	WriteParam(ipcParam_uClinuxVersion, "0.9.0");
+	
+	return(SUCCESS);
+}
+
+OSC_ERR CIPC::CmdGetStats(const IPC_ARGS& args) {
+	
+	/* parameter of each stage, in the order of enum StatStage */
+	static const uint16 stage_params[StatStage_count]={
+		ipcParam_latencyAcquire, ipcParam_latencyCaptureSetup, ipcParam_latencyProcess
+		, ipcParam_latencyProcess1, ipcParam_latencyProcess2, ipcParam_latencyProcess3
+		, ipcParam_latencyEncode, ipcParam_latencyIpcWrite, ipcParam_latencyFrameInterval
+		, ipcParam_latencyTrigger, ipcParam_latencyRecordWrite, ipcParam_latencyImageStats
+		, ipcParam_latencyFocus
+	};
+	
+	for(int stage=0; stage<StatStage_count; ++stage) {
+		STAT_LATENCY latency;
+		CStats::GetLatency((StatStage)stage, latency);
+		WriteLatency(stage_params[stage], latency);
+	}
+	
+	WriteParam(ipcParam_framesCaptured, (int)CStats::GetCounter(StatCounter_framesCaptured));
+	WriteParam(ipcParam_framesDropped, (int)CStats::GetCounter(StatCounter_framesDropped));
+	WriteParam(ipcParam_framesServed, (int)CStats::GetCounter(StatCounter_framesServed));
+	WriteParam(ipcParam_kbytesSent, (int)(CStats::GetCounter(StatCounter_bytesSent)/1024));
+	WriteParam(ipcParam_requests, (int)CStats::GetCounter(StatCounter_requests));
+	WriteParam(ipcParam_deadlineMisses, (int)CStats::GetCounter(StatCounter_deadlineMisses));
+	WriteParam(ipcParam_heapAllocations, (int)CStats::GetCounter(StatCounter_heapAllocations));
+	WriteParam(ipcParam_kernelIsa, CKernels::IsaName(CKernels::getIsa()));
+	WriteParam(ipcParam_triggerEdges, (int)CStats::GetCounter(StatCounter_triggerEdges));
+	WriteParam(ipcParam_triggersMissed, (int)CStats::GetCounter(StatCounter_triggersMissed));
+	WriteParam(ipcParam_framesRecorded, (int)CStats::GetCounter(StatCounter_framesRecorded));
+	WriteParam(ipcParam_recordDropped, (int)CStats::GetCounter(StatCounter_recordDropped));
+	WriteParam(ipcParam_kbytesRecorded, (int)(CStats::GetCounter(StatCounter_bytesRecorded)/1024));
+	WriteParam(ipcParam_imageCacheHits, (int)CStats::GetCounter(StatCounter_imageCacheHits));
+	WriteParam(ipcParam_statsSharedThreads, CStats::GetSharedThreads());
+	
+	return(SUCCESS);
+}
+
+OSC_ERR CIPC::CmdDumpTrace(const IPC_ARGS& args) {
+	
+	std::string json;
+	json.reserve(64*1024);
+	CTrace::Export(args.GetInt(ipcParam_seconds, 5), json);
+	
+	return(WriteData(HEADER_APPLICATION_JSON, ipcParam_trace, (const uint8*)json.data(), json.size()));
+}
+
+OSC_ERR CIPC::WriteLatency(uint16 param, const STAT_LATENCY& latency) {
+	
+	if(m_bBinary) {
+		IPC_STAT_LATENCY l;
+		l.count=latency.count;
+		l.p50_us=latency.p50;
+		l.p90_us=latency.p90;
+		l.p99_us=latency.p99;
+		l.max_us=latency.max;
+		AppendBinaryParam(param, ipcParamKind_blob, &l, sizeof(l));
+		return(SUCCESS);
 	}
+	
+	char value[96];
+	snprintf(value, sizeof(value), "count=%u p50=%u p90=%u p99=%u max=%u"
+			, latency.count, latency.p50, latency.p90, latency.p99, latency.max);
+	return(WriteParam(param, value));
 }
 
 
@@ -322,37 +1151,122 @@ OSC_ERR CIPC::WriteArgument(const char * pKey, const char * pValue) {
 	return(SUCCESS);
 }
 
-OSC_ERR CIPC::WriteImage(const cv::Mat img) {
+OSC_ERR CIPC::WriteParam(uint16 param, int value) {
 	
-        std::vector<int> qualityType;
-        qualityType.push_back(CV_IMWRITE_JPEG_QUALITY);
-        qualityType.push_back(90);
+	if(m_bBinary) {
+		int32 v=value;
+		AppendBinaryParam(param, ipcParamKind_int, &v, sizeof(v));
+		return(SUCCESS);
+	}
+	
+	const IPC_PARAM_NAME* p=FindParamName(param);
+	if(!p) return(EINVALID_PARAMETER);
+	if(p->enum_names) {
+		/* enums are written by name */
+		int count=0;
+		while(p->enum_names[count]) ++count;
+		if(value < 0 || value >= count) return(EINVALID_PARAMETER);
+		return(WriteArgument(p->name, p->enum_names[value]));
+	}
+	return(WriteArgument(p->name, value));
+}
+
+OSC_ERR CIPC::WriteParam(uint16 param, const char* value) {
+	
+	if(m_bBinary) {
+		AppendBinaryParam(param, ipcParamKind_string, value, strlen(value));
+		return(SUCCESS);
+	}
+	
+	const IPC_PARAM_NAME* p=FindParamName(param);
+	if(!p) return(EINVALID_PARAMETER);
+	return(WriteArgument(p->name, value));
+}
+
+void CIPC::AppendBinaryParam(uint16 param, uint16 kind, const void* value, size_t length) {
+	
+	IPC_BIN_PARAM p;
+	p.id=param;
+	p.kind=kind;
+	p.length=length;
+	
+	const size_t pos=m_reply.size();
+	m_reply.resize(pos + sizeof(p) + length);
+	memcpy(&m_reply[pos], &p, sizeof(p));
+	if(length > 0) memcpy(&m_reply[pos + sizeof(p)], value, length);
+}
 
-        std::vector<uchar> buf;
-        cv::imencode(".jpg", img, buf, qualityType);
-    
-	WriteHtmlHeader(HEADER_IMAGE_JPG, buf.size());
+OSC_ERR CIPC::WriteData(HTML_HEADER_TYPE type, uint16 param, const uint8* data, size_t size) {
+	
+	if(m_bBinary) {
+		/* part of a batch: the data is sent with the other replies */
+		AppendBinaryParam(param, ipcParamKind_blob, data, size);
+		return(SUCCESS);
+	}
+	
+	WriteHtmlHeader(type, size);
 	
-	//write image data
-	if(IpcWrite(buf.data(), (size_t)buf.size()) <=0)
+	if(IpcWrite(data, size) <=0)
 			return(EGENERAL);
 	
 	return(SUCCESS);
 }
 
+cv::Rect CIPC::RequestRegion(const IPC_ARGS& args, const cv::Size& size) {
+	
+	const cv::Rect image(0, 0, size.width, size.height);
+	const int width=args.GetInt(ipcParam_roiWidth, 0), height=args.GetInt(ipcParam_roiHeight, 0);
+	if(width <= 0 || height <= 0) return(image);
+	return(cv::Rect(args.GetInt(ipcParam_roiX, 0), args.GetInt(ipcParam_roiY, 0), width, height) & image);
+}
+
+cv::Size CIPC::RequestSize(const IPC_ARGS& args, const cv::Size& region) {
+	
+	int width=args.GetInt(ipcParam_outWidth, 0), height=args.GetInt(ipcParam_outHeight, 0);
+	if(width <= 0 && height <= 0) return(region);
+	/* one of them: the other keeps the aspect ratio of the region */
+	if(width <= 0) width=cvRound((double)height*region.width/region.height);
+	if(height <= 0) height=cvRound((double)width*region.height/region.width);
+	return(cv::Size(std::min(std::max(width, 1), IPC_MAX_IMAGE_SIZE), std::min(std::max(height, 1), IPC_MAX_IMAGE_SIZE)));
+}
+
+OSC_ERR CIPC::EncodeJpeg(const cv::Mat& img, int quality, std::vector<uint8>& out) {
+	
+	if(m_jpeg.Encode(img, quality, out) == SUCCESS)
+		return(SUCCESS);
+	
+	/* formats the slice encoder does not take (e.g. 16 bit) */
+	m_jpeg_params[1]=quality;
+	return(cv::imencode(".jpg", img, out, m_jpeg_params) ? SUCCESS : EGENERAL);
+}
+
 int CIPC::IpcWrite(const void* buf, size_t count) {
 	if(m_fd < 0) return(m_fd);
-	int ret;
-	while((ret=write(m_fd, buf, count)) == -1 
-			&& (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)) {
-		//resource temp. unavailable -> just try again
-		usleep(1000);
-	}
-	if(ret==-1) {
-		close(m_fd);
-		m_fd=-1;
+	CStageTimer timer(StatStage_ipcWrite);
+	/* the socket is non-blocking: write all of buf, large replies take several writes */
+	const char* data=(const char*)buf;
+	size_t remaining=count;
+	while(remaining > 0) {
+		int ret=write(m_fd, data, remaining);
+		if(ret == -1) {
+			if(errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+				//resource temp. unavailable -> wait until it can take data
+				struct pollfd p;
+				p.fd=m_fd;
+				p.events=POLLOUT;
+				if(errno == EINTR || poll(&p, 1, IPC_WRITE_TIMEOUT_MS) > 0)
+					continue;
+				OscLog(WARN, "The cgi does not take the reply, giving up\n");
+			}
+			close(m_fd);
+			m_fd=-1;
+			return(-1);
+		}
+		data+=ret;
+		remaining-=ret;
 	}
-	return(ret);
+	CStats::Count(StatCounter_bytesSent, count);
+	return(count);
 }
 
 
@@ -8,9 +8,21 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <vector>
 
 #include "camera.h"
-#include "image_processing.h"
+#include "frame.h"
+#include "shm_publisher.h"
+#include "rate_control.h"
+#include "delta_encoder.h"
+#include "image_codec.h"
+#include "buffer_pool.h"
+#include "worker_pool.h"
+#include "jpeg_encoder.h"
+#include "trace.h"
+#include "frame_history.h"
+#include "recorder.h"
+#include "image_cache.h"
 
 
 #define BUFFER_SIZE (1024)
@@ -24,49 +36,152 @@
 
 
 
+enum HTML_HEADER_TYPE {
+	HEADER_TEXT_PLAIN,
+	HEADER_IMAGE_BMP,
+        HEADER_IMAGE_JPG,
+	HEADER_IMAGE_QOI,
+	HEADER_APPLICATION_BINARY,
+	HEADER_APPLICATION_JSON
+};
 
-#define INIT_EXPOSURE_TIME 10000
 
-/* settings that can be changed over the web */
-struct WEB_SETTINGS {
-	int exposure_time; // [us]
+#define IPC_MAX_ARGS 16
+/* a reply write waits at most this long for the cgi to take data */
+#define IPC_WRITE_TIMEOUT_MS 1000
+/* connections answered per call of handleIpcRequests */
+#define IPC_MAX_REQUESTS_PER_CALL 8
+/* quality of the jpeg images kept in the history */
+#define HISTORY_JPEG_QUALITY 90
+/* largest width and height GetImage scales to */
+#define IPC_MAX_IMAGE_SIZE 4096
+
+/* one argument of a request, independent of the protocol it came with */
+struct IPC_ARG {
+	uint16 param; /* enum ipcParams */
+	int32 value;
+	const char* str; /* text value, NULL for binary requests */
 };
 
-enum HTML_HEADER_TYPE {
-	HEADER_TEXT_PLAIN,
-	HEADER_IMAGE_BMP,
-        HEADER_IMAGE_JPG
+struct IPC_ARGS {
+	IPC_ARGS() : count(0) {}
+	
+	const IPC_ARG* Find(uint16 param) const;
+	int32 GetInt(uint16 param, int32 default_value) const;
+	
+	IPC_ARG arg[IPC_MAX_ARGS];
+	int count;
+};
+
+class CIPC;
+typedef OSC_ERR (CIPC::*IPC_HANDLER)(const IPC_ARGS& args);
+
+/* entry of the command dispatch table */
+struct IPC_COMMAND {
+	const char* name; /* header line of the text protocol */
+	uint8 type; /* enum ipcMsgTypes */
+	uint8 version; /* highest supported message version */
+	bool bPrefix; /* text header only needs to start with name (e.g. GetImage_<n>) */
+	bool bTextReply; /* replies with "key: value" lines in the text protocol */
+	IPC_HANDLER handler;
 };
 
 
 class CIPC {
 public:
-	CIPC(CCamera& camera, CImageProcessor& img_process);
+	/*! @brief cameras: camera_count cameras, requests address them by the camera argument */
+	CIPC(CCamera* cameras, int camera_count=1);
 	~CIPC();
 	
 	OSC_ERR Init();
 	
 	
-	const WEB_SETTINGS& WebSettings() const { return(m_web_settings); }
+	/*! @brief frame of a camera the requests are answered with, it must stay valid until the next call */
+	void SetFrame(const FRAME* frame, int camera=0) { m_frames[camera]=frame; }
+	/*! @brief timestamp difference of the frames set for the cameras [us] (see CFrameSync) */
+	void setSyncSkew(uint32 skew_us) { m_sync_skew_us=skew_us; }
 	
 	/*! @brief answer cgi requests from webapp */
 	OSC_ERR handleIpcRequests();
 	
+	/*! @brief publish the current camera and processing images into the shared memory ring
+	 * for local consumers (see shm/shm_frames.h), and add the camera images to the history */
+	void PublishFrames();
+	
+	/*! @brief keep the camera images of the last seconds, encoded in format (jpeg, raw or qoi)
+	 * budget: bytes for all cameras together
+	 */
+	OSC_ERR InitHistory(uint32 seconds, size_t budget, ImageFormat format);
+	
+	/*! @brief PublishFrames queues the camera images to recorder, NULL: no recording */
+	void setRecorder(CRecorder* recorder) { m_recorder=recorder; }
+	
 	int img_count;
 	
 private:
-	void ProcessRequest(char* request);
+	void ProcessRequest(char* request, size_t length);
+	void ProcessBinaryRequest(const uint8* request, size_t length);
+	
+	/* command handlers, see m_commands */
+	OSC_ERR CmdSetOptions(const IPC_ARGS& args);
+	OSC_ERR CmdGetImageInfo(const IPC_ARGS& args);
+	OSC_ERR CmdGetImage(const IPC_ARGS& args);
+	OSC_ERR CmdGetSystemInfo(const IPC_ARGS& args);
+	OSC_ERR CmdGetStats(const IPC_ARGS& args);
+	OSC_ERR CmdDumpTrace(const IPC_ARGS& args);
+	OSC_ERR CmdGetBurst(const IPC_ARGS& args);
+	OSC_ERR CmdGetHistogram(const IPC_ARGS& args);
+	
+	static const IPC_COMMAND m_commands[];
+	static const IPC_COMMAND* FindCommand(const char* name);
+	static const IPC_COMMAND* FindCommand(uint8 type);
+	
+	/* convert a "key: value" pair to an argument; returns false for unknown keys */
+	static bool TextToArgument(const char* key, char* value, IPC_ARG* arg);
+	OSC_ERR BinaryToArguments(const uint8* data, size_t length, IPC_ARGS* args);
+	
+	/* camera addressed by a request (default 0), -1 if there is no such camera */
+	int CameraIndex(const IPC_ARGS& args) const;
+	/* rate control and delta state are kept per viewer and camera */
+	static int RateClientId(int client_id, int camera) { return(client_id < 0 ? -1 : client_id*MAX_CAMERAS + camera); }
 	
 	void WriteHtmlHeader(HTML_HEADER_TYPE type, int content_length=0);
 	bool m_bHeader_written;
 	
+	/* write a reply parameter in the format of the current request */
+	OSC_ERR WriteParam(uint16 param, int value);
+	OSC_ERR WriteParam(uint16 param, const char* value);
+	void AppendBinaryParam(uint16 param, uint16 kind, const void* value, size_t length);
+	bool m_bBinary; /* the current request uses the binary protocol */
+	std::vector<uint8> m_reply; /* binary reply, sent at once after the whole batch */
+	/* images in the batch, their clients get a share of the time the reply takes to write */
+	struct RATE_WRITE {
+		RATE_CLIENT* client;
+		size_t bytes;
+	};
+	std::vector<RATE_WRITE> m_rate_writes;
+	
 	/* returns begin to header or NULL
 	 * request will be set to next line */
 	char* ReadHeader(char ** request);
 	OSC_ERR ReadArgument(char ** pBuffer, char ** pKey, char ** pValue);
 	OSC_ERR WriteArgument(const char * pKey, const char * pValue);
 	OSC_ERR WriteArgument(const char * pKey, int value);
-	OSC_ERR WriteImage(const cv::Mat img);
+	/* send data with a CGI header of the given type, or as blob param in binary requests */
+	OSC_ERR WriteData(HTML_HEADER_TYPE type, uint16 param, const uint8* data, size_t size);
+	/* JPEG with the slice encoder, cv::imencode for images it does not take */
+	OSC_ERR EncodeJpeg(const cv::Mat& img, int quality, std::vector<uint8>& out);
+	/* region of GetImage within an image of size, empty if it is outside */
+	static cv::Rect RequestRegion(const IPC_ARGS& args, const cv::Size& size);
+	/* size GetImage scales the region to */
+	static cv::Size RequestSize(const IPC_ARGS& args, const cv::Size& region);
+	/* encode the camera image of the current frames into the histories */
+	void RecordHistory();
+	/* frame of a history addressed by seq or age, -1 if there is none */
+	static int FindHistoryFrame(const CFrameHistory& history, const IPC_ARGS& args, bool bExact);
+	OSC_ERR SendHistoryFrame(int camera, const IPC_ARGS& args);
+	/* latency summary of a stage, see IPC_STAT_LATENCY */
+	OSC_ERR WriteLatency(uint16 param, const STAT_LATENCY& latency);
 	int IpcWrite(const void* buf, size_t count); /* write to socket, returns > 0 on success */
 	int m_fd; //file handle
 	
@@ -74,8 +189,11 @@ private:
 	char* strtrim(char* str);
 	
 	
-	CCamera& m_camera;
-        CImageProcessor& m_img_process;
+	CCamera* m_cameras;
+	int m_camera_count;
+	const FRAME* m_frames[MAX_CAMERAS]; /* frames being served */
+	uint32 m_shm_seq[MAX_CAMERAS]; /* frame last published to the shared memory ring, 0: none */
+	uint32 m_sync_skew_us;
         
 	int m_socket_fd;
 	
@@ -84,7 +202,20 @@ private:
 	
 	
 	bool m_bInit;
-	WEB_SETTINGS m_web_settings;
+	
+	CShmPublisher m_shm;
+	CRateController m_rate_control;
+	CDeltaEncoder m_delta;
+	CImageCache m_image_cache;
+	CBufferPool m_buffers; /* output buffers of the image encoders */
+	CWorkerPool m_pool;
+	CJpegEncoder m_jpeg;
+	std::vector<int> m_jpeg_params; /* of cv::imencode, the quality is set per image */
+	
+	CFrameHistory* m_history[MAX_CAMERAS]; /* NULL without history */
+	ImageFormat m_history_format;
+	std::vector<uint8> m_history_buf; /* encoded frame before it goes into the history */
+	CRecorder* m_recorder;
 };
 
 
@@ -0,0 +1,518 @@
+/*! @file jpeg_encoder.cpp
+ * @brief Baseline JPEG encoder that encodes horizontal slices in parallel
+ *
+ * The DCT is the AAN float version with the scaling folded into the
+ * quantization; the tables are the standard ones of the JPEG specification
+ * (Annex K). 4:2:0 chroma subsampling is used for color images.
+ */
+
+#include "jpeg_encoder.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+
+/* worst case size of one 8x8 block in the entropy coded data (incl. byte stuffing) */
+#define JPEG_MAX_BLOCK_BYTES 512
+
+/* natural order index -> zigzag index */
+static const uint8 g_zigzag[64] = {
+	0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42,
+	3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18, 24, 31, 40, 44, 53,
+	10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60,
+	21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63
+};
+
+/* quantization tables of the specification, natural order */
+static const uint8 g_qt_luma_base[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+	14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+static const uint8 g_qt_chroma_base[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+/* Huffman tables of the specification: number of codes per length 1..16, then the values */
+static const uint8 g_dc_luma_counts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8 g_dc_luma_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8 g_dc_chroma_counts[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8 g_dc_chroma_values[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8 g_ac_luma_counts[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8 g_ac_luma_values[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+static const uint8 g_ac_chroma_counts[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8 g_ac_chroma_values[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+/* code and length for every symbol, built once from the tables above */
+struct HUFFMAN_CODE {
+	uint16 code;
+	uint16 length;
+};
+static HUFFMAN_CODE g_ht_dc_luma[256];
+static HUFFMAN_CODE g_ht_ac_luma[256];
+static HUFFMAN_CODE g_ht_dc_chroma[256];
+static HUFFMAN_CODE g_ht_ac_chroma[256];
+
+static void BuildHuffmanTable(HUFFMAN_CODE* table, const uint8* counts, const uint8* values) {
+	uint16 code=0;
+	int k=0;
+	for(int length=1; length<=16; ++length) {
+		for(int i=0; i<counts[length-1]; ++i, ++k, ++code) {
+			table[values[k]].code=code;
+			table[values[k]].length=length;
+		}
+		code<<=1;
+	}
+}
+
+static void BuildHuffmanTables() {
+	static bool bBuilt=false;
+	if(bBuilt) return;
+	BuildHuffmanTable(g_ht_dc_luma, g_dc_luma_counts, g_dc_luma_values);
+	BuildHuffmanTable(g_ht_ac_luma, g_ac_luma_counts, g_ac_luma_values);
+	BuildHuffmanTable(g_ht_dc_chroma, g_dc_chroma_counts, g_dc_chroma_values);
+	BuildHuffmanTable(g_ht_ac_chroma, g_ac_chroma_counts, g_ac_chroma_values);
+	bBuilt=true;
+}
+
+
+/* writes the entropy coded data of a slice into a buffer that keeps its capacity */
+class CBitWriter {
+public:
+	CBitWriter(std::vector<uint8>& out) : m_out(out), m_pos(0), m_bits(0), m_count(0) {
+		if(m_out.size() < m_out.capacity()) m_out.resize(m_out.capacity());
+	}
+
+	void Reserve(size_t bytes) {
+		if(m_pos + bytes > m_out.size()) m_out.resize(2*(m_pos + bytes));
+	}
+
+	inline void Put(uint32 code, int length) {
+		m_count+=length;
+		m_bits|=code << (24 - m_count);
+		while(m_count >= 8) {
+			const uint8 c=(m_bits >> 16) & 0xff;
+			m_out[m_pos++]=c;
+			if(c == 0xff) m_out[m_pos++]=0; /* byte stuffing */
+			m_bits<<=8;
+			m_count-=8;
+		}
+	}
+
+	/*! @brief pad the last byte with 1 bits, returns the number of bytes written */
+	size_t Finish() {
+		Put(0x7f, 7);
+		m_bits=0;
+		m_count=0;
+		m_out.resize(m_pos);
+		return(m_pos);
+	}
+
+private:
+	std::vector<uint8>& m_out;
+	size_t m_pos;
+	uint32 m_bits;
+	int m_count;
+};
+
+
+static inline void Dct8(float& d0, float& d1, float& d2, float& d3, float& d4, float& d5, float& d6, float& d7) {
+	const float tmp0=d0 + d7, tmp7=d0 - d7;
+	const float tmp1=d1 + d6, tmp6=d1 - d6;
+	const float tmp2=d2 + d5, tmp5=d2 - d5;
+	const float tmp3=d3 + d4, tmp4=d3 - d4;
+
+	/* even part */
+	float tmp10=tmp0 + tmp3;
+	const float tmp13=tmp0 - tmp3;
+	float tmp11=tmp1 + tmp2;
+	float tmp12=tmp1 - tmp2;
+	d0=tmp10 + tmp11;
+	d4=tmp10 - tmp11;
+	const float z1=(tmp12 + tmp13)*0.707106781f;
+	d2=tmp13 + z1;
+	d6=tmp13 - z1;
+
+	/* odd part */
+	tmp10=tmp4 + tmp5;
+	tmp11=tmp5 + tmp6;
+	tmp12=tmp6 + tmp7;
+	const float z5=(tmp10 - tmp12)*0.382683433f;
+	const float z2=tmp10*0.541196100f + z5;
+	const float z4=tmp12*1.306562965f + z5;
+	const float z3=tmp11*0.707106781f;
+	const float z11=tmp7 + z3;
+	const float z13=tmp7 - z3;
+	d5=z13 + z2;
+	d3=z13 - z2;
+	d1=z11 + z4;
+	d7=z11 - z4;
+}
+
+static inline void PutValue(CBitWriter& bw, const HUFFMAN_CODE* table, int run, int value) {
+	int magnitude=value < 0 ? -value : value;
+	int length=1;
+	while(magnitude >>= 1) ++length;
+	if(value < 0) --value;
+	bw.Put(table[(run << 4) + length].code, table[(run << 4) + length].length);
+	bw.Put(value & ((1 << length)-1), length);
+}
+
+/* transform, quantize and write one block; returns the DC value for the prediction of the next block */
+static int EncodeBlock(CBitWriter& bw, float* du, const float* fdtbl, int dc
+		, const HUFFMAN_CODE* ht_dc, const HUFFMAN_CODE* ht_ac) {
+
+	for(int i=0; i<64; i+=8)
+		Dct8(du[i], du[i+1], du[i+2], du[i+3], du[i+4], du[i+5], du[i+6], du[i+7]);
+	for(int i=0; i<8; ++i)
+		Dct8(du[i], du[i+8], du[i+16], du[i+24], du[i+32], du[i+40], du[i+48], du[i+56]);
+
+	int q[64];
+	for(int i=0; i<64; ++i) {
+		const float v=du[i]*fdtbl[i];
+		q[g_zigzag[i]]=(int)(v < 0 ? ceilf(v - 0.5f) : floorf(v + 0.5f));
+	}
+
+	const int diff=q[0] - dc;
+	if(diff == 0) bw.Put(ht_dc[0].code, ht_dc[0].length);
+	else PutValue(bw, ht_dc, 0, diff);
+
+	int last=63;
+	while(last > 0 && q[last] == 0) --last;
+
+	for(int i=1; i<=last; ++i) {
+		int run=0;
+		while(q[i] == 0) {
+			++run;
+			++i;
+		}
+		for(; run >= 16; run-=16)
+			bw.Put(ht_ac[0xf0].code, ht_ac[0xf0].length); /* 16 zeros */
+		PutValue(bw, ht_ac, run, q[i]);
+	}
+	if(last != 63) bw.Put(ht_ac[0].code, ht_ac[0].length); /* end of block */
+
+	return(q[0]);
+}
+
+
+CJpegEncoder::CJpegEncoder(CWorkerPool* pool) : m_pool(pool), m_quality(-1)
+	, m_header_width(0), m_header_height(0), m_bHeader_color(false), m_header_quality(-1)
+	, m_header_restart_interval(-1) {
+	BuildHuffmanTables();
+}
+
+void CJpegEncoder::SetQuality(int quality) {
+
+	if(quality == m_quality) return;
+	m_quality=quality;
+
+	/* scaling of the standard tables as done by libjpeg */
+	if(quality < 1) quality=1;
+	if(quality > 100) quality=100;
+	const int scale=quality < 50 ? 5000/quality : 200 - 2*quality;
+
+	for(int i=0; i<64; ++i) {
+		int y=(g_qt_luma_base[i]*scale + 50)/100;
+		int c=(g_qt_chroma_base[i]*scale + 50)/100;
+		m_qt_luma[g_zigzag[i]]=y < 1 ? 1 : (y > 255 ? 255 : y);
+		m_qt_chroma[g_zigzag[i]]=c < 1 ? 1 : (c > 255 ? 255 : c);
+	}
+
+	/* AAN scale factors */
+	static const float aasf[8] = {
+		1.0f*2.828427125f, 1.387039845f*2.828427125f, 1.306562965f*2.828427125f, 1.175875602f*2.828427125f,
+		1.0f*2.828427125f, 0.785694958f*2.828427125f, 0.541196100f*2.828427125f, 0.275899379f*2.828427125f
+	};
+	for(int row=0, k=0; row<8; ++row) {
+		for(int col=0; col<8; ++col, ++k) {
+			m_fdtbl_luma[k]=1.0f/(m_qt_luma[g_zigzag[k]]*aasf[row]*aasf[col]);
+			m_fdtbl_chroma[k]=1.0f/(m_qt_chroma[g_zigzag[k]]*aasf[row]*aasf[col]);
+		}
+	}
+}
+
+static void PutMarker(std::vector<uint8>& out, uint8 marker, int length) {
+	out.push_back(0xff);
+	out.push_back(marker);
+	if(length >= 0) {
+		out.push_back(length >> 8);
+		out.push_back(length & 0xff);
+	}
+}
+
+static void PutHuffmanTable(std::vector<uint8>& out, uint8 id, const uint8* counts, const uint8* values) {
+	out.push_back(id);
+	int n=0;
+	for(int i=0; i<16; ++i) {
+		out.push_back(counts[i]);
+		n+=counts[i];
+	}
+	out.insert(out.end(), values, values + n);
+}
+
+void CJpegEncoder::BuildHeader(const JPEG_IMAGE& img) {
+
+	const bool bColor=img.format != JpegInput_gray;
+	const int restart_interval=m_header_restart_interval;
+
+	m_header.clear();
+
+	PutMarker(m_header, 0xd8, -1); /* SOI */
+
+	static const uint8 jfif[]={ 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+	PutMarker(m_header, 0xe0, 2 + sizeof(jfif)); /* APP0 */
+	m_header.insert(m_header.end(), jfif, jfif + sizeof(jfif));
+
+	PutMarker(m_header, 0xdb, 2 + (bColor ? 2 : 1)*65); /* DQT */
+	m_header.push_back(0);
+	m_header.insert(m_header.end(), m_qt_luma, m_qt_luma + 64);
+	if(bColor) {
+		m_header.push_back(1);
+		m_header.insert(m_header.end(), m_qt_chroma, m_qt_chroma + 64);
+	}
+
+	const int components=bColor ? 3 : 1;
+	PutMarker(m_header, 0xc0, 8 + 3*components); /* SOF0 */
+	m_header.push_back(8);
+	m_header.push_back(img.height >> 8);
+	m_header.push_back(img.height & 0xff);
+	m_header.push_back(img.width >> 8);
+	m_header.push_back(img.width & 0xff);
+	m_header.push_back(components);
+	for(int i=0; i<components; ++i) {
+		m_header.push_back(i+1); /* component id */
+		m_header.push_back(bColor && i == 0 ? 0x22 : 0x11); /* sampling factors */
+		m_header.push_back(i == 0 ? 0 : 1); /* quantization table */
+	}
+
+	PutMarker(m_header, 0xc4, bColor ? 2 + 2*(17+12) + 2*(17+162) : 2 + (17+12) + (17+162)); /* DHT */
+	PutHuffmanTable(m_header, 0x00, g_dc_luma_counts, g_dc_luma_values);
+	PutHuffmanTable(m_header, 0x10, g_ac_luma_counts, g_ac_luma_values);
+	if(bColor) {
+		PutHuffmanTable(m_header, 0x01, g_dc_chroma_counts, g_dc_chroma_values);
+		PutHuffmanTable(m_header, 0x11, g_ac_chroma_counts, g_ac_chroma_values);
+	}
+
+	if(restart_interval > 0) {
+		PutMarker(m_header, 0xdd, 4); /* DRI */
+		m_header.push_back(restart_interval >> 8);
+		m_header.push_back(restart_interval & 0xff);
+	}
+
+	PutMarker(m_header, 0xda, 6 + 2*components); /* SOS */
+	m_header.push_back(components);
+	for(int i=0; i<components; ++i) {
+		m_header.push_back(i+1);
+		m_header.push_back(i == 0 ? 0x00 : 0x11); /* Huffman tables DC/AC */
+	}
+	m_header.push_back(0); /* spectral selection */
+	m_header.push_back(63);
+	m_header.push_back(0);
+
+	m_header_width=img.width;
+	m_header_height=img.height;
+	m_bHeader_color=bColor;
+	m_header_quality=m_quality;
+}
+
+void CJpegEncoder::EncodeSliceJob(void* context, int index) {
+	SLICE* slices=(SLICE*)context;
+	slices[index].encoder->EncodeSlice(slices[index]);
+}
+
+void CJpegEncoder::EncodeSlice(SLICE& slice) {
+
+	const JPEG_IMAGE& img=*slice.img;
+	const int w=img.width, h=img.height;
+	CBitWriter bw(slice.data);
+	float du[64];
+
+	if(img.format == JpegInput_gray) {
+		int dc=0;
+		for(int y0=slice.mcu_row_begin*8; y0<slice.mcu_row_end*8; y0+=8) {
+			bw.Reserve(((w+7)/8)*JPEG_MAX_BLOCK_BYTES);
+			for(int x0=0; x0<w; x0+=8) {
+				/* edge blocks repeat the last row/column */
+				for(int r=0; r<8; ++r) {
+					const uint8* src=img.plane[0] + std::min(y0+r, h-1)*img.stride[0];
+					if(x0+8 <= w) {
+						for(int c=0; c<8; ++c) du[r*8+c]=src[x0+c] - 128.0f;
+					} else {
+						for(int c=0; c<8; ++c) du[r*8+c]=src[std::min(x0+c, w-1)] - 128.0f;
+					}
+				}
+				dc=EncodeBlock(bw, du, m_fdtbl_luma, dc, g_ht_dc_luma, g_ht_ac_luma);
+			}
+		}
+		bw.Finish();
+		return;
+	}
+
+	/* 4:2:0, MCUs of 16x16 pixels: 4 luma blocks, 1 Cb block, 1 Cr block */
+	int dc_y=0, dc_u=0, dc_v=0;
+	float Y[256], U[64], V[64];
+	const int ri=img.format == JpegInput_bgr ? 2 : 0, bi=2-ri;
+
+	for(int y0=slice.mcu_row_begin*16; y0<slice.mcu_row_end*16; y0+=16) {
+		bw.Reserve(((w+15)/16)*6*JPEG_MAX_BLOCK_BYTES);
+		for(int x0=0; x0<w; x0+=16) {
+
+			if(img.format == JpegInput_yuv420) {
+				const int cw=(w+1)/2, ch=(h+1)/2;
+				for(int r=0; r<16; ++r) {
+					const uint8* src=img.plane[0] + std::min(y0+r, h-1)*img.stride[0];
+					for(int c=0; c<16; ++c) Y[r*16+c]=src[std::min(x0+c, w-1)] - 128.0f;
+				}
+				for(int r=0; r<8; ++r) {
+					const int cy=std::min(y0/2+r, ch-1);
+					const uint8* su=img.plane[1] + cy*img.stride[1];
+					const uint8* sv=img.plane[2] + cy*img.stride[2];
+					for(int c=0; c<8; ++c) {
+						const int cx=std::min(x0/2+c, cw-1);
+						U[r*8+c]=su[cx] - 128.0f;
+						V[r*8+c]=sv[cx] - 128.0f;
+					}
+				}
+			} else {
+				/* convert the interleaved pixels directly, no intermediate image */
+				float R[256], G[256], B[256];
+				for(int r=0; r<16; ++r) {
+					const uint8* src=img.plane[0] + std::min(y0+r, h-1)*img.stride[0];
+					for(int c=0; c<16; ++c) {
+						const uint8* px=src + 3*std::min(x0+c, w-1);
+						const int i=r*16+c;
+						R[i]=px[ri];
+						G[i]=px[1];
+						B[i]=px[bi];
+						Y[i]=0.29900f*R[i] + 0.58700f*G[i] + 0.11400f*B[i] - 128.0f;
+					}
+				}
+				for(int r=0; r<8; ++r) {
+					for(int c=0; c<8; ++c) {
+						const int i=2*r*16 + 2*c;
+						const float rs=0.25f*(R[i] + R[i+1] + R[i+16] + R[i+17]);
+						const float gs=0.25f*(G[i] + G[i+1] + G[i+16] + G[i+17]);
+						const float bs=0.25f*(B[i] + B[i+1] + B[i+16] + B[i+17]);
+						U[r*8+c]=-0.16874f*rs - 0.33126f*gs + 0.50000f*bs;
+						V[r*8+c]=0.50000f*rs - 0.41869f*gs - 0.08131f*bs;
+					}
+				}
+			}
+
+			for(int b=0; b<4; ++b) {
+				const float* src=Y + (b/2)*8*16 + (b%2)*8;
+				for(int r=0; r<8; ++r)
+					for(int c=0; c<8; ++c) du[r*8+c]=src[r*16+c];
+				dc_y=EncodeBlock(bw, du, m_fdtbl_luma, dc_y, g_ht_dc_luma, g_ht_ac_luma);
+			}
+			dc_u=EncodeBlock(bw, U, m_fdtbl_chroma, dc_u, g_ht_dc_chroma, g_ht_ac_chroma);
+			dc_v=EncodeBlock(bw, V, m_fdtbl_chroma, dc_v, g_ht_dc_chroma, g_ht_ac_chroma);
+		}
+	}
+	bw.Finish();
+}
+
+OSC_ERR CJpegEncoder::Encode(const JPEG_IMAGE& img, int quality, std::vector<uint8>& out) {
+
+	if(img.width <= 0 || img.height <= 0 || img.width > 0xffff || img.height > 0xffff)
+		return(EINVALID_PARAMETER);
+
+	SetQuality(quality);
+
+	/* split the MCU rows into equally sized slices, one per thread */
+	const int mcu_size=img.format == JpegInput_gray ? 8 : 16;
+	const int mcu_rows=(img.height + mcu_size-1)/mcu_size;
+	const int mcus_per_row=(img.width + mcu_size-1)/mcu_size;
+	int slice_count=m_pool ? std::min(m_pool->getThreadCount(), JPEG_MAX_SLICES) : 1;
+	slice_count=std::min(slice_count, mcu_rows);
+	const int rows_per_slice=(mcu_rows + slice_count-1)/slice_count;
+	slice_count=(mcu_rows + rows_per_slice-1)/rows_per_slice;
+
+	/* every slice but the last one ends with a restart marker */
+	const int restart_interval=slice_count > 1 ? rows_per_slice*mcus_per_row : 0;
+	if(restart_interval > 0xffff) return(EINVALID_PARAMETER);
+
+	if(m_header.empty() || img.width != m_header_width || img.height != m_header_height
+			|| (img.format != JpegInput_gray) != m_bHeader_color || m_quality != m_header_quality
+			|| restart_interval != m_header_restart_interval) {
+		m_header_restart_interval=restart_interval;
+		BuildHeader(img);
+	}
+
+	for(int i=0; i<slice_count; ++i) {
+		m_slices[i].encoder=this;
+		m_slices[i].img=&img;
+		m_slices[i].mcu_row_begin=i*rows_per_slice;
+		m_slices[i].mcu_row_end=std::min((i+1)*rows_per_slice, mcu_rows);
+	}
+	if(m_pool) m_pool->Run(slice_count, EncodeSliceJob, m_slices);
+	else EncodeSliceJob(m_slices, 0);
+
+	/* header, slices joined by RSTn markers, EOI */
+	size_t size=m_header.size() + 2;
+	for(int i=0; i<slice_count; ++i) size+=m_slices[i].data.size() + 2;
+	out.resize(size);
+
+	uint8* p=&out[0];
+	memcpy(p, &m_header[0], m_header.size());
+	p+=m_header.size();
+	for(int i=0; i<slice_count; ++i) {
+		memcpy(p, &m_slices[i].data[0], m_slices[i].data.size());
+		p+=m_slices[i].data.size();
+		if(i < slice_count-1) {
+			*p++=0xff;
+			*p++=0xd0 + (i & 7);
+		}
+	}
+	*p++=0xff;
+	*p++=0xd9; /* EOI */
+	out.resize(p - &out[0]);
+
+	return(SUCCESS);
+}
+
+OSC_ERR CJpegEncoder::Encode(const cv::Mat& img, int quality, std::vector<uint8>& out) {
+
+	if(img.empty() || img.depth() != CV_8U || (img.channels() != 1 && img.channels() != 3))
+		return(EINVALID_PARAMETER);
+
+	JPEG_IMAGE jpeg_img;
+	memset(&jpeg_img, 0, sizeof(jpeg_img));
+	jpeg_img.format=img.channels() == 1 ? JpegInput_gray : JpegInput_bgr;
+	jpeg_img.width=img.cols;
+	jpeg_img.height=img.rows;
+	jpeg_img.plane[0]=img.data;
+	jpeg_img.stride[0]=img.step;
+
+	return(Encode(jpeg_img, quality, out));
+}
@@ -0,0 +1,84 @@
+/*! @file jpeg_encoder.h
+ * @brief Baseline JPEG encoder that encodes horizontal slices in parallel
+ *  The slices are joined with restart markers, so the result is a single
+ *  standard JPEG. Quantization tables, Huffman tables, the file header and
+ *  the slice buffers are kept between frames.
+ */
+
+#ifndef JPEG_ENCODER_H_
+#define JPEG_ENCODER_H_
+
+#include <vector>
+
+#include "opencv.hpp"
+#include "includes.h"
+#include "worker_pool.h"
+
+
+#define JPEG_MAX_SLICES 16
+
+
+enum JpegInput {
+	JpegInput_gray, // one plane
+	JpegInput_rgb, // interleaved 8 bit R, G, B
+	JpegInput_bgr, // interleaved 8 bit B, G, R (OpenCV order)
+	JpegInput_yuv420 // planes Y, U (Cb), V (Cr), U and V subsampled by 2 in both directions
+};
+
+/*! @brief image to encode, the planes are not copied */
+struct JPEG_IMAGE {
+	JpegInput format;
+	int width;
+	int height;
+	const uint8* plane[3];
+	int stride[3]; /* bytes per row of each plane */
+};
+
+
+class CJpegEncoder {
+public:
+	/*! @brief pool: threads to encode the slices with, NULL encodes everything in the caller */
+	CJpegEncoder(CWorkerPool* pool=NULL);
+
+	/*! @brief encode img into out (out keeps its capacity) */
+	OSC_ERR Encode(const JPEG_IMAGE& img, int quality, std::vector<uint8>& out);
+
+	/*! @brief encode an 8 bit gray or BGR image (same color order as cv::imencode) */
+	OSC_ERR Encode(const cv::Mat& img, int quality, std::vector<uint8>& out);
+
+private:
+	struct SLICE {
+		CJpegEncoder* encoder;
+		const JPEG_IMAGE* img;
+		int mcu_row_begin;
+		int mcu_row_end;
+		std::vector<uint8> data;
+	};
+
+	void SetQuality(int quality);
+	void BuildHeader(const JPEG_IMAGE& img);
+	static void EncodeSliceJob(void* context, int index);
+	void EncodeSlice(SLICE& slice);
+
+	CWorkerPool* m_pool;
+
+	/* state for the current quality */
+	int m_quality;
+	uint8 m_qt_luma[64]; /* zigzag order as written to the file */
+	uint8 m_qt_chroma[64];
+	float m_fdtbl_luma[64]; /* quantization with DCT scaling folded in */
+	float m_fdtbl_chroma[64];
+
+	/* file header for the current geometry */
+	std::vector<uint8> m_header;
+	int m_header_width;
+	int m_header_height;
+	bool m_bHeader_color;
+	int m_header_quality;
+	int m_header_restart_interval;
+
+	SLICE m_slices[JPEG_MAX_SLICES];
+};
+
+
+#endif /* JPEG_ENCODER_H_ */
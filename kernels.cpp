@@ -0,0 +1,604 @@
+/*! @file kernels.cpp
+ * @brief Image kernels of the frame path with a variant per instruction set
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+/* intrinsics in functions with a target pragma need gcc 4.9 */
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define KERNELS_NEON
+#include <arm_neon.h>
+#elif defined(__arm__) && defined(__ARM_FP) && __GNUC__ >= 7
+/* 32 bit ARM without -mfpu=neon: the NEON variant gets its own target (arm_neon.h does the same) */
+#define KERNELS_NEON
+#define KERNELS_NEON_PRAGMA
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+
+/* row functions of a variant, see kernels_impl.h */
+typedef void (*GRAY_ROW)(const uint8* rgb, uint8* gray, int width);
+typedef void (*INVERT_ROW8)(const uint8* src, uint8* dst, int width);
+typedef void (*INVERT_ROW16)(const uint16* src, uint16* dst, int width);
+typedef void (*HIST_ROW)(const uint8* src, uint32 (*hist)[256], int width);
+typedef void (*LAPLACE_ROW)(const uint8* src, int stride, int width, int64_t* sum, uint64_t* sum_sq);
+
+struct KERNEL_TABLE {
+	GRAY_ROW gray[2]; /* [width multiple of 16] */
+	INVERT_ROW8 invert8[2][2]; /* [1 or 3 channels][width multiple of 16] */
+	INVERT_ROW16 invert16[2][2];
+	HIST_ROW hist[2]; /* [width multiple of 16] */
+	LAPLACE_ROW laplace[2]; /* [width multiple of 16] */
+};
+
+
+/* weights and rounding of OpenCV's RGB2Gray for 8 bit (fixed point, 14 bits) */
+#define GRAY_SHIFT 14
+#define GRAY_R 4899
+#define GRAY_G 9617
+#define GRAY_B 1868
+
+static inline uint8 GrayPixel(const uint8* rgb) {
+	return((uint8)((rgb[0]*GRAY_R + rgb[1]*GRAY_G + rgb[2]*GRAY_B + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT));
+}
+
+static inline uint8 InvertPixel(uint8 v) {
+	return(255 - v);
+}
+
+static inline uint16 InvertPixel(uint16 v) {
+	return(v < 255 ? 255 - v : 0);
+}
+
+/* neighbouring samples go to different tables: equal values in a row do not
+ * wait for each other's increment (store to load forwarding) */
+#define HIST_TABLES 4
+/* samples converted or gathered at a time */
+#define HIST_CHUNK 512
+
+/* the 4 bytes of a word, the first byte in memory (little endian) in table 0 */
+static inline void HistWord(uint32 w, uint32 (*hist)[256]) {
+	++hist[0][w & 0xff];
+	++hist[1][(w >> 8) & 0xff];
+	++hist[2][(w >> 16) & 0xff];
+	++hist[3][w >> 24];
+}
+
+
+/* pixels of a row at a time, the vector sums of a row stay within 32 bits */
+#define LAPLACE_CHUNK 2048
+
+/* 4-neighbour Laplacian, [-1020, 1020] */
+static inline int LaplacePixel(const uint8* p, int stride) {
+	return(4*p[0] - p[-1] - p[1] - p[-stride] - p[stride]);
+}
+
+
+namespace kernels_scalar {
+
+static inline void GrayBlock(const uint8* rgb, uint8* gray) {
+	for(int i=0; i<16; ++i)
+		gray[i]=GrayPixel(rgb + 3*i);
+}
+
+template<typename T>
+static inline void InvertBlock(const T* src, T* dst) {
+	for(int i=0; i<16; ++i)
+		dst[i]=InvertPixel(src[i]);
+}
+
+static inline void HistBlock(const uint8* src, uint32 (*hist)[256]) {
+	uint32 w[4];
+	memcpy(w, src, sizeof(w));
+	for(int i=0; i<4; ++i)
+		HistWord(w[i], hist);
+}
+
+struct LAPLACE_ACC {
+	int32 sum;
+	uint32 sum_sq;
+};
+
+static inline void LaplaceInit(LAPLACE_ACC& acc) {
+	acc.sum=0;
+	acc.sum_sq=0;
+}
+
+static inline void LaplaceBlock(const uint8* src, int stride, LAPLACE_ACC& acc) {
+	for(int i=0; i<16; ++i) {
+		const int v=LaplacePixel(src + i, stride);
+		acc.sum+=v;
+		acc.sum_sq+=v*v;
+	}
+}
+
+static inline void LaplaceTotal(const LAPLACE_ACC& acc, int64_t* sum, uint64_t* sum_sq) {
+	*sum+=acc.sum;
+	*sum_sq+=acc.sum_sq;
+}
+
+#include "kernels_impl.h"
+
+} /* namespace kernels_scalar */
+
+
+#ifdef KERNELS_X86
+
+/* deinterleave 16 RGB pixels (48 bytes) into R, G and B (SSSE3 shuffles) */
+#define GRAY_DEINTERLEAVE(rgb, r, g, b) \
+	const __m128i a0=_mm_loadu_si128((const __m128i*)(rgb)); \
+	const __m128i a1=_mm_loadu_si128((const __m128i*)(rgb) + 1); \
+	const __m128i a2=_mm_loadu_si128((const __m128i*)(rgb) + 2); \
+	const __m128i r=_mm_or_si128(_mm_or_si128( \
+			_mm_shuffle_epi8(a0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+			_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))), \
+			_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13))); \
+	const __m128i g=_mm_or_si128(_mm_or_si128( \
+			_mm_shuffle_epi8(a0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+			_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))), \
+			_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14))); \
+	const __m128i b=_mm_or_si128(_mm_or_si128( \
+			_mm_shuffle_epi8(a0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)), \
+			_mm_shuffle_epi8(a1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))), \
+			_mm_shuffle_epi8(a2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)))
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace kernels_sse41 {
+
+/* 8 pixels: R*GRAY_R + G*GRAY_G and B*GRAY_B + rounding as 32 bit pairs (pmaddwd) */
+static inline __m128i Gray8(__m128i r16, __m128i g16, __m128i b16) {
+	const __m128i w_rg=_mm_set1_epi32((GRAY_G << 16) | GRAY_R);
+	const __m128i w_b=_mm_set1_epi32(((1 << (GRAY_SHIFT-1)) << 16) | GRAY_B);
+	const __m128i one=_mm_set1_epi16(1);
+	const __m128i lo=_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r16, g16), w_rg)
+			, _mm_madd_epi16(_mm_unpacklo_epi16(b16, one), w_b));
+	const __m128i hi=_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r16, g16), w_rg)
+			, _mm_madd_epi16(_mm_unpackhi_epi16(b16, one), w_b));
+	return(_mm_packs_epi32(_mm_srli_epi32(lo, GRAY_SHIFT), _mm_srli_epi32(hi, GRAY_SHIFT)));
+}
+
+static inline void GrayBlock(const uint8* rgb, uint8* gray) {
+	GRAY_DEINTERLEAVE(rgb, r, g, b);
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i y_lo=Gray8(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(b));
+	const __m128i y_hi=Gray8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+	_mm_storeu_si128((__m128i*)gray, _mm_packus_epi16(y_lo, y_hi));
+}
+
+static inline void InvertBlock(const uint8* src, uint8* dst) {
+	const __m128i v=_mm_loadu_si128((const __m128i*)src);
+	_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(v, _mm_set1_epi8(-1)));
+}
+
+static inline void InvertBlock(const uint16* src, uint16* dst) {
+	const __m128i c=_mm_set1_epi16(255);
+	_mm_storeu_si128((__m128i*)dst, _mm_subs_epu16(c, _mm_loadu_si128((const __m128i*)src)));
+	_mm_storeu_si128((__m128i*)dst + 1, _mm_subs_epu16(c, _mm_loadu_si128((const __m128i*)src + 1)));
+}
+
+/* one load, the bytes are taken from the words in registers */
+static inline void HistBlock(const uint8* src, uint32 (*hist)[256]) {
+	const __m128i v=_mm_loadu_si128((const __m128i*)src);
+	HistWord(_mm_cvtsi128_si32(v), hist);
+	HistWord(_mm_extract_epi32(v, 1), hist);
+	HistWord(_mm_extract_epi32(v, 2), hist);
+	HistWord(_mm_extract_epi32(v, 3), hist);
+}
+
+/* 32 bit lanes, pmaddwd adds pairs of the 16 bit values */
+struct LAPLACE_ACC {
+	__m128i sum;
+	__m128i sum_sq;
+};
+
+static inline void LaplaceInit(LAPLACE_ACC& acc) {
+	acc.sum=_mm_setzero_si128();
+	acc.sum_sq=_mm_setzero_si128();
+}
+
+/* 8 pixels in 16 bit */
+static inline __m128i Laplace8(__m128i c, __m128i l, __m128i r, __m128i u, __m128i d) {
+	return(_mm_sub_epi16(_mm_slli_epi16(c, 2), _mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(u, d))));
+}
+
+static inline void LaplaceBlock(const uint8* src, int stride, LAPLACE_ACC& acc) {
+	const __m128i c=_mm_loadu_si128((const __m128i*)src);
+	const __m128i l=_mm_loadu_si128((const __m128i*)(src - 1));
+	const __m128i r=_mm_loadu_si128((const __m128i*)(src + 1));
+	const __m128i u=_mm_loadu_si128((const __m128i*)(src - stride));
+	const __m128i d=_mm_loadu_si128((const __m128i*)(src + stride));
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i lo=Laplace8(_mm_cvtepu8_epi16(c), _mm_cvtepu8_epi16(l), _mm_cvtepu8_epi16(r)
+			, _mm_cvtepu8_epi16(u), _mm_cvtepu8_epi16(d));
+	const __m128i hi=Laplace8(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero)
+			, _mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero));
+	const __m128i one=_mm_set1_epi16(1);
+	acc.sum=_mm_add_epi32(acc.sum, _mm_add_epi32(_mm_madd_epi16(lo, one), _mm_madd_epi16(hi, one)));
+	acc.sum_sq=_mm_add_epi32(acc.sum_sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+}
+
+static inline void LaplaceTotal(const LAPLACE_ACC& acc, int64_t* sum, uint64_t* sum_sq) {
+	int32 s[4];
+	uint32 sq[4];
+	_mm_storeu_si128((__m128i*)s, acc.sum);
+	_mm_storeu_si128((__m128i*)sq, acc.sum_sq);
+	for(int i=0; i<4; ++i) {
+		*sum+=s[i];
+		*sum_sq+=sq[i];
+	}
+}
+
+#include "kernels_impl.h"
+
+} /* namespace kernels_sse41 */
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace kernels_avx2 {
+
+/* the 16 pixels of a block in 256 bit: unpack and pack work per 128 bit lane,
+ * so the pixel order comes out as it went in */
+static inline void GrayBlock(const uint8* rgb, uint8* gray) {
+	GRAY_DEINTERLEAVE(rgb, r, g, b);
+	const __m256i r16=_mm256_cvtepu8_epi16(r);
+	const __m256i g16=_mm256_cvtepu8_epi16(g);
+	const __m256i b16=_mm256_cvtepu8_epi16(b);
+	const __m256i w_rg=_mm256_set1_epi32((GRAY_G << 16) | GRAY_R);
+	const __m256i w_b=_mm256_set1_epi32(((1 << (GRAY_SHIFT-1)) << 16) | GRAY_B);
+	const __m256i one=_mm256_set1_epi16(1);
+	const __m256i lo=_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r16, g16), w_rg)
+			, _mm256_madd_epi16(_mm256_unpacklo_epi16(b16, one), w_b));
+	const __m256i hi=_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r16, g16), w_rg)
+			, _mm256_madd_epi16(_mm256_unpackhi_epi16(b16, one), w_b));
+	const __m256i y16=_mm256_packs_epi32(_mm256_srli_epi32(lo, GRAY_SHIFT), _mm256_srli_epi32(hi, GRAY_SHIFT));
+	const __m128i y=_mm_packus_epi16(_mm256_castsi256_si128(y16), _mm256_extracti128_si256(y16, 1));
+	_mm_storeu_si128((__m128i*)gray, y);
+}
+
+static inline void InvertBlock(const uint8* src, uint8* dst) {
+	const __m128i v=_mm_loadu_si128((const __m128i*)src);
+	_mm_storeu_si128((__m128i*)dst, _mm_xor_si128(v, _mm_set1_epi8(-1)));
+}
+
+static inline void InvertBlock(const uint16* src, uint16* dst) {
+	const __m256i v=_mm256_loadu_si256((const __m256i*)src);
+	_mm256_storeu_si256((__m256i*)dst, _mm256_subs_epu16(_mm256_set1_epi16(255), v));
+}
+
+/* the increments are the bottleneck, wider loads do not help */
+static inline void HistBlock(const uint8* src, uint32 (*hist)[256]) {
+	const __m128i v=_mm_loadu_si128((const __m128i*)src);
+	HistWord(_mm_cvtsi128_si32(v), hist);
+	HistWord(_mm_extract_epi32(v, 1), hist);
+	HistWord(_mm_extract_epi32(v, 2), hist);
+	HistWord(_mm_extract_epi32(v, 3), hist);
+}
+
+struct LAPLACE_ACC {
+	__m256i sum;
+	__m256i sum_sq;
+};
+
+static inline void LaplaceInit(LAPLACE_ACC& acc) {
+	acc.sum=_mm256_setzero_si256();
+	acc.sum_sq=_mm256_setzero_si256();
+}
+
+/* the 16 pixels of a block in 16 bit */
+static inline void LaplaceBlock(const uint8* src, int stride, LAPLACE_ACC& acc) {
+	const __m256i c=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)src));
+	const __m256i l=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src - 1)));
+	const __m256i r=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + 1)));
+	const __m256i u=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src - stride)));
+	const __m256i d=_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + stride)));
+	const __m256i v=_mm256_sub_epi16(_mm256_slli_epi16(c, 2), _mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_add_epi16(u, d)));
+	acc.sum=_mm256_add_epi32(acc.sum, _mm256_madd_epi16(v, _mm256_set1_epi16(1)));
+	acc.sum_sq=_mm256_add_epi32(acc.sum_sq, _mm256_madd_epi16(v, v));
+}
+
+static inline void LaplaceTotal(const LAPLACE_ACC& acc, int64_t* sum, uint64_t* sum_sq) {
+	int32 s[8];
+	uint32 sq[8];
+	_mm256_storeu_si256((__m256i*)s, acc.sum);
+	_mm256_storeu_si256((__m256i*)sq, acc.sum_sq);
+	for(int i=0; i<8; ++i) {
+		*sum+=s[i];
+		*sum_sq+=sq[i];
+	}
+}
+
+#include "kernels_impl.h"
+
+} /* namespace kernels_avx2 */
+#pragma GCC pop_options
+
+#endif /* KERNELS_X86 */
+
+
+#ifdef KERNELS_NEON
+
+#ifdef KERNELS_NEON_PRAGMA
+#pragma GCC push_options
+#pragma GCC target("fpu=neon")
+#endif
+namespace kernels_neon {
+
+/* 4 pixels, rounding shift as OpenCV */
+static inline uint16x4_t Gray4(uint16x4_t r, uint16x4_t g, uint16x4_t b) {
+	uint32x4_t acc=vmull_n_u16(r, GRAY_R);
+	acc=vmlal_n_u16(acc, g, GRAY_G);
+	acc=vmlal_n_u16(acc, b, GRAY_B);
+	return(vrshrn_n_u32(acc, GRAY_SHIFT));
+}
+
+static inline void GrayBlock(const uint8* rgb, uint8* gray) {
+	const uint8x16x3_t v=vld3q_u8(rgb);
+	const uint16x8_t r_lo=vmovl_u8(vget_low_u8(v.val[0])), r_hi=vmovl_u8(vget_high_u8(v.val[0]));
+	const uint16x8_t g_lo=vmovl_u8(vget_low_u8(v.val[1])), g_hi=vmovl_u8(vget_high_u8(v.val[1]));
+	const uint16x8_t b_lo=vmovl_u8(vget_low_u8(v.val[2])), b_hi=vmovl_u8(vget_high_u8(v.val[2]));
+	const uint16x8_t y_lo=vcombine_u16(Gray4(vget_low_u16(r_lo), vget_low_u16(g_lo), vget_low_u16(b_lo))
+			, Gray4(vget_high_u16(r_lo), vget_high_u16(g_lo), vget_high_u16(b_lo)));
+	const uint16x8_t y_hi=vcombine_u16(Gray4(vget_low_u16(r_hi), vget_low_u16(g_hi), vget_low_u16(b_hi))
+			, Gray4(vget_high_u16(r_hi), vget_high_u16(g_hi), vget_high_u16(b_hi)));
+	vst1q_u8(gray, vcombine_u8(vmovn_u16(y_lo), vmovn_u16(y_hi)));
+}
+
+static inline void InvertBlock(const uint8* src, uint8* dst) {
+	vst1q_u8(dst, vmvnq_u8(vld1q_u8(src)));
+}
+
+static inline void InvertBlock(const uint16* src, uint16* dst) {
+	const uint16x8_t c=vdupq_n_u16(255);
+	vst1q_u16(dst, vqsubq_u16(c, vld1q_u16(src)));
+	vst1q_u16(dst + 8, vqsubq_u16(c, vld1q_u16(src + 8)));
+}
+
+static inline void HistBlock(const uint8* src, uint32 (*hist)[256]) {
+	const uint32x4_t v=vreinterpretq_u32_u8(vld1q_u8(src));
+	HistWord(vgetq_lane_u32(v, 0), hist);
+	HistWord(vgetq_lane_u32(v, 1), hist);
+	HistWord(vgetq_lane_u32(v, 2), hist);
+	HistWord(vgetq_lane_u32(v, 3), hist);
+}
+
+struct LAPLACE_ACC {
+	int32x4_t sum;
+	int32x4_t sum_sq;
+};
+
+static inline void LaplaceInit(LAPLACE_ACC& acc) {
+	acc.sum=vdupq_n_s32(0);
+	acc.sum_sq=vdupq_n_s32(0);
+}
+
+/* 8 pixels, the unsigned difference wraps to the signed value */
+static inline int16x8_t Laplace8(uint8x8_t c, uint8x8_t l, uint8x8_t r, uint8x8_t u, uint8x8_t d) {
+	return(vreinterpretq_s16_u16(vsubq_u16(vshll_n_u8(c, 2), vaddq_u16(vaddl_u8(l, r), vaddl_u8(u, d)))));
+}
+
+static inline void LaplaceBlock(const uint8* src, int stride, LAPLACE_ACC& acc) {
+	const uint8x16_t c=vld1q_u8(src);
+	const uint8x16_t l=vld1q_u8(src - 1);
+	const uint8x16_t r=vld1q_u8(src + 1);
+	const uint8x16_t u=vld1q_u8(src - stride);
+	const uint8x16_t d=vld1q_u8(src + stride);
+	const int16x8_t lo=Laplace8(vget_low_u8(c), vget_low_u8(l), vget_low_u8(r), vget_low_u8(u), vget_low_u8(d));
+	const int16x8_t hi=Laplace8(vget_high_u8(c), vget_high_u8(l), vget_high_u8(r), vget_high_u8(u), vget_high_u8(d));
+	acc.sum=vpadalq_s16(vpadalq_s16(acc.sum, lo), hi);
+	acc.sum_sq=vmlal_s16(acc.sum_sq, vget_low_s16(lo), vget_low_s16(lo));
+	acc.sum_sq=vmlal_s16(acc.sum_sq, vget_high_s16(lo), vget_high_s16(lo));
+	acc.sum_sq=vmlal_s16(acc.sum_sq, vget_low_s16(hi), vget_low_s16(hi));
+	acc.sum_sq=vmlal_s16(acc.sum_sq, vget_high_s16(hi), vget_high_s16(hi));
+}
+
+static inline void LaplaceTotal(const LAPLACE_ACC& acc, int64_t* sum, uint64_t* sum_sq) {
+	int32 s[4];
+	int32 sq[4];
+	vst1q_s32(s, acc.sum);
+	vst1q_s32(sq, acc.sum_sq);
+	for(int i=0; i<4; ++i) {
+		*sum+=s[i];
+		*sum_sq+=(uint32)sq[i];
+	}
+}
+
+#include "kernels_impl.h"
+
+} /* namespace kernels_neon */
+#ifdef KERNELS_NEON_PRAGMA
+#pragma GCC pop_options
+#endif
+
+#endif /* KERNELS_NEON */
+
+
+static const KERNEL_TABLE* const g_tables[KernelIsa_count]={
+	&kernels_scalar::g_table,
+#ifdef KERNELS_X86
+	&kernels_sse41::g_table,
+	&kernels_avx2::g_table,
+#else
+	NULL,
+	NULL,
+#endif
+#ifdef KERNELS_NEON
+	&kernels_neon::g_table
+#else
+	NULL
+#endif
+};
+
+static const char* const g_isa_names[KernelIsa_count]={ "scalar", "sse4.1", "avx2", "neon" };
+
+static volatile KernelIsa g_isa=KernelIsa_count; /* KernelIsa_count: not initialized */
+
+
+bool CKernels::IsSupported(KernelIsa isa) {
+	if(isa < 0 || isa >= KernelIsa_count || !g_tables[isa]) return(false);
+
+	switch(isa) {
+#ifdef KERNELS_X86
+	case KernelIsa_sse41:
+		__builtin_cpu_init();
+		return(__builtin_cpu_supports("sse4.1"));
+	case KernelIsa_avx2:
+		__builtin_cpu_init();
+		return(__builtin_cpu_supports("avx2"));
+#endif
+#ifdef KERNELS_NEON
+	case KernelIsa_neon:
+#ifdef KERNELS_NEON_PRAGMA
+		return((getauxval(AT_HWCAP) & HWCAP_NEON) != 0);
+#else
+		return(true);
+#endif
+#endif
+	default:
+		return(isa == KernelIsa_scalar);
+	}
+}
+
+KernelIsa CKernels::Init() {
+	KernelIsa isa=KernelIsa_scalar;
+	for(int i=KernelIsa_scalar+1; i<KernelIsa_count; ++i) {
+		if(IsSupported((KernelIsa)i)) isa=(KernelIsa)i;
+	}
+	g_isa=isa;
+	return(isa);
+}
+
+KernelIsa CKernels::getIsa() {
+	if(g_isa == KernelIsa_count) Init();
+	return(g_isa);
+}
+
+OSC_ERR CKernels::setIsa(KernelIsa isa) {
+	if(!IsSupported(isa)) return(EINVALID_PARAMETER);
+	g_isa=isa;
+	return(SUCCESS);
+}
+
+const char* CKernels::IsaName(KernelIsa isa) {
+	return(isa >= 0 && isa < KernelIsa_count ? g_isa_names[isa] : "unknown");
+}
+
+
+void CKernels::RgbToGray(const cv::Mat& src, cv::Mat& dst) {
+	if(src.type() != CV_8UC3 || src.data == dst.data) {
+		cv::cvtColor(src, dst, cv::COLOR_RGB2GRAY);
+		return;
+	}
+	dst.create(src.rows, src.cols, CV_8UC1);
+
+	int rows=src.rows, width=src.cols;
+	if(src.isContinuous() && dst.isContinuous()) {
+		width*=rows;
+		rows=1;
+	}
+	const GRAY_ROW row=g_tables[getIsa()]->gray[width%16 == 0];
+	for(int y=0; y<rows; ++y)
+		row(src.ptr<uint8>(y), dst.ptr<uint8>(y), width);
+}
+
+void CKernels::SubtractFrom255(const cv::Mat& src, cv::Mat& dst) {
+	const int depth=src.depth(), cn=src.channels();
+	if((depth != CV_8U && depth != CV_16U) || (cn != 1 && cn != 3)) {
+		cv::subtract(cv::Scalar::all(255), src, dst);
+		return;
+	}
+	dst.create(src.rows, src.cols, src.type());
+
+	int rows=src.rows, width=src.cols;
+	if(src.isContinuous() && dst.isContinuous()) {
+		width*=rows;
+		rows=1;
+	}
+	const KERNEL_TABLE* table=g_tables[getIsa()];
+	const bool bWidth16=width%16 == 0;
+	for(int y=0; y<rows; ++y) {
+		if(depth == CV_8U)
+			table->invert8[cn == 3][bWidth16](src.ptr<uint8>(y), dst.ptr<uint8>(y), width);
+		else
+			table->invert16[cn == 3][bWidth16](src.ptr<uint16>(y), dst.ptr<uint16>(y), width);
+	}
+}
+
+uint32 CKernels::Histogram(const cv::Mat& img, const cv::Rect& grid, int step_x, int step_y, uint32* hist) {
+	memset(hist, 0, 256*sizeof(uint32));
+	const int cn=img.channels();
+	const cv::Rect r=grid & cv::Rect(0, 0, img.cols, img.rows);
+	if(img.depth() != CV_8U || (cn != 1 && cn != 3) || r.width <= 0 || r.height <= 0 || step_x < 1 || step_y < 1)
+		return(0);
+
+	uint32 tables[HIST_TABLES][256];
+	memset(tables, 0, sizeof(tables));
+	uint8 samples[HIST_CHUNK];
+	const KERNEL_TABLE* table=g_tables[getIsa()];
+	const int width=(r.width + step_x - 1)/step_x;
+
+	uint32 count=0;
+	for(int y=r.y; y<r.y + r.height; y+=step_y) {
+		const uint8* row=img.ptr<uint8>(y) + r.x*cn;
+		for(int x=0; x<width; x+=HIST_CHUNK) {
+			const int n=std::min(HIST_CHUNK, width - x);
+			const uint8* src=samples;
+			if(step_x == 1 && cn == 1) {
+				src=row + x;
+			} else if(step_x == 1) {
+				table->gray[n%16 == 0](row + 3*x, samples, n);
+			} else {
+				const uint8* p=row + x*step_x*cn;
+				for(int i=0; i<n; ++i, p+=step_x*cn)
+					samples[i]=(cn == 1 ? *p : GrayPixel(p));
+			}
+			table->hist[n%16 == 0](src, tables, n);
+		}
+		count+=width;
+	}
+
+	for(int v=0; v<256; ++v)
+		hist[v]=tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+	return(count);
+}
+
+uint32 CKernels::Laplacian(const cv::Mat& img, const cv::Rect& grid, int step_y, int64_t* sum, uint64_t* sum_sq) {
+	*sum=0;
+	*sum_sq=0;
+	const int cn=img.channels();
+	/* the neighbours of every pixel must be in the image */
+	const cv::Rect r=grid & cv::Rect(1, 1, img.cols - 2, img.rows - 2);
+	if(img.depth() != CV_8U || (cn != 1 && cn != 3) || r.width <= 0 || r.height <= 0 || step_y < 1)
+		return(0);
+
+	/* RGB: gray of the row and the rows above and below, with the pixels left and right */
+	uint8 gray[3][LAPLACE_CHUNK + 2];
+	const KERNEL_TABLE* table=g_tables[getIsa()];
+
+	uint32 count=0;
+	for(int y=r.y; y<r.y + r.height; y+=step_y) {
+		for(int x=r.x; x<r.x + r.width; x+=LAPLACE_CHUNK) {
+			const int n=std::min(LAPLACE_CHUNK, r.x + r.width - x);
+			if(cn == 1) {
+				table->laplace[n%16 == 0](img.ptr<uint8>(y) + x, (int)img.step, n, sum, sum_sq);
+			} else {
+				for(int i=0; i<3; ++i)
+					table->gray[(n + 2)%16 == 0](img.ptr<uint8>(y - 1 + i) + 3*(x - 1), gray[i], n + 2);
+				table->laplace[n%16 == 0](gray[1] + 1, (int)sizeof(gray[0]), n, sum, sum_sq);
+			}
+		}
+		count+=r.width;
+	}
+	return(count);
+}
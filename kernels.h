@@ -0,0 +1,66 @@
+/*! @file kernels.h
+ * @brief Image kernels of the frame path with a variant per instruction set
+ *  The row loops are templates specialized on channel count, pixel type and
+ *  whether the row length is a multiple of 16 (no scalar tail). They are
+ *  compiled once per instruction set (see kernels_impl.h); the variant of the
+ *  best instruction set the CPU supports is picked at the first use, so one
+ *  binary runs on all CPUs of a board family.
+ *  Results are bit exact to the OpenCV 3.0 functions they replace.
+ */
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <stdint.h>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+enum KernelIsa {
+	KernelIsa_scalar,
+	KernelIsa_sse41,
+	KernelIsa_avx2,
+	KernelIsa_neon,
+	KernelIsa_count
+};
+
+
+class CKernels {
+public:
+	/*! @brief select the best variant the CPU supports, returns it */
+	static KernelIsa Init();
+
+	/*! @brief variant in use */
+	static KernelIsa getIsa();
+	/*! @brief force a variant (benchmarks), fails if it is not compiled in or not supported */
+	static OSC_ERR setIsa(KernelIsa isa);
+	/*! @brief the variant is compiled in and the CPU supports it */
+	static bool IsSupported(KernelIsa isa);
+	static const char* IsaName(KernelIsa isa);
+
+	/*! @brief RGB to gray as cv::cvtColor(src, dst, cv::COLOR_RGB2GRAY)
+	 * 8 bit RGB takes the fast path, anything else is passed to OpenCV
+	 */
+	static void RgbToGray(const cv::Mat& src, cv::Mat& dst);
+
+	/*! @brief dst=saturate(255 - src) as cv::subtract(cv::Scalar::all(255), src, dst)
+	 * 8 and 16 bit unsigned with 1 or 3 channels take the fast path
+	 */
+	static void SubtractFrom255(const cv::Mat& src, cv::Mat& dst);
+
+	/*! @brief 256 bin histogram of the samples at (grid.x + i*step_x, grid.y + j*step_y) within grid
+	 * 8 bit gray, or RGB counted as its gray value (RgbToGray). hist is overwritten.
+	 * returns the number of samples, 0 for other image types
+	 */
+	static uint32 Histogram(const cv::Mat& img, const cv::Rect& grid, int step_x, int step_y, uint32* hist);
+
+	/*! @brief sum and sum of squares of the 4-neighbour Laplacian on the rows grid.y + j*step_y within grid
+	 * 8 bit gray, or RGB as its gray value (RgbToGray). The image border is left out.
+	 * returns the number of pixels, 0 for other image types
+	 */
+	static uint32 Laplacian(const cv::Mat& img, const cv::Rect& grid, int step_y, int64_t* sum, uint64_t* sum_sq);
+};
+
+
+#endif /* KERNELS_H_ */
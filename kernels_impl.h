@@ -0,0 +1,80 @@
+/*! @file kernels_impl.h
+ * @brief Row loops of the image kernels, included by kernels.cpp once per
+ *  instruction set inside the namespace of that instruction set
+ *  The namespace provides the blocks of 16 elements:
+ *    void GrayBlock(const uint8* rgb, uint8* gray);
+ *    void InvertBlock(const uint8* src, uint8* dst);
+ *    void InvertBlock(const uint16* src, uint16* dst);
+ *    void HistBlock(const uint8* src, uint32 (*hist)[256]);
+ *    void LaplaceBlock(const uint8* src, int stride, LAPLACE_ACC& acc);
+ *  with LaplaceInit and LaplaceTotal for the accumulator LAPLACE_ACC, and
+ *  the pixel functions GrayPixel, InvertPixel and LaplacePixel for the tails.
+ *  No include guard: included several times on purpose.
+ */
+
+
+template<int CN, typename T, bool bWidth16>
+static void GrayRow(const T* src, T* dst, int width) {
+	int x=0;
+	for(; x+16<=width; x+=16)
+		GrayBlock(src + CN*x, dst + x);
+	if(!bWidth16) {
+		for(; x<width; ++x)
+			dst[x]=GrayPixel(src + CN*x);
+	}
+}
+
+template<int CN, typename T, bool bWidth16>
+static void InvertRow(const T* src, T* dst, int width) {
+	const int n=CN*width;
+	int x=0;
+	for(; x+16<=n; x+=16)
+		InvertBlock(src + x, dst + x);
+	if(!bWidth16) {
+		for(; x<n; ++x)
+			dst[x]=InvertPixel(src[x]);
+	}
+}
+
+template<bool bWidth16>
+static void HistRow(const uint8* src, uint32 (*hist)[256], int width) {
+	int x=0;
+	for(; x+16<=width; x+=16)
+		HistBlock(src + x, hist);
+	if(!bWidth16) {
+		for(; x<width; ++x)
+			++hist[x % HIST_TABLES][src[x]];
+	}
+}
+
+template<bool bWidth16>
+static void LaplaceRow(const uint8* src, int stride, int width, int64_t* sum, uint64_t* sum_sq) {
+	LAPLACE_ACC acc;
+	LaplaceInit(acc);
+	int x=0;
+	for(; x+16<=width; x+=16)
+		LaplaceBlock(src + x, stride, acc);
+	LaplaceTotal(acc, sum, sum_sq);
+	if(!bWidth16) {
+		for(; x<width; ++x) {
+			const int v=LaplacePixel(src + x, stride);
+			*sum+=v;
+			*sum_sq+=v*v;
+		}
+	}
+}
+
+
+static const KERNEL_TABLE g_table={
+	{ GrayRow<3, uint8, false>, GrayRow<3, uint8, true> },
+	{
+		{ InvertRow<1, uint8, false>, InvertRow<1, uint8, true> },
+		{ InvertRow<3, uint8, false>, InvertRow<3, uint8, true> }
+	},
+	{
+		{ InvertRow<1, uint16, false>, InvertRow<1, uint16, true> },
+		{ InvertRow<3, uint16, false>, InvertRow<3, uint16, true> }
+	},
+	{ HistRow<false>, HistRow<true> },
+	{ LaplaceRow<false>, LaplaceRow<true> }
+};
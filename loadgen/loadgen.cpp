@@ -0,0 +1,472 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file loadgen.cpp
+ * @brief Load generator for the IPC socket of the application
+ *  Simulates many viewers: every client is a thread that connects to
+ *  CGI_SOCKET_PATH like the CGI does, one request per connection, with a
+ *  weighted mix of request types. Reports latency percentiles, throughput
+ *  and errors per request type, and the frame rate of the application under
+ *  the load (from GetStats before and after the run).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "../cgi/cgi.h"
+
+
+#define LOADGEN_MAX_CLIENTS 256
+#define LOADGEN_MAX_TYPES 8
+#define LOADGEN_DEFAULT_CLIENTS 8
+#define LOADGEN_DEFAULT_SECONDS 10
+#define LOADGEN_DEFAULT_MIX "GetImage:8,GetImageInfo:1,SetOptions:1"
+/* a request not answered within this time counts as error */
+#define LOADGEN_TIMEOUT_S 5
+/* clientId of the first client, the next ones count up */
+#define LOADGEN_CLIENT_ID_BASE 1000
+#define LOADGEN_READ_SIZE 65536
+
+
+enum LoadError {
+	LoadError_connect, // connect failed (application down or its backlog full)
+	LoadError_io, // write or read failed or timed out
+	LoadError_reply, // empty, malformed or truncated reply
+	LoadError_count
+};
+
+static const char* g_error_names[LoadError_count]={ "connect", "io", "reply" };
+
+struct REQUEST_TYPE {
+	std::string name; /* header line of the text protocol */
+	int weight;
+	bool bClientId; /* send the clientId of the simulated viewer */
+	std::string args; /* "key: value" lines */
+};
+
+struct TYPE_RESULT {
+	std::vector<uint32_t> latencies_us; /* of the successful requests */
+	uint64_t errors[LoadError_count];
+	uint64_t bytes;
+};
+
+struct CLIENT {
+	pthread_t thread;
+	int index;
+	unsigned int seed;
+	TYPE_RESULT results[LOADGEN_MAX_TYPES];
+	std::vector<char> reply;
+};
+
+struct LOADGEN_OPTIONS {
+	int clients;
+	double seconds;
+	double rate; /* requests/s per client, 0: next request as soon as the reply is in */
+	bool bJson;
+	std::vector<REQUEST_TYPE> types;
+	int total_weight;
+};
+
+/* counters of GetStats */
+struct APP_STATS {
+	bool bValid;
+	double framesCaptured;
+	double framesDropped;
+	double framesServed;
+	double deadlineMisses;
+};
+
+
+static LOADGEN_OPTIONS g_opt;
+static double g_end_time;
+
+
+static double Now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec*1e-9);
+}
+
+static void SleepUntil(double t) {
+	struct timespec ts;
+	ts.tv_sec=(time_t)t;
+	ts.tv_nsec=(long)((t - ts.tv_sec)*1e9);
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+
+static int Connect() {
+	int fd=socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0) return(-1);
+
+	struct timeval tv;
+	tv.tv_sec=LOADGEN_TIMEOUT_S;
+	tv.tv_usec=0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	struct sockaddr_un servaddr;
+	servaddr.sun_family=AF_UNIX;
+	strncpy(servaddr.sun_path, CGI_SOCKET_PATH, sizeof servaddr.sun_path);
+	if(connect(fd, (struct sockaddr *) &servaddr, SUN_LEN(&servaddr)) != 0) {
+		close(fd);
+		return(-1);
+	}
+	return(fd);
+}
+
+static bool WriteAll(int fd, const char* data, size_t count) {
+	while(count > 0) {
+		ssize_t ret=write(fd, data, count);
+		if(ret < 0) {
+			if(errno == EINTR) continue;
+			return(false);
+		}
+		data+=ret;
+		count-=ret;
+	}
+	return(true);
+}
+
+/* a whole reply has a header, and as much content as the header announces */
+static bool CheckReply(const char* reply, size_t length) {
+	const char* end=NULL;
+	size_t header_length=0;
+	for(size_t i=0; i+1<length && !end; ++i) {
+		if(reply[i] == '\n' && reply[i+1] == '\n') header_length=i+2;
+		else if(i+3 < length && memcmp(reply+i, "\r\n\r\n", 4) == 0) header_length=i+4;
+		if(header_length) end=reply+header_length;
+	}
+	if(!end) return(false);
+
+	static const char content_length[]="Content-Length:";
+	if(header_length >= sizeof(content_length) && strncmp(reply, content_length, sizeof(content_length)-1) == 0)
+		return((size_t)atol(reply + sizeof(content_length)-1) == length - header_length);
+	return(true);
+}
+
+/* one request on its own connection, returns false and the error on failure */
+static bool Exchange(const std::string& request, std::vector<char>& reply, size_t& reply_length
+		, LoadError& error) {
+
+	int fd=Connect();
+	if(fd < 0) {
+		error=LoadError_connect;
+		return(false);
+	}
+
+	bool bOk=WriteAll(fd, request.data(), request.size()) && shutdown(fd, SHUT_WR) == 0;
+	reply_length=0;
+	while(bOk) {
+		if(reply.size() < reply_length + LOADGEN_READ_SIZE)
+			reply.resize(reply_length + LOADGEN_READ_SIZE);
+		ssize_t ret=read(fd, &reply[reply_length], reply.size() - reply_length);
+		if(ret == 0) break;
+		if(ret < 0) {
+			if(errno == EINTR) continue;
+			bOk=false;
+		} else {
+			reply_length+=ret;
+		}
+	}
+	close(fd);
+
+	if(!bOk) {
+		error=LoadError_io;
+		return(false);
+	}
+	if(!CheckReply(reply.empty() ? NULL : &reply[0], reply_length)) {
+		error=LoadError_reply;
+		return(false);
+	}
+	return(true);
+}
+
+static std::string BuildRequest(const REQUEST_TYPE& type, int client_index) {
+	std::string request=type.name + "\n" + type.args;
+	if(type.bClientId) {
+		char line[48];
+		snprintf(line, sizeof(line), "clientId: %d\n", LOADGEN_CLIENT_ID_BASE + client_index);
+		request+=line;
+	}
+	return(request);
+}
+
+static int PickType(unsigned int* seed) {
+	int r=rand_r(seed) % g_opt.total_weight;
+	for(size_t i=0; i<g_opt.types.size(); ++i) {
+		if(r < g_opt.types[i].weight) return((int)i);
+		r-=g_opt.types[i].weight;
+	}
+	return(0);
+}
+
+static void* ClientThread(void* arg) {
+	CLIENT* client=(CLIENT*)arg;
+
+	std::vector<std::string> requests;
+	for(size_t i=0; i<g_opt.types.size(); ++i)
+		requests.push_back(BuildRequest(g_opt.types[i], client->index));
+
+	/* spread the clients over the first interval in open loop mode */
+	double next=Now();
+	if(g_opt.rate > 0) next+=(double)client->index/g_opt.clients/g_opt.rate;
+
+	while(next < g_end_time) {
+		if(g_opt.rate > 0) SleepUntil(next);
+
+		const int t=PickType(&client->seed);
+		TYPE_RESULT& result=client->results[t];
+		size_t length;
+		LoadError error;
+		/* measured from the planned start: a late answer delays the following requests */
+		const double start=g_opt.rate > 0 ? next : Now();
+		if(Exchange(requests[t], client->reply, length, error)) {
+			result.latencies_us.push_back((uint32_t)((Now() - start)*1e6));
+			result.bytes+=length;
+		} else {
+			++result.errors[error];
+		}
+
+		if(g_opt.rate > 0) next+=1/g_opt.rate;
+		else next=Now();
+	}
+	return(NULL);
+}
+
+
+/* GetStats over the text protocol */
+static void ReadAppStats(APP_STATS& stats) {
+	std::vector<char> reply;
+	size_t length;
+	LoadError error;
+	stats.bValid=false;
+	if(!Exchange("GetStats\n", reply, length, error)) return;
+
+	std::string text(&reply[0], length);
+	struct { const char* key; double* value; } fields[]={
+		{ "\nframesCaptured: ", &stats.framesCaptured },
+		{ "\nframesDropped: ", &stats.framesDropped },
+		{ "\nframesServed: ", &stats.framesServed },
+		{ "\ndeadlineMisses: ", &stats.deadlineMisses }
+	};
+	for(size_t i=0; i<sizeof(fields)/sizeof(fields[0]); ++i) {
+		size_t pos=text.find(fields[i].key);
+		if(pos == std::string::npos) return;
+		*fields[i].value=atof(text.c_str() + pos + strlen(fields[i].key));
+	}
+	stats.bValid=true;
+}
+
+
+/* "Type:weight,Type:weight" */
+static bool ParseMix(const char* str) {
+	static const char* const known[]={ "GetImage", "GetImageInfo", "SetOptions", "GetSystemInfo", "GetStats", NULL };
+	g_opt.types.clear();
+	g_opt.total_weight=0;
+	while(*str) {
+		const char* colon=strchr(str, ':');
+		if(!colon || g_opt.types.size() == LOADGEN_MAX_TYPES) return(false);
+		REQUEST_TYPE type;
+		type.name.assign(str, colon - str);
+		char* end;
+		type.weight=(int)strtol(colon+1, &end, 10);
+		if(end == colon+1 || type.weight < 0) return(false);
+
+		bool bKnown=false;
+		for(int i=0; known[i]; ++i) bKnown|=type.name == known[i];
+		if(!bKnown) return(false);
+		/* clientId lets the rate control see every simulated viewer separately */
+		type.bClientId=type.name == "GetImage" || type.name == "GetImageInfo";
+
+		g_opt.total_weight+=type.weight;
+		g_opt.types.push_back(type);
+		str=end;
+		if(*str == ',') ++str;
+		else if(*str) return(false);
+	}
+	return(g_opt.total_weight > 0);
+}
+
+/* "key:value,key:value" as "key: value" lines for the requests of a type */
+static bool SetArgs(const char* type_name, const char* str) {
+	std::string lines;
+	while(*str) {
+		const char* colon=strchr(str, ':');
+		if(!colon) return(false);
+		const char* comma=strchr(colon, ',');
+		if(!comma) comma=str + strlen(str);
+		lines+=std::string(str, colon - str) + ": " + std::string(colon+1, comma - colon - 1) + "\n";
+		str=*comma ? comma+1 : comma;
+	}
+	for(size_t i=0; i<g_opt.types.size(); ++i)
+		if(g_opt.types[i].name == type_name) g_opt.types[i].args=lines;
+	return(true);
+}
+
+
+static void Percentiles(std::vector<uint32_t>& v, double& p50, double& p90, double& p99, double& max) {
+	p50=p90=p99=max=0;
+	if(v.empty()) return;
+	std::sort(v.begin(), v.end());
+	p50=v[(v.size()-1)*50/100]*1e-3;
+	p90=v[(v.size()-1)*90/100]*1e-3;
+	p99=v[(v.size()-1)*99/100]*1e-3;
+	max=v.back()*1e-3;
+}
+
+static void PrintResults(const TYPE_RESULT* results, double seconds, const APP_STATS& before
+		, const APP_STATS& after) {
+
+	const bool bJson=g_opt.bJson;
+	if(bJson) printf("{\"clients\":%d,\"seconds\":%.3f,\"rate\":%.2f,\"types\":{", g_opt.clients, seconds, g_opt.rate);
+	else printf("%-14s %8s %9s %8s %8s %8s %8s %8s %9s\n", "request", "count", "req/s", "errors"
+			, "p50 ms", "p90 ms", "p99 ms", "max ms", "MB/s");
+
+	for(size_t t=0; t<g_opt.types.size(); ++t) {
+		const TYPE_RESULT& r=results[t];
+		std::vector<uint32_t> latencies=r.latencies_us;
+		double p50, p90, p99, max;
+		Percentiles(latencies, p50, p90, p99, max);
+		uint64_t errors=0;
+		for(int e=0; e<LoadError_count; ++e) errors+=r.errors[e];
+		const double count=(double)latencies.size();
+
+		if(bJson) {
+			printf("%s\"%s\":{\"count\":%.0f,\"rate\":%.2f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f"
+					",\"max_ms\":%.3f,\"bytes\":%llu,\"errors\":{", t ? "," : "", g_opt.types[t].name.c_str()
+					, count, count/seconds, p50, p90, p99, max, (unsigned long long)r.bytes);
+			for(int e=0; e<LoadError_count; ++e)
+				printf("%s\"%s\":%llu", e ? "," : "", g_error_names[e], (unsigned long long)r.errors[e]);
+			printf("}}");
+		} else {
+			printf("%-14s %8.0f %9.1f %8llu %8.2f %8.2f %8.2f %8.2f %9.2f\n", g_opt.types[t].name.c_str()
+					, count, count/seconds, (unsigned long long)errors, p50, p90, p99, max, r.bytes/seconds*1e-6);
+			if(errors > 0) {
+				printf("%14s", "");
+				for(int e=0; e<LoadError_count; ++e)
+					printf(" %s: %llu", g_error_names[e], (unsigned long long)r.errors[e]);
+				printf("\n");
+			}
+		}
+	}
+
+	const bool bApp=before.bValid && after.bValid;
+	if(bJson) {
+		printf("}");
+		if(bApp)
+			printf(",\"app\":{\"captured_fps\":%.2f,\"served_fps\":%.2f,\"dropped\":%.0f,\"deadline_misses\":%.0f}"
+					, (after.framesCaptured - before.framesCaptured)/seconds
+					, (after.framesServed - before.framesServed)/seconds
+					, after.framesDropped - before.framesDropped, after.deadlineMisses - before.deadlineMisses);
+		printf("}\n");
+	} else if(bApp) {
+		printf("application: %.1f fps captured, %.1f images/s served, %.0f frames dropped, %.0f deadline misses\n"
+				, (after.framesCaptured - before.framesCaptured)/seconds
+				, (after.framesServed - before.framesServed)/seconds
+				, after.framesDropped - before.framesDropped, after.deadlineMisses - before.deadlineMisses);
+	} else {
+		printf("application: no statistics (GetStats failed)\n");
+	}
+}
+
+
+static void Usage(const char* name) {
+	fprintf(stderr, "usage: %s [-c clients] [-d seconds] [-r requests/s per client] [-m mix]\n"
+			"\t[-i GetImage args] [-s SetOptions args] [-o text|json]\n"
+			"  mix: Type:weight[,Type:weight]... (default " LOADGEN_DEFAULT_MIX ")\n"
+			"  args: key:value[,key:value]... e.g. -i format:qoi,perspective:1\n"
+			"  -r 0 (default): every client sends its next request as soon as it has the reply\n", name);
+}
+
+int main(int argc, char ** argv) {
+	g_opt.clients=LOADGEN_DEFAULT_CLIENTS;
+	g_opt.seconds=LOADGEN_DEFAULT_SECONDS;
+	g_opt.rate=0;
+	g_opt.bJson=false;
+	ParseMix(LOADGEN_DEFAULT_MIX);
+	const char* image_args="";
+	const char* options_args="";
+
+	int c;
+	bool bValid=true;
+	while(bValid && (c=getopt(argc, argv, "c:d:r:m:i:s:o:")) != -1) {
+		switch(c) {
+		case 'c': g_opt.clients=atoi(optarg); bValid=g_opt.clients > 0 && g_opt.clients <= LOADGEN_MAX_CLIENTS; break;
+		case 'd': g_opt.seconds=atof(optarg); bValid=g_opt.seconds > 0; break;
+		case 'r': g_opt.rate=atof(optarg); bValid=g_opt.rate >= 0; break;
+		case 'm': bValid=ParseMix(optarg); break;
+		case 'i': image_args=optarg; break;
+		case 's': options_args=optarg; break;
+		case 'o':
+			g_opt.bJson=strcmp(optarg, "json") == 0;
+			bValid=g_opt.bJson || strcmp(optarg, "text") == 0;
+			break;
+		default: bValid=false; break;
+		}
+	}
+	if(!bValid || optind < argc || !SetArgs("GetImage", image_args) || !SetArgs("SetOptions", options_args)) {
+		Usage(argv[0]);
+		return(1);
+	}
+
+	APP_STATS before, after;
+	ReadAppStats(before);
+	if(!before.bValid) fprintf(stderr, "Warning: GetStats failed, is the application running?\n");
+
+	std::vector<CLIENT> clients(g_opt.clients);
+	const double start=Now();
+	g_end_time=start + g_opt.seconds;
+	int started=0;
+	for(int i=0; i<g_opt.clients; ++i) {
+		CLIENT& client=clients[i];
+		client.index=i;
+		client.seed=(unsigned int)(start*1000) + i;
+		for(int t=0; t<LOADGEN_MAX_TYPES; ++t) {
+			memset(client.results[t].errors, 0, sizeof(client.results[t].errors));
+			client.results[t].bytes=0;
+		}
+		if(pthread_create(&client.thread, NULL, ClientThread, &client) != 0) {
+			fprintf(stderr, "Could not start client %d: %s\n", i, strerror(errno));
+			break;
+		}
+		++started;
+	}
+	for(int i=0; i<started; ++i)
+		pthread_join(clients[i].thread, NULL);
+	const double seconds=Now() - start;
+
+	ReadAppStats(after);
+
+	/* merge the clients */
+	TYPE_RESULT total[LOADGEN_MAX_TYPES];
+	for(size_t t=0; t<g_opt.types.size(); ++t) {
+		memset(total[t].errors, 0, sizeof(total[t].errors));
+		total[t].bytes=0;
+		for(int i=0; i<started; ++i) {
+			const TYPE_RESULT& r=clients[i].results[t];
+			total[t].latencies_us.insert(total[t].latencies_us.end(), r.latencies_us.begin(), r.latencies_us.end());
+			for(int e=0; e<LoadError_count; ++e) total[t].errors[e]+=r.errors[e];
+			total[t].bytes+=r.bytes;
+		}
+	}
+
+	PrintResults(total, seconds, before, after);
+	return(0);
+}
@@ -2,13 +2,23 @@
 #include "main_class.h"
 #include "version.h"
 #include "ipc.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "mat_arena.h"
+#include "kernels.h"
+#include "frame_sync.h"
 
 
 
 #include <unistd.h>
+#include <getopt.h>
+#include <algorithm>
 
 
-CMain::CMain() {
+CMain::CMain() : m_camera_count(1), m_sync_tolerance_us(-1), m_history_seconds(0)
+	, m_history_budget_mb(HISTORY_DEFAULT_BUDGET_MB), m_history_format(ImageFormat_jpeg)
+	, m_bPipelined(false), m_capture_policy(QueuePolicy_dropOldest)
+	, m_process_policy(QueuePolicy_dropOldest), m_last_heap_allocations(0), m_last_frames(0) {
 }
 
 
@@ -18,6 +28,14 @@ CMain::~CMain() {
 
 
 
+/* "block" or "drop" */
+static bool ParseQueuePolicy(const char* str, QueuePolicy& policy) {
+	if(strncmp(str, "block", 5) == 0) policy=QueuePolicy_block;
+	else if(strncmp(str, "drop", 4) == 0) policy=QueuePolicy_dropOldest;
+	else return(false);
+	return(true);
+}
+
 OSC_ERR CMain::Init(int argc, char ** argv) {
 	
 	OSC_ERR err;
@@ -29,15 +47,98 @@ OSC_ERR CMain::Init(int argc, char ** argv) {
 			&OscModule_sup, 
 			&OscModule_bmp, 
 			&OscModule_cam,  
-			&OscModule_vis
-			//,&OscModule_gpio
+			&OscModule_vis,
+			&OscModule_gpio
 			))!=SUCCESS)
 		return(err);
 	
-	if(argc == 1) {
+	/* options: [-f fps] [-l] [-p] [-q capture,process] [-t] [-T thread config]... [-m] [-x trigger]
+	 *  [-C picture]... [-S us] [-H seconds[,MB[,format]]] [-R prefix[,MB[,seconds[,format]]]] [log level] */
+	double fps=MAIN_LOOP_DEFAULT_FPS;
+	bool bLowLatency=false;
+	const char* comma;
+	int opt;
+	while((opt=getopt(argc, argv, "f:lpq:tT:mx:C:S:H:R:")) != -1) {
+		switch(opt) {
+		case 'f': /* target frame rate, 0: as fast as possible */
+			fps=atof(optarg);
+			break;
+		case 'l': /* start an iteration as soon as a frame is ready */
+			bLowLatency=true;
+			break;
+		case 'T': /* thread placement: <capture|process|serve>=<cpu|*>[/fifo:<prio>|/nice:<level>] */
+			if(m_thread_config.Parse(optarg) == SUCCESS)
+				break;
+			fprintf(stderr, "invalid thread configuration '%s'\n", optarg);
+			return(EINVALID_PARAMETER);
+		case 'm': /* lock the memory, frame buffers must not be paged out */
+			m_thread_config.setMemoryLock(true);
+			break;
+		case 'x': /* capture on an edge of in1|in2 (rising, or ",falling"), the loop polls the input */
+			if(m_cameras[0].getTrigger().Parse(optarg) == SUCCESS)
+				break;
+			fprintf(stderr, "invalid trigger '%s'\n", optarg);
+			return(EINVALID_PARAMETER);
+		case 'C': /* one more camera, replaying a picture file at the frame rate */
+			if(m_camera_count < MAX_CAMERAS) {
+				m_camera_files[m_camera_count++]=optarg;
+				break;
+			}
+			fprintf(stderr, "at most %d cameras\n", MAX_CAMERAS);
+			return(EINVALID_PARAMETER);
+		case 'S': /* frames of the cameras within this many us are served together, 0: unpaired */
+			m_sync_tolerance_us=atoi(optarg);
+			if(m_sync_tolerance_us >= 0)
+				break;
+			fprintf(stderr, "invalid sync tolerance '%s'\n", optarg);
+			return(EINVALID_PARAMETER);
+		case 'H': /* keep the camera images of the last seconds (see GetBurst), format: jpeg|raw|qoi */
+			m_history_seconds=atoi(optarg);
+			comma=strchr(optarg, ',');
+			if(comma) {
+				m_history_budget_mb=atoi(comma+1);
+				comma=strchr(comma+1, ',');
+			}
+			if(comma) {
+				if(strcmp(comma+1, "raw") == 0) m_history_format=ImageFormat_raw;
+				else if(strcmp(comma+1, "qoi") == 0) m_history_format=ImageFormat_qoi;
+				else if(strcmp(comma+1, "jpeg") != 0) m_history_seconds=0;
+			}
+			if(m_history_seconds > 0 && m_history_budget_mb > 0)
+				break;
+			fprintf(stderr, "invalid history '%s'\n", optarg);
+			return(EINVALID_PARAMETER);
+		case 'R': /* record to files prefix-*.wvr, limited in size [MB] and duration [s], format: jpeg|raw|qoi */
+			if(m_recorder.Parse(optarg) == SUCCESS)
+				break;
+			fprintf(stderr, "invalid recording '%s'\n", optarg);
+			return(EINVALID_PARAMETER);
+		case 't': /* record a trace from the start (see DumpTrace) */
+			CTrace::Enable(true);
+			break;
+		case 'p': /* capture, process and serve on separate threads */
+			m_bPipelined=true;
+			break;
+		case 'q': /* policies of the queues after the capture and the process stage */
+			comma=strchr(optarg, ',');
+			if(ParseQueuePolicy(optarg, m_capture_policy)
+					&& (!comma || ParseQueuePolicy(comma+1, m_process_policy)))
+				break;
+			/* no break */
+		default:
+			fprintf(stderr, "usage: %s [-f fps] [-l] [-p] [-q block|drop[,block|drop]] [-t]"
+					" [-T role=cpu[/fifo:prio|/nice:level]]... [-m] [-x in1|in2[,falling]]"
+					" [-C picture]... [-S us] [-H seconds[,MB[,jpeg|raw|qoi]]]"
+					" [-R prefix[,MB[,seconds[,jpeg|raw|qoi]]]] [log level]\n", argv[0]);
+			return(EINVALID_PARAMETER);
+		}
+	}
+	m_pacer.Init(fps, bLowLatency);
+	
+	if(optind >= argc) {
             OscLogSetConsoleLogLevel(NOTICE);
         } else {
-            enum EnOscLogLevel level = (EnOscLogLevel) atol(argv[1]);
+            enum EnOscLogLevel level = (EnOscLogLevel) atol(argv[optind]);
             printf("setting log level to %d", level);
             OscLogSetConsoleLogLevel(level);
         }
@@ -58,10 +159,27 @@ OSC_ERR CMain::Init(int argc, char ** argv) {
 	
 
 	/* init the camera */
-	if((err=m_camera.Init(ROI(), 3))!=SUCCESS)
+	if((err=m_cameras[0].Init(ROI(), 3))!=SUCCESS)
 		return(err);
 	
-	m_camera.setAutoExposure(true);
+	m_cameras[0].setAutoExposure(true);
+	
+	if(m_camera_count > 1) {
+		/* free running cameras of the same rate always have frames within half a period */
+		if(m_sync_tolerance_us < 0)
+			m_sync_tolerance_us=fps > 0 ? (int)(500000/fps) : FRAME_SYNC_DEFAULT_TOLERANCE_US;
+		for(int c=1; c<m_camera_count; ++c) {
+			if((err=m_cameras[c].InitFileSource(m_camera_files[c], fps)) != SUCCESS)
+				return(err);
+		}
+		/* every camera has its own pipeline, the processing shares one pool of threads */
+		m_bPipelined=true;
+		if(m_process_pool.Init() == SUCCESS) {
+			for(int c=0; c<m_camera_count; ++c)
+				m_img_process[c].setPool(&m_process_pool);
+		}
+		OscLog(INFO, "%d cameras, frames within %d us are served together\n", m_camera_count, m_sync_tolerance_us);
+	}
 	
 	
 	char* osc_version;
@@ -69,6 +187,7 @@ OSC_ERR CMain::Init(int argc, char ** argv) {
             string welcome_msg="###  "APP_NAME" "+getAppVersion().toStr()+"  OSCAR "+osc_version+"  ###\n";
             OscLog(INFO, welcome_msg.c_str());
         }
+	OscLog(INFO, "Image kernels: %s\n", CKernels::IsaName(CKernels::Init()));
 	
 	
 	return(SUCCESS);
@@ -76,66 +195,174 @@ OSC_ERR CMain::Init(int argc, char ** argv) {
 
 OSC_ERR CMain::MainLoop() {
 	OSC_ERR err=SUCCESS;
+	/* the loop without pipeline runs camera 0 only */
+	CCamera& camera=m_cameras[0];
+	CImageProcessor& img_process=m_img_process[0];
+	
+	/* the writer must not inherit the priority of the serve thread, it may wait for the disk */
+	/* the recording queue takes several frames of every camera, debayered at most 3 bytes per pixel */
+	size_t frame_bytes=0;
+	for(int c=0; c<m_camera_count; ++c)
+		frame_bytes+=(size_t)m_cameras[c].getROI().width*m_cameras[c].getROI().height*3;
+	if(m_recorder.IsConfigured() && (err=m_recorder.Start(frame_bytes)) != SUCCESS) {
+		OscLog(ERROR, "Could not start the recorder (Error=%i)\n", err);
+		return(err);
+	}
+	
+	/* before CIPC starts its worker threads: they inherit the settings of the serve thread */
+	m_thread_config.Apply(ThreadRole_serve);
+	m_thread_config.LockMemory();
 	
-	CIPC ipc(m_camera, m_img_process);
+	CIPC ipc(m_cameras, m_camera_count);
 	err=ipc.Init();
+	ipc.setRecorder(m_recorder.IsRunning() ? &m_recorder : NULL);
+	if(err == SUCCESS && m_history_seconds > 0)
+		err=ipc.InitHistory(m_history_seconds, (size_t)m_history_budget_mb << 20, m_history_format);
+	CTrace::SetThreadName(m_bPipelined ? "serve" : "main");
         
         /* do all init stuff here */
         OscCamSetShutterWidth(0);
         
         OscSimInitialize();
 	
-	/* read one image ahead */
-	m_camera.CapturePicture();
-	m_camera.ReadPicture();
+	if(err == SUCCESS && m_bPipelined)
+		return(PipelinedLoop(ipc));
+	
+	/* read one image ahead, with the external trigger arm the sensor only */
+	camera.CapturePicture();
+	if(!camera.isExternalTrigger()) camera.ReadPicture();
         
 	
 	printf("read\n");
 	
 	uint32 startCyc=OscSupCycGet();
+	m_pacer.Start();
+	FRAME frame; /* refers to the images of camera and processor, no copy */
 	
 	while(err==SUCCESS) { /* infinite loop if no error occurs */
-                /* read current picture and capture next */
-                uint32 startCycProc=OscSupCycGet();
-		cv::Mat* img=m_camera.ReadPicture();
-                uint32 delta_time_us_proc=OscSupCycToMicroSecs(OscSupCycGet() - startCycProc);
-                OscLog(DEBUG, "Image acquisition required %ums\n", delta_time_us_proc/1000);
-                
-                startCycProc=OscSupCycGet();
-		OSC_ERR e=m_camera.CapturePicture();
-                delta_time_us_proc=OscSupCycToMicroSecs(OscSupCycGet() - startCycProc);
-                OscLog(DEBUG, "CapturePicture %ums\n", delta_time_us_proc/1000);
+		/* read current picture and capture next */
+		CTrace::SetFrame(camera.getFrameSeq()+1);
+		CStageTimer acquire_timer(StatStage_acquire);
+		cv::Mat* img=camera.isExternalTrigger() ? camera.ReadTriggeredPicture() : camera.ReadPicture();
+		acquire_timer.Stop();
+		
+		CStageTimer capture_timer(StatStage_captureSetup);
+		OSC_ERR e=camera.CapturePicture();
+		capture_timer.Stop();
 		
 		if(e!=SUCCESS) OscLog(ERROR, "Could not Capture Picture (Error=%i)", e);
-                
-                startCycProc=OscSupCycGet();
-                m_img_process.DoProcess(img);
-                delta_time_us_proc=OscSupCycToMicroSecs(OscSupCycGet() - startCycProc);
-                OscLog(DEBUG, "Image processing required %ums\n", delta_time_us_proc/1000);
 		
-                startCycProc=OscSupCycGet();
+		img_process.DoProcess(img);
+		
+		if(img) {
+			CStats::Count(StatCounter_framesCaptured);
+			frame.img=*img;
+			for(uint32 i=0; i<FRAME_PROC_COUNT; ++i)
+				frame.proc[i]=*img_process.GetProcImage(i);
+			frame.seq=camera.getFrameSeq();
+			frame.timestamp_us=camera.getFrameTimestamp();
+			frame.trigger_seq=camera.getTriggerSeq();
+			frame.stats=camera.getImageStats().get();
+			frame.focus=camera.getFocus().get();
+			frame.settings=camera.getAppliedSettings();
+			frame.exposure_time=camera.getFrameExposure();
+			ipc.SetFrame(&frame);
+		}
+		ipc.PublishFrames();
+		CMatArena::Instance().EndFrame();
+		
 		err=ipc.handleIpcRequests();
-                delta_time_us_proc=OscSupCycToMicroSecs(OscSupCycGet() - startCycProc);
-                OscLog(DEBUG, "IPC request required %ums\n", delta_time_us_proc/1000);
 		
-		/* Allow other processes to run. Due to kernel tick rate of 250Hz this
-		 * call will return in 4ms. */
-		usleep(500);
+		/* sleep until the deadline of the next frame */
+		m_pacer.Wait();
 		
 		/* Advance the simulation step counter. */
 		OscSimStep();
 		
 		
-		uint32 delta_time_us=OscSupCycToMicroSecs(OscSupCycGet() - startCyc);
-		if(delta_time_us/1000 > 1000) {
-			startCyc=OscSupCycGet();
-			if(ipc.img_count > 0)
-				OscLog(DEBUG, "Sent %i images in %i ms\n", ipc.img_count, (int) delta_time_us/1000);
-			ipc.img_count=0;
+		LogLoopStats(ipc, startCyc);
+	}
+	return(err);
+}
+
+OSC_ERR CMain::PipelinedLoop(CIPC& ipc) {
+	OSC_ERR err;
+	
+	/* a pipeline per camera */
+	CPipeline* pipelines[MAX_CAMERAS];
+	int pipeline_count=0;
+	err=SUCCESS;
+	while(err == SUCCESS && pipeline_count < m_camera_count) {
+		CPipeline* pipeline=new CPipeline(m_cameras[pipeline_count], m_img_process[pipeline_count]);
+		pipelines[pipeline_count++]=pipeline;
+		if((err=pipeline->Init(m_capture_policy, m_process_policy)) == SUCCESS)
+			err=pipeline->Start(&m_thread_config, m_pacer.getTargetFps(), m_pacer.isLowLatency());
+	}
+	
+	CFrameSync sync;
+	if(err == SUCCESS) err=sync.Init(pipelines, m_camera_count, (uint32)std::max(m_sync_tolerance_us, 0));
+	if(err != SUCCESS)
+		OscLog(ERROR, "Could not start the pipeline (Error=%i)\n", err);
+	
+	uint32 startCyc=OscSupCycGet();
+	m_pacer.Start();
+	
+	while(err==SUCCESS) { /* serve stage, infinite loop if no error occurs */
+		/* in low latency mode, wait for the next frame instead of sleeping */
+		if(sync.NextSet(m_pacer.isLowLatency() ? PIPELINE_FRAME_WAIT_US : 0)) {
+			CTrace::SetFrame(sync.getFrame(0)->seq);
+			for(int c=0; c<m_camera_count; ++c)
+				ipc.SetFrame(sync.getFrame(c), c);
+			ipc.setSyncSkew(sync.getSkew());
+			ipc.PublishFrames();
+			CMatArena::Instance().EndFrame();
+		}
+		
+		err=ipc.handleIpcRequests();
+		
+		m_pacer.Wait();
+		
+		if(LogLoopStats(ipc, startCyc)) {
+			for(int c=0; c<m_camera_count; ++c)
+				OscLog(DEBUG, "Pipeline %d dropped %u frames after capture, %u after processing\n"
+						, c, pipelines[c]->getCaptureDropCount(), pipelines[c]->getProcessDropCount());
+			if(m_camera_count > 1)
+				OscLog(DEBUG, "%u frames without partner, skew %u us\n", sync.getDropCount(), sync.getSkew());
 		}
 	}
+	
+	/* the frames go back to their pipelines before these stop */
+	for(int c=0; c<m_camera_count; ++c)
+		ipc.SetFrame(NULL, c);
+	sync.Release();
+	for(int c=0; c<pipeline_count; ++c) {
+		pipelines[c]->Stop();
+		delete pipelines[c];
+	}
 	return(err);
 }
 
+bool CMain::LogLoopStats(CIPC& ipc, uint32& startCyc) {
+	uint32 delta_time_us=OscSupCycToMicroSecs(OscSupCycGet() - startCyc);
+	if(delta_time_us/1000 <= 1000) return(false);
+	
+	startCyc=OscSupCycGet();
+	if(ipc.img_count > 0)
+		OscLog(DEBUG, "Sent %i images in %i ms\n", ipc.img_count, (int) delta_time_us/1000);
+	OscLog(DEBUG, "Main loop at %.1f fps (target %.1f), %u missed deadlines\n"
+			, m_pacer.getMeasuredFps(), m_pacer.getTargetFps(), m_pacer.getMissCount());
+	
+	/* 0 once every buffer size has been seen (see mat_arena.h) */
+	const uint64_t heap_allocations=CStats::GetCounter(StatCounter_heapAllocations);
+	const uint64_t frames=CStats::GetCounter(StatCounter_framesCaptured);
+	if(frames > m_last_frames)
+		OscLog(DEBUG, "%.1f heap allocations per frame\n"
+				, (double)(heap_allocations - m_last_heap_allocations)/(frames - m_last_frames));
+	m_last_heap_allocations=heap_allocations;
+	m_last_frames=frames;
+	ipc.img_count=0;
+	return(true);
+}
+
 
 
@@ -8,9 +8,24 @@
 #include "includes.h"
 #include "camera.h"
 #include "image_processing.h"
+#include "frame_pacer.h"
+#include "frame_queue.h"
+#include "thread_config.h"
+#include "worker_pool.h"
+#include "image_codec.h"
+#include "recorder.h"
+
+
+class CIPC;
 
 
 #define TEST_IMAGE_FN "test.bmp"
+/* rate of the main loop if not given with -f */
+#define MAIN_LOOP_DEFAULT_FPS 60
+/* in pipelined low latency mode, the serve stage waits this long for a frame */
+#define PIPELINE_FRAME_WAIT_US 5000
+/* memory of the frame history if -H gives none [MB] */
+#define HISTORY_DEFAULT_BUDGET_MB 32
 
 
 /*********************************************************************//*!
@@ -29,8 +44,33 @@ public:
 	OSC_ERR MainLoop();
 	
 private:
-	CCamera m_camera;
-	CImageProcessor m_img_process;
+	/* capture, processing and serving on separate threads */
+	OSC_ERR PipelinedLoop(CIPC& ipc);
+	/* once per second, returns true if it logged */
+	bool LogLoopStats(CIPC& ipc, uint32& startCyc);
+	
+	/* camera 0 is Oscar's sensor, further cameras replay picture files (see CCamera::InitFileSource) */
+	CCamera m_cameras[MAX_CAMERAS];
+	CImageProcessor m_img_process[MAX_CAMERAS];
+	const char* m_camera_files[MAX_CAMERAS];
+	int m_camera_count;
+	int m_sync_tolerance_us; /* see CFrameSync, -1: half a frame period */
+	CWorkerPool m_process_pool; /* shared by the processors of several cameras */
+	CFramePacer m_pacer;
+	
+	uint32 m_history_seconds; /* 0: no frame history */
+	uint32 m_history_budget_mb;
+	ImageFormat m_history_format;
+	CRecorder m_recorder;
+	
+	bool m_bPipelined;
+	QueuePolicy m_capture_policy;
+	QueuePolicy m_process_policy;
+	CThreadConfig m_thread_config;
+	
+	/* counters at the last LogLoopStats */
+	uint64_t m_last_heap_allocations;
+	uint64_t m_last_frames;
 };
 
 #endif /* MAIN_CLASS_H_ */
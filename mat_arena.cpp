@@ -0,0 +1,179 @@
+/*! @file mat_arena.cpp
+ * @brief cv::MatAllocator that recycles the image buffers of the frame path
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "mat_arena.h"
+#include "stats.h"
+
+
+/* Counting operator new: every C++ heap allocation (std::vector growth, new cv::Mat, ...)
+ * is counted, so a steady state without allocations can be checked with GetStats.
+ * The array and nothrow forms of the standard library call these. */
+#if __cplusplus >= 201103L
+#define ARENA_THROW_BAD_ALLOC
+#define ARENA_NO_THROW noexcept
+#else
+#define ARENA_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define ARENA_NO_THROW throw()
+#endif
+
+void* operator new(size_t size) ARENA_THROW_BAD_ALLOC {
+	CStats::Count(StatCounter_heapAllocations);
+	void* p=malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return(p);
+}
+
+void operator delete(void* p) ARENA_NO_THROW {
+	free(p);
+}
+
+
+CMatArena::CMatArena() : m_free_header_count(0), m_frame_count(0) {
+	pthread_mutex_init(&m_mutex, NULL);
+	memset(m_classes, 0, sizeof(m_classes));
+
+	m_headers=(uint8*)malloc(MAT_ARENA_MAX_HEADERS*sizeof(cv::UMatData));
+	for(int i=MAT_ARENA_MAX_HEADERS-1; m_headers && i>=0; --i)
+		m_free_headers[m_free_header_count++]=(cv::UMatData*)(m_headers + i*sizeof(cv::UMatData));
+}
+
+CMatArena::~CMatArena() {
+	/* the application's arena lives until the process ends, Mats may still refer to it */
+	for(int c=0; c<MAT_ARENA_CLASSES; ++c) {
+		for(int i=0; i<m_classes[c].free_count; ++i)
+			cv::fastFree(m_classes[c].free[i]);
+	}
+	pthread_mutex_destroy(&m_mutex);
+}
+
+CMatArena& CMatArena::Instance() {
+	/* never destroyed: static Mats may release their data after the end of main */
+	static CMatArena* arena=new CMatArena();
+	return(*arena);
+}
+
+int CMatArena::SizeClass(size_t size) {
+	if(size > ((size_t)1 << MAT_ARENA_MAX_SHIFT)) return(-1);
+	int shift=MAT_ARENA_MIN_SHIFT;
+	while(((size_t)1 << shift) < size) ++shift;
+	return(shift - MAT_ARENA_MIN_SHIFT);
+}
+
+cv::UMatData* CMatArena::NewHeader() const {
+	void* mem=NULL;
+	pthread_mutex_lock(&m_mutex);
+	if(m_free_header_count > 0) mem=m_free_headers[--m_free_header_count];
+	pthread_mutex_unlock(&m_mutex);
+
+	if(!mem) return(new cv::UMatData(this));
+	return(new(mem) cv::UMatData(this));
+}
+
+void CMatArena::DeleteHeader(cv::UMatData* u) const {
+	const uint8* p=(const uint8*)u;
+	if(!m_headers || p < m_headers || p >= m_headers + MAT_ARENA_MAX_HEADERS*sizeof(cv::UMatData)) {
+		delete u;
+		return;
+	}
+	u->~UMatData();
+	pthread_mutex_lock(&m_mutex);
+	m_free_headers[m_free_header_count++]=u;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+cv::UMatData* CMatArena::allocate(int dims, const int* sizes, int type, void* data0, size_t* step
+		, int flags, cv::UMatUsageFlags usageFlags) const {
+
+	/* same layout as OpenCV's standard allocator: continuous rows */
+	size_t total=CV_ELEM_SIZE(type);
+	for(int i=dims-1; i>=0; --i) {
+		if(step) {
+			if(data0 && step[i] != CV_AUTOSTEP) {
+				CV_Assert(total <= step[i]);
+				total=step[i];
+			} else {
+				step[i]=total;
+			}
+		}
+		total*=sizes[i];
+	}
+
+	uchar* data=(uchar*)data0;
+	if(!data) {
+		const int c=SizeClass(total);
+		if(c >= 0) {
+			SIZE_CLASS& size_class=m_classes[c];
+			pthread_mutex_lock(&m_mutex);
+			if(size_class.free_count > 0) {
+				data=(uchar*)size_class.free[--size_class.free_count];
+				if(size_class.free_count < size_class.min_free_count)
+					size_class.min_free_count=size_class.free_count;
+			}
+			pthread_mutex_unlock(&m_mutex);
+			if(!data) {
+				CStats::Count(StatCounter_heapAllocations);
+				data=(uchar*)cv::fastMalloc((size_t)1 << (c + MAT_ARENA_MIN_SHIFT));
+			}
+		} else {
+			CStats::Count(StatCounter_heapAllocations);
+			data=(uchar*)cv::fastMalloc(total);
+		}
+	}
+
+	cv::UMatData* u=NewHeader();
+	u->data=u->origdata=data;
+	u->size=total;
+	if(data0) u->flags|=cv::UMatData::USER_ALLOCATED;
+	return(u);
+}
+
+bool CMatArena::allocate(cv::UMatData* u, int accessflags, cv::UMatUsageFlags usageFlags) const {
+	return(u != NULL);
+}
+
+void CMatArena::deallocate(cv::UMatData* u) const {
+	if(!u) return;
+
+	CV_Assert(u->urefcount == 0 && u->refcount == 0);
+	if(!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+		void* data=u->origdata;
+		const int c=SizeClass(u->size);
+		if(c >= 0) {
+			SIZE_CLASS& size_class=m_classes[c];
+			pthread_mutex_lock(&m_mutex);
+			if(size_class.free_count < MAT_ARENA_MAX_FREE) {
+				size_class.free[size_class.free_count++]=data;
+				data=NULL;
+			}
+			pthread_mutex_unlock(&m_mutex);
+		}
+		/* not pooled or the class is full */
+		if(data) cv::fastFree(data);
+		u->origdata=0;
+	}
+	DeleteHeader(u);
+}
+
+void CMatArena::EndFrame() {
+	if(++m_frame_count % MAT_ARENA_TRIM_FRAMES != 0) return;
+
+	/* buffers that stayed in the pool during the whole period are not needed */
+	void* unused[MAT_ARENA_CLASSES*MAT_ARENA_MAX_FREE];
+	int unused_count=0;
+	pthread_mutex_lock(&m_mutex);
+	for(int c=0; c<MAT_ARENA_CLASSES; ++c) {
+		SIZE_CLASS& size_class=m_classes[c];
+		for(int i=0; i<size_class.min_free_count; ++i)
+			unused[unused_count++]=size_class.free[--size_class.free_count];
+		size_class.min_free_count=size_class.free_count;
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	for(int i=0; i<unused_count; ++i)
+		cv::fastFree(unused[i]);
+}
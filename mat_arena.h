@@ -0,0 +1,77 @@
+/*! @file mat_arena.h
+ * @brief cv::MatAllocator that recycles the image buffers of the frame path
+ *  Buffers are kept in power of two size classes. A released buffer goes back
+ *  to its class and is handed out again to the next image of that class, so
+ *  once the pipeline has seen every image size, no image memory is allocated
+ *  anymore. Buffers a class did not need during MAT_ARENA_TRIM_FRAMES frames
+ *  are freed at a frame boundary (EndFrame).
+ *  Mats use the arena if it is set with CMatArena::Use before their data is
+ *  allocated. Heap allocations of the process (operator new and arena
+ *  buffers) are counted in StatCounter_heapAllocations.
+ */
+
+#ifndef MAT_ARENA_H_
+#define MAT_ARENA_H_
+
+#include <pthread.h>
+
+#include "opencv.hpp"
+#include "includes.h"
+
+
+/* smallest and largest size class (2^shift bytes), larger buffers are not pooled */
+#define MAT_ARENA_MIN_SHIFT 12
+#define MAT_ARENA_MAX_SHIFT 25
+#define MAT_ARENA_CLASSES (MAT_ARENA_MAX_SHIFT - MAT_ARENA_MIN_SHIFT + 1)
+/* free buffers kept per size class */
+#define MAT_ARENA_MAX_FREE 8
+/* Mat headers (UMatData) kept without heap allocation */
+#define MAT_ARENA_MAX_HEADERS 128
+/* spare buffers unused for this many frames are freed */
+#define MAT_ARENA_TRIM_FRAMES 128
+
+
+class CMatArena : public cv::MatAllocator {
+public:
+	CMatArena();
+	~CMatArena();
+
+	/*! @brief the arena of the application */
+	static CMatArena& Instance();
+
+	/*! @brief let img allocate its data from the arena (takes effect at the next allocation) */
+	static void Use(cv::Mat& img) { img.allocator=&Instance(); }
+
+	/*! @brief frame boundary: free the spare buffers of the size classes no longer needed */
+	void EndFrame();
+
+	/* cv::MatAllocator */
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step
+			, int flags, cv::UMatUsageFlags usageFlags) const;
+	bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const;
+	void deallocate(cv::UMatData* data) const;
+
+private:
+	struct SIZE_CLASS {
+		void* free[MAT_ARENA_MAX_FREE];
+		int free_count;
+		int min_free_count; /* lowest free_count since the last trim */
+	};
+
+	/* class of a buffer size, -1 if not pooled */
+	static int SizeClass(size_t size);
+
+	cv::UMatData* NewHeader() const;
+	void DeleteHeader(cv::UMatData* u) const;
+
+	/* cv::MatAllocator's interface is const */
+	mutable SIZE_CLASS m_classes[MAT_ARENA_CLASSES];
+	mutable cv::UMatData* m_free_headers[MAT_ARENA_MAX_HEADERS];
+	mutable int m_free_header_count;
+	uint8* m_headers; /* storage of MAT_ARENA_MAX_HEADERS UMatData */
+	uint32 m_frame_count;
+	mutable pthread_mutex_t m_mutex;
+};
+
+
+#endif /* MAT_ARENA_H_ */
@@ -0,0 +1,165 @@
+/*! @file pipeline.cpp
+ * @brief Pipelined execution of the main loop
+ */
+
+#include "pipeline.h"
+#include "trace.h"
+#include "mat_arena.h"
+
+#include <algorithm>
+#include <unistd.h>
+
+
+CPipeline::CPipeline(CCamera& camera, CImageProcessor& img_process) : m_camera(camera)
+	, m_img_process(img_process), m_frame_count(0), m_bRunning(false)
+	, m_thread_config(NULL) {
+}
+
+CPipeline::~CPipeline() {
+	Stop();
+}
+
+OSC_ERR CPipeline::Init(QueuePolicy capture_policy, QueuePolicy process_policy, int queue_depth) {
+	
+	if(m_bRunning) return(EALREADY_INITIALIZED);
+	
+	/* a frame in each queue slot, one per stage and one spare */
+	const int frame_count=2*queue_depth + 4;
+	if(queue_depth < 1 || frame_count > PIPELINE_MAX_FRAMES) return(EINVALID_PARAMETER);
+	
+	OSC_ERR err;
+	if((err=m_captured.Init(queue_depth, capture_policy)) != SUCCESS
+			|| (err=m_processed.Init(queue_depth, process_policy)) != SUCCESS)
+		return(err);
+	
+	if((err=m_free.Init(frame_count, QueuePolicy_block)) != SUCCESS)
+		return(err);
+	m_frame_count=frame_count;
+	for(int i=0; i<m_frame_count; ++i) {
+		/* camera and processor swap their images with the frames: same allocator */
+		CMatArena::Use(m_frames[i].img);
+		for(uint32 p=0; p<FRAME_PROC_COUNT; ++p)
+			CMatArena::Use(m_frames[i].proc[p]);
+		m_free.Push(&m_frames[i]);
+	}
+	return(SUCCESS);
+}
+
+OSC_ERR CPipeline::Start(const CThreadConfig* threads, double fps, bool bLowLatency) {
+	
+	if(m_bRunning) return(EALREADY_INITIALIZED);
+	if(m_frame_count == 0) return(EGENERAL);
+	m_thread_config=threads;
+	m_capture_pacer.Init(fps, bLowLatency);
+	
+	/* read one image ahead */
+	m_camera.CapturePicture();
+	
+	if(pthread_create(&m_capture_thread, NULL, CaptureThread, this) != 0)
+		return(EGENERAL);
+	if(pthread_create(&m_process_thread, NULL, ProcessThread, this) != 0) {
+		m_free.Close();
+		m_captured.Close();
+		pthread_join(m_capture_thread, NULL);
+		return(EGENERAL);
+	}
+	m_bRunning=true;
+	return(SUCCESS);
+}
+
+void CPipeline::Stop() {
+	if(!m_bRunning) return;
+	
+	m_free.Close();
+	m_captured.Close();
+	m_processed.Close();
+	pthread_join(m_capture_thread, NULL);
+	pthread_join(m_process_thread, NULL);
+	m_bRunning=false;
+}
+
+void* CPipeline::CaptureThread(void* arg) {
+	CTrace::SetThreadName("capture");
+	CPipeline* pipeline=(CPipeline*)arg;
+	if(pipeline->m_thread_config) pipeline->m_thread_config->Apply(ThreadRole_capture);
+	pipeline->Capture();
+	return(NULL);
+}
+
+void* CPipeline::ProcessThread(void* arg) {
+	CTrace::SetThreadName("process");
+	CPipeline* pipeline=(CPipeline*)arg;
+	if(pipeline->m_thread_config) pipeline->m_thread_config->Apply(ThreadRole_process);
+	pipeline->Process();
+	return(NULL);
+}
+
+void CPipeline::Forward(CFrameQueue& queue, FRAME* frame) {
+	FRAME* ret=queue.Push(frame);
+	if(ret) {
+		if(ret != frame) CStats::Count(StatCounter_framesDropped);
+		m_free.Push(ret);
+	}
+}
+
+void CPipeline::Capture() {
+	
+	/* the sensor is read at the target rate, not only the serve stage */
+	m_capture_pacer.Start();
+	
+	FRAME* frame;
+	while((frame=m_free.Pop()) != NULL) {
+		
+		/* read current picture and capture next, the camera is ours (see CCamera::getSettings) */
+		CTrace::SetFrame(m_camera.getFrameSeq()+1);
+		CStageTimer acquire_timer(StatStage_acquire);
+		cv::Mat* img=m_camera.isExternalTrigger() ? m_camera.ReadTriggeredPicture() : m_camera.ReadPicture();
+		acquire_timer.Stop();
+		CStageTimer capture_timer(StatStage_captureSetup);
+		OSC_ERR e=m_camera.CapturePicture();
+		capture_timer.Stop();
+		if(img) {
+			CStats::Count(StatCounter_framesCaptured);
+			/* no copy: the camera reuses the buffer of the recycled frame */
+			std::swap(frame->img, *img);
+			frame->seq=m_camera.getFrameSeq();
+			frame->timestamp_us=m_camera.getFrameTimestamp();
+			frame->trigger_seq=m_camera.getTriggerSeq();
+			frame->stats=m_camera.getImageStats().get();
+			frame->focus=m_camera.getFocus().get();
+			/* requests read these, never the camera the capture thread works with */
+			frame->settings=m_camera.getAppliedSettings();
+			frame->exposure_time=m_camera.getFrameExposure();
+		}
+		
+		if(e != SUCCESS) OscLog(ERROR, "Could not Capture Picture (Error=%i)", e);
+		
+		/* Advance the simulation step counter, once per picture of the sensor. */
+		if(m_camera.getSource() == CameraSource_sensor) OscSimStep();
+		
+		if(img) {
+			Forward(m_captured, frame);
+		} else {
+			m_free.Push(frame);
+			/* external trigger without edge: poll the input again after a while */
+			if(m_camera.isExternalTrigger()) usleep(TRIGGER_POLL_US);
+		}
+		
+		m_capture_pacer.Wait();
+	}
+}
+
+void CPipeline::Process() {
+	
+	FRAME* frame;
+	while((frame=m_captured.Pop()) != NULL) {
+		CTrace::SetFrame(frame->seq);
+		m_img_process.DoProcess(&frame->img);
+		
+		/* the processor keeps working in the buffers of the recycled frame */
+		for(uint32 i=0; i<FRAME_PROC_COUNT; ++i)
+			std::swap(frame->proc[i], *m_img_process.GetProcImage(i));
+		
+		Forward(m_processed, frame);
+	}
+}
@@ -0,0 +1,82 @@
+/*! @file pipeline.h
+ * @brief Pipelined execution of the main loop
+ *  Frame N+2 is captured and frame N+1 processed on their own threads while
+ *  the main thread serves frame N. The stages are connected by bounded
+ *  queues, so the frame rate is limited by the slowest stage only.
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <pthread.h>
+
+#include "includes.h"
+#include "camera.h"
+#include "image_processing.h"
+#include "frame.h"
+#include "frame_queue.h"
+#include "thread_config.h"
+#include "frame_pacer.h"
+
+
+/* default number of frames each queue between two stages holds */
+#define PIPELINE_QUEUE_DEPTH 2
+/* all frames are in the queue of free frames at the start */
+#define PIPELINE_MAX_FRAMES FRAME_QUEUE_MAX_CAPACITY
+
+
+class CPipeline {
+public:
+	CPipeline(CCamera& camera, CImageProcessor& img_process);
+	~CPipeline();
+	
+	/*! @brief configure the queues capture -> process and process -> serve */
+	OSC_ERR Init(QueuePolicy capture_policy, QueuePolicy process_policy, int queue_depth=PIPELINE_QUEUE_DEPTH);
+	
+	/*! @brief start the capture and processing threads
+	 * threads: affinity and scheduling of the threads, NULL leaves the defaults
+	 * fps, bLowLatency: pacing of the capture stage, as CFramePacer::Init
+	 */
+	OSC_ERR Start(const CThreadConfig* threads=NULL, double fps=0, bool bLowLatency=false);
+	
+	/*! @brief stop the threads, frames in flight are discarded */
+	void Stop();
+	
+	/*! @brief serve stage: take the next processed frame and keep it until ReleaseFrame
+	 * The serve stage may hold several frames (see CFrameSync).
+	 * Waits up to timeout_us for a frame, returns NULL if there is none.
+	 */
+	FRAME* TakeFrame(int timeout_us=0) { return(m_processed.Pop(timeout_us)); }
+	/*! @brief hand a frame of TakeFrame back to the capture stage */
+	void ReleaseFrame(FRAME* frame) { m_free.Push(frame); }
+	
+	/*! @brief frames dropped by the capture -> process and process -> serve queues */
+	uint32 getCaptureDropCount() const { return(m_captured.getDropCount()); }
+	uint32 getProcessDropCount() const { return(m_processed.getDropCount()); }
+	
+private:
+	static void* CaptureThread(void* arg);
+	static void* ProcessThread(void* arg);
+	void Capture();
+	void Process();
+	/* push a frame to queue, frames the queue does not keep are recycled */
+	void Forward(CFrameQueue& queue, FRAME* frame);
+	
+	CCamera& m_camera;
+	CImageProcessor& m_img_process;
+	
+	FRAME m_frames[PIPELINE_MAX_FRAMES];
+	int m_frame_count;
+	CFrameQueue m_free; /* frames available to the capture stage */
+	CFrameQueue m_captured;
+	CFrameQueue m_processed;
+	
+	pthread_t m_capture_thread;
+	pthread_t m_process_thread;
+	bool m_bRunning;
+	const CThreadConfig* m_thread_config;
+	CFramePacer m_capture_pacer;
+};
+
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,147 @@
+/*! @file rate_control.cpp
+ * @brief Per-client rate control of the images sent over IPC
+ */
+
+#include <algorithm>
+
+#include "rate_control.h"
+
+
+/* steps from best to cheapest; each step reduces the bytes per second a client needs */
+static const RATE_DECISION g_ladder[] = {
+	/* quality, downscale, frame_skip */
+	{ RATE_CONTROL_DEFAULT_QUALITY, 0, 0 },
+	{ 80, 0, 0 },
+	{ 70, 0, 0 },
+	{ 60, 0, 0 },
+	{ 80, 1, 0 },
+	{ 70, 1, 0 },
+	{ 60, 1, 0 },
+	{ 50, 1, 0 },
+	{ 70, 2, 0 },
+	{ 60, 2, 0 },
+	{ 50, 2, 0 },
+	/* frame skipping is only used without a frame rate target */
+	{ 50, 2, 1 },
+	{ 50, 2, 2 },
+	{ 50, 2, 4 },
+	{ 50, 2, 8 }
+};
+static const int g_ladder_count=sizeof(g_ladder)/sizeof(g_ladder[0]);
+static const int g_ladder_no_skip_count=11;
+
+/* weight of a new sample in the averages */
+#define RATE_CONTROL_ALPHA 0.25
+
+
+static void UpdateAverage(double& avg, double sample, bool bFirst) {
+	avg=bFirst ? sample : avg + RATE_CONTROL_ALPHA*(sample - avg);
+}
+
+
+CRateController::CRateController() : m_target_bitrate(0), m_target_fps(0) {
+	for(int i=0; i<RATE_CONTROL_MAX_CLIENTS; ++i)
+		ResetClient(m_clients[i], -1);
+}
+
+void CRateController::ResetClient(RATE_CLIENT& client, int client_id) {
+	memset(&client, 0, sizeof(client));
+	client.id=client_id;
+	client.decision=g_ladder[0];
+}
+
+const RATE_CLIENT* CRateController::FindClient(int client_id) const {
+	for(int i=0; i<RATE_CONTROL_MAX_CLIENTS; ++i)
+		if(m_clients[i].id == client_id) return(&m_clients[i]);
+	return(NULL);
+}
+
+RATE_CLIENT* CRateController::FindClient(int client_id) {
+	for(int i=0; i<RATE_CONTROL_MAX_CLIENTS; ++i)
+		if(m_clients[i].id == client_id) return(&m_clients[i]);
+	return(NULL);
+}
+
+RATE_CLIENT* CRateController::BeginFrame(int client_id, uint32 frame_seq, uint64_t frame_timestamp_us, uint64_t now_us) {
+
+	RATE_CLIENT* client=FindClient(client_id);
+	if(!client) {
+		/* replace an unused slot or the client that was idle the longest */
+		client=&m_clients[0];
+		for(int i=1; i<RATE_CONTROL_MAX_CLIENTS && client->id != -1; ++i)
+			if(m_clients[i].id == -1 || m_clients[i].last_request_us < client->last_request_us)
+				client=&m_clients[i];
+		ResetClient(*client, client_id);
+	} else if(now_us - client->last_request_us > RATE_CONTROL_CLIENT_TIMEOUT_US) {
+		ResetClient(*client, client_id);
+	}
+
+	if(client->last_request_us != 0 && client->last_bytes != 0 && now_us > client->last_request_us) {
+		const double interval_us=now_us - client->last_request_us;
+		const bool bFirst=!client->bMeasured;
+
+		UpdateAverage(client->frame_bytes, client->last_bytes, bFirst);
+		UpdateAverage(client->fps, 1e6/interval_us, bFirst);
+		if(frame_seq != client->last_frame_seq && frame_timestamp_us > client->last_frame_timestamp_us) {
+			const double period=(frame_timestamp_us - client->last_frame_timestamp_us)/1000.0
+					/ (uint32)(frame_seq - client->last_frame_seq);
+			UpdateAverage(client->frame_period_ms, period, client->frame_period_ms == 0);
+		}
+		client->bMeasured=true;
+
+		if(++client->frames_since_update >= RATE_CONTROL_UPDATE_FRAMES) {
+			client->frames_since_update=0;
+			Adjust(*client);
+		}
+	}
+
+	client->last_request_us=now_us;
+	client->last_frame_seq=frame_seq;
+	client->last_frame_timestamp_us=frame_timestamp_us;
+	client->last_bytes=0;
+	return(client);
+}
+
+void CRateController::EndFrame(RATE_CLIENT* client, size_t bytes, uint64_t write_us) {
+	client->last_bytes=bytes;
+	/* the time the client takes to drain the socket, not the time it waits before the next request */
+	const bool bFirst=!client->bWritten;
+	UpdateAverage(client->bytes_per_sec, bytes*1e6/std::max(write_us, (uint64_t)1), bFirst);
+	UpdateAverage(client->latency_ms, write_us/1000.0, bFirst);
+	client->bWritten=true;
+}
+
+void CRateController::Adjust(RATE_CLIENT& client) {
+
+	bool bTooMuch=false; /* client must get cheaper frames */
+	bool bHeadroom=true; /* client could take better frames */
+
+	if(m_target_bitrate > 0) {
+		/* what the client takes on average, including the time between its requests */
+		const double target=m_target_bitrate*1000.0/8;
+		const double rate=client.frame_bytes*client.fps;
+		if(rate > 1.1*target) bTooMuch=true;
+		else if(rate > 0.7*target) bHeadroom=false;
+	}
+	if(m_target_fps > 0) {
+		if(client.fps < 0.9*m_target_fps) bTooMuch=true;
+		else if(client.fps < 1.3*m_target_fps) bHeadroom=false;
+	}
+
+	const int max_level=(m_target_fps > 0 ? g_ladder_no_skip_count : g_ladder_count) - 1;
+
+	if(m_target_bitrate <= 0 && m_target_fps <= 0) {
+		client.level=0;
+	} else if(bTooMuch) {
+		if(client.level < max_level) ++client.level;
+	} else if(bHeadroom && client.level > 0) {
+		--client.level;
+	}
+	if(client.level > max_level) client.level=max_level;
+
+	client.decision=g_ladder[client.level];
+}
+
+int CRateController::FrameIntervalMs(const RATE_CLIENT& client) {
+	return((int)(client.decision.frame_skip*client.frame_period_ms + 0.5));
+}
@@ -0,0 +1,90 @@
+/*! @file rate_control.h
+ * @brief Per-client rate control of the images sent over IPC
+ *  Measures the throughput each client achieves and chooses JPEG quality,
+ *  downscale level and frame skipping to meet a target bitrate or frame rate.
+ */
+
+#ifndef RATE_CONTROL_H_
+#define RATE_CONTROL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "includes.h"
+
+
+#define RATE_CONTROL_MAX_CLIENTS 16
+/* clients that did not request an image for this time start over */
+#define RATE_CONTROL_CLIENT_TIMEOUT_US (10*1000000)
+/* number of frames between two decisions */
+#define RATE_CONTROL_UPDATE_FRAMES 4
+/* quality used if there is no target or the client is unknown */
+#define RATE_CONTROL_DEFAULT_QUALITY 90
+
+
+/* what is sent to a client */
+struct RATE_DECISION {
+	int quality; /* JPEG quality */
+	int downscale; /* image is scaled by 1/2^downscale */
+	int frame_skip; /* client should only fetch every (frame_skip+1)-th camera frame */
+};
+
+struct RATE_CLIENT {
+	int id; /* -1 if the slot is unused */
+
+	uint64_t last_request_us;
+	size_t last_bytes;
+	uint32 last_frame_seq;
+	uint64_t last_frame_timestamp_us;
+
+	/* measurements (exponentially weighted averages) */
+	double frame_bytes; /* size of the images sent */
+	double fps;
+	double bytes_per_sec; /* while an image is written: what the link to the client takes */
+	double latency_ms; /* time to write an image to the socket */
+	bool bWritten; /* bytes_per_sec and latency_ms are measured */
+	double frame_period_ms; /* camera frame period */
+	bool bMeasured;
+
+	int level; /* index into the decision ladder */
+	int frames_since_update;
+	RATE_DECISION decision;
+};
+
+
+class CRateController {
+public:
+	CRateController();
+
+	/*! @brief targets, 0 disables the target. Without any target, full quality is sent */
+	void setTargetBitrate(int kbit_per_sec) { m_target_bitrate=kbit_per_sec; }
+	int getTargetBitrate() const { return(m_target_bitrate); }
+	void setTargetFps(int fps) { m_target_fps=fps; }
+	int getTargetFps() const { return(m_target_fps); }
+
+	/*! @brief account for a new image request of a client and return its state
+	 * The client is created if it is unknown. client->decision tells how to encode the frame.
+	 */
+	RATE_CLIENT* BeginFrame(int client_id, uint32 frame_seq, uint64_t frame_timestamp_us, uint64_t now_us);
+
+	/*! @brief the frame for the client was written completely, in write_us */
+	void EndFrame(RATE_CLIENT* client, size_t bytes, uint64_t write_us);
+
+	/*! @brief returns NULL for unknown clients */
+	const RATE_CLIENT* FindClient(int client_id) const;
+	RATE_CLIENT* FindClient(int client_id);
+
+	/*! @brief time the client should wait between two image requests [ms] */
+	static int FrameIntervalMs(const RATE_CLIENT& client);
+
+private:
+	void ResetClient(RATE_CLIENT& client, int client_id);
+	void Adjust(RATE_CLIENT& client);
+
+	RATE_CLIENT m_clients[RATE_CONTROL_MAX_CLIENTS];
+	int m_target_bitrate; /* [kbit/s] */
+	int m_target_fps;
+};
+
+
+#endif /* RATE_CONTROL_H_ */
@@ -0,0 +1,388 @@
+/*! @file recorder.cpp
+ * @brief Continuous recording of the camera frames to disk
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "recorder.h"
+#include "timing.h"
+#include "stats.h"
+#include "trace.h"
+
+
+CRecorder::CRecorder() : m_max_file_bytes((uint64_t)RECORDER_DEFAULT_FILE_MB << 20), m_max_file_seconds(0)
+	, m_format(ImageFormat_jpeg), m_queue(NULL), m_queue_size(0), m_write_pos(0), m_read_pos(0), m_bTooLarge(false)
+	, m_bQuit(false), m_bRunning(false), m_block(0), m_block_fill(0), m_file_offset(0)
+	, m_file_start_us(0), m_block_start_us(0), m_file_seq(0), m_bFailed(false)
+	, m_retry_us(0), m_retry_ms(RECORDER_RETRY_MS) {
+	for(int c=0; c<MAX_CAMERAS; ++c) {
+		m_bQueued[c]=false;
+		m_last_seq[c]=0;
+	}
+	m_blocks[0]=m_blocks[1]=NULL;
+}
+
+CRecorder::~CRecorder() {
+	Stop();
+	free(m_queue);
+	/* writes that never completed may still read the blocks (see CAsyncFile::Close) */
+	if(m_file.getPendingCount() == 0) {
+		free(m_blocks[0]);
+		free(m_blocks[1]);
+	}
+}
+
+OSC_ERR CRecorder::Parse(const char* str) {
+	const char* comma=strchr(str, ',');
+	const std::string prefix=comma ? std::string(str, comma - str) : std::string(str);
+	if(prefix.empty()) return(EINVALID_PARAMETER);
+
+	if(comma) {
+		m_max_file_bytes=(uint64_t)atoi(comma+1) << 20;
+		comma=strchr(comma+1, ',');
+	}
+	if(comma) {
+		m_max_file_seconds=atoi(comma+1);
+		comma=strchr(comma+1, ',');
+	}
+	if(comma) {
+		if(strcmp(comma+1, "jpeg") == 0) m_format=ImageFormat_jpeg;
+		else if(strcmp(comma+1, "raw") == 0) m_format=ImageFormat_raw;
+		else if(strcmp(comma+1, "qoi") == 0) m_format=ImageFormat_qoi;
+		else return(EINVALID_PARAMETER);
+	}
+	m_prefix=prefix;
+	return(SUCCESS);
+}
+
+OSC_ERR CRecorder::Start(size_t frame_bytes) {
+	if(m_bRunning) return(EALREADY_INITIALIZED);
+	if(m_prefix.empty()) return(EGENERAL);
+
+	/* a power of two: the free running positions stay valid when they wrap */
+	const size_t queue_bytes=std::max((size_t)RECORDER_DEFAULT_QUEUE_MB << 20
+			, RECORDER_QUEUE_FRAMES*(frame_bytes + MAX_CAMERAS*sizeof(QUEUE_SLOT)));
+	if(queue_bytes > (size_t)1 << 31) return(EINVALID_PARAMETER);
+	m_queue_size=1;
+	while(m_queue_size < queue_bytes) m_queue_size<<=1;
+	m_queue=(uint8*)malloc(m_queue_size);
+	if(posix_memalign((void**)&m_blocks[0], RECORD_ALIGN, RECORDER_WRITE_SIZE) != 0) m_blocks[0]=NULL;
+	if(posix_memalign((void**)&m_blocks[1], RECORD_ALIGN, RECORDER_WRITE_SIZE) != 0) m_blocks[1]=NULL;
+	if(!m_queue || !m_blocks[0] || !m_blocks[1]) return(EOUT_OF_MEMORY);
+	/* touch the pages now, not while frames are queued */
+	memset(m_queue, 0, m_queue_size);
+	m_index.reserve(4096);
+
+	m_write_pos=m_read_pos=0;
+	m_bQuit=false;
+	if(sem_init(&m_sem, 0, 0) != 0) return(EGENERAL);
+	if(pthread_create(&m_thread, NULL, ThreadMain, this) != 0) {
+		sem_destroy(&m_sem);
+		return(EGENERAL);
+	}
+	m_bRunning=true;
+	OscLog(NOTICE, "Recording to %s-*.wvr, queue of %u MB\n", m_prefix.c_str(), m_queue_size >> 20);
+	return(SUCCESS);
+}
+
+void CRecorder::Stop() {
+	if(!m_bRunning) return;
+
+	m_bQuit=true;
+	sem_post(&m_sem);
+	pthread_join(m_thread, NULL);
+	sem_destroy(&m_sem);
+	m_bRunning=false;
+}
+
+bool CRecorder::Add(const cv::Mat& img, uint32 seq, uint64_t timestamp_us, int camera) {
+	if(!m_bRunning || img.empty() || camera < 0 || camera >= MAX_CAMERAS) return(false);
+	/* the serve stage may see the same frame several times */
+	if(m_bQueued[camera] && m_last_seq[camera] == seq) return(true);
+	m_bQueued[camera]=true;
+	m_last_seq[camera]=seq;
+
+	const size_t row_bytes=img.cols*img.elemSize();
+	const size_t size=(sizeof(QUEUE_SLOT) + row_bytes*img.rows + 7) & ~(size_t)7;
+	const uint32 write_pos=m_write_pos;
+	const uint32 pos=write_pos & (m_queue_size-1);
+	const uint32 contiguous=m_queue_size - pos;
+	/* a slot does not wrap around, the end of the ring is skipped */
+	const size_t need=size + (contiguous < size ? contiguous : 0);
+	const uint32 used=write_pos - m_read_pos;
+	/* the space is reused only after the writer is done with it */
+	__sync_synchronize();
+	if(size > m_queue_size/2) {
+		if(!m_bTooLarge) {
+			m_bTooLarge=true;
+			OscLog(ERROR, "Frames of %u bytes are not recorded, the queue takes %u at most\n"
+					, (unsigned)size, m_queue_size/2);
+		}
+		CStats::Count(StatCounter_recordDropped);
+		return(false);
+	}
+	if(used + need > m_queue_size) {
+		CStats::Count(StatCounter_recordDropped);
+		return(false);
+	}
+
+	uint32 start=write_pos;
+	if(contiguous < size) {
+		((QUEUE_SLOT*)(m_queue + pos))->size=0;
+		start+=contiguous;
+	}
+	QUEUE_SLOT* slot=(QUEUE_SLOT*)(m_queue + (start & (m_queue_size-1)));
+	slot->size=(uint32)size;
+	slot->seq=seq;
+	slot->timestamp_us=timestamp_us;
+	slot->rows=img.rows;
+	slot->cols=img.cols;
+	slot->type=img.type();
+	slot->camera=camera;
+	uint8* data=(uint8*)(slot + 1);
+	for(int y=0; y<img.rows; ++y)
+		memcpy(data + y*row_bytes, img.ptr(y), row_bytes);
+
+	/* the slot must be complete before the writer sees it */
+	__sync_synchronize();
+	m_write_pos=start + (uint32)size;
+	sem_post(&m_sem);
+	return(true);
+}
+
+void* CRecorder::ThreadMain(void* arg) {
+	CTrace::SetThreadName("recorder");
+	((CRecorder*)arg)->Run();
+	return(NULL);
+}
+
+void CRecorder::Run() {
+	while(!m_bQuit) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec+=RECORDER_FLUSH_MS/2*1000000L;
+		if(ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec-=1000000000L;
+			++ts.tv_sec;
+		}
+		while(sem_timedwait(&m_sem, &ts) != 0 && errno == EINTR);
+
+		Drain();
+		/* completed writes are collected early, so their latency is not overstated */
+		if(m_file.IsOpen() && m_file.Wait(false) != SUCCESS) Fail();
+		if(m_block_fill > 0 && GetMonotonicTimeUs() - m_block_start_us >= RECORDER_FLUSH_MS*1000)
+			Flush(false);
+	}
+	Drain();
+	CloseFile();
+}
+
+int CRecorder::Drain() {
+	int count=0;
+	while(m_read_pos != m_write_pos) {
+		/* the slot is read after the position that published it */
+		__sync_synchronize();
+		const uint32 pos=m_read_pos & (m_queue_size-1);
+		const QUEUE_SLOT* slot=(const QUEUE_SLOT*)(m_queue + pos);
+		if(slot->size == 0) {
+			m_read_pos+=m_queue_size - pos;
+			continue;
+		}
+		WriteFrame(*slot);
+		const uint32 size=slot->size;
+		__sync_synchronize();
+		m_read_pos+=size;
+		++count;
+	}
+	return(count);
+}
+
+void CRecorder::WriteFrame(const QUEUE_SLOT& slot) {
+	if(m_bFailed && GetMonotonicTimeUs() < m_retry_us) {
+		CStats::Count(StatCounter_recordDropped);
+		return;
+	}
+
+	const cv::Mat img(slot.rows, slot.cols, slot.type, (void*)(&slot + 1));
+	OSC_ERR err;
+	switch(m_format) {
+	case ImageFormat_raw:
+		err=CImageCodec::EncodeRaw(img, slot.seq, m_encoded);
+		break;
+	case ImageFormat_qoi:
+		err=CImageCodec::EncodeQoi(img, m_encoded);
+		break;
+	default:
+		err=m_jpeg.Encode(img, RECORDER_JPEG_QUALITY, m_encoded);
+		if(err != SUCCESS) {
+			/* formats the slice encoder does not take (e.g. 16 bit) */
+			std::vector<int> params;
+			params.push_back(CV_IMWRITE_JPEG_QUALITY);
+			params.push_back(RECORDER_JPEG_QUALITY);
+			err=cv::imencode(".jpg", img, m_encoded, params) ? SUCCESS : EGENERAL;
+		}
+		break;
+	}
+	if(err != SUCCESS || m_encoded.empty()) {
+		OscLog(WARN, "Frame %u could not be encoded for the recording\n", slot.seq);
+		CStats::Count(StatCounter_recordDropped);
+		return;
+	}
+
+	const size_t record_size=(sizeof(RECORD_FRAME_HEADER) + m_encoded.size() + 7) & ~(size_t)7;
+	if(m_file.IsOpen() && !m_index.empty()) {
+		const uint64_t file_size=m_file_offset + m_block_fill
+				+ (m_index.size() + 1)*sizeof(RECORD_INDEX_ENTRY) + sizeof(RECORD_TRAILER);
+		if((m_max_file_bytes > 0 && file_size + record_size > m_max_file_bytes)
+				|| (m_max_file_seconds > 0 && GetMonotonicTimeUs() - m_file_start_us >= (uint64_t)m_max_file_seconds*1000000))
+			CloseFile();
+	}
+	if(!m_file.IsOpen() && OpenFile() != SUCCESS) {
+		Fail();
+		CStats::Count(StatCounter_recordDropped);
+		return;
+	}
+
+
+	RECORD_FRAME_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.magic=RECORD_FRAME_MAGIC;
+	header.frame_seq=slot.seq;
+	header.timestamp_us=slot.timestamp_us;
+	header.length=(uint32_t)m_encoded.size();
+	header.format=(uint8_t)m_format;
+	header.camera=(uint8_t)slot.camera;
+
+	RECORD_INDEX_ENTRY entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.offset=m_file_offset + m_block_fill;
+	entry.timestamp_us=slot.timestamp_us;
+	entry.frame_seq=slot.seq;
+	entry.length=header.length;
+	entry.format=header.format;
+	entry.camera=header.camera;
+	m_index.push_back(entry);
+
+	static const uint8 padding[8]={ 0 };
+	Append(&header, sizeof(header));
+	Append(&m_encoded[0], m_encoded.size());
+	Append(padding, record_size - sizeof(header) - m_encoded.size());
+	if(m_bFailed) {
+		CStats::Count(StatCounter_recordDropped);
+		return;
+	}
+
+	CStats::Count(StatCounter_framesRecorded);
+	CStats::Count(StatCounter_bytesRecorded, record_size);
+}
+
+OSC_ERR CRecorder::OpenFile() {
+	const time_t now=time(NULL);
+	struct tm local;
+	localtime_r(&now, &local);
+	char date[32];
+	strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &local);
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), "-%s-%u.wvr", date, m_file_seq);
+	m_file_name=m_prefix + suffix;
+
+	/* the blocks are still written to a file that could not be closed */
+	if(m_file.getPendingCount() > 0) return(EFILE_ERROR);
+	const OSC_ERR err=m_file.Open(m_file_name.c_str());
+	if(err != SUCCESS) return(err);
+	if(m_bFailed) {
+		OscLog(NOTICE, "Recording continued in %s\n", m_file_name.c_str());
+		m_bFailed=false;
+	}
+
+	m_file_offset=0;
+	m_block_fill=0;
+	m_file_start_us=GetMonotonicTimeUs();
+	m_index.clear();
+
+	RECORD_FILE_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.magic=RECORD_FILE_MAGIC;
+	header.version=1;
+	header.start_time_us=(uint64_t)now*1000000;
+	header.file_seq=m_file_seq++;
+	Append(&header, sizeof(header));
+	return(SUCCESS);
+}
+
+OSC_ERR CRecorder::CloseFile() {
+	if(!m_file.IsOpen()) return(SUCCESS);
+
+	RECORD_TRAILER trailer;
+	trailer.magic=RECORD_INDEX_MAGIC;
+	trailer.count=(uint32_t)m_index.size();
+	trailer.index_offset=m_file_offset + m_block_fill;
+	if(!m_index.empty()) Append(&m_index[0], m_index.size()*sizeof(RECORD_INDEX_ENTRY));
+	Append(&trailer, sizeof(trailer));
+	Flush(true);
+	if(m_bFailed) return(EFILE_ERROR);
+
+	const OSC_ERR err=m_file.Close();
+	if(err != SUCCESS) {
+		Fail();
+		return(err);
+	}
+	OscLog(NOTICE, "Recorded %u frames to %s\n", (unsigned)m_index.size(), m_file_name.c_str());
+	m_retry_ms=RECORDER_RETRY_MS;
+	return(SUCCESS);
+}
+
+void CRecorder::Fail() {
+	if(!m_bFailed)
+		OscLog(ERROR, "Recording to %s failed after %u frames, retrying in %u ms\n"
+				, m_file_name.c_str(), (unsigned)m_index.size(), m_retry_ms);
+	m_bFailed=true;
+	m_retry_us=GetMonotonicTimeUs() + (uint64_t)m_retry_ms*1000;
+	/* until a file is finished again */
+	m_retry_ms=std::min(m_retry_ms*2, (uint32)RECORDER_RETRY_MAX_MS);
+
+	/* the file stays as it is, it can be read up to the last complete frame */
+	if(m_file.IsOpen()) m_file.Close();
+	m_block_fill=0;
+	m_index.clear();
+}
+
+void CRecorder::Append(const void* data, size_t size) {
+	const uint8* src=(const uint8*)data;
+	/* nothing goes to a file given up (see Fail) */
+	while(size > 0 && !m_bFailed) {
+		if(m_block_fill == 0) m_block_start_us=GetMonotonicTimeUs();
+		const size_t n=std::min(size, (size_t)RECORDER_WRITE_SIZE - m_block_fill);
+		memcpy(m_blocks[m_block] + m_block_fill, src, n);
+		m_block_fill+=n;
+		src+=n;
+		size-=n;
+		if(m_block_fill == RECORDER_WRITE_SIZE) Flush(false);
+	}
+}
+
+void CRecorder::Flush(bool bAll) {
+	const size_t size=bAll ? m_block_fill : (m_block_fill & ~(size_t)(RECORD_ALIGN-1));
+	if(size == 0 || !m_file.IsOpen()) return;
+
+	/* the other block is written by now: it takes the rest of the current one */
+	OSC_ERR err=m_file.Wait(true);
+	if(err == SUCCESS) err=m_file.Write(m_blocks[m_block], size, m_file_offset);
+	if(err != SUCCESS) {
+		Fail();
+		return;
+	}
+	m_file_offset+=size;
+
+	const size_t rest=m_block_fill - size;
+	const int next=1 - m_block;
+	if(rest > 0) memcpy(m_blocks[next], m_blocks[m_block] + size, rest);
+	m_block=next;
+	m_block_fill=rest;
+	if(bAll && m_file.Wait(true) != SUCCESS) Fail();
+}
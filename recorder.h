@@ -0,0 +1,187 @@
+/*! @file recorder.h
+ * @brief Continuous recording of the camera frames to disk
+ *  The serve stage copies every new frame into a queue and continues; it
+ *  never waits for the disk. If the queue is full the frame is dropped.
+ *  A writer thread encodes the frames and collects them in large blocks
+ *  that are written at block aligned offsets (see CAsyncFile). Data waits
+ *  at most RECORDER_FLUSH_MS before it is written, apart from the last
+ *  partial block of a file. After a write error the file is given up and
+ *  frames are dropped until a new file is started, which is retried with
+ *  a growing delay (e.g. until disk space was freed).
+ *
+ *  The queue is a ring of bytes with one producer and one consumer, which
+ *  synchronize through the ring positions only (no lock).
+ *
+ *  File format (host byte order): RECORD_FILE_HEADER, then per frame a
+ *  RECORD_FRAME_HEADER followed by 'length' bytes, padded to 8 bytes. A
+ *  finished file ends with an index of RECORD_INDEX_ENTRY and the
+ *  RECORD_TRAILER, which readers find at the end of the file. Files that
+ *  were not finished can be read sequentially. A new file is started when
+ *  the size or duration limit is reached.
+ */
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "opencv.hpp"
+#include "includes.h"
+#include "image_codec.h"
+#include "jpeg_encoder.h"
+#include "async_file.h"
+#include "camera.h"
+
+
+/* file size limit if the option gives none [MB] */
+#define RECORDER_DEFAULT_FILE_MB 256
+/* memory of the queue at least, rounded up to a power of two */
+#define RECORDER_DEFAULT_QUEUE_MB 16
+/* frames of every camera the queue holds at least */
+#define RECORDER_QUEUE_FRAMES 4
+/* size of the write blocks, a multiple of RECORD_ALIGN */
+#define RECORDER_WRITE_SIZE (1024*1024)
+/* longest time data waits in a block that is not full [ms] */
+#define RECORDER_FLUSH_MS 200
+#define RECORDER_JPEG_QUALITY 90
+/* after a write error a new file is tried after this time, doubled up to the maximum [ms] */
+#define RECORDER_RETRY_MS 1000
+#define RECORDER_RETRY_MAX_MS 60000
+
+#define RECORD_ALIGN 4096
+#define RECORD_FILE_MAGIC 0x31525657 /* 'WVR1' */
+#define RECORD_FRAME_MAGIC 0x46525657 /* 'WVRF' */
+#define RECORD_INDEX_MAGIC 0x49525657 /* 'WVRI' */
+
+
+struct RECORD_FILE_HEADER {
+	uint32_t magic;
+	uint32_t version; /* 1 */
+	uint64_t start_time_us; /* CLOCK_REALTIME when the file was started */
+	uint32_t file_seq; /* files of a recording are numbered from 0 */
+	uint32_t reserved;
+};
+
+struct RECORD_FRAME_HEADER {
+	uint32_t magic;
+	uint32_t frame_seq;
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time the frame was read */
+	uint32_t length; /* bytes of image data following */
+	uint8_t format; /* format of GetImage: 0=jpeg, 1=raw, 2=qoi */
+	uint8_t camera;
+	uint8_t reserved[2];
+};
+
+struct RECORD_INDEX_ENTRY {
+	uint64_t offset; /* of the RECORD_FRAME_HEADER in the file */
+	uint64_t timestamp_us;
+	uint32_t frame_seq;
+	uint32_t length;
+	uint8_t format;
+	uint8_t camera;
+	uint8_t reserved[6];
+};
+
+/* the last bytes of a finished file */
+struct RECORD_TRAILER {
+	uint32_t magic; /* RECORD_INDEX_MAGIC */
+	uint32_t count; /* entries of the index */
+	uint64_t index_offset;
+};
+
+
+class CRecorder {
+public:
+	CRecorder();
+	~CRecorder();
+
+	/*! @brief recording from a command line option: prefix[,MB[,seconds[,jpeg|raw|qoi]]]
+	 * MB and seconds limit the size and duration of a file, 0: no limit
+	 */
+	OSC_ERR Parse(const char* str);
+	bool IsConfigured() const { return(!m_prefix.empty()); }
+
+	/*! @brief allocate the queue and start the writer thread
+	 * frame_bytes: the largest frames of all cameras together, the queue takes RECORDER_QUEUE_FRAMES of them
+	 * Files are named <prefix>-<date>-<time>-<n>.wvr
+	 */
+	OSC_ERR Start(size_t frame_bytes=0);
+	/*! @brief write the queued frames, finish the file and stop the writer */
+	void Stop();
+	bool IsRunning() const { return(m_bRunning); }
+
+	/*! @brief queue a frame of a camera, a frame already queued is ignored
+	 * Never blocks: returns false if there is no room and the frame is dropped.
+	 */
+	bool Add(const cv::Mat& img, uint32 seq, uint64_t timestamp_us, int camera=0);
+
+private:
+	/* a frame in the queue, followed by its pixels */
+	struct QUEUE_SLOT {
+		uint32 size; /* bytes including this header, 0: the rest of the ring is unused */
+		uint32 seq;
+		uint64_t timestamp_us;
+		int32 rows;
+		int32 cols;
+		int32 type;
+		int32 camera;
+	};
+
+	static void* ThreadMain(void* arg);
+	void Run();
+	/* encode and write the frames in the queue, returns the number of frames */
+	int Drain();
+	void WriteFrame(const QUEUE_SLOT& slot);
+	OSC_ERR OpenFile();
+	OSC_ERR CloseFile();
+	/* give up the current file after a write error and drop frames until the next retry */
+	void Fail();
+	/* copy into the write blocks, full blocks are written */
+	void Append(const void* data, size_t size);
+	/* write the full RECORD_ALIGN pages of the current block, bAll: the partial page as well */
+	void Flush(bool bAll);
+
+	/* configuration */
+	std::string m_prefix;
+	std::string m_file_name;
+	uint64_t m_max_file_bytes;
+	uint32 m_max_file_seconds;
+	ImageFormat m_format;
+
+	/* queue, m_write_pos is written by the producer, m_read_pos by the writer only */
+	uint8* m_queue;
+	uint32 m_queue_size;
+	volatile uint32 m_write_pos;
+	volatile uint32 m_read_pos;
+	bool m_bQueued[MAX_CAMERAS];
+	bool m_bTooLarge; /* a frame did not fit the queue, logged once */
+	uint32 m_last_seq[MAX_CAMERAS];
+	sem_t m_sem;
+
+	pthread_t m_thread;
+	volatile bool m_bQuit;
+	bool m_bRunning;
+
+	/* writer thread */
+	CAsyncFile m_file;
+	uint8* m_blocks[2]; /* one is filled while the other is written */
+	int m_block;
+	size_t m_block_fill;
+	uint64_t m_file_offset; /* where the current block goes */
+	uint64_t m_file_start_us;
+	uint64_t m_block_start_us; /* first data in the current block */
+	uint32 m_file_seq;
+	bool m_bFailed; /* write error: frames are discarded until m_retry_us */
+	uint64_t m_retry_us;
+	uint32 m_retry_ms; /* delay of the next retry */
+	std::vector<RECORD_INDEX_ENTRY> m_index;
+	std::vector<uint8> m_encoded;
+	CJpegEncoder m_jpeg;
+};
+
+
+#endif /* RECORDER_H_ */
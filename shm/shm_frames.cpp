@@ -0,0 +1,127 @@
+/*! @file shm_frames.cpp
+ * @brief Client side of the shared memory frame ring (read-only mapping)
+ */
+
+#include <cstring>
+using namespace std;
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shm_frames.h"
+
+
+static const struct SHM_FRAME_SLOT* getSlot(const struct SHM_FRAMES_CLIENT* client, uint32_t i) {
+	return((const struct SHM_FRAME_SLOT*)(client->base + client->header->slots_offset) + i);
+}
+
+
+int shm_frames_open(struct SHM_FRAMES_CLIENT* client, const char* name) {
+	memset(client, 0, sizeof(*client));
+	client->fd=-1;
+
+	int fd=shm_open(name ? name : SHM_FRAMES_NAME, O_RDONLY, 0);
+	if(fd < 0) return(-errno);
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct SHM_FRAMES_HEADER)) {
+		close(fd);
+		return(-EINVAL);
+	}
+
+	void* base=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED) {
+		int err=errno;
+		close(fd);
+		return(-err);
+	}
+
+	const struct SHM_FRAMES_HEADER* header=(const struct SHM_FRAMES_HEADER*)base;
+	if(header->magic != SHM_FRAMES_MAGIC || header->version != SHM_FRAMES_VERSION
+			|| shm_frames_total_size(header->slot_count, header->slot_size) > (size_t)st.st_size) {
+		munmap(base, st.st_size);
+		close(fd);
+		return(-EPROTO);
+	}
+
+	client->fd=fd;
+	client->map_size=st.st_size;
+	client->base=(const uint8_t*)base;
+	client->header=header;
+	return(0);
+}
+
+void shm_frames_close(struct SHM_FRAMES_CLIENT* client) {
+	if(client->base) munmap((void*)client->base, client->map_size);
+	if(client->fd >= 0) close(client->fd);
+	memset(client, 0, sizeof(*client));
+	client->fd=-1;
+}
+
+/* take a consistent snapshot of the slot header; returns 0 if the slot is being written */
+static int readSlot(const struct SHM_FRAMES_CLIENT* client, uint32_t i, struct SHM_FRAME_VIEW* view) {
+	const struct SHM_FRAME_SLOT* slot=getSlot(client, i);
+
+	uint32_t lock=slot->lock;
+	if(lock & 1) return(0);
+	__sync_synchronize();
+
+	view->slot=i;
+	view->lock=lock;
+	view->stream=slot->stream;
+	view->format=slot->format;
+	view->frame_seq=slot->frame_seq;
+	view->timestamp_us=slot->timestamp_us;
+	view->width=slot->width;
+	view->height=slot->height;
+	view->stride=slot->stride;
+	view->size=slot->size;
+	view->data=client->base + client->header->data_offset + (size_t)i*client->header->slot_size;
+
+	__sync_synchronize();
+	return(lock != 0 && slot->lock == lock);
+}
+
+int shm_frames_latest(const struct SHM_FRAMES_CLIENT* client, uint32_t stream, struct SHM_FRAME_VIEW* view) {
+	int found=0;
+	struct SHM_FRAME_VIEW cur;
+
+	for(uint32_t i=0; i<client->header->slot_count; ++i) {
+		if(readSlot(client, i, &cur) && cur.stream == stream) {
+			/* sequence numbers wrap around -> compare the difference */
+			if(!found || (int32_t)(cur.frame_seq - view->frame_seq) > 0) {
+				*view=cur;
+				found=1;
+			}
+		}
+	}
+	return(found);
+}
+
+int shm_frames_wait(const struct SHM_FRAMES_CLIENT* client, uint32_t stream, uint32_t last_seq
+		, struct SHM_FRAME_VIEW* view, int timeout_ms) {
+
+	const struct timespec poll_interval={0, 500000};
+	int waited_us=0;
+	uint32_t publish_count=client->header->publish_count-1;
+
+	for(;;) {
+		if(client->header->publish_count != publish_count) {
+			publish_count=client->header->publish_count;
+			if(shm_frames_latest(client, stream, view) && (int32_t)(view->frame_seq - last_seq) > 0)
+				return(1);
+		}
+		if(waited_us >= timeout_ms*1000) return(0);
+		nanosleep(&poll_interval, NULL);
+		waited_us+=poll_interval.tv_nsec/1000;
+	}
+}
+
+int shm_frames_check(const struct SHM_FRAMES_CLIENT* client, const struct SHM_FRAME_VIEW* view) {
+	__sync_synchronize();
+	return(getSlot(client, view->slot)->lock == view->lock);
+}
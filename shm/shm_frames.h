@@ -0,0 +1,147 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file shm_frames.h
+ * @brief Shared header file between the application and local frame consumers.
+ * Describes the layout of the shared memory frame ring and the client API
+ * to map it read-only.
+ *
+ * The ring consists of one SHM_FRAMES_HEADER followed by slot_count slot
+ * headers and slot_count payload areas of slot_size bytes each. Every slot
+ * is protected by a seqlock: the writer makes 'lock' odd while it updates
+ * the slot and even again when the frame is complete. A reader takes the
+ * lock value before and after accessing the pixels; if both are equal and
+ * even, the pixels it looked at were consistent.
+ *
+ * Every camera publishes its own streams, SHM_FRAMES_STREAM(camera, stream)
+ * (the streams of camera 0 are the values of ShmFrameStream). Each stream
+ * has its own slot_count/stream_count slots, so a stream keeps its recent
+ * frames however often the others are published.
+ */
+
+#ifndef SHM_FRAMES_H_
+#define SHM_FRAMES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*! @brief Name of the POSIX shared memory object (see shm_open). */
+#define SHM_FRAMES_NAME "/" APP_NAME ".frames"
+
+#define SHM_FRAMES_MAGIC 0x52465657 /* 'WVFR' */
+#define SHM_FRAMES_VERSION 1
+
+/*! @brief Payloads start at multiples of this (same as PICTURE_ALIGNMENT). */
+#define SHM_FRAMES_ALIGNMENT 16
+
+/*! @brief Streams published into the ring */
+enum ShmFrameStream {
+	ShmFrameStream_camera = 0, // image as read from the camera
+	ShmFrameStream_proc1, // processing image 1 (perspective 1)
+	ShmFrameStream_proc2, // processing image 2 (perspective 2)
+	ShmFrameStream_proc3, // processing image 3 (perspective 3)
+	ShmFrameStream_count
+};
+
+/*! @brief stream number of a camera's stream in the ring */
+#define SHM_FRAMES_STREAM(camera, stream) ((camera)*ShmFrameStream_count + (stream))
+
+/*! @brief Pixel format of a published frame */
+enum ShmFrameFormat {
+	ShmFrameFormat_gray8 = 1, // 1 channel, uint8
+	ShmFrameFormat_rgb8, // 3 channels interleaved, uint8
+	ShmFrameFormat_gray16s, // 1 channel, int16
+	ShmFrameFormat_gray32f // 1 channel, float
+};
+
+/*! @brief Global header at offset 0 of the shared memory object */
+struct SHM_FRAMES_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_size; /* payload bytes per slot */
+	uint32_t slots_offset; /* offset of the first SHM_FRAME_SLOT */
+	uint32_t data_offset; /* offset of the first payload */
+	volatile uint32_t publish_count; /* incremented after every published frame */
+	volatile uint32_t dropped_count; /* frames that did not fit into a slot */
+	volatile uint32_t writer_pid; /* 0 if the application has shut down */
+	uint32_t stream_count; /* cameras*ShmFrameStream_count */
+	uint32_t reserved[6];
+};
+
+/*! @brief Per-slot header, protected by the seqlock 'lock' */
+struct SHM_FRAME_SLOT {
+	volatile uint32_t lock; /* odd while the slot is written */
+	uint32_t stream; /* SHM_FRAMES_STREAM(camera, enum ShmFrameStream) */
+	uint32_t format; /* enum ShmFrameFormat */
+	uint32_t frame_seq; /* camera frame sequence number */
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time of the camera read */
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride; /* bytes per row */
+	uint32_t size; /* valid payload bytes */
+	uint32_t reserved[4];
+};
+
+
+/*! @brief Handle of a client mapping */
+struct SHM_FRAMES_CLIENT {
+	int fd;
+	size_t map_size;
+	const uint8_t* base;
+	const struct SHM_FRAMES_HEADER* header;
+};
+
+/*! @brief A zero-copy view of one frame in the ring.
+ * data points directly into the shared memory; it stays valid as long as
+ * shm_frames_check() returns 1 for this view.
+ */
+struct SHM_FRAME_VIEW {
+	const uint8_t* data;
+	uint32_t slot;
+	uint32_t lock; /* seqlock value the view was taken with */
+	uint32_t stream;
+	uint32_t format;
+	uint32_t frame_seq;
+	uint64_t timestamp_us;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t size;
+};
+
+
+/*! @brief total size of the shared memory object for the given ring geometry */
+static inline size_t shm_frames_total_size(uint32_t slot_count, uint32_t slot_size) {
+	size_t slots=sizeof(struct SHM_FRAMES_HEADER);
+	size_t data=slots+slot_count*sizeof(struct SHM_FRAME_SLOT);
+	data=(data + SHM_FRAMES_ALIGNMENT-1) & ~(size_t)(SHM_FRAMES_ALIGNMENT-1);
+	return(data + (size_t)slot_count*slot_size);
+}
+
+
+/*! @brief Map the frame ring read-only. Returns 0 on success, -errno on failure */
+int shm_frames_open(struct SHM_FRAMES_CLIENT* client, const char* name);
+/*! @brief Unmap the frame ring */
+void shm_frames_close(struct SHM_FRAMES_CLIENT* client);
+
+/*! @brief Get the most recent consistent frame of a stream.
+ * Returns 1 if a frame was found, 0 if the stream has no frame yet
+ */
+int shm_frames_latest(const struct SHM_FRAMES_CLIENT* client, uint32_t stream, struct SHM_FRAME_VIEW* view);
+
+/*! @brief Wait until a frame of the stream newer than last_seq is published.
+ * Returns 1 on success, 0 on timeout
+ */
+int shm_frames_wait(const struct SHM_FRAMES_CLIENT* client, uint32_t stream, uint32_t last_seq
+		, struct SHM_FRAME_VIEW* view, int timeout_ms);
+
+/*! @brief Returns 1 if the pixels of view were not overwritten in the meantime.
+ * Call this after consuming the data; discard the result if it returns 0.
+ */
+int shm_frames_check(const struct SHM_FRAMES_CLIENT* client, const struct SHM_FRAME_VIEW* view);
+
+
+#endif // #ifndef SHM_FRAMES_H_
@@ -0,0 +1,136 @@
+/*! @file shm_publisher.cpp
+ * @brief Writer side of the shared memory frame ring
+ */
+
+#include "shm_publisher.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+
+CShmPublisher::CShmPublisher() : m_fd(-1), m_map_size(0), m_base(NULL), m_header(NULL)
+	, m_slots(NULL), m_slots_per_stream(0) {}
+
+CShmPublisher::~CShmPublisher() {
+	Destroy();
+}
+
+OSC_ERR CShmPublisher::Init(uint32 slot_size, int camera_count, uint32 slots_per_stream) {
+	
+	if(m_header) return(EALREADY_INITIALIZED);
+	if(camera_count<=0 || slots_per_stream==0 || slot_size==0) return(EINVALID_PARAMETER);
+	
+	const uint32 stream_count=camera_count*ShmFrameStream_count;
+	const uint32 slot_count=stream_count*slots_per_stream;
+	slot_size=(slot_size + SHM_FRAMES_ALIGNMENT-1) & -SHM_FRAMES_ALIGNMENT;
+	m_map_size=shm_frames_total_size(slot_count, slot_size);
+	
+	/* start from a fresh object, readers of a previous instance keep their old mapping */
+	shm_unlink(SHM_FRAMES_NAME);
+	m_fd=shm_open(SHM_FRAMES_NAME, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	OscAssert_w(m_fd >= 0, "Cannot create shared memory \"%s\": %s", SHM_FRAMES_NAME, strerror(errno));
+	
+	if(ftruncate(m_fd, m_map_size) != 0) {
+		OscLog(ERROR, "Cannot resize shared memory: %s\n", strerror(errno));
+		Destroy();
+		return(EOUT_OF_MEMORY);
+	}
+	
+	void* base=mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if(base == MAP_FAILED) {
+		OscLog(ERROR, "Cannot map shared memory: %s\n", strerror(errno));
+		Destroy();
+		return(EOUT_OF_MEMORY);
+	}
+	m_base=(uint8*)base;
+	
+	/* ftruncate zero-fills -> all slot locks are 0 (= never written) */
+	SHM_FRAMES_HEADER* header=(SHM_FRAMES_HEADER*)m_base;
+	header->slot_count=slot_count;
+	header->slot_size=slot_size;
+	header->slots_offset=sizeof(SHM_FRAMES_HEADER);
+	header->data_offset=m_map_size - (size_t)slot_count*slot_size;
+	header->writer_pid=getpid();
+	header->stream_count=stream_count;
+	header->version=SHM_FRAMES_VERSION;
+	__sync_synchronize();
+	header->magic=SHM_FRAMES_MAGIC; /* readers check this last */
+	
+	m_slots=(SHM_FRAME_SLOT*)(m_base + header->slots_offset);
+	m_header=header;
+	m_slots_per_stream=slots_per_stream;
+	m_next_slot.assign(stream_count, 0);
+	
+	return(SUCCESS);
+}
+
+void CShmPublisher::Destroy() {
+	if(m_header) m_header->writer_pid=0;
+	if(m_base) munmap(m_base, m_map_size);
+	if(m_fd >= 0) {
+		close(m_fd);
+		shm_unlink(SHM_FRAMES_NAME);
+	}
+	m_fd=-1;
+	m_base=NULL;
+	m_header=NULL;
+	m_slots=NULL;
+}
+
+uint32 CShmPublisher::FormatFromType(int type) {
+	switch(type) {
+	case CV_8UC1: return(ShmFrameFormat_gray8);
+	case CV_8UC3: return(ShmFrameFormat_rgb8);
+	case CV_16SC1: return(ShmFrameFormat_gray16s);
+	case CV_32FC1: return(ShmFrameFormat_gray32f);
+	}
+	return(0);
+}
+
+OSC_ERR CShmPublisher::Publish(const cv::Mat& img, int camera, ShmFrameStream stream, uint32 frame_seq, uint64_t timestamp_us) {
+	
+	if(!m_header) return(EGENERAL);
+	const uint32 stream_index=SHM_FRAMES_STREAM(camera, stream);
+	if(img.empty() || camera < 0 || stream_index >= m_header->stream_count) return(EINVALID_PARAMETER);
+	
+	const uint32 format=FormatFromType(img.type());
+	const uint32 row_size=img.cols*img.elemSize();
+	const uint32 size=row_size*img.rows;
+	if(format==0 || size > m_header->slot_size) {
+		__sync_fetch_and_add(&m_header->dropped_count, 1);
+		return(EUNSUPPORTED);
+	}
+	
+	const uint32 index=stream_index*m_slots_per_stream + m_next_slot[stream_index];
+	m_next_slot[stream_index]=(m_next_slot[stream_index]+1) % m_slots_per_stream;
+	SHM_FRAME_SLOT* slot=m_slots + index;
+	uint8* data=m_base + m_header->data_offset + (size_t)index*m_header->slot_size;
+	
+	/* seqlock: odd while the slot content is inconsistent */
+	slot->lock++;
+	__sync_synchronize();
+	
+	slot->stream=stream_index;
+	slot->format=format;
+	slot->frame_seq=frame_seq;
+	slot->timestamp_us=timestamp_us;
+	slot->width=img.cols;
+	slot->height=img.rows;
+	slot->stride=row_size;
+	slot->size=size;
+	if(img.isContinuous()) {
+		memcpy(data, img.data, size);
+	} else {
+		for(int y=0; y<img.rows; ++y)
+			memcpy(data + y*row_size, img.ptr(y), row_size);
+	}
+	
+	__sync_synchronize();
+	slot->lock++;
+	
+	__sync_fetch_and_add(&m_header->publish_count, 1);
+	return(SUCCESS);
+}
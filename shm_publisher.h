@@ -0,0 +1,54 @@
+/*! @file shm_publisher.h
+ * @brief Publishes frames into the shared memory frame ring
+ *  see shm/shm_frames.h for the layout and the client API
+ */
+
+#ifndef SHM_PUBLISHER_H_
+#define SHM_PUBLISHER_H_
+
+#include <vector>
+
+#include "opencv.hpp"
+
+#include "includes.h"
+#include "shm/shm_frames.h"
+
+
+/* a reader can stay on the previous frame of a stream while the next one is written */
+#define SHM_FRAMES_SLOTS_PER_STREAM 3
+
+
+class CShmPublisher {
+public:
+	CShmPublisher();
+	~CShmPublisher();
+
+	/*! @brief Create the shared memory object for the streams of camera_count cameras
+	 * slot_size must be large enough for the biggest frame to publish
+	 */
+	OSC_ERR Init(uint32 slot_size, int camera_count, uint32 slots_per_stream=SHM_FRAMES_SLOTS_PER_STREAM);
+
+	bool IsInitialized() const { return(m_header != NULL); }
+
+	/*! @brief Copy a frame into the next slot of its stream
+	 * Frames with an unsupported type or too large for a slot are counted as dropped
+	 */
+	OSC_ERR Publish(const cv::Mat& img, int camera, ShmFrameStream stream, uint32 frame_seq, uint64_t timestamp_us);
+
+private:
+	void Destroy();
+
+	/* returns 0 for types that cannot be published */
+	static uint32 FormatFromType(int type);
+
+	int m_fd;
+	size_t m_map_size;
+	uint8* m_base;
+	SHM_FRAMES_HEADER* m_header;
+	SHM_FRAME_SLOT* m_slots;
+	uint32 m_slots_per_stream;
+	std::vector<uint32> m_next_slot; /* per stream, within its slots */
+};
+
+
+#endif /* SHM_PUBLISHER_H_ */
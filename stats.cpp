@@ -0,0 +1,97 @@
+/*! @file stats.cpp
+ * @brief Latency histograms of the processing stages and event counters
+ */
+
+#include <string.h>
+
+#include "stats.h"
+
+
+CStats::STATS_SLOT CStats::m_slots[STATS_MAX_THREADS];
+int CStats::m_slot_count=0;
+__thread CStats::STATS_SLOT* CStats::m_thread_slot=NULL;
+
+
+static const char* g_stage_names[StatStage_count]={
+	"acquire", "captureSetup", "process", "process1", "process2", "process3", "encode", "ipcWrite", "frameInterval"
+	, "trigger", "recordWrite", "imageStats", "focus"
+};
+
+const char* CStats::StageName(StatStage stage) {
+	return(stage < StatStage_count ? g_stage_names[stage] : "unknown");
+}
+
+uint32 CStats::BucketUpperBound(int bucket) {
+	if(bucket < STATS_SUB_BUCKETS) return(bucket);
+	const int msb=bucket/STATS_SUB_BUCKETS + STATS_SUB_BUCKET_BITS - 1;
+	const uint64_t lower=(uint64_t)(STATS_SUB_BUCKETS + bucket%STATS_SUB_BUCKETS) << (msb - STATS_SUB_BUCKET_BITS);
+	const uint64_t upper=lower + (1ULL << (msb - STATS_SUB_BUCKET_BITS)) - 1;
+	return(upper > 0xffffffffULL ? 0xffffffff : (uint32)upper);
+}
+
+void CStats::AssignSlot() {
+	const int index=__sync_fetch_and_add(&m_slot_count, 1);
+	m_thread_slot=&m_slots[index < STATS_MAX_THREADS ? index : STATS_MAX_THREADS-1];
+	/* after the slot is set: logging may allocate and record */
+	if(index == STATS_MAX_THREADS-1)
+		OscLog(WARN, "More than %i threads record statistics, they share a slot\n", STATS_MAX_THREADS-1);
+}
+
+int CStats::GetSharedThreads() {
+	const int count=m_slot_count - (STATS_MAX_THREADS-1);
+	return(count > 1 ? count : 0);
+}
+
+void CStats::Reset() {
+	memset(m_slots, 0, sizeof(m_slots));
+}
+
+void CStats::GetLatency(StatStage stage, STAT_LATENCY& latency) {
+	
+	/* the slots are written concurrently, a snapshot may be off by the samples in flight */
+	uint32 buckets[STATS_BUCKETS];
+	uint64_t count=0;
+	
+	latency.max=0;
+	for(int b=0; b<STATS_BUCKETS; ++b) {
+		buckets[b]=0;
+		for(int s=0; s<STATS_MAX_THREADS; ++s)
+			buckets[b]+=m_slots[s].buckets[stage][b];
+		count+=buckets[b];
+	}
+	for(int s=0; s<STATS_MAX_THREADS; ++s)
+		if(m_slots[s].max[stage] > latency.max) latency.max=m_slots[s].max[stage];
+	
+	latency.count=(uint32)count;
+	latency.p50=latency.p90=latency.p99=0;
+	if(count == 0) return;
+	
+	const uint64_t rank50=(count*50 + 99)/100, rank90=(count*90 + 99)/100, rank99=(count*99 + 99)/100;
+	uint64_t sum=0;
+	bool bP50=false, bP90=false;
+	for(int b=0; b<STATS_BUCKETS; ++b) {
+		if(buckets[b] == 0) continue;
+		sum+=buckets[b];
+		uint32 value=BucketUpperBound(b);
+		if(value > latency.max) value=latency.max;
+		if(!bP50 && sum >= rank50) {
+			latency.p50=value;
+			bP50=true;
+		}
+		if(!bP90 && sum >= rank90) {
+			latency.p90=value;
+			bP90=true;
+		}
+		if(sum >= rank99) {
+			latency.p99=value;
+			break;
+		}
+	}
+}
+
+uint64_t CStats::GetCounter(StatCounter counter) {
+	uint64_t sum=0;
+	for(int s=0; s<STATS_MAX_THREADS; ++s)
+		sum+=m_slots[s].counters[counter];
+	return(sum);
+}
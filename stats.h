@@ -0,0 +1,132 @@
+/*! @file stats.h
+ * @brief Latency histograms of the processing stages and event counters
+ *  Every thread records into its own slot without locks or atomic
+ *  operations; a snapshot sums the slots of all threads.
+ *  Stages are timed with CStageTimer (see trace.h).
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+#include "includes.h"
+
+
+/* threads with their own slot; further threads share the last slot (with atomic operations)
+ * Every thread that allocates records (see mat_arena.h): main, capture and process per
+ * camera, the JPEG and processing worker pools (2*WORKER_POOL_MAX_THREADS), the recorder.
+ */
+#define STATS_MAX_THREADS 48
+/* log-linear buckets: 2^STATS_SUB_BUCKET_BITS linear buckets per power of two */
+#define STATS_SUB_BUCKET_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_BUCKETS ((32 - STATS_SUB_BUCKET_BITS + 1)*STATS_SUB_BUCKETS)
+
+
+enum StatStage {
+	StatStage_acquire, // read the captured picture
+	StatStage_captureSetup, // set up the next capture
+	StatStage_process, // CImageProcessor::DoProcess
+	StatStage_process1, // steps of the processing producing the processing images 1..3
+	StatStage_process2,
+	StatStage_process3,
+	StatStage_encode, // image encoding for GetImage
+	StatStage_ipcWrite, // writing a reply to the cgi
+	StatStage_frameInterval, // time between two captured frames, its spread is the capture jitter
+	StatStage_trigger, // external trigger: input edge to the read of its picture
+	StatStage_recordWrite, // recorder: a batch handed to the file system until it is written
+	StatStage_imageStats, // histogram of the camera image and exposure control
+	StatStage_focus, // focus score of the camera image
+	StatStage_count
+};
+
+enum StatCounter {
+	StatCounter_framesCaptured,
+	StatCounter_framesDropped, // dropped by a pipeline queue
+	StatCounter_framesServed, // images sent
+	StatCounter_bytesSent,
+	StatCounter_requests,
+	StatCounter_deadlineMisses, // main loop iterations that ended after their deadline
+	StatCounter_heapAllocations, // operator new and image buffers (see mat_arena.h)
+	StatCounter_triggerEdges, // edges of the external trigger input
+	StatCounter_triggersMissed, // edges without picture (timeout or too many pending)
+	StatCounter_framesRecorded, // frames the recorder wrote
+	StatCounter_recordDropped, // frames the recorder's queue had no room for
+	StatCounter_bytesRecorded,
+	StatCounter_imageCacheHits, // GetImage replies sent from the cache of encoded images
+	StatCounter_count
+};
+
+/* latency summary of a stage [us] */
+struct STAT_LATENCY {
+	uint32 count;
+	uint32 p50;
+	uint32 p90;
+	uint32 p99;
+	uint32 max;
+};
+
+
+class CStats {
+public:
+	/*! @brief add a latency sample of a stage [us] */
+	static void Record(StatStage stage, uint32 us) {
+		STATS_SLOT& slot=Slot();
+		uint32* bucket=&slot.buckets[stage][Bucket(us)];
+		if(&slot == &m_slots[STATS_MAX_THREADS-1]) {
+			__sync_fetch_and_add(bucket, 1);
+			uint32 max=slot.max[stage];
+			while(us > max && !__sync_bool_compare_and_swap(&slot.max[stage], max, us))
+				max=slot.max[stage];
+		} else {
+			++*bucket;
+			if(us > slot.max[stage]) slot.max[stage]=us;
+		}
+	}
+	
+	static void Count(StatCounter counter, uint64_t n=1) {
+		STATS_SLOT& slot=Slot();
+		if(&slot == &m_slots[STATS_MAX_THREADS-1]) __sync_fetch_and_add(&slot.counters[counter], n);
+		else slot.counters[counter]+=n;
+	}
+	
+	/*! @brief percentiles are the upper bounds of their buckets (12.5% resolution) */
+	static void GetLatency(StatStage stage, STAT_LATENCY& latency);
+	static uint64_t GetCounter(StatCounter counter);
+	/*! @brief clear all histograms and counters, no other thread may record meanwhile */
+	static void Reset();
+	static const char* StageName(StatStage stage);
+	/*! @brief threads recording into the shared last slot, 0 if every thread has its own */
+	static int GetSharedThreads();
+	
+	/*! @brief bucket index of a value, exact below STATS_SUB_BUCKETS */
+	static inline int Bucket(uint32 value) {
+		if(value < STATS_SUB_BUCKETS) return(value);
+		const int msb=31 - __builtin_clz(value);
+		return((msb - STATS_SUB_BUCKET_BITS + 1)*STATS_SUB_BUCKETS
+				+ ((value >> (msb - STATS_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKETS-1)));
+	}
+	/*! @brief largest value that falls into a bucket */
+	static uint32 BucketUpperBound(int bucket);
+	
+private:
+	struct STATS_SLOT {
+		uint32 buckets[StatStage_count][STATS_BUCKETS];
+		uint32 max[StatStage_count];
+		uint64_t counters[StatCounter_count];
+	};
+	
+	static STATS_SLOT& Slot() {
+		if(!m_thread_slot) AssignSlot();
+		return(*m_thread_slot);
+	}
+	static void AssignSlot();
+	
+	static STATS_SLOT m_slots[STATS_MAX_THREADS];
+	static int m_slot_count;
+	static __thread STATS_SLOT* m_thread_slot;
+};
+
+
+#endif /* STATS_H_ */
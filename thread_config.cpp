@@ -0,0 +1,146 @@
+/*! @file thread_config.cpp
+ * @brief CPU affinity and scheduling of the threads of the main loop
+ */
+
+#include "thread_config.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+static const char* g_role_names[ThreadRole_count]={ "capture", "process", "serve" };
+
+
+CThreadConfig::CThreadConfig() : m_bMemory_lock(false) {
+	for(int i=0; i<ThreadRole_count; ++i) {
+		m_config[i].cpu=-1;
+		m_config[i].fifo_priority=0;
+		m_config[i].nice=0;
+		m_config[i].bNice=false;
+	}
+	/* constructed by the main thread before any Apply */
+	if(sched_getaffinity(0, sizeof(m_default_cpus), &m_default_cpus) != 0) {
+		CPU_ZERO(&m_default_cpus);
+		for(int i=0; i<CPU_SETSIZE; ++i) CPU_SET(i, &m_default_cpus);
+	}
+	errno=0;
+	m_default_nice=getpriority(PRIO_PROCESS, 0);
+	if(errno != 0) m_default_nice=0;
+}
+
+OSC_ERR CThreadConfig::Parse(const char* str) {
+	
+	const char* eq=strchr(str, '=');
+	if(!eq) return(EINVALID_PARAMETER);
+	
+	int role;
+	for(role=0; role<ThreadRole_count; ++role)
+		if(strlen(g_role_names[role]) == (size_t)(eq - str) && strncmp(str, g_role_names[role], eq - str) == 0)
+			break;
+	if(role == ThreadRole_count) return(EINVALID_PARAMETER);
+	
+	THREAD_CONFIG config=m_config[role];
+	const char* p=eq+1;
+	char* end;
+	
+	if(*p == '*') {
+		config.cpu=-1;
+		++p;
+	} else {
+		config.cpu=strtol(p, &end, 10);
+		if(end == p || config.cpu < 0 || config.cpu >= CPU_SETSIZE) return(EINVALID_PARAMETER);
+		p=end;
+	}
+	
+	if(*p == '/') {
+		++p;
+		if(strncmp(p, "fifo:", 5) == 0) {
+			config.fifo_priority=strtol(p+5, &end, 10);
+			if(end == p+5 || config.fifo_priority < sched_get_priority_min(SCHED_FIFO)
+					|| config.fifo_priority > sched_get_priority_max(SCHED_FIFO))
+				return(EINVALID_PARAMETER);
+			config.bNice=false;
+		} else if(strncmp(p, "nice:", 5) == 0) {
+			config.nice=strtol(p+5, &end, 10);
+			if(end == p+5 || config.nice < -20 || config.nice > 19) return(EINVALID_PARAMETER);
+			config.bNice=true;
+			config.fifo_priority=0;
+		} else {
+			return(EINVALID_PARAMETER);
+		}
+		p=end;
+	}
+	if(*p != 0) return(EINVALID_PARAMETER);
+	
+	m_config[role]=config;
+	return(SUCCESS);
+}
+
+OSC_ERR CThreadConfig::LockMemory() const {
+	if(!m_bMemory_lock) return(SUCCESS);
+	
+	int flags=MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+	/* only pages in use, not the whole reserved stacks of the threads */
+	flags|=MCL_ONFAULT;
+#endif
+	if(mlockall(flags) != 0) {
+		OscLog(WARN, "Could not lock the memory: %s\n", strerror(errno));
+		return(EGENERAL);
+	}
+	return(SUCCESS);
+}
+
+OSC_ERR CThreadConfig::Apply(ThreadRole role) const {
+	
+	const THREAD_CONFIG& config=m_config[role];
+	OSC_ERR err=SUCCESS;
+	
+	cpu_set_t set;
+	if(config.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(config.cpu, &set);
+	} else {
+		set=m_default_cpus;
+	}
+	int ret=pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(ret != 0) {
+		OscLog(WARN, "Could not bind the %s thread to CPU %i: %s\n", g_role_names[role], config.cpu, strerror(ret));
+		err=EGENERAL;
+	}
+	
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	if(config.fifo_priority > 0) {
+		param.sched_priority=config.fifo_priority;
+		ret=pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(ret != 0) {
+			OscLog(WARN, "Could not set SCHED_FIFO %i for the %s thread: %s\n"
+					, config.fifo_priority, g_role_names[role], strerror(ret));
+			err=EGENERAL;
+		}
+	} else {
+		ret=pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+		if(ret != 0) {
+			OscLog(WARN, "Could not set SCHED_OTHER for the %s thread: %s\n", g_role_names[role], strerror(ret));
+			err=EGENERAL;
+		}
+		/* on Linux the nice level is per thread */
+		const int nice=config.bNice ? config.nice : m_default_nice;
+		const pid_t tid=syscall(SYS_gettid);
+		errno=0;
+		if(getpriority(PRIO_PROCESS, tid) != nice && setpriority(PRIO_PROCESS, tid, nice) != 0) {
+			OscLog(WARN, "Could not set nice %i for the %s thread: %s\n"
+					, nice, g_role_names[role], strerror(errno));
+			err=EGENERAL;
+		}
+	}
+	return(err);
+}
@@ -0,0 +1,58 @@
+/*! @file thread_config.h
+ * @brief CPU affinity and scheduling of the threads of the main loop
+ */
+
+#ifndef THREAD_CONFIG_H_
+#define THREAD_CONFIG_H_
+
+#include <sched.h>
+
+#include "includes.h"
+
+
+enum ThreadRole {
+	ThreadRole_capture,
+	ThreadRole_process,
+	ThreadRole_serve, // main thread, also the JPEG worker threads it starts
+	ThreadRole_count
+};
+
+struct THREAD_CONFIG {
+	int cpu; /* CPU the thread is bound to, -1: any */
+	int fifo_priority; /* > 0: SCHED_FIFO with this priority */
+	int nice; /* nice level if not SCHED_FIFO */
+	bool bNice; /* nice is set */
+};
+
+
+class CThreadConfig {
+public:
+	CThreadConfig();
+	
+	/*! @brief parse "<role>=<cpu>[/fifo:<priority>|/nice:<level>]"
+	 * role: capture, process or serve; cpu: number or '*' for any
+	 */
+	OSC_ERR Parse(const char* str);
+	
+	void setMemoryLock(bool bLock) { m_bMemory_lock=bLock; }
+	
+	/*! @brief lock all current and future memory (frame buffers) into RAM */
+	OSC_ERR LockMemory() const;
+	
+	/*! @brief apply the configuration of role to the calling thread
+	 * What is not configured for role is reset to how the process started,
+	 * threads must not keep the settings of the thread that created them.
+	 */
+	OSC_ERR Apply(ThreadRole role) const;
+	
+	const THREAD_CONFIG& get(ThreadRole role) const { return(m_config[role]); }
+	
+private:
+	THREAD_CONFIG m_config[ThreadRole_count];
+	bool m_bMemory_lock;
+	cpu_set_t m_default_cpus; /* affinity of the process at start */
+	int m_default_nice; /* nice level of the process at start */
+};
+
+
+#endif /* THREAD_CONFIG_H_ */
@@ -0,0 +1,29 @@
+/*! @file timing.h
+ * @brief Monotonic time helpers shared by the application modules
+ */
+
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <stdint.h>
+#include <time.h>
+
+
+/*! @brief current time of CLOCK_MONOTONIC in microseconds
+ * Unlike OscSupCycGet() this does not wrap around after a few seconds
+ */
+static inline uint64_t GetMonotonicTimeUs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000);
+}
+
+/*! @brief current time of CLOCK_MONOTONIC in nanoseconds */
+static inline uint64_t GetMonotonicTimeNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+
+#endif /* TIMING_H_ */
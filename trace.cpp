@@ -0,0 +1,89 @@
+/*! @file trace.cpp
+ * @brief Per-frame trace of the processing stages
+ */
+
+#include "trace.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+volatile bool CTrace::m_bEnabled=false;
+TRACE_SPAN CTrace::m_spans[TRACE_CAPACITY];
+uint32 CTrace::m_next=0;
+int32 CTrace::m_thread_ids[TRACE_MAX_THREAD_NAMES];
+const char* CTrace::m_thread_names[TRACE_MAX_THREAD_NAMES];
+int CTrace::m_thread_name_count=0;
+__thread uint32 CTrace::m_thread_frame=0;
+__thread int32 CTrace::m_thread_id=0;
+
+
+int32 CTrace::ThreadId() {
+	if(m_thread_id == 0) m_thread_id=syscall(SYS_gettid);
+	return(m_thread_id);
+}
+
+void CTrace::SetThreadName(const char* name) {
+	const int index=__sync_fetch_and_add(&m_thread_name_count, 1);
+	if(index >= TRACE_MAX_THREAD_NAMES) return;
+	m_thread_ids[index]=ThreadId();
+	m_thread_names[index]=name;
+}
+
+void CTrace::Span(StatStage stage, uint64_t begin_ns, uint64_t end_ns) {
+	
+	TRACE_SPAN& span=m_spans[__sync_fetch_and_add(&m_next, 1) % TRACE_CAPACITY];
+	
+	__sync_fetch_and_add(&span.seq, 1);
+	__sync_synchronize();
+	span.begin_ns=begin_ns;
+	span.duration_ns=end_ns - begin_ns > 0xffffffffULL ? 0xffffffff : (uint32)(end_ns - begin_ns);
+	span.frame_seq=m_thread_frame;
+	span.tid=ThreadId();
+	span.stage=stage;
+	__sync_synchronize();
+	__sync_fetch_and_add(&span.seq, 1);
+}
+
+void CTrace::Export(double seconds, std::string& json) {
+	
+	const uint64_t now=GetMonotonicTimeNs();
+	const uint64_t since=seconds*1e9 < now ? now - (uint64_t)(seconds*1e9) : 0;
+	const int pid=getpid();
+	char event[256];
+	bool bFirst=true;
+	
+	json+="{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	
+	const int names=m_thread_name_count < TRACE_MAX_THREAD_NAMES ? m_thread_name_count : TRACE_MAX_THREAD_NAMES;
+	for(int i=0; i<names; ++i) {
+		snprintf(event, sizeof(event), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+				"\"args\":{\"name\":\"%s\"}}", bFirst ? "" : ",", pid, m_thread_ids[i], m_thread_names[i]);
+		json+=event;
+		bFirst=false;
+	}
+	
+	/* oldest first; spans written during the copy are skipped */
+	const uint32 next=m_next;
+	const uint32 count=next < TRACE_CAPACITY ? next : TRACE_CAPACITY;
+	for(uint32 i=next - count; i != next; ++i) {
+		const TRACE_SPAN& slot=m_spans[i % TRACE_CAPACITY];
+		const uint16 seq=slot.seq;
+		__sync_synchronize();
+		const TRACE_SPAN span=slot;
+		__sync_synchronize();
+		if(seq == 0 || (seq & 1) || slot.seq != seq) continue;
+		if(span.begin_ns < since || span.stage >= StatStage_count) continue;
+		
+		snprintf(event, sizeof(event), "%s\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%u}}", bFirst ? "" : ","
+				, CStats::StageName((StatStage)span.stage), span.begin_ns/1000.0, span.duration_ns/1000.0
+				, pid, span.tid, span.frame_seq);
+		json+=event;
+		bFirst=false;
+	}
+	
+	json+="\n]}\n";
+}
@@ -0,0 +1,88 @@
+/*! @file trace.h
+ * @brief Per-frame trace of the processing stages
+ *  Spans (stage, begin, duration, thread, frame sequence number) are written
+ *  into a preallocated ring and exported as Chrome trace JSON (chrome://tracing,
+ *  ui.perfetto.dev). The spans come from CStageTimer; while tracing is off,
+ *  recording costs one test of a flag.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "includes.h"
+#include "stats.h"
+#include "timing.h"
+
+
+/* number of spans kept, older ones are overwritten */
+#define TRACE_CAPACITY 8192
+#define TRACE_MAX_THREAD_NAMES 16
+
+
+struct TRACE_SPAN {
+	uint64_t begin_ns; /* CLOCK_MONOTONIC */
+	uint32 duration_ns;
+	uint32 frame_seq;
+	int32 tid;
+	uint16 stage; /* enum StatStage */
+	volatile uint16 seq; /* seqlock: odd while the span is written, 0: never written */
+};
+
+
+class CTrace {
+public:
+	static void Enable(bool bEnable) { m_bEnabled=bEnable; }
+	static bool IsEnabled() { return(m_bEnabled); }
+	
+	/*! @brief frame the calling thread is working on, tags its following spans */
+	static void SetFrame(uint32 frame_seq) { m_thread_frame=frame_seq; }
+	/*! @brief name shown for the calling thread in the trace */
+	static void SetThreadName(const char* name);
+	
+	static void Span(StatStage stage, uint64_t begin_ns, uint64_t end_ns);
+	
+	/*! @brief append the spans of the last 'seconds' as Chrome trace JSON */
+	static void Export(double seconds, std::string& json);
+	
+private:
+	static int32 ThreadId();
+	
+	static volatile bool m_bEnabled;
+	static TRACE_SPAN m_spans[TRACE_CAPACITY];
+	static uint32 m_next; /* total number of spans recorded */
+	
+	static int32 m_thread_ids[TRACE_MAX_THREAD_NAMES];
+	static const char* m_thread_names[TRACE_MAX_THREAD_NAMES];
+	static int m_thread_name_count;
+	
+	static __thread uint32 m_thread_frame;
+	static __thread int32 m_thread_id;
+};
+
+
+/*! @brief records the time from construction to Stop() or destruction
+ * in the statistics and, if enabled, in the trace */
+class CStageTimer {
+public:
+	CStageTimer(StatStage stage) : m_stage(stage), m_start_ns(GetMonotonicTimeNs()), m_bStopped(false) {}
+	~CStageTimer() { Stop(); }
+	
+	void Stop() {
+		if(m_bStopped) return;
+		m_bStopped=true;
+		const uint64_t end_ns=GetMonotonicTimeNs();
+		CStats::Record(m_stage, (uint32)((end_ns - m_start_ns)/1000));
+		if(CTrace::IsEnabled()) CTrace::Span(m_stage, m_start_ns, end_ns);
+	}
+	
+private:
+	StatStage m_stage;
+	uint64_t m_start_ns;
+	bool m_bStopped;
+};
+
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,88 @@
+/*! @file trigger.cpp
+ * @brief Capture on an edge of a GPIO input (external trigger)
+ */
+
+#include <string.h>
+
+#include "trigger.h"
+#include "timing.h"
+#include "stats.h"
+
+
+CTrigger::CTrigger() : m_mode(TriggerMode_software), m_input(GPIO_IN1), m_bFallingEdge(false)
+	, m_bLastState(false), m_pending_first(0), m_pending_count(0), m_edge_seq(0), m_last_frame_seq(0) {
+	m_last_event.seq=0;
+	m_last_event.timestamp_us=0;
+}
+
+OSC_ERR CTrigger::Parse(const char* str) {
+	if(strncmp(str, "in1", 3) == 0) m_input=GPIO_IN1;
+	else if(strncmp(str, "in2", 3) == 0) m_input=GPIO_IN2;
+	else return(EINVALID_PARAMETER);
+
+	str+=3;
+	if(*str == ',') {
+		if(strcmp(str+1, "falling") == 0) m_bFallingEdge=true;
+		else if(strcmp(str+1, "rising") == 0) m_bFallingEdge=false;
+		else return(EINVALID_PARAMETER);
+	} else if(*str) {
+		return(EINVALID_PARAMETER);
+	}
+	m_mode=TriggerMode_external;
+	return(SUCCESS);
+}
+
+OSC_ERR CTrigger::Init() {
+	OSC_ERR err;
+	if(!isExternal())
+		return(OscGpioConfigImageTrigger(TRIGGER_INTERNAL));
+
+	/* a low active input reads true while it is low: the edge is always a rising one */
+	if((err=OscGpioSetupPolarity(m_input, m_bFallingEdge)) != SUCCESS
+			|| (err=OscGpioConfigImageTrigger(TRIGGER_EXTERNAL)) != SUCCESS)
+		return(err);
+
+	/* a level present at the start is no edge */
+	if(OscGpioRead(m_input, &m_bLastState) != SUCCESS) m_bLastState=false;
+	m_pending_count=0;
+	OscLog(INFO, "External trigger on the %s edge of IN%d\n", m_bFallingEdge ? "falling" : "rising"
+			, m_input == GPIO_IN1 ? 1 : 2);
+	return(SUCCESS);
+}
+
+bool CTrigger::Poll() {
+	bool bState;
+	if(OscGpioRead(m_input, &bState) != SUCCESS) return(false);
+
+	const bool bEdge=bState && !m_bLastState;
+	m_bLastState=bState;
+	if(!bEdge) return(false);
+
+	CStats::Count(StatCounter_triggerEdges);
+	if(m_pending_count == TRIGGER_MAX_PENDING) {
+		/* the pictures do not keep up: the oldest edge will not get one */
+		m_pending_first=(m_pending_first + 1)%TRIGGER_MAX_PENDING;
+		--m_pending_count;
+		CStats::Count(StatCounter_triggersMissed);
+	}
+	TRIGGER_EVENT& event=m_pending[(m_pending_first + m_pending_count)%TRIGGER_MAX_PENDING];
+	event.seq=++m_edge_seq;
+	event.timestamp_us=GetMonotonicTimeUs();
+	++m_pending_count;
+	return(true);
+}
+
+bool CTrigger::PopEvent(TRIGGER_EVENT& event) {
+	if(m_pending_count == 0) return(false);
+	event=m_pending[m_pending_first];
+	m_pending_first=(m_pending_first + 1)%TRIGGER_MAX_PENDING;
+	--m_pending_count;
+	return(true);
+}
+
+void CTrigger::Match(const TRIGGER_EVENT& event, uint32 frame_seq, uint64_t frame_timestamp_us) {
+	m_last_event=event;
+	m_last_frame_seq=frame_seq;
+	if(frame_timestamp_us >= event.timestamp_us)
+		CStats::Record(StatStage_trigger, (uint32)(frame_timestamp_us - event.timestamp_us));
+}
@@ -0,0 +1,85 @@
+/*! @file trigger.h
+ * @brief Capture on an edge of a GPIO input (external trigger)
+ *  The sensor is armed and takes the picture on the edge of its trigger
+ *  input. The input is polled by the capture stage: every edge gets a
+ *  sequence number and a CLOCK_MONOTONIC timestamp, and is matched to the
+ *  next picture read, which yields the trigger-to-frame latency
+ *  (StatStage_trigger). Edges shorter than a poll period are not seen.
+ *  On host builds the GPIO module replays gpio_in.txt; its times are
+ *  simulation steps, i.e. iterations of the capture loop (see OscSimStep).
+ */
+
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#include <stdint.h>
+
+#include "includes.h"
+
+
+/* edges waiting for their picture */
+#define TRIGGER_MAX_PENDING 8
+/* poll period of the pipelined capture stage while there is no edge [us] */
+#define TRIGGER_POLL_US 500
+/* an edge whose picture did not arrive within this time is given up [ms] */
+#define TRIGGER_FRAME_TIMEOUT_MS 100
+
+
+enum TriggerMode {
+	TriggerMode_software, // the application triggers every capture (OscGpioTriggerImage)
+	TriggerMode_external // the sensor captures on an input edge
+};
+
+struct TRIGGER_EVENT {
+	uint32 seq; /* edge number, starting at 1 */
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time the edge was seen */
+};
+
+
+class CTrigger {
+public:
+	CTrigger();
+
+	/*! @brief external trigger from a command line option: in1|in2[,falling] */
+	OSC_ERR Parse(const char* str);
+
+	/*! @brief configure the sensor's trigger source
+	 * NOTE: Oscar's GPIO module must be created before this call!
+	 */
+	OSC_ERR Init();
+
+	TriggerMode getMode() const { return(m_mode); }
+	bool isExternal() const { return(m_mode == TriggerMode_external); }
+
+	/*! @brief read the input, an edge is timestamped and queued
+	 * returns true on an edge
+	 */
+	bool Poll();
+
+	/*! @brief take the oldest edge that has no picture yet */
+	bool PopEvent(TRIGGER_EVENT& event);
+
+	/*! @brief the picture of event was read at frame_timestamp_us, records the latency */
+	void Match(const TRIGGER_EVENT& event, uint32 frame_seq, uint64_t frame_timestamp_us);
+
+	/*! @brief edge and picture of the last match */
+	const TRIGGER_EVENT& getLastEvent() const { return(m_last_event); }
+	uint32 getLastFrameSeq() const { return(m_last_frame_seq); }
+
+private:
+	TriggerMode m_mode;
+	EnGpios m_input;
+	bool m_bFallingEdge;
+	bool m_bLastState;
+
+	TRIGGER_EVENT m_pending[TRIGGER_MAX_PENDING]; /* ring of edges without picture */
+	int m_pending_first;
+	int m_pending_count;
+	uint32 m_edge_seq;
+
+	TRIGGER_EVENT m_last_event;
+	uint32 m_last_frame_seq;
+};
+
+
+#endif /* TRIGGER_H_ */
@@ -0,0 +1,107 @@
+/*! @file worker_pool.cpp
+ * @brief Persistent pool of worker threads for data parallel jobs
+ */
+
+#include "worker_pool.h"
+
+#include <unistd.h>
+
+
+CWorkerPool::CWorkerPool() : m_thread_count(0), m_job(NULL), m_context(NULL), m_job_count(0)
+	, m_next_job(0), m_jobs_done(0), m_generation(0), m_bQuit(false) {
+	pthread_mutex_init(&m_run_mutex, NULL);
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond_work, NULL);
+	pthread_cond_init(&m_cond_done, NULL);
+}
+
+CWorkerPool::~CWorkerPool() {
+	pthread_mutex_lock(&m_mutex);
+	m_bQuit=true;
+	pthread_cond_broadcast(&m_cond_work);
+	pthread_mutex_unlock(&m_mutex);
+	
+	for(int i=0; i<m_thread_count; ++i)
+		pthread_join(m_threads[i], NULL);
+	
+	pthread_cond_destroy(&m_cond_done);
+	pthread_cond_destroy(&m_cond_work);
+	pthread_mutex_destroy(&m_mutex);
+	pthread_mutex_destroy(&m_run_mutex);
+}
+
+OSC_ERR CWorkerPool::Init(int thread_count) {
+	
+	if(m_thread_count > 0) return(EALREADY_INITIALIZED);
+	
+	if(thread_count <= 0) thread_count=sysconf(_SC_NPROCESSORS_ONLN);
+	if(thread_count > WORKER_POOL_MAX_THREADS) thread_count=WORKER_POOL_MAX_THREADS;
+	
+	/* the caller of Run is one of the workers */
+	for(int i=0; i<thread_count-1; ++i) {
+		if(pthread_create(&m_threads[m_thread_count], NULL, ThreadMain, this) != 0) {
+			OscLog(WARN, "Could only start %i worker threads\n", m_thread_count);
+			break;
+		}
+		++m_thread_count;
+	}
+	return(SUCCESS);
+}
+
+void* CWorkerPool::ThreadMain(void* arg) {
+	CWorkerPool* pool=(CWorkerPool*)arg;
+	uint32 generation=0;
+	
+	pthread_mutex_lock(&pool->m_mutex);
+	for(;;) {
+		while(!pool->m_bQuit && pool->m_generation == generation)
+			pthread_cond_wait(&pool->m_cond_work, &pool->m_mutex);
+		if(pool->m_bQuit) break;
+		
+		generation=pool->m_generation;
+		pool->WorkOnBatch();
+	}
+	pthread_mutex_unlock(&pool->m_mutex);
+	return(NULL);
+}
+
+void CWorkerPool::WorkOnBatch() {
+	while(m_next_job < m_job_count) {
+		const int index=m_next_job++;
+		
+		pthread_mutex_unlock(&m_mutex);
+		m_job(m_context, index);
+		pthread_mutex_lock(&m_mutex);
+		
+		if(++m_jobs_done == m_job_count)
+			pthread_cond_signal(&m_cond_done);
+	}
+}
+
+void CWorkerPool::Run(int job_count, WORKER_JOB job, void* context) {
+	
+	if(job_count <= 0) return;
+	
+	if(m_thread_count == 0 || job_count == 1) {
+		for(int i=0; i<job_count; ++i) job(context, i);
+		return;
+	}
+	
+	pthread_mutex_lock(&m_run_mutex);
+	pthread_mutex_lock(&m_mutex);
+	
+	m_job=job;
+	m_context=context;
+	m_job_count=job_count;
+	m_next_job=0;
+	m_jobs_done=0;
+	++m_generation;
+	pthread_cond_broadcast(&m_cond_work);
+	
+	WorkOnBatch();
+	while(m_jobs_done < m_job_count)
+		pthread_cond_wait(&m_cond_done, &m_mutex);
+	
+	pthread_mutex_unlock(&m_mutex);
+	pthread_mutex_unlock(&m_run_mutex);
+}
@@ -0,0 +1,61 @@
+/*! @file worker_pool.h
+ * @brief Persistent pool of worker threads for data parallel jobs
+ */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <pthread.h>
+
+#include "includes.h"
+
+
+#define WORKER_POOL_MAX_THREADS 16
+
+/*! @brief job function, called once for every index in [0, job_count) */
+typedef void (*WORKER_JOB)(void* context, int index);
+
+
+class CWorkerPool {
+public:
+	CWorkerPool();
+	~CWorkerPool();
+	
+	/*! @brief start the threads
+	 * thread_count: number of threads working on a job including the caller of Run,
+	 *  0 means one per online CPU
+	 */
+	OSC_ERR Init(int thread_count=0);
+	
+	/*! @brief number of threads working on a job including the caller of Run */
+	int getThreadCount() const { return(m_thread_count+1); }
+	
+	/*! @brief run job(context, i) for all i in [0, job_count) and wait for completion
+	 * The calling thread works on the jobs as well. Calls from different threads are serialized.
+	 */
+	void Run(int job_count, WORKER_JOB job, void* context);
+	
+private:
+	static void* ThreadMain(void* arg);
+	/* take and run jobs of the current batch, m_mutex must be locked */
+	void WorkOnBatch();
+	
+	pthread_t m_threads[WORKER_POOL_MAX_THREADS];
+	int m_thread_count; /* threads besides the caller */
+	
+	pthread_mutex_t m_run_mutex; /* one batch at a time */
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond_work;
+	pthread_cond_t m_cond_done;
+	
+	WORKER_JOB m_job;
+	void* m_context;
+	int m_job_count;
+	int m_next_job;
+	int m_jobs_done;
+	uint32 m_generation; /* incremented for every batch */
+	bool m_bQuit;
+};
+
+
+#endif /* WORKER_POOL_H_ */
@@ -219,7 +219,104 @@ function parseValues(data) {
 	return obj;
 }
 
+// Identifies this viewer to the rate control of the application.
+var g_client_id = Math.floor(Math.random() * 1000000);
+// Time to wait between two images as advised by the application [ms].
+var g_frame_interval = 0;
+
+// Only changed tiles are transferred and composed on a canvas.
+var g_delta_mode = false;
+var g_delta_keyframe = true;
+var g_delta_base = -1; // frame_seq of the last update drawn
+
+function setDeltaMode(enabled) {
+	g_delta_mode = enabled;
+	g_delta_keyframe = true;
+	g_delta_base = -1;
+	if (enabled) {
+		$("#imageWindow1").hide();
+		$("#imageCanvas").show();
+	} else {
+		$("#imageCanvas").hide();
+		$("#imageWindow1").show();
+	}
+}
+
+// Fetches a delta update (see IPC_DELTA_HEADER in cgi/cgi.h) and draws its tiles onto the canvas.
+function loadDeltaImage(src, onLoad, onError) {
+	var xhr = new XMLHttpRequest();
+	
+	xhr.open("GET", src, true);
+	xhr.responseType = "arraybuffer";
+	xhr.onerror = onError;
+	xhr.onload = function () {
+		var buf = xhr.response;
+		var HEADER_SIZE = 20, TILE_SIZE = 12;
+		
+		if (xhr.status != 200 || !buf || buf.byteLength < HEADER_SIZE) {
+			onError();
+			return;
+		}
+		var view = new DataView(buf);
+		if (view.getUint32(0, true) != 0x31445657) {
+			onError();
+			return;
+		}
+		var width = view.getUint16(4, true), height = view.getUint16(6, true);
+		var count = view.getUint16(10, true), keyframe = view.getUint8(12);
+		var frame_seq = view.getUint32(16, true);
+		var canvas = document.getElementById("imageCanvas");
+		
+		if (keyframe && (canvas.width != width || canvas.height != height)) {
+			canvas.width = width;
+			canvas.height = height;
+		}
+		var ctx = canvas.getContext("2d");
+		var pending = count, failed = false, pos = HEADER_SIZE;
+		
+		if (pending == 0) {
+			onLoad(frame_seq);
+			return;
+		}
+		for (var i = 0; i < count; ++i) {
+			var x = view.getUint16(pos, true), y = view.getUint16(pos + 2, true);
+			var length = view.getUint32(pos + 8, true);
+			var blob = new Blob([new Uint8Array(buf, pos + TILE_SIZE, length)], { type: "image/jpeg" });
+			pos += TILE_SIZE + length;
+			
+			(function (x, y, url) {
+				var tile = new Image();
+				tile.onload = function () {
+					ctx.drawImage(tile, x, y);
+					URL.revokeObjectURL(url);
+					if (--pending == 0 && !failed)
+						onLoad(frame_seq);
+				};
+				tile.onerror = function () {
+					URL.revokeObjectURL(url);
+					if (!failed) {
+						failed = true;
+						onError();
+					}
+				};
+				tile.src = url;
+			})(x, y, URL.createObjectURL(blob));
+		}
+	};
+	xhr.send();
+}
+
 var outputValueHooks = {
+	width: function (value) {
+		// downscaled images are shown in full size
+		$("#imageWindow1").attr("width", value);
+		$("#imageCanvas").css("width", value + "px");
+		return value;
+	},
+	frameInterval: function (value) {
+		g_frame_interval = parseInt(value) || 0;
+		return value;
+	},
 	colorType: function (value) {
 		if (value == "gray")
 			return "8 bit grayscale";
@@ -353,17 +450,21 @@ function autoExposureChanged(key, setting) {
 }
 
 function updateCycle() {
+	function showValues(data) {
+		$.each(data, function (key, value) {
+			function id(value) {
+				return value;
+			};
+			var val=(outputValueHooks[key] || id)(value);
+			if(val!=null)
+				$("#" + key).text(val);
+		});
+	}
+	
 	function getImageInfo() {
 		$(document).oneTime("0.1s", function () {
-			exchangeState("GetImageInfo", { }, function (data) {
-				$.each(data, function (key, value) {
-					function id(value) {
-						return value;
-					};
-					var val=(outputValueHooks[key] || id)(value);
-					if(val!=null)
-						$("#" + key).text(val);
-				});
+			exchangeState("GetImageInfo", { clientId: g_client_id }, function (data) {
+				showValues(data);
 				
 				g_changed_values = new Object(); //reset changes
 			
@@ -377,14 +478,7 @@ function updateCycle() {
 	function getSystemInfo() {
 		$(document).oneTime("0.5s", function () {
 			exchangeState("GetSystemInfo", { }, function (data) {
-				$.each(data, function (key, value) {
-					function id(value) {
-						return value;
-					};
-					var val=(outputValueHooks[key] || id)(value);
-					if(val!=null)
-						$("#" + key).text(val);
-				});
+				showValues(data);
 				
 				getImageInfo();
 			
@@ -407,6 +501,26 @@ function updateCycle() {
 	
 	
 	var tmp_img_val=0;
+	var images_since_info=0;
+	
+	//refresh the rate control decision from time to time
+	function refreshInfo() {
+		exchangeState("GetImageInfo", { clientId: g_client_id }, function (data) {
+			showValues(data);
+			loadImage();
+		}, offline);
+	}
+	
+	function nextImage() {
+		if(++images_since_info >= 20) {
+			images_since_info=0;
+			refreshInfo();
+		} else if(g_frame_interval > 0) {
+			$(document).oneTime(g_frame_interval, loadImage);
+		} else {
+			loadImage();
+		}
+	}
 	
 	function loadImage() {
 		
@@ -416,6 +530,22 @@ function updateCycle() {
 			exchangeState("SetOptions", g_changed_values, loadImage, offline);
 			g_changed_values=new Object();
 			
+		} else if(g_delta_mode) {
+			
+			++tmp_img_val;
+			var delta = g_delta_keyframe ? 2 : 1;
+			g_delta_keyframe = false;
+			var base = delta == 1 && g_delta_base >= 0 ? "+deltaBase:"+g_delta_base : "";
+			loadDeltaImage("/cgi-bin/cgi?GetImage_"+tmp_img_val+"+clientId:"+g_client_id+"+delta:"+delta+base, function (frame_seq) {
+				g_delta_base = frame_seq;
+				online();
+				nextImage();
+			}, function () {
+				g_delta_keyframe = true;
+				g_delta_base = -1;
+				offline();
+			});
+			
 		} else {
 			
 			var img = $(new Image());
@@ -424,20 +554,17 @@ function updateCycle() {
 				//$("#image").replaceWith(this); 
 				//this.id="image";
                                 online();
-				loadImage(); //load next image here instead with timer. prevents overloading the (poor) browser
+				nextImage(); //load next image here instead with timer. prevents overloading the (poor) browser
 			});
 			
 			img.error(offline);
 			
 			++tmp_img_val;
-                        $("#imageWindow1").attr("src", "/cgi-bin/cgi?GetImage_"+tmp_img_val);
-			img.attr("src", "/cgi-bin/cgi?GetImage_"+tmp_img_val); //preload the next image                                                				
+			var src="/cgi-bin/cgi?GetImage_"+tmp_img_val+"+clientId:"+g_client_id;
+                        $("#imageWindow1").attr("src", src);
+			img.attr("src", src); //preload the next image                                                				
 		}
 		
 	}
 	
 }
-
-
-
-